@@ -8,773 +8,4241 @@
 #include<functional>
 #include<cstdint>
 #include<cmath>
-
+#include<vector>
+#include<algorithm>
+#include<stdexcept>
+#include<memory>
+#include<utility>
+#include<atomic>
+
+#include "utils/threadpool.h"
+#include "utils/hash.h"
+#include "utils/bufferpool.h"
+
+// SIMD paths can be disabled by defining GUL_IMAGE_NO_SIMD
+#if !defined(GUL_IMAGE_NO_SIMD)
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define GUL_IMAGE_SSE2
+        #include <emmintrin.h>
+    #endif
+    #if defined(__AVX2__)
+        #define GUL_IMAGE_AVX2
+        #include <immintrin.h>
+    #endif
+#endif
 
 namespace gul
 {
 
-inline uint8_t mix( uint8_t  a, uint8_t  b, float t)
-{
-    return static_cast<uint8_t>( (float(a) * (1.0f-t) + float(b)*t));
-
-}
-
 /**
- * @brief The channel1f struct
- *
- * Essentially a 1D image of floating point values.
- * Mostly used for intermediate stages;
+ * Row kernels used by the Image/ColorChannel operations. Each kernel has
+ * a scalar version and SSE2/AVX2 versions which are selected at compile
+ * time. The SIMD versions perform the exact same float operations as the
+ * scalar ones so the results are identical.
  */
-struct channel1f
+namespace detail
 {
-      std::vector<float> data;
-
-      channel1f(uint32_t w, uint32_t h) : _width(w), _height(h)
-      {
-          data.resize(w*h);
-      }
-      float & operator()(uint32_t u, uint32_t v)
-      {
-          return data[v*_width+u];
-      }
-      float const & operator()(uint32_t u, uint32_t v) const
-      {
-          return data[v*_width+u];
-      }
 
-      uint32_t width() const
-      {
-          return _width;
-      }
+inline uint8_t clamp_u8(float x)
+{
+    if( !(x > 0.0f) )
+        return 0;
+    if( x >= 255.0f )
+        return 255;
+    return static_cast<uint8_t>(x);
+}
 
-      uint32_t height() const
-      {
-          return _height;
-      }
+#if defined(GUL_IMAGE_SSE2)
+inline void sse_unpack_u8(__m128i v, __m128 f[4])
+{
+    const __m128i z = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(v,z);
+    __m128i hi = _mm_unpackhi_epi8(v,z);
+    f[0] = _mm_cvtepi32_ps( _mm_unpacklo_epi16(lo,z) );
+    f[1] = _mm_cvtepi32_ps( _mm_unpackhi_epi16(lo,z) );
+    f[2] = _mm_cvtepi32_ps( _mm_unpacklo_epi16(hi,z) );
+    f[3] = _mm_cvtepi32_ps( _mm_unpackhi_epi16(hi,z) );
+}
 
+// truncates and saturates 16 floats into 16 bytes
+inline __m128i sse_pack_u8(__m128 const f[4])
+{
+    __m128i lo = _mm_packs_epi32( _mm_cvttps_epi32(f[0]), _mm_cvttps_epi32(f[1]) );
+    __m128i hi = _mm_packs_epi32( _mm_cvttps_epi32(f[2]), _mm_cvttps_epi32(f[3]) );
+    return _mm_packus_epi16(lo,hi);
+}
 
-private:
-      uint32_t _width;
-      uint32_t _height;
-};
+// Reads one channel of 4 RGBA8 pixels. shift = 8*channelOffset
+inline __m128 sse_load_channel(uint8_t const * base, __m128i shift)
+{
+    __m128i v = _mm_loadu_si128( reinterpret_cast<__m128i const*>(base) );
+    v = _mm_and_si128( _mm_srl_epi32(v, shift), _mm_set1_epi32(0xFF) );
+    return _mm_cvtepi32_ps(v);
+}
 
+// Writes one channel of 4 RGBA8 pixels, leaving the other channels untouched
+inline void sse_store_channel(uint8_t * base, __m128i shift, __m128 f)
+{
+    const __m128i z = _mm_setzero_si128();
+    __m128i i = _mm_cvttps_epi32(f);
+    i = _mm_packs_epi32(i,i);
+    i = _mm_packus_epi16(i,i);
+    i = _mm_unpacklo_epi16( _mm_unpacklo_epi8(i,z), z);
+
+    __m128i mask = _mm_sll_epi32( _mm_set1_epi32(0xFF), shift);
+    __m128i o    = _mm_loadu_si128( reinterpret_cast<__m128i const*>(base) );
+    o = _mm_or_si128( _mm_andnot_si128(mask, o), _mm_sll_epi32(i, shift) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>(base), o);
+}
+#endif
 
-struct ColorChannel
+#if defined(GUL_IMAGE_AVX2)
+inline __m256 avx_load_u8x8(uint8_t const * p)
 {
-      using channel_type = ColorChannel;
-      uint32_t stride = 0;
-      uint32_t offset = 0;
+    return _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<__m128i const*>(p) ) ) );
+}
 
-      ColorChannel()
-      {
+// truncates and saturates 8 floats into 8 bytes
+inline void avx_store_u8x8(uint8_t * p, __m256 f)
+{
+    __m256i i = _mm256_cvttps_epi32(f);
+    __m128i w = _mm_packs_epi32( _mm256_castsi256_si128(i), _mm256_extracti128_si256(i,1) );
+    _mm_storel_epi64( reinterpret_cast<__m128i*>(p), _mm_packus_epi16(w,w) );
+}
 
-      }
-      ColorChannel(uint8_t * data, uint32_t _offset, uint32_t _stride, uint32_t w, uint32_t h) : stride(_stride), offset(_offset), width(w), height(h), ptr(data)
-      {
-      }
+// Reads one channel of 8 RGBA8 pixels. shift = 8*channelOffset
+inline __m256 avx_load_channel(uint8_t const * base, __m128i shift)
+{
+    __m256i v = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(base) );
+    v = _mm256_and_si256( _mm256_srl_epi32(v, shift), _mm256_set1_epi32(0xFF) );
+    return _mm256_cvtepi32_ps(v);
+}
 
-      void reset(uint8_t * data, uint32_t _offset, uint32_t _stride, uint32_t w, uint32_t h)
-      {
-            stride = _stride;
-            offset = _offset;
-            width  = w;
-            height = h;
-            ptr = data;
-      }
+// Writes one channel of 8 RGBA8 pixels, leaving the other channels untouched
+inline void avx_store_channel(uint8_t * base, __m128i shift, __m256 f)
+{
+    __m256i i = _mm256_cvttps_epi32(f);
+    i = _mm256_min_epi32( _mm256_max_epi32(i, _mm256_setzero_si256()), _mm256_set1_epi32(0xFF) );
 
+    __m256i mask = _mm256_sll_epi32( _mm256_set1_epi32(0xFF), shift);
+    __m256i o    = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(base) );
+    o = _mm256_or_si256( _mm256_andnot_si256(mask, o), _mm256_sll_epi32(i, shift) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>(base), o);
+}
+#endif
 
-      uint8_t & operator()(uint32_t u, uint32_t v)
-      {
-          const auto rowLength = stride * width;
-          return ptr[  v*rowLength + u*stride + offset ];
-          //return static_cast<uint8_t*>(static_cast<void*>(&ptr[v*width+u]))[offset];
-      }
-      uint8_t const & operator()(uint32_t u, uint32_t v) const
-      {
-          const auto rowLength = stride * width;
-          return ptr[  v*rowLength + u*stride + offset ];
-          //return static_cast<uint8_t*>(static_cast<void*>(&ptr[v*width+u]))[offset];
-      }
+/**
+ * @brief mix_bytes_scalar
+ *
+ * out[i] = a[i]*(1-t) + b[i]*t
+ */
+inline void mix_bytes_scalar(uint8_t const * a, uint8_t const * b, float t, uint8_t * out, size_t n)
+{
+    const float s = 1.0f - t;
+    for(size_t i = 0; i < n; i++)
+    {
+        out[i] = clamp_u8( static_cast<float>(a[i]) * s + static_cast<float>(b[i]) * t );
+    }
+}
 
-      ColorChannel& operator=( ColorChannel const & other)
-      {
-          if( width  !=  other.width ||
-              height !=  other.height)
-          {
-              throw std::logic_error("Channels are of different size");
-          }
+inline void mix_bytes(uint8_t const * a, uint8_t const * b, float t, uint8_t * out, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256 T = _mm256_set1_ps(t);
+        const __m256 S = _mm256_set1_ps(1.0f - t);
+        for(; i + 8 <= n; i += 8)
+        {
+            __m256 A = avx_load_u8x8(a+i);
+            __m256 B = avx_load_u8x8(b+i);
+            avx_store_u8x8(out+i, _mm256_add_ps( _mm256_mul_ps(A,S), _mm256_mul_ps(B,T) ) );
+        }
+    }
+#elif defined(GUL_IMAGE_SSE2)
+    {
+        const __m128 T = _mm_set1_ps(t);
+        const __m128 S = _mm_set1_ps(1.0f - t);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128 A[4], B[4];
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(a+i) ), A);
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(b+i) ), B);
+            for(int k = 0; k < 4; k++)
+                A[k] = _mm_add_ps( _mm_mul_ps(A[k],S), _mm_mul_ps(B[k],T) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out+i), sse_pack_u8(A) );
+        }
+    }
+#endif
+    mix_bytes_scalar(a+i, b+i, t, out+i, n-i);
+}
 
-          auto w = other.getWidth();
-          auto h = other.getHeight();
+/**
+ * @brief mix_bytes_scalar
+ *
+ * out[i] = a[i]*(1-t[i]) + b[i]*t[i], where t[i] is in the range 0-255
+ */
+inline void mix_bytes_scalar(uint8_t const * a, uint8_t const * b, uint8_t const * t, uint8_t * out, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        const float T = static_cast<float>(t[i]) / 255.0f;
+        out[i] = clamp_u8( static_cast<float>(a[i]) * (1.0f - T) + static_cast<float>(b[i]) * T );
+    }
+}
 
-          for(uint32_t j=0;j<h;j++)
-          {
-            for(uint32_t i=0;i<w;i++)
+inline void mix_bytes(uint8_t const * a, uint8_t const * b, uint8_t const * t, uint8_t * out, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 d   = _mm256_set1_ps(255.0f);
+        for(; i + 8 <= n; i += 8)
+        {
+            __m256 A = avx_load_u8x8(a+i);
+            __m256 B = avx_load_u8x8(b+i);
+            __m256 T = _mm256_div_ps( avx_load_u8x8(t+i), d);
+            avx_store_u8x8(out+i, _mm256_add_ps( _mm256_mul_ps(A, _mm256_sub_ps(one,T)), _mm256_mul_ps(B,T) ) );
+        }
+    }
+#elif defined(GUL_IMAGE_SSE2)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 d   = _mm_set1_ps(255.0f);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128 A[4], B[4], T[4];
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(a+i) ), A);
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(b+i) ), B);
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(t+i) ), T);
+            for(int k = 0; k < 4; k++)
             {
-                (*this)(i,j) = other(i,j);
+                T[k] = _mm_div_ps(T[k], d);
+                A[k] = _mm_add_ps( _mm_mul_ps(A[k], _mm_sub_ps(one,T[k])), _mm_mul_ps(B[k],T[k]) );
             }
-          }
-
-          return *this;
-      }
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out+i), sse_pack_u8(A) );
+        }
+    }
+#endif
+    mix_bytes_scalar(a+i, b+i, t+i, out+i, n-i);
+}
 
-      ColorChannel& operator=( uint8_t val)
-      {
-          auto w = getWidth();
-          auto h = getHeight();
+/**
+ * The channel operators. Each one is given the raw (0-255) values of
+ * the channels a and b, the interpolation value t (0-1) and a scale, k.
+ */
+struct channel_op_sum
+{
+    static float apply(float a, float b, float, float k) { return (a + b) * k; }
+#if defined(GUL_IMAGE_SSE2)
+    static __m128 apply(__m128 a, __m128 b, __m128, __m128 k) { return _mm_mul_ps( _mm_add_ps(a,b), k); }
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    static __m256 apply(__m256 a, __m256 b, __m256, __m256 k) { return _mm256_mul_ps( _mm256_add_ps(a,b), k); }
+#endif
+};
 
-          for(uint32_t j=0;j<h;j++)
-          {
-            for(uint32_t i=0;i<w;i++)
-            {
-                (*this)(i,j) = val;
-            }
-          }
+struct channel_op_product
+{
+    static float apply(float a, float b, float, float k) { return (a * b) * k; }
+#if defined(GUL_IMAGE_SSE2)
+    static __m128 apply(__m128 a, __m128 b, __m128, __m128 k) { return _mm_mul_ps( _mm_mul_ps(a,b), k); }
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    static __m256 apply(__m256 a, __m256 b, __m256, __m256 k) { return _mm256_mul_ps( _mm256_mul_ps(a,b), k); }
+#endif
+};
 
-          return *this;
-      }
+struct channel_op_mix
+{
+    static float apply(float a, float b, float t, float k) { return ( (1.0f - t) * a + t * b ) * k; }
+#if defined(GUL_IMAGE_SSE2)
+    static __m128 apply(__m128 a, __m128 b, __m128 t, __m128 k)
+    {
+        return _mm_mul_ps( _mm_add_ps( _mm_mul_ps( _mm_sub_ps(_mm_set1_ps(1.0f), t), a), _mm_mul_ps(t,b) ), k);
+    }
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    static __m256 apply(__m256 a, __m256 b, __m256 t, __m256 k)
+    {
+        return _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( _mm256_sub_ps(_mm256_set1_ps(1.0f), t), a), _mm256_mul_ps(t,b) ), k);
+    }
+#endif
+};
 
-      ColorChannel& operator=( int val )
-      {
-          return this->operator=( static_cast<uint8_t>(val) );
-      }
+/**
+ * @brief The rgba_channel struct
+ *
+ * A single channel of a row of interleaved RGBA8 pixels.
+ * base points to the first byte of the first pixel.
+ */
+struct rgba_channel
+{
+    uint8_t const * base   = nullptr;
+    uint32_t        offset = 0;
 
-      ColorChannel& operator=( float val )
-      {
-          return this->operator=( static_cast<uint8_t>(val*255.0f) );
-      }
+    uint8_t get(size_t i) const
+    {
+        return base[4*i + offset];
+    }
+};
 
-      ColorChannel& operator=( channel1f && val )
-      {
-          for(uint32_t j = 0; j < getHeight(); j++)
-          {
-                for(uint32_t i = 0; i < getWidth(); i++)
-                {
-                    (*this)(i,j) = static_cast<uint8_t>(255.0f * val(i,j));
-                }
-          }
+/**
+ * @brief channel_kernel_scalar
+ *
+ * out = 255 * Op(a, b, t, k) for n pixels. If t.base is null, tConst is
+ * used as the interpolation value.
+ */
+template<typename Op>
+void channel_kernel_scalar(uint8_t * out, uint32_t outOffset, rgba_channel a, rgba_channel b, rgba_channel t, float tConst, float k, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        const float T = t.base ? static_cast<float>( t.get(i) ) * (1.0f / 255.0f) : tConst;
+        out[4*i + outOffset] = clamp_u8( 255.0f * Op::apply( static_cast<float>(a.get(i)), static_cast<float>(b.get(i)), T, k) );
+    }
+}
 
-          return *this;
-      }
+template<typename Op>
+void channel_kernel(uint8_t * out, uint32_t outOffset, rgba_channel a, rgba_channel b, rgba_channel t, float tConst, float k, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i sOut = _mm_cvtsi32_si128( static_cast<int>(8*outOffset) );
+    const __m128i sA   = _mm_cvtsi32_si128( static_cast<int>(8*a.offset) );
+    const __m128i sB   = _mm_cvtsi32_si128( static_cast<int>(8*b.offset) );
+    const __m128i sT   = _mm_cvtsi32_si128( static_cast<int>(8*t.offset) );
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256 K   = _mm256_set1_ps(k);
+        const __m256 c   = _mm256_set1_ps(255.0f);
+        const __m256 sc  = _mm256_set1_ps(1.0f / 255.0f);
+        const __m256 Tc  = _mm256_set1_ps(tConst);
+        for(; i + 8 <= n; i += 8)
+        {
+            __m256 A = avx_load_channel(a.base + 4*i, sA);
+            __m256 B = avx_load_channel(b.base + 4*i, sB);
+            __m256 T = t.base ? _mm256_mul_ps( avx_load_channel(t.base + 4*i, sT), sc) : Tc;
+            avx_store_channel(out + 4*i, sOut, _mm256_mul_ps(c, Op::apply(A,B,T,K)) );
+        }
+    }
+#endif
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128 K   = _mm_set1_ps(k);
+        const __m128 c   = _mm_set1_ps(255.0f);
+        const __m128 sc  = _mm_set1_ps(1.0f / 255.0f);
+        const __m128 Tc  = _mm_set1_ps(tConst);
+        for(; i + 4 <= n; i += 4)
+        {
+            __m128 A = sse_load_channel(a.base + 4*i, sA);
+            __m128 B = sse_load_channel(b.base + 4*i, sB);
+            __m128 T = t.base ? _mm_mul_ps( sse_load_channel(t.base + 4*i, sT), sc) : Tc;
+            sse_store_channel(out + 4*i, sOut, _mm_mul_ps(c, Op::apply(A,B,T,K)) );
+        }
+    }
+#endif
+    if( i < n )
+    {
+        rgba_channel A{a.base + 4*i, a.offset};
+        rgba_channel B{b.base + 4*i, b.offset};
+        rgba_channel T{t.base ? t.base + 4*i : nullptr, t.offset};
+        channel_kernel_scalar<Op>(out + 4*i, outOffset, A, B, T, tConst, k, n-i);
+    }
+}
 
-      ColorChannel& operator=( channel1f const &val )
-      {
-          for(uint32_t j = 0; j < getHeight(); j++)
-          {
-                for(uint32_t i = 0; i < getWidth(); i++)
-                {
-                    (*this)(i,j) = static_cast<uint8_t>(255.0f * val(i,j));
-                }
-          }
-          return *this;
-      }
+/**
+ * @brief channel_kernel_planar
+ *
+ * Same as channel_kernel() for channels which are contiguous bytes, eg:
+ * the planes of a planar image. Every lane of the vectors is used.
+ * If t is null, tConst is used as the interpolation value.
+ */
+template<typename Op>
+void channel_kernel_planar(uint8_t * out, uint8_t const * a, uint8_t const * b, uint8_t const * t, float tConst, float k, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256 K   = _mm256_set1_ps(k);
+        const __m256 c   = _mm256_set1_ps(255.0f);
+        const __m256 sc  = _mm256_set1_ps(1.0f / 255.0f);
+        const __m256 Tc  = _mm256_set1_ps(tConst);
+        for(; i + 8 <= n; i += 8)
+        {
+            __m256 A = avx_load_u8x8(a + i);
+            __m256 B = avx_load_u8x8(b + i);
+            __m256 T = t ? _mm256_mul_ps( avx_load_u8x8(t + i), sc) : Tc;
+            avx_store_u8x8(out + i, _mm256_mul_ps(c, Op::apply(A,B,T,K)) );
+        }
+    }
+#endif
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128 K   = _mm_set1_ps(k);
+        const __m128 c   = _mm_set1_ps(255.0f);
+        const __m128 sc  = _mm_set1_ps(1.0f / 255.0f);
+        const __m128 Tc  = _mm_set1_ps(tConst);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128 A[4], B[4], T[4], O[4];
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(a + i) ), A);
+            sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(b + i) ), B);
+            if( t )
+                sse_unpack_u8( _mm_loadu_si128( reinterpret_cast<__m128i const*>(t + i) ), T);
+            for(int j = 0; j < 4; j++)
+            {
+                O[j] = _mm_mul_ps(c, Op::apply(A[j], B[j], t ? _mm_mul_ps(T[j], sc) : Tc, K));
+            }
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i), sse_pack_u8(O) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        const float T = t ? static_cast<float>( t[i] ) * (1.0f / 255.0f) : tConst;
+        out[i] = clamp_u8( 255.0f * Op::apply( static_cast<float>(a[i]), static_cast<float>(b[i]), T, k) );
+    }
+}
 
-      channel1f operator+( ColorChannel const & other) const
-      {
-          channel1f R(width,height);
+/**
+ * @brief div255_round
+ *
+ * Returns round(v/255) for v <= 65025, without a division.
+ */
+inline uint32_t div255_round(uint32_t v)
+{
+    v += 128;
+    return (v + (v >> 8)) >> 8;
+}
 
-          auto & b1 = *this;
-          auto & b2 = other;
+#if defined(GUL_IMAGE_SSE2)
+// div255_round on 8 unsigned 16-bit lanes
+inline __m128i sse_div255_round_epu16(__m128i v)
+{
+    v = _mm_add_epi16(v, _mm_set1_epi16(128));
+    return _mm_srli_epi16( _mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+#endif
+#if defined(GUL_IMAGE_AVX2)
+inline __m256i avx_div255_round_epu16(__m256i v)
+{
+    v = _mm256_add_epi16(v, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16( _mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), 8);
+}
+#endif
 
+/**
+ * The 8-bit fixed point channel operators, see fixedPoint(). Each one
+ * is given the values of the channels a and b and the interpolation
+ * value t, all in the range 0-255, and returns the result in the same
+ * range. The SIMD versions work on 16 (SSE2) or 32 (AVX2) bytes at a
+ * time and give the exact same results.
+ */
+struct fixed_op_sum
+{
+    // min(a+b, 255)
+    static uint8_t apply(uint8_t a, uint8_t b, uint8_t) { return static_cast<uint8_t>( std::min(255u, uint32_t(a) + b) ); }
+#if defined(GUL_IMAGE_SSE2)
+    static __m128i apply(__m128i a, __m128i b, __m128i) { return _mm_adds_epu8(a,b); }
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    static __m256i apply(__m256i a, __m256i b, __m256i) { return _mm256_adds_epu8(a,b); }
+#endif
+};
 
-          const float sc = 1.0f / 255.0f;
-          for(uint32_t j = 0; j < getHeight(); j++)
-          {
-                for(uint32_t i = 0; i < getWidth(); i++)
-                {
-                    R(i,j) =( static_cast<float>( b1(i,j) ) + static_cast<float>(b2(i,j))) * sc;
-                }
-          }
+struct fixed_op_product
+{
+    // round(a*b/255)
+    static uint8_t apply(uint8_t a, uint8_t b, uint8_t) { return static_cast<uint8_t>( div255_round(uint32_t(a) * b) ); }
+#if defined(GUL_IMAGE_SSE2)
+    static __m128i apply(__m128i a, __m128i b, __m128i)
+    {
+        const __m128i z = _mm_setzero_si128();
+        __m128i lo = _mm_mullo_epi16( _mm_unpacklo_epi8(a,z), _mm_unpacklo_epi8(b,z) );
+        __m128i hi = _mm_mullo_epi16( _mm_unpackhi_epi8(a,z), _mm_unpackhi_epi8(b,z) );
+        return _mm_packus_epi16( sse_div255_round_epu16(lo), sse_div255_round_epu16(hi) );
+    }
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    static __m256i apply(__m256i a, __m256i b, __m256i)
+    {
+        const __m256i z = _mm256_setzero_si256();
+        __m256i lo = _mm256_mullo_epi16( _mm256_unpacklo_epi8(a,z), _mm256_unpacklo_epi8(b,z) );
+        __m256i hi = _mm256_mullo_epi16( _mm256_unpackhi_epi8(a,z), _mm256_unpackhi_epi8(b,z) );
+        return _mm256_packus_epi16( avx_div255_round_epu16(lo), avx_div255_round_epu16(hi) );
+    }
+#endif
+};
 
-          return R;
-      }
+struct fixed_op_mix
+{
+    // round( (a*(255-t) + b*t)/255 ), the sum is at most 255*255
+    static uint8_t apply(uint8_t a, uint8_t b, uint8_t t) { return static_cast<uint8_t>( div255_round( uint32_t(a) * (255u - t) + uint32_t(b) * t ) ); }
+#if defined(GUL_IMAGE_SSE2)
+    static __m128i apply(__m128i a, __m128i b, __m128i t)
+    {
+        const __m128i z  = _mm_setzero_si128();
+        const __m128i it = _mm_xor_si128(t, _mm_set1_epi8(-1)); // 255-t
+        __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8(a,z), _mm_unpacklo_epi8(it,z) ),
+                                    _mm_mullo_epi16( _mm_unpacklo_epi8(b,z), _mm_unpacklo_epi8(t,z) ) );
+        __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8(a,z), _mm_unpackhi_epi8(it,z) ),
+                                    _mm_mullo_epi16( _mm_unpackhi_epi8(b,z), _mm_unpackhi_epi8(t,z) ) );
+        return _mm_packus_epi16( sse_div255_round_epu16(lo), sse_div255_round_epu16(hi) );
+    }
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    static __m256i apply(__m256i a, __m256i b, __m256i t)
+    {
+        const __m256i z  = _mm256_setzero_si256();
+        const __m256i it = _mm256_xor_si256(t, _mm256_set1_epi8(-1));
+        __m256i lo = _mm256_add_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8(a,z), _mm256_unpacklo_epi8(it,z) ),
+                                       _mm256_mullo_epi16( _mm256_unpacklo_epi8(b,z), _mm256_unpacklo_epi8(t,z) ) );
+        __m256i hi = _mm256_add_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8(a,z), _mm256_unpackhi_epi8(it,z) ),
+                                       _mm256_mullo_epi16( _mm256_unpackhi_epi8(b,z), _mm256_unpackhi_epi8(t,z) ) );
+        return _mm256_packus_epi16( avx_div255_round_epu16(lo), avx_div255_round_epu16(hi) );
+    }
+#endif
+};
+
+/**
+ * @brief fixed_kernel
+ *
+ * out[i] = Op(a[i], b[i], t[i]) for n contiguous bytes. If t is null,
+ * tConst is used as the interpolation value.
+ */
+template<typename Op>
+void fixed_kernel(uint8_t * out, uint8_t const * a, uint8_t const * b, uint8_t const * t, uint8_t tConst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256i Tc = _mm256_set1_epi8( static_cast<char>(tConst) );
+        for(; i + 32 <= n; i += 32)
+        {
+            __m256i A = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(a + i) );
+            __m256i B = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(b + i) );
+            __m256i T = t ? _mm256_loadu_si256( reinterpret_cast<__m256i const*>(t + i) ) : Tc;
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>(out + i), Op::apply(A,B,T) );
+        }
+    }
+#endif
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128i Tc = _mm_set1_epi8( static_cast<char>(tConst) );
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i A = _mm_loadu_si128( reinterpret_cast<__m128i const*>(a + i) );
+            __m128i B = _mm_loadu_si128( reinterpret_cast<__m128i const*>(b + i) );
+            __m128i T = t ? _mm_loadu_si128( reinterpret_cast<__m128i const*>(t + i) ) : Tc;
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i), Op::apply(A,B,T) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        out[i] = Op::apply(a[i], b[i], t ? t[i] : tConst);
+    }
+}
+
+#if defined(GUL_IMAGE_SSE2)
+// one channel of 16 RGBA pixels as 16 bytes, s is the bit offset of the channel
+inline __m128i sse_load_channel_u8(uint8_t const * p, __m128i s)
+{
+    const __m128i m = _mm_set1_epi32(0xFF);
+    __m128i x[4];
+    for(int k = 0; k < 4; k++)
+        x[k] = _mm_and_si128( _mm_srl_epi32( _mm_loadu_si128( reinterpret_cast<__m128i const*>(p + 16*k) ), s), m);
+    return _mm_packus_epi16( _mm_packs_epi32(x[0], x[1]), _mm_packs_epi32(x[2], x[3]) );
+}
+// the inverse of sse_load_channel_u8(), the other channels are kept
+inline void sse_store_channel_u8(uint8_t * p, __m128i s, __m128i v)
+{
+    const __m128i z    = _mm_setzero_si128();
+    const __m128i keep = _mm_xor_si128( _mm_sll_epi32( _mm_set1_epi32(0xFF), s), _mm_set1_epi32(-1) );
+    const __m128i lo = _mm_unpacklo_epi8(v, z);
+    const __m128i hi = _mm_unpackhi_epi8(v, z);
+    const __m128i x[4] = { _mm_unpacklo_epi16(lo, z), _mm_unpackhi_epi16(lo, z),
+                           _mm_unpacklo_epi16(hi, z), _mm_unpackhi_epi16(hi, z) };
+    for(int k = 0; k < 4; k++)
+    {
+        __m128i * d = reinterpret_cast<__m128i*>(p + 16*k);
+        _mm_storeu_si128(d, _mm_or_si128( _mm_and_si128( _mm_loadu_si128(d), keep), _mm_sll_epi32(x[k], s) ) );
+    }
+}
+#endif
+#if defined(GUL_IMAGE_AVX2)
+// same as above for 32 pixels. The packs and unpacks work within each
+// 128-bit lane, so the bytes are not in pixel order, but storing undoes
+// the shuffle and the fixed point operators work on each byte separately.
+inline __m256i avx_load_channel_u8(uint8_t const * p, __m128i s)
+{
+    const __m256i m = _mm256_set1_epi32(0xFF);
+    __m256i x[4];
+    for(int k = 0; k < 4; k++)
+        x[k] = _mm256_and_si256( _mm256_srl_epi32( _mm256_loadu_si256( reinterpret_cast<__m256i const*>(p + 32*k) ), s), m);
+    return _mm256_packus_epi16( _mm256_packs_epi32(x[0], x[1]), _mm256_packs_epi32(x[2], x[3]) );
+}
+inline void avx_store_channel_u8(uint8_t * p, __m128i s, __m256i v)
+{
+    const __m256i z    = _mm256_setzero_si256();
+    const __m256i keep = _mm256_xor_si256( _mm256_sll_epi32( _mm256_set1_epi32(0xFF), s), _mm256_set1_epi32(-1) );
+    const __m256i lo = _mm256_unpacklo_epi8(v, z);
+    const __m256i hi = _mm256_unpackhi_epi8(v, z);
+    const __m256i x[4] = { _mm256_unpacklo_epi16(lo, z), _mm256_unpackhi_epi16(lo, z),
+                           _mm256_unpacklo_epi16(hi, z), _mm256_unpackhi_epi16(hi, z) };
+    for(int k = 0; k < 4; k++)
+    {
+        __m256i * d = reinterpret_cast<__m256i*>(p + 32*k);
+        _mm256_storeu_si256(d, _mm256_or_si256( _mm256_and_si256( _mm256_loadu_si256(d), keep), _mm256_sll_epi32(x[k], s) ) );
+    }
+}
+#endif
+
+/**
+ * @brief fixed_kernel_rgba
+ *
+ * Same as fixed_kernel() for channels of interleaved RGBA8 pixels.
+ */
+template<typename Op>
+void fixed_kernel_rgba(uint8_t * out, uint32_t outOffset, rgba_channel a, rgba_channel b, rgba_channel t, uint8_t tConst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i sOut = _mm_cvtsi32_si128( static_cast<int>(8*outOffset) );
+    const __m128i sA   = _mm_cvtsi32_si128( static_cast<int>(8*a.offset) );
+    const __m128i sB   = _mm_cvtsi32_si128( static_cast<int>(8*b.offset) );
+    const __m128i sT   = _mm_cvtsi32_si128( static_cast<int>(8*t.offset) );
+#endif
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256i Tc = _mm256_set1_epi8( static_cast<char>(tConst) );
+        for(; i + 32 <= n; i += 32)
+        {
+            __m256i A = avx_load_channel_u8(a.base + 4*i, sA);
+            __m256i B = avx_load_channel_u8(b.base + 4*i, sB);
+            __m256i T = t.base ? avx_load_channel_u8(t.base + 4*i, sT) : Tc;
+            avx_store_channel_u8(out + 4*i, sOut, Op::apply(A,B,T) );
+        }
+    }
+#endif
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128i Tc = _mm_set1_epi8( static_cast<char>(tConst) );
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i A = sse_load_channel_u8(a.base + 4*i, sA);
+            __m128i B = sse_load_channel_u8(b.base + 4*i, sB);
+            __m128i T = t.base ? sse_load_channel_u8(t.base + 4*i, sT) : Tc;
+            sse_store_channel_u8(out + 4*i, sOut, Op::apply(A,B,T) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        out[4*i + outOffset] = Op::apply( a.get(i), b.get(i), t.base ? t.get(i) : tConst );
+    }
+}
+
+/**
+ * @brief channel_copy_scalar
+ *
+ * Copies n values of one channel into another. Each channel is given by
+ * a pointer to its first pixel, the byte offset of the channel within
+ * the pixel and the number of bytes per pixel.
+ */
+inline void channel_copy_scalar(uint8_t * dst, uint32_t dstOffset, uint32_t dstStride,
+                                uint8_t const * src, uint32_t srcOffset, uint32_t srcStride, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        dst[i*dstStride + dstOffset] = src[i*srcStride + srcOffset];
+    }
+}
+
+/**
+ * @brief channel_copy
+ *
+ * Same as channel_copy_scalar(). The RGBA->RGBA, RGBA->R (extract) and
+ * R->RGBA (insert) cases use SIMD, the other channels of the
+ * destination are left untouched.
+ */
+inline void channel_copy(uint8_t * dst, uint32_t dstOffset, uint32_t dstStride,
+                         uint8_t const * src, uint32_t srcOffset, uint32_t srcStride, size_t n)
+{
+    if( dstStride == 1 && srcStride == 1 )
+    {
+        memmove(dst + dstOffset, src + srcOffset, n);
+        return;
+    }
+
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i sIn   = _mm_cvtsi32_si128( static_cast<int>(8*srcOffset) );
+    const __m128i sOut  = _mm_cvtsi32_si128( static_cast<int>(8*dstOffset) );
+    const __m128i mByte = _mm_set1_epi32(0xFF);
+    const __m128i mOut  = _mm_sll_epi32(mByte, sOut);
+
+    if( dstStride == 4 && srcStride == 4 )
+    {
+  #if defined(GUL_IMAGE_AVX2)
+        const __m256i mByte8 = _mm256_set1_epi32(0xFF);
+        const __m256i mOut8  = _mm256_sll_epi32(mByte8, sOut);
+        for(; i + 8 <= n; i += 8)
+        {
+            __m256i v = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(src + 4*i) );
+            __m256i o = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(dst + 4*i) );
+            v = _mm256_sll_epi32( _mm256_and_si256( _mm256_srl_epi32(v, sIn), mByte8), sOut);
+            o = _mm256_or_si256( _mm256_andnot_si256(mOut8, o), v);
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>(dst + 4*i), o);
+        }
+  #endif
+        for(; i + 4 <= n; i += 4)
+        {
+            __m128i v = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 4*i) );
+            __m128i o = _mm_loadu_si128( reinterpret_cast<__m128i const*>(dst + 4*i) );
+            v = _mm_sll_epi32( _mm_and_si128( _mm_srl_epi32(v, sIn), mByte), sOut);
+            o = _mm_or_si128( _mm_andnot_si128(mOut, o), v);
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + 4*i), o);
+        }
+    }
+    else if( dstStride == 1 && srcStride == 4 )
+    {
+        // extract: 16 pixels -> 16 bytes
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i v[4];
+            for(int k = 0; k < 4; k++)
+            {
+                v[k] = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 4*i + 16*size_t(k)) );
+                v[k] = _mm_and_si128( _mm_srl_epi32(v[k], sIn), mByte);
+            }
+            __m128i lo = _mm_packs_epi32(v[0], v[1]);
+            __m128i hi = _mm_packs_epi32(v[2], v[3]);
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + dstOffset + i), _mm_packus_epi16(lo, hi) );
+        }
+    }
+    else if( dstStride == 4 && srcStride == 1 )
+    {
+        // insert: 16 bytes -> 16 pixels
+        const __m128i z = _mm_setzero_si128();
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i b  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + srcOffset + i) );
+            __m128i lo = _mm_unpacklo_epi8(b, z);
+            __m128i hi = _mm_unpackhi_epi8(b, z);
+            __m128i v[4] = { _mm_unpacklo_epi16(lo, z), _mm_unpackhi_epi16(lo, z),
+                             _mm_unpacklo_epi16(hi, z), _mm_unpackhi_epi16(hi, z) };
+            for(int k = 0; k < 4; k++)
+            {
+                auto * p = reinterpret_cast<__m128i*>(dst + 4*i + 16*size_t(k));
+                __m128i o = _mm_loadu_si128(p);
+                o = _mm_or_si128( _mm_andnot_si128(mOut, o), _mm_sll_epi32(v[k], sOut) );
+                _mm_storeu_si128(p, o);
+            }
+        }
+    }
+#endif
+    if( i < n )
+    {
+        channel_copy_scalar(dst + i*dstStride, dstOffset, dstStride, src + i*srcStride, srcOffset, srcStride, n - i);
+    }
+}
+
+/**
+ * @brief channel_fill
+ *
+ * Sets n values of a channel to val. See channel_copy_scalar()
+ */
+inline void channel_fill(uint8_t * dst, uint32_t dstOffset, uint32_t dstStride, uint8_t val, size_t n)
+{
+    if( dstStride == 1 )
+    {
+        memset(dst + dstOffset, val, n);
+        return;
+    }
+
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    if( dstStride == 4 )
+    {
+        const __m128i sOut = _mm_cvtsi32_si128( static_cast<int>(8*dstOffset) );
+        const __m128i mOut = _mm_sll_epi32( _mm_set1_epi32(0xFF), sOut);
+        const __m128i V    = _mm_sll_epi32( _mm_set1_epi32(val), sOut);
+  #if defined(GUL_IMAGE_AVX2)
+        const __m256i mOut8 = _mm256_broadcastsi128_si256(mOut);
+        const __m256i V8    = _mm256_broadcastsi128_si256(V);
+        for(; i + 8 <= n; i += 8)
+        {
+            auto * p = reinterpret_cast<__m256i*>(dst + 4*i);
+            _mm256_storeu_si256(p, _mm256_or_si256( _mm256_andnot_si256(mOut8, _mm256_loadu_si256(p)), V8) );
+        }
+  #endif
+        for(; i + 4 <= n; i += 4)
+        {
+            auto * p = reinterpret_cast<__m128i*>(dst + 4*i);
+            _mm_storeu_si128(p, _mm_or_si128( _mm_andnot_si128(mOut, _mm_loadu_si128(p)), V) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        dst[i*dstStride + dstOffset] = val;
+    }
+}
+
+/**
+ * @brief deinterleave
+ *
+ * Splits n pixels with C interleaved channels into C planes of n bytes,
+ * plane c starts at dst + c*n.
+ */
+inline void deinterleave(uint8_t const * src, size_t n, uint32_t C, uint8_t * dst)
+{
+    if( C == 1 )
+    {
+        memcpy(dst, src, n);
+        return;
+    }
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    if( C == 4 )
+    {
+        // 16 pixels -> 16 bytes of each plane
+        const __m128i mByte = _mm_set1_epi32(0xFF);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i v[4];
+            for(int k = 0; k < 4; k++)
+                v[k] = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 4*i + 16*size_t(k)) );
+            for(int c = 0; c < 4; c++)
+            {
+                __m128i p[4];
+                for(int k = 0; k < 4; k++)
+                    p[k] = _mm_and_si128(v[k], mByte);
+                __m128i lo = _mm_packs_epi32(p[0], p[1]);
+                __m128i hi = _mm_packs_epi32(p[2], p[3]);
+                _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + size_t(c)*n + i), _mm_packus_epi16(lo, hi) );
+                for(int k = 0; k < 4; k++)
+                    v[k] = _mm_srli_epi32(v[k], 8);
+            }
+        }
+    }
+    else if( C == 2 )
+    {
+        // 16 pixels -> 16 bytes of each plane
+        const __m128i mByte = _mm_set1_epi16(0xFF);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i v0 = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 2*i) );
+            __m128i v1 = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 2*i + 16) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i),
+                              _mm_packus_epi16( _mm_and_si128(v0, mByte), _mm_and_si128(v1, mByte) ) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + n + i),
+                              _mm_packus_epi16( _mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8) ) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        for(uint32_t c = 0; c < C; c++)
+            dst[size_t(c)*n + i] = src[i*C + c];
+    }
+}
+
+/**
+ * @brief interleave
+ *
+ * The inverse of deinterleave(), merges C planes of n bytes into n
+ * pixels with C interleaved channels.
+ */
+inline void interleave(uint8_t const * src, size_t n, uint32_t C, uint8_t * dst)
+{
+    if( C == 1 )
+    {
+        memcpy(dst, src, n);
+        return;
+    }
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    if( C == 4 )
+    {
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i r = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + i) );
+            __m128i g = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + n + i) );
+            __m128i b = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 2*n + i) );
+            __m128i a = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 3*n + i) );
+            __m128i rgLo = _mm_unpacklo_epi8(r, g), rgHi = _mm_unpackhi_epi8(r, g);
+            __m128i baLo = _mm_unpacklo_epi8(b, a), baHi = _mm_unpackhi_epi8(b, a);
+            auto * o = reinterpret_cast<__m128i*>(dst + 4*i);
+            _mm_storeu_si128(o,     _mm_unpacklo_epi16(rgLo, baLo) );
+            _mm_storeu_si128(o + 1, _mm_unpackhi_epi16(rgLo, baLo) );
+            _mm_storeu_si128(o + 2, _mm_unpacklo_epi16(rgHi, baHi) );
+            _mm_storeu_si128(o + 3, _mm_unpackhi_epi16(rgHi, baHi) );
+        }
+    }
+    else if( C == 2 )
+    {
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i r = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + i) );
+            __m128i g = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + n + i) );
+            auto * o = reinterpret_cast<__m128i*>(dst + 2*i);
+            _mm_storeu_si128(o,     _mm_unpacklo_epi8(r, g) );
+            _mm_storeu_si128(o + 1, _mm_unpackhi_epi8(r, g) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        for(uint32_t c = 0; c < C; c++)
+            dst[i*C + c] = src[size_t(c)*n + i];
+    }
+}
+
+/**
+ * @brief box2x2_row
+ *
+ * Averages 2x2 blocks of pixels from the two source rows r0 and r1 into
+ * dw output pixels, ie: (a+b+c+d)/4. Same result as Image::sample()
+ */
+inline void box2x2_row(uint8_t const * r0, uint8_t const * r1, uint8_t * out, uint32_t dw, uint32_t C)
+{
+    uint32_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i z = _mm_setzero_si128();
+    if( C == 4 )
+    {
+        // 4 source pixels -> 2 output pixels
+        for(; i + 2 <= dw; i += 2)
+        {
+            __m128i a  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(r0 + 8*i) );
+            __m128i b  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(r1 + 8*i) );
+            __m128i lo = _mm_add_epi16( _mm_unpacklo_epi8(a,z), _mm_unpacklo_epi8(b,z) );
+            __m128i hi = _mm_add_epi16( _mm_unpackhi_epi8(a,z), _mm_unpackhi_epi8(b,z) );
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo,8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi,8));
+            __m128i s = _mm_srli_epi16( _mm_unpacklo_epi64(lo,hi), 2);
+            _mm_storel_epi64( reinterpret_cast<__m128i*>(out + 4*i), _mm_packus_epi16(s,s) );
+        }
+    }
+    else if( C == 1 )
+    {
+        // 16 source pixels -> 8 output pixels
+        const __m128i ones = _mm_set1_epi16(1);
+        for(; i + 8 <= dw; i += 8)
+        {
+            __m128i a  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(r0 + 2*i) );
+            __m128i b  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(r1 + 2*i) );
+            __m128i lo = _mm_madd_epi16( _mm_add_epi16( _mm_unpacklo_epi8(a,z), _mm_unpacklo_epi8(b,z) ), ones);
+            __m128i hi = _mm_madd_epi16( _mm_add_epi16( _mm_unpackhi_epi8(a,z), _mm_unpackhi_epi8(b,z) ), ones);
+            __m128i s  = _mm_srli_epi16( _mm_packs_epi32(lo,hi), 2);
+            _mm_storel_epi64( reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(s,s) );
+        }
+    }
+#endif
+    for(; i < dw; i++)
+    {
+        auto * a = r0 + 2*i*C;
+        auto * b = r1 + 2*i*C;
+        for(uint32_t c = 0; c < C; c++)
+        {
+            const uint32_t sum = uint32_t(a[c]) + uint32_t(a[c+C]) + uint32_t(b[c]) + uint32_t(b[c+C]);
+            out[i*C + c] = static_cast<uint8_t>(sum / 4u);
+        }
+    }
+}
+
+/**
+ * @brief box_taps
+ *
+ * Returns the source pixels and integer weights that make up the output
+ * pixel i when a dimension of size s is halved. Even sizes use two equal
+ * weights. Odd sizes, s=2n+1, use a 3-tap filter with weights
+ * (n-i, n, i+1) / (2n+1) so that every source pixel contributes
+ * exactly its coverage to the output.
+ *
+ * Returns the number of taps.
+ */
+inline uint32_t box_taps(uint32_t s, uint32_t i, uint32_t w[3])
+{
+    if( (s & 1u) == 0 )
+    {
+        w[0] = w[1] = 1;
+        return 2;
+    }
+    const uint32_t n = s / 2;
+    w[0] = n - i;
+    w[1] = n;
+    w[2] = i + 1;
+    return 3;
+}
+
+/**
+ * @brief downsample_box
+ *
+ * Halves an image of sw x sh pixels with C interleaved channels using a
+ * box filter. The output is floor(sw/2) x floor(sh/2) pixels. Only the
+ * output rows [row0, row1) are written. The pitches are the number of bytes
+ * between rows, 0 if the rows are tightly packed.
+ */
+inline void downsample_box(uint8_t const * src, uint32_t sw, uint32_t sh, uint32_t C, uint8_t * dst, uint32_t row0, uint32_t row1,
+                           size_t srcPitch = 0, size_t dstPitch = 0)
+{
+    const uint32_t dw = sw / 2;
+    if( srcPitch == 0 )
+        srcPitch = size_t(sw) * C;
+    if( dstPitch == 0 )
+        dstPitch = size_t(dw) * C;
+
+    const bool     oddX = (sw & 1u) != 0;
+    const uint64_t divX = oddX ? sw : 2u;
+    const uint64_t divY = (sh & 1u) ? sh : 2u;
+
+    for(uint32_t j = row0; j < row1; j++)
+    {
+        uint8_t * out = dst + j * dstPitch;
+
+        uint32_t wy[3];
+        const uint32_t ty = box_taps(sh, j, wy);
+
+        if( ty == 2 && !oddX )
+        {
+            box2x2_row(src + 2*j*srcPitch, src + (2*j+1)*srcPitch, out, dw, C);
+            continue;
+        }
+
+        for(uint32_t i = 0; i < dw; i++)
+        {
+            uint32_t wx[3];
+            const uint32_t tx = box_taps(sw, i, wx);
+
+            for(uint32_t c = 0; c < C; c++)
+            {
+                uint64_t sum = 0;
+                for(uint32_t y = 0; y < ty; y++)
+                {
+                    auto * row = src + (2*j+y)*srcPitch + 2*i*C + c;
+                    uint64_t rs = 0;
+                    for(uint32_t x = 0; x < tx; x++)
+                    {
+                        rs += uint64_t(wx[x]) * row[x*C];
+                    }
+                    sum += rs * wy[y];
+                }
+                out[i*C + c] = static_cast<uint8_t>( sum / (divX*divY) );
+            }
+        }
+    }
+}
+
+}
+
+
+inline uint8_t mix( uint8_t  a, uint8_t  b, float t)
+{
+    return static_cast<uint8_t>( (float(a) * (1.0f-t) + float(b)*t));
+
+}
+
+/**
+ * @brief The ChannelExpr struct
+ *
+ * Base class for all lazily evaluated channel expressions. Arithmetic on
+ * ColorChannels and channel1fs does not compute anything, it builds a tree
+ * of expression nodes which is evaluated in a single pass when it is
+ * assigned to a ColorChannel (or a channel1f).
+ *
+ * Each derived class must provide:
+ *
+ *   float    eval(uint32_t u, uint32_t v) const; // value in the range 0-1
+ *   uint32_t getWidth() const;
+ *   uint32_t getHeight() const;
+ *
+ * Note: Expressions hold references to the ColorChannels and channel1fs
+ *       they were built from, so those must outlive the expression.
+ *       Temporary channel1fs, eg: Image::X(w,h), are moved into the
+ *       expression, so auto e = Image::X(w,h) * 2.0f; can be evaluated
+ *       later.
+ */
+template<typename E>
+struct ChannelExpr
+{
+    E const & self() const
+    {
+        return static_cast<E const&>(*this);
+    }
+};
+
+struct channel1f;
+struct ColorChannel;
+class Image;
+
+template<typename E>
+struct ChannelFixedExpr;
+
+template<typename E>
+using is_channel_expr = std::is_base_of< ChannelExpr<E>, E>;
+
+/**
+ * @brief The expr_storage struct
+ *
+ * Channels are held by reference inside an expression node while all
+ * other nodes are small and are held by value.
+ */
+template<typename E>
+struct expr_storage
+{
+    using type = E;
+};
+template<>
+struct expr_storage<channel1f>
+{
+    using type = channel1f const &;
+};
+template<>
+struct expr_storage<ColorChannel>
+{
+    using type = ColorChannel const &;
+};
+
+/**
+ * @brief The ChannelScalar struct
+ *
+ * A constant value used inside an expression.
+ */
+struct ChannelScalar : public ChannelExpr<ChannelScalar>
+{
+    float value;
+
+    explicit ChannelScalar(float v) : value(v)
+    {
+    }
+    float eval(uint32_t, uint32_t) const
+    {
+        return value;
+    }
+    uint32_t getWidth() const
+    {
+        return 0;
+    }
+    uint32_t getHeight() const
+    {
+        return 0;
+    }
+};
+
+template<typename L, typename R, typename Op>
+struct ChannelBinaryExpr : public ChannelExpr< ChannelBinaryExpr<L,R,Op> >
+{
+    typename expr_storage<L>::type lhs;
+    typename expr_storage<R>::type rhs;
+
+    ChannelBinaryExpr(L const & l, R const & r) : lhs(l), rhs(r)
+    {
+    }
+    float eval(uint32_t u, uint32_t v) const
+    {
+        return Op::apply( lhs.eval(u,v), rhs.eval(u,v) );
+    }
+    uint32_t getWidth() const
+    {
+        return std::max( lhs.getWidth(), rhs.getWidth() );
+    }
+    uint32_t getHeight() const
+    {
+        return std::max( lhs.getHeight(), rhs.getHeight() );
+    }
+};
+
+template<typename A, typename B, typename T, typename Op>
+struct ChannelTernaryExpr : public ChannelExpr< ChannelTernaryExpr<A,B,T,Op> >
+{
+    typename expr_storage<A>::type a;
+    typename expr_storage<B>::type b;
+    typename expr_storage<T>::type t;
+
+    ChannelTernaryExpr(A const & _a, B const & _b, T const & _t) : a(_a), b(_b), t(_t)
+    {
+    }
+    float eval(uint32_t u, uint32_t v) const
+    {
+        return Op::apply( a.eval(u,v), b.eval(u,v), t.eval(u,v) );
+    }
+    uint32_t getWidth() const
+    {
+        return std::max( std::max( a.getWidth(), b.getWidth() ), t.getWidth() );
+    }
+    uint32_t getHeight() const
+    {
+        return std::max( std::max( a.getHeight(), b.getHeight() ), t.getHeight() );
+    }
+};
+
+struct expr_add
+{
+    static float apply(float a, float b) { return a + b; }
+};
+struct expr_sub
+{
+    static float apply(float a, float b) { return a - b; }
+};
+struct expr_mul
+{
+    static float apply(float a, float b) { return a * b; }
+};
+struct expr_mix
+{
+    static float apply(float a, float b, float t) { return (1.0f - t) * a + t * b; }
+};
+
+/**
+ * @brief The channel1f struct
+ *
+ * Essentially a 1D image of floating point values.
+ * Mostly used for intermediate stages; assigning an expression
+ * evaluates it into scratch memory from buffer_pool::global().
+ */
+struct channel1f : public ChannelExpr<channel1f>
+{
+      std::vector<float> data;
+
+      channel1f(uint32_t w, uint32_t h) : _width(w), _height(h)
+      {
+          data.resize(w*h);
+      }
+
+      /**
+       * @brief channel1f
+       * @param E
+       *
+       * Evaluates the expression and stores the result.
+       */
+      template<typename E>
+      channel1f(ChannelExpr<E> const & E_) : channel1f(E_.self().getWidth(), E_.self().getHeight())
+      {
+          _eval(E_.self(), data.data());
+      }
+
+      template<typename E>
+      channel1f& operator=(ChannelExpr<E> const & E_)
+      {
+          // evaluate into pooled scratch first in case the
+          // expression references this channel, data keeps
+          // its capacity.
+          auto const & e = E_.self();
+          std::vector<float, pool_allocator<float> > scratch( size_t(e.getWidth()) * e.getHeight() );
+          _eval(e, scratch.data());
+          data.assign(scratch.begin(), scratch.end());
+          _width  = e.getWidth();
+          _height = e.getHeight();
+          return *this;
+      }
+
+      float eval(uint32_t u, uint32_t v) const
+      {
+          return data[v*_width+u];
+      }
+      float & operator()(uint32_t u, uint32_t v)
+      {
+          return data[v*_width+u];
+      }
+      float const & operator()(uint32_t u, uint32_t v) const
+      {
+          return data[v*_width+u];
+      }
+
+      uint32_t width() const
+      {
+          return _width;
+      }
+
+      uint32_t height() const
+      {
+          return _height;
+      }
+
+      uint32_t getWidth() const
+      {
+          return _width;
+      }
+
+      uint32_t getHeight() const
+      {
+          return _height;
+      }
+
+private:
+      template<typename E>
+      static void _eval(E const & e, float * D)
+      {
+          const uint32_t w = e.getWidth();
+          const uint32_t h = e.getHeight();
+          for(uint32_t v = 0; v < h; ++v)
+          {
+              for(uint32_t u = 0; u < w; ++u)
+              {
+                  *D++ = e.eval(u,v);
+              }
+          }
+      }
+
+      uint32_t _width;
+      uint32_t _height;
+};
+
+/**
+ * @brief The ChannelValue struct
+ *
+ * A temporary channel1f which has been moved into an expression. The
+ * values are shared, so copying the node into a larger expression does
+ * not copy them.
+ */
+struct ChannelValue : public ChannelExpr<ChannelValue>
+{
+    std::shared_ptr<channel1f const> channel;
+
+    explicit ChannelValue(channel1f && c) : channel( std::make_shared<channel1f const>( std::move(c) ) )
+    {
+    }
+    float eval(uint32_t u, uint32_t v) const
+    {
+        return channel->eval(u,v);
+    }
+    uint32_t getWidth() const
+    {
+        return channel->getWidth();
+    }
+    uint32_t getHeight() const
+    {
+        return channel->getHeight();
+    }
+};
+
+// An operand deduced as A&& is a temporary channel1f if A is channel1f.
+// Temporaries are stored as a ChannelValue, everything else as described
+// by expr_storage.
+template<typename A>
+using is_temp_channel = std::is_same<A, channel1f>;
+
+template<typename A>
+using expr_operand_t = typename std::conditional< is_temp_channel<A>::value, ChannelValue, typename std::decay<A>::type >::type;
+
+template<typename... E>
+using enable_if_temp_operand = typename std::enable_if< (is_channel_expr<typename std::decay<E>::type>::value && ...) &&
+                                                        (is_temp_channel<E>::value || ...) >::type;
+
+template<typename E>
+E const & expr_operand(ChannelExpr<E> const & e)
+{
+    return e.self();
+}
+inline ChannelValue expr_operand(channel1f && c)
+{
+    return ChannelValue( std::move(c) );
+}
+
+
+struct ChannelRaw;
+
+namespace detail
+{
+/**
+ * @brief The pixel_anchor struct
+ *
+ * The current pixels of a copy-on-write Image. The image and all the
+ * copies of its ColorChannels share one anchor, so a copied channel keeps
+ * referring to the image when its buffer is duplicated or when the image
+ * is moved. Both members are cleared when the image is destroyed.
+ */
+struct pixel_anchor
+{
+    uint8_t * ptr   = nullptr;
+    Image   * owner = nullptr;
+};
+}
+
+// The expressions created by combining two ColorChannels. These have
+// dedicated SIMD kernels when they are assigned to a channel.
+using ChannelSumExpr        = ChannelBinaryExpr< ChannelBinaryExpr<ChannelRaw, ChannelRaw, expr_add>, ChannelScalar, expr_mul>;
+using ChannelProductExpr    = ChannelBinaryExpr< ChannelBinaryExpr<ChannelRaw, ChannelRaw, expr_mul>, ChannelScalar, expr_mul>;
+using ChannelMixExpr        = ChannelBinaryExpr< ChannelTernaryExpr<ChannelRaw, ChannelRaw, ChannelScalar, expr_mix>, ChannelScalar, expr_mul>;
+using ChannelMixChannelExpr = ChannelBinaryExpr< ChannelTernaryExpr<ChannelRaw, ChannelRaw, ColorChannel,  expr_mix>, ChannelScalar, expr_mul>;
+
+struct ColorChannel : public ChannelExpr<ColorChannel>
+{
+      using channel_type = ColorChannel;
+      uint32_t stride = 0;
+      uint32_t offset = 0;
+      uint32_t rowPitch = 0; // bytes between the start of two rows
+
+      ColorChannel()
+      {
+
+      }
+      // copies the handle, operator= copies the pixels
+      ColorChannel(ColorChannel const &) = default;
+
+      ColorChannel(uint8_t * data, uint32_t _offset, uint32_t _stride, uint32_t w, uint32_t h, uint32_t _rowPitch=0) :
+          stride(_stride), offset(_offset), rowPitch(_rowPitch ? _rowPitch : _stride*w), width(w), height(h), ptr(data)
+      {
+      }
+
+      /**
+       * @brief reset
+       *
+       * If _rowPitch is 0, the rows are assumed to be tightly
+       * packed, ie: _stride*w bytes apart.
+       */
+      void reset(uint8_t * data, uint32_t _offset, uint32_t _stride, uint32_t w, uint32_t h, uint32_t _rowPitch=0)
+      {
+            stride   = _stride;
+            offset   = _offset;
+            rowPitch = _rowPitch ? _rowPitch : _stride*w;
+            width    = w;
+            height   = h;
+            ptr = data;
+            m_anchor.reset();
+      }
+
+
+      uint8_t & operator()(uint32_t u, uint32_t v)
+      {
+          _prepareWrite();
+          return _at(u,v);
+      }
+      uint8_t & _at(uint32_t u, uint32_t v)
+      {
+          return ptr[  v*rowPitch + u*stride + offset ];
+      }
+      uint8_t const & operator()(uint32_t u, uint32_t v) const
+      {
+          return _data()[  v*rowPitch + u*stride + offset ];
+          //return static_cast<uint8_t*>(static_cast<void*>(&ptr[v*width+u]))[offset];
+      }
+
+      /**
+       * @brief valid
+       * @return
+       *
+       * Returns false if the channel does not refer to any pixels, eg: it
+       * is a copy of a channel of an Image which has been destroyed.
+       */
+      bool valid() const
+      {
+          return _data() != nullptr;
+      }
+
+      /**
+       * @brief _data
+       * @return
+       *
+       * Returns the pixels the channel currently refers to. Every read goes
+       * through this so that copies of the channels of a copy-on-write image
+       * see its current buffer.
+       */
+      uint8_t * _data() const
+      {
+          return m_anchor ? m_anchor->ptr : ptr;
+      }
+
+      ColorChannel& operator=( ColorChannel const & other)
+      {
+          if( width  !=  other.width ||
+              height !=  other.height)
+          {
+              throw std::logic_error("Channels are of different size");
+          }
+          _prepareWrite();
+
+          if( _isPacked() && other._isPacked() )
+          {
+              detail::channel_copy(ptr, offset, stride, other._data(), other.offset, other.stride, size_t(width)*height);
+              return *this;
+          }
+          for(uint32_t j=0;j<height;j++)
+          {
+              detail::channel_copy(ptr + size_t(j)*rowPitch, offset, stride,
+                                   other._data() + size_t(j)*other.rowPitch, other.offset, other.stride, width);
+          }
+
+          return *this;
+      }
+
+      ColorChannel& operator=( uint8_t val)
+      {
+          _prepareWrite();
+          if( _isPacked() )
+          {
+              detail::channel_fill(ptr, offset, stride, val, size_t(width)*height);
+              return *this;
+          }
+          for(uint32_t j=0;j<height;j++)
+          {
+              detail::channel_fill(ptr + size_t(j)*rowPitch, offset, stride, val, width);
+          }
+
+          return *this;
+      }
+
+      bool _isPacked() const
+      {
+          return rowPitch == stride * width;
+      }
+
+      ColorChannel& operator=( int val )
+      {
+          return this->operator=( static_cast<uint8_t>(val) );
+      }
+
+      ColorChannel& operator=( float val )
+      {
+          return this->operator=( static_cast<uint8_t>(val*255.0f) );
+      }
+
+      /**
+       * @brief operator =
+       * @param E
+       * @return
+       *
+       * Evaluates a channel expression, eg: I.r = 0.5f*I.g + I.b*I.a,
+       * in a single pass without allocating any intermediate buffers.
+       */
+      template<typename E>
+      ColorChannel& operator=( ChannelExpr<E> const & E_ )
+      {
+          auto & e = E_.self();
+
+          if( (e.getWidth()  != 0 && e.getWidth()  != width ) ||
+              (e.getHeight() != 0 && e.getHeight() != height) )
+          {
+              throw std::logic_error("Channels are of different size");
+          }
+
+          _prepareWrite();
+          if( _assignFast(e) )
+              return *this;
+
+          for(uint32_t j = 0; j < getHeight(); j++)
+          {
+                for(uint32_t i = 0; i < getWidth(); i++)
+                {
+                    // saturate the same way as the SIMD kernels
+                    _at(i,j) = detail::clamp_u8(255.0f * e.eval(i,j));
+                }
+          }
+          return *this;
+      }
+
+      /**
+       * @brief _assignFast
+       * @return
+       *
+       * Evaluates the expression using one of the SIMD channel kernels.
+       * Returns false if there is no kernel for the expression or the
+       * channels are not all part of RGBA images or all contiguous
+       * (planar or single channel images).
+       */
+      template<typename E>
+      bool _assignFast( E const & )
+      {
+          return false;
+      }
+      bool _assignFast( ChannelSumExpr const & e);
+      bool _assignFast( ChannelProductExpr const & e);
+      bool _assignFast( ChannelMixExpr const & e);
+      bool _assignFast( ChannelMixChannelExpr const & e);
+      template<typename E>
+      bool _assignFast( ChannelFixedExpr<E> const & e);
+
+      /**
+       * @brief _assignFixed
+       *
+       * Evaluates one of the fixed point operators. Contiguous channels
+       * and channels of RGBA images are processed in place, any other
+       * channels are gathered into blocks of contiguous bytes first.
+       */
+      template<typename Op>
+      bool _assignFixed(ColorChannel const & A, ColorChannel const & B, ColorChannel const * T, uint8_t tConst)
+      {
+          auto isPlane = [](ColorChannel const & c)
+          {
+              return c.stride == 1;
+          };
+          if( isPlane(*this) && isPlane(A) && isPlane(B) && (!T || isPlane(*T)) )
+          {
+              if( _isPacked() && A._isPacked() && B._isPacked() && (!T || T->_isPacked()) )
+              {
+                  detail::fixed_kernel<Op>( ptr + offset, A._data() + A.offset, B._data() + B.offset,
+                                            T ? T->_data() + T->offset : nullptr, tConst,
+                                            size_t(width) * size_t(height) );
+                  return true;
+              }
+              for(uint32_t j = 0; j < height; j++)
+              {
+                  detail::fixed_kernel<Op>( ptr + size_t(j)*rowPitch + offset,
+                                            A._data() + size_t(j)*A.rowPitch + A.offset,
+                                            B._data() + size_t(j)*B.rowPitch + B.offset,
+                                            T ? T->_data() + size_t(j)*T->rowPitch + T->offset : nullptr,
+                                            tConst, width );
+              }
+              return true;
+          }
+
+          auto isRGBA = [](ColorChannel const & c)
+          {
+              return c.stride == 4;
+          };
+          if( isRGBA(*this) && isRGBA(A) && isRGBA(B) && (!T || isRGBA(*T)) )
+          {
+              for(uint32_t j = 0; j < height; j++)
+              {
+                  detail::rgba_channel t;
+                  if( T )
+                  {
+                      t = {T->_data() + size_t(j)*T->rowPitch, T->offset};
+                  }
+                  detail::fixed_kernel_rgba<Op>( ptr + size_t(j)*rowPitch, offset,
+                                                 {A._data() + size_t(j)*A.rowPitch, A.offset},
+                                                 {B._data() + size_t(j)*B.rowPitch, B.offset},
+                                                 t, tConst, width );
+              }
+              return true;
+          }
+
+          // mixed layouts, gather the channels into contiguous blocks
+          constexpr uint32_t block = 256;
+          uint8_t ta[block], tb[block], tt[block], to[block];
+          for(uint32_t j = 0; j < height; j++)
+          {
+              for(uint32_t i = 0; i < width; i += block)
+              {
+                  const uint32_t n = std::min(block, width - i);
+                  auto src = [&](ColorChannel const & c)
+                  {
+                      return c._data() + size_t(j)*c.rowPitch + size_t(i)*c.stride;
+                  };
+                  detail::channel_copy(ta, 0, 1, src(A), A.offset, A.stride, n);
+                  detail::channel_copy(tb, 0, 1, src(B), B.offset, B.stride, n);
+                  if( T )
+                      detail::channel_copy(tt, 0, 1, src(*T), T->offset, T->stride, n);
+                  detail::fixed_kernel<Op>(to, ta, tb, T ? tt : nullptr, tConst, n);
+                  detail::channel_copy(ptr + size_t(j)*rowPitch + size_t(i)*stride, offset, stride, to, 0, 1, n);
+              }
+          }
+          return true;
+      }
+
+      template<typename Op>
+      bool _assignKernel(ColorChannel const & A, ColorChannel const & B, ColorChannel const * T, float tConst, float k)
+      {
+          // planar images and single channel images
+          auto isPlane = [this](ColorChannel const & c)
+          {
+              return c.stride == 1 && c.width == width && c.height == height;
+          };
+          if( isPlane(*this) && isPlane(A) && isPlane(B) && (!T || isPlane(*T)) )
+          {
+              if( _isPacked() && A._isPacked() && B._isPacked() && (!T || T->_isPacked()) )
+              {
+                  detail::channel_kernel_planar<Op>( ptr + offset, A._data() + A.offset, B._data() + B.offset,
+                                                     T ? T->_data() + T->offset : nullptr, tConst, k,
+                                                     size_t(width) * size_t(height) );
+                  return true;
+              }
+              for(uint32_t j = 0; j < height; j++)
+              {
+                  detail::channel_kernel_planar<Op>( ptr + size_t(j)*rowPitch + offset,
+                                                     A._data() + size_t(j)*A.rowPitch + A.offset,
+                                                     B._data() + size_t(j)*B.rowPitch + B.offset,
+                                                     T ? T->_data() + size_t(j)*T->rowPitch + T->offset : nullptr,
+                                                     tConst, k, width );
+              }
+              return true;
+          }
+
+          auto isRGBA = [this](ColorChannel const & c)
+          {
+              return c.stride == 4 && c.width == width && c.height == height;
+          };
+          if( !isRGBA(*this) || !isRGBA(A) || !isRGBA(B) || (T && !isRGBA(*T)) )
+          {
+              return false;
+          }
+
+          if( _isPacked() && A._isPacked() && B._isPacked() && (!T || T->_isPacked()) )
+          {
+              detail::rgba_channel t;
+              if( T )
+              {
+                  t = {T->_data(), T->offset};
+              }
+              detail::channel_kernel<Op>( ptr, offset,
+                                          {A._data(), A.offset},
+                                          {B._data(), B.offset},
+                                          t, tConst, k,
+                                          size_t(width) * size_t(height) );
+              return true;
+          }
+
+          // one of the channels is part of an ImageView, run the kernel row by row
+          for(uint32_t j = 0; j < height; j++)
+          {
+              detail::rgba_channel t;
+              if( T )
+              {
+                  t = {T->_data() + size_t(j)*T->rowPitch, T->offset};
+              }
+              detail::channel_kernel<Op>( ptr + size_t(j)*rowPitch, offset,
+                                          {A._data() + size_t(j)*A.rowPitch, A.offset},
+                                          {B._data() + size_t(j)*B.rowPitch, B.offset},
+                                          t, tConst, k, width );
+          }
+          return true;
+      }
+
+      /**
+       * @brief eval
+       * @param u
+       * @param v
+       * @return
+       *
+       * Returns the value of the pixel as a float in the range 0-1
+       */
+      float eval(uint32_t u, uint32_t v) const
+      {
+          return static_cast<float>( (*this)(u,v) ) * (1.0f / 255.0f);
+      }
+
+      template<typename Callable_t>
+      void apply( Callable_t C)
+      {
+          _prepareWrite();
+          _applyRows(C, 0, height);
+      }
+
+      /**
+       * @brief apply
+       * @param pool
+       * @param C
+       *
+       * Same as apply(C), but the rows of the channel are split into bands
+       * which are evaluated on the thread pool. The callable is shared
+       * between the threads so it must be safe to call concurrently.
+       *
+       * Each pixel only depends on its own coordinates so the output is
+       * identical to the single threaded version.
+       */
+      template<typename Callable_t>
+      void apply( thread_pool & pool, Callable_t C)
+      {
+          _prepareWrite();
+          pool.parallel_for(0, height, [this, &C](size_t v0, size_t v1)
+          {
+              _applyRows(C, static_cast<uint32_t>(v0), static_cast<uint32_t>(v1));
+          });
+      }
+
+      template<typename Callable_t>
+      void _applyRows( Callable_t & C, uint32_t v0, uint32_t v1)
+      {
+          float sw = 1.0f / float(width);
+          float sh = 1.0f / float(height);
+
+          for(uint32_t v = v0; v < v1; ++v)
+          for(uint32_t u = 0; u < width; ++u)
+          {
+              float x = static_cast<float>(u) * sw;
+              float y = static_cast<float>(v) * sh;
+
+              _at(u,v) =  static_cast<uint8_t>( C(x,y) * 255);
+          }
+      }
+
+      template<typename Callable_t, typename = typename std::enable_if< !is_channel_expr<Callable_t>::value >::type>
+      ColorChannel& operator=( Callable_t C )
+      {
+          apply(C);
+          return *this;
+      }
+
+      uint32_t getWidth() const
+      {
+          return width;
+      }
+      uint32_t getHeight() const
+      {
+          return height;
+      }
+      uint32_t getStride() const
+      {
+          return stride;
+      }
+      uint32_t getRowPitch() const
+      {
+          return rowPitch;
+      }
+      /**
+       * @brief _prepareWrite
+       *
+       * If the channel belongs to an Image whose pixels are shared through
+       * copy-on-write, the image is given its own copy of the pixels and
+       * the channel is pointed at it. Called before every write.
+       */
+      void _prepareWrite();
+
+    private:
+      uint32_t  width = 0;
+      uint32_t  height= 0;
+      uint8_t   *ptr =nullptr;
+      std::shared_ptr<detail::pixel_anchor> m_anchor; // set for the channels of copy-on-write images
+
+      friend class Image;
+};
+
+
+/**
+ * @brief The ChannelRaw struct
+ *
+ * Evaluates a ColorChannel without normalizing it, ie: in the range 0-255.
+ * Used by the operators which combine the raw values of two channels
+ * before scaling them.
+ */
+struct ChannelRaw : public ChannelExpr<ChannelRaw>
+{
+    ColorChannel const & channel;
+
+    explicit ChannelRaw(ColorChannel const & c) : channel(c)
+    {
+    }
+    float eval(uint32_t u, uint32_t v) const
+    {
+        return static_cast<float>( channel(u,v) );
+    }
+    uint32_t getWidth() const
+    {
+        return channel.getWidth();
+    }
+    uint32_t getHeight() const
+    {
+        return channel.getHeight();
+    }
+};
+
+inline bool ColorChannel::_assignFast( ChannelSumExpr const & e)
+{
+    return _assignKernel<detail::channel_op_sum>( e.lhs.lhs.channel, e.lhs.rhs.channel, nullptr, 0.0f, e.rhs.value );
+}
+inline bool ColorChannel::_assignFast( ChannelProductExpr const & e)
+{
+    return _assignKernel<detail::channel_op_product>( e.lhs.lhs.channel, e.lhs.rhs.channel, nullptr, 0.0f, e.rhs.value );
+}
+inline bool ColorChannel::_assignFast( ChannelMixExpr const & e)
+{
+    return _assignKernel<detail::channel_op_mix>( e.lhs.a.channel, e.lhs.b.channel, nullptr, e.lhs.t.value, e.rhs.value );
+}
+inline bool ColorChannel::_assignFast( ChannelMixChannelExpr const & e)
+{
+    return _assignKernel<detail::channel_op_mix>( e.lhs.a.channel, e.lhs.b.channel, &e.lhs.t, 0.0f, e.rhs.value );
+}
+
+// (a + b) / 255
+inline ChannelSumExpr operator + (ColorChannel const & a, ColorChannel const & b)
+{
+    return { {ChannelRaw(a), ChannelRaw(b)}, ChannelScalar(1.0f / 255.0f) };
+}
+
+// (a * b) / (255*255)
+inline ChannelProductExpr operator * (ColorChannel const & a, ColorChannel const & b)
+{
+    return { {ChannelRaw(a), ChannelRaw(b)}, ChannelScalar(1.0f / (255.0f*255.0f)) };
+}
+
+template<typename A, typename B>
+ChannelBinaryExpr<A,B,expr_add> operator + (ChannelExpr<A> const & a, ChannelExpr<B> const & b)
+{
+    return {a.self(), b.self()};
+}
+template<typename A>
+ChannelBinaryExpr<A,ChannelScalar,expr_add> operator + (ChannelExpr<A> const & a, float b)
+{
+    return {a.self(), ChannelScalar(b)};
+}
+template<typename A>
+ChannelBinaryExpr<A,ChannelScalar,expr_add> operator + (float b, ChannelExpr<A> const & a)
+{
+    return {a.self(), ChannelScalar(b)};
+}
+
+template<typename A, typename B>
+ChannelBinaryExpr<A,B,expr_sub> operator - (ChannelExpr<A> const & a, ChannelExpr<B> const & b)
+{
+    return {a.self(), b.self()};
+}
+template<typename A>
+ChannelBinaryExpr<A,ChannelScalar,expr_add> operator - (ChannelExpr<A> const & a, float b)
+{
+    return {a.self(), ChannelScalar(-b)};
+}
+template<typename A>
+ChannelBinaryExpr<ChannelScalar,A,expr_sub> operator - (float b, ChannelExpr<A> const & a)
+{
+    return {ChannelScalar(b), a.self()};
+}
+
+template<typename A, typename B>
+ChannelBinaryExpr<A,B,expr_mul> operator * (ChannelExpr<A> const & a, ChannelExpr<B> const & b)
+{
+    return {a.self(), b.self()};
+}
+template<typename A>
+ChannelBinaryExpr<A,ChannelScalar,expr_mul> operator * (ChannelExpr<A> const & a, float b)
+{
+    return {a.self(), ChannelScalar(b)};
+}
+template<typename A>
+ChannelBinaryExpr<A,ChannelScalar,expr_mul> operator * (float b, ChannelExpr<A> const & a)
+{
+    return {a.self(), ChannelScalar(b)};
+}
+
+// the same operators with a temporary channel1f as one of the operands
+template<typename A, typename B, typename = enable_if_temp_operand<A,B> >
+ChannelBinaryExpr<expr_operand_t<A>,expr_operand_t<B>,expr_add> operator + (A && a, B && b)
+{
+    return {expr_operand( std::forward<A>(a) ), expr_operand( std::forward<B>(b) )};
+}
+inline ChannelBinaryExpr<ChannelValue,ChannelScalar,expr_add> operator + (channel1f && a, float b)
+{
+    return {ChannelValue( std::move(a) ), ChannelScalar(b)};
+}
+inline ChannelBinaryExpr<ChannelValue,ChannelScalar,expr_add> operator + (float b, channel1f && a)
+{
+    return {ChannelValue( std::move(a) ), ChannelScalar(b)};
+}
+
+template<typename A, typename B, typename = enable_if_temp_operand<A,B> >
+ChannelBinaryExpr<expr_operand_t<A>,expr_operand_t<B>,expr_sub> operator - (A && a, B && b)
+{
+    return {expr_operand( std::forward<A>(a) ), expr_operand( std::forward<B>(b) )};
+}
+inline ChannelBinaryExpr<ChannelValue,ChannelScalar,expr_add> operator - (channel1f && a, float b)
+{
+    return {ChannelValue( std::move(a) ), ChannelScalar(-b)};
+}
+inline ChannelBinaryExpr<ChannelScalar,ChannelValue,expr_sub> operator - (float b, channel1f && a)
+{
+    return {ChannelScalar(b), ChannelValue( std::move(a) )};
+}
+
+template<typename A, typename B, typename = enable_if_temp_operand<A,B> >
+ChannelBinaryExpr<expr_operand_t<A>,expr_operand_t<B>,expr_mul> operator * (A && a, B && b)
+{
+    return {expr_operand( std::forward<A>(a) ), expr_operand( std::forward<B>(b) )};
+}
+inline ChannelBinaryExpr<ChannelValue,ChannelScalar,expr_mul> operator * (channel1f && a, float b)
+{
+    return {ChannelValue( std::move(a) ), ChannelScalar(b)};
+}
+inline ChannelBinaryExpr<ChannelValue,ChannelScalar,expr_mul> operator * (float b, channel1f && a)
+{
+    return {ChannelValue( std::move(a) ), ChannelScalar(b)};
+}
+
+/**
+ * @brief The ChannelFixedExpr struct
+ *
+ * Wraps one of the channel expressions a + b, a * b, mix(a,b,t) and
+ * mix(a,b,c) so that it is evaluated with 8-bit fixed point integers
+ * instead of floats, see fixedPoint().
+ */
+template<typename E>
+struct ChannelFixedExpr : public ChannelExpr< ChannelFixedExpr<E> >
+{
+    E expr;
+
+    explicit ChannelFixedExpr(E const & e) : expr(e)
+    {
+    }
+    float eval(uint32_t u, uint32_t v) const
+    {
+        return static_cast<float>( evalFixed(u,v) ) * (1.0f / 255.0f);
+    }
+    uint8_t evalFixed(uint32_t u, uint32_t v) const;
+
+    uint32_t getWidth() const
+    {
+        return expr.getWidth();
+    }
+    uint32_t getHeight() const
+    {
+        return expr.getHeight();
+    }
+};
+
+namespace detail
+{
+// the interpolation value of mix(a,b,t) in 1/255 steps
+inline uint8_t fixed_t(float t)
+{
+    return clamp_u8( t * 255.0f + 0.5f );
+}
+}
+
+template<>
+inline uint8_t ChannelFixedExpr<ChannelSumExpr>::evalFixed(uint32_t u, uint32_t v) const
+{
+    return detail::fixed_op_sum::apply( expr.lhs.lhs.channel(u,v), expr.lhs.rhs.channel(u,v), 0 );
+}
+template<>
+inline uint8_t ChannelFixedExpr<ChannelProductExpr>::evalFixed(uint32_t u, uint32_t v) const
+{
+    return detail::fixed_op_product::apply( expr.lhs.lhs.channel(u,v), expr.lhs.rhs.channel(u,v), 0 );
+}
+template<>
+inline uint8_t ChannelFixedExpr<ChannelMixExpr>::evalFixed(uint32_t u, uint32_t v) const
+{
+    return detail::fixed_op_mix::apply( expr.lhs.a.channel(u,v), expr.lhs.b.channel(u,v), detail::fixed_t(expr.lhs.t.value) );
+}
+template<>
+inline uint8_t ChannelFixedExpr<ChannelMixChannelExpr>::evalFixed(uint32_t u, uint32_t v) const
+{
+    return detail::fixed_op_mix::apply( expr.lhs.a.channel(u,v), expr.lhs.b.channel(u,v), expr.lhs.t(u,v) );
+}
+
+/**
+ * @brief fixedPoint
+ * @param e
+ * @return
+ *
+ * Evaluates a sum, product or mix of 8-bit channels with integer math
+ * instead of floats. 16 (SSE2) or 32 (AVX2) channel values are
+ * processed per instruction, eg:
+ *
+ *     I.a = gul::fixedPoint( I.r * I.g );
+ *     I.r = gul::fixedPoint( mix(I.r, J.r, K.a) );
+ *
+ * The results are rounded to the nearest value, while the float path
+ * truncates:
+ *
+ *     a + b         -> min(a+b, 255)
+ *     a * b         -> round(a*b/255)
+ *     mix(a, b, t)  -> round((a*(255-T) + b*T)/255), T = round(t*255)
+ *     mix(a, b, c)  -> the same with T = c
+ */
+inline ChannelFixedExpr<ChannelSumExpr> fixedPoint(ChannelSumExpr const & e)
+{
+    return ChannelFixedExpr<ChannelSumExpr>(e);
+}
+inline ChannelFixedExpr<ChannelProductExpr> fixedPoint(ChannelProductExpr const & e)
+{
+    return ChannelFixedExpr<ChannelProductExpr>(e);
+}
+inline ChannelFixedExpr<ChannelMixExpr> fixedPoint(ChannelMixExpr const & e)
+{
+    return ChannelFixedExpr<ChannelMixExpr>(e);
+}
+inline ChannelFixedExpr<ChannelMixChannelExpr> fixedPoint(ChannelMixChannelExpr const & e)
+{
+    return ChannelFixedExpr<ChannelMixChannelExpr>(e);
+}
+
+template<typename E>
+inline bool ColorChannel::_assignFast( ChannelFixedExpr<E> const & )
+{
+    return false;
+}
+template<>
+inline bool ColorChannel::_assignFast( ChannelFixedExpr<ChannelSumExpr> const & e)
+{
+    return _assignFixed<detail::fixed_op_sum>( e.expr.lhs.lhs.channel, e.expr.lhs.rhs.channel, nullptr, 0 );
+}
+template<>
+inline bool ColorChannel::_assignFast( ChannelFixedExpr<ChannelProductExpr> const & e)
+{
+    return _assignFixed<detail::fixed_op_product>( e.expr.lhs.lhs.channel, e.expr.lhs.rhs.channel, nullptr, 0 );
+}
+template<>
+inline bool ColorChannel::_assignFast( ChannelFixedExpr<ChannelMixExpr> const & e)
+{
+    return _assignFixed<detail::fixed_op_mix>( e.expr.lhs.a.channel, e.expr.lhs.b.channel, nullptr, detail::fixed_t(e.expr.lhs.t.value) );
+}
+template<>
+inline bool ColorChannel::_assignFast( ChannelFixedExpr<ChannelMixChannelExpr> const & e)
+{
+    return _assignFixed<detail::fixed_op_mix>( e.expr.lhs.a.channel, e.expr.lhs.b.channel, &e.expr.lhs.t, 0 );
+}
+
+/**
+ * @brief The ImageFilter enum
+ *
+ * The reconstruction filters used when downsampling or resizing an image.
+ */
+enum class ImageFilter
+{
+    Box,       // averages the pixels covered by the output pixel
+    Kaiser,    // Kaiser windowed sinc, 3 lobes, alpha=4
+    Lanczos3,  // Lanczos windowed sinc, 3 lobes
+    Bilinear,  // triangle filter
+    Bicubic,   // Catmull-Rom cubic, B=0 C=0.5
+    Mitchell   // Mitchell-Netravali cubic, B=C=1/3
+};
+
+template<typename T>
+class ImageView_t;
+
+using ImageView      = ImageView_t<uint8_t>;
+using ConstImageView = ImageView_t<uint8_t const>;
+
+class Image
+{
+public:
+
+    Image() : Image(8,8,4)
+    {
+    }
+    explicit Image(uint32_t w) : Image(w,w,4)
+    {
+    }
+    Image(uint32_t w, uint32_t h, uint32_t ch=4)
+    {
+        resize(w,h,ch);
+    }
+
+    /**
+     * @brief Image
+     * @param other
+     *
+     * Copying an image creates a new buffer, unless other is in
+     * copy-on-write mode (see setCopyOnWrite()), in which case the copy
+     * shares the pixels of other until one of them is modified.
+     *
+     * A view into the storage of an ImageArray/ImageMM is always copied.
+     */
+    Image(const Image & other)
+    {
+        if( other._canShare() )
+        {
+            _share(other);
+            return;
+        }
+        m_planar = other.m_planar;
+        m_cow    = other.m_cow;
+        resize(other.getWidth(), other.getHeight(), other.getChannels());
+        if( m_size )
+            memcpy(m_ptr, other.m_ptr, m_size);
+    }
+
+    /**
+     * @brief Image
+     * @param other
+     *
+     * Takes the pixels of other. Copies of the ColorChannels of other
+     * refer to this image afterwards.
+     */
+    Image(Image && other) :
+        m_buffer( std::move(other.m_buffer) ),
+        m_ptr( other.m_ptr ),
+        m_size( other.m_size ),
+        m_cow( other.m_cow ),
+        m_view( other.m_view ),
+        m_planar( other.m_planar ),
+        m_exclusive( other.m_exclusive.load(std::memory_order_relaxed) ),
+        m_anchor( std::move(other.m_anchor) )
+    {
+        _setChannels( other.getWidth(), other.getHeight(), other.getChannels() );
+        other._release();
+    }
+
+    ~Image()
+    {
+        _dropAnchor();
+    }
+
+    /**
+     * @brief operator =
+     * @param other
+     *
+     * If this image is a view into the storage of an ImageArray/ImageMM
+     * and has the same size as other, the pixels are copied into that
+     * storage, converting them to the layout of the view if other is
+     * planar. Otherwise this follows the same rules as the copy
+     * constructor.
+     */
+    Image& operator=(const Image & other)
+    {
+        if( &other != this)
+        {
+            if( other._canShare() && !m_view )
+            {
+                _share(other);
+                return *this;
+            }
+            if( _isShared() )
+            {
+                _release(); // no point copying pixels which are about to be overwritten
+            }
+            if( !m_view )
+                m_planar = other.m_planar;
+            resize(other.getWidth(), other.getHeight(), other.getChannels());
+            if( m_size )
+                _copyPixels(other);
+        }
+        return *this;
+    }
+    Image& operator=(Image && other)
+    {
+        if( &other != this)
+        {
+            m_buffer = std::move(other.m_buffer);
+            m_ptr    = other.m_ptr;
+            m_size   = other.m_size;
+            m_cow    = other.m_cow;
+            m_view   = other.m_view;
+            m_planar = other.m_planar;
+            m_exclusive = other.m_exclusive.load(std::memory_order_relaxed);
+            _dropAnchor();
+            m_anchor = std::move(other.m_anchor);
+            _setChannels( other.getWidth(), other.getHeight(), other.getChannels() );
+            other._release();
+        }
+        return *this;
+    }
+
+    /**
+     * @brief setCopyOnWrite
+     * @param enable
+     *
+     * In copy-on-write mode, copies of this image share its pixel buffer.
+     * The buffer is only duplicated when one of the images sharing it is
+     * modified, through data(), operator(), a view or one of the
+     * ColorChannels. Copies inherit the mode.
+     *
+     * The ColorChannels (r,g,b,a) of an image always refer to its current
+     * buffer. References to them, and copies of them, remain valid when the
+     * buffer is duplicated or the image is moved. Once the image is
+     * destroyed, copies of its channels no longer refer to any pixels
+     * (see ColorChannel::valid()).
+     *
+     * Note: Images sharing a buffer should not be modified concurrently
+     *       from different threads.
+     */
+    void setCopyOnWrite(bool enable)
+    {
+        if( !enable )
+            _detach();
+        m_cow = enable;
+        _updateAnchor();
+    }
+    bool isCopyOnWrite() const
+    {
+        return m_cow;
+    }
+
+    /**
+     * @brief isShared
+     * @return
+     *
+     * Returns true if the pixels are shared with another image
+     * through copy-on-write.
+     */
+    bool isShared() const
+    {
+        return _isShared();
+    }
+
+    /**
+     * @brief setPlanar
+     * @param enable
+     *
+     * Converts the pixels between the interleaved layout (rgbargba...),
+     * the default, and the planar layout, where each channel is stored
+     * contiguously (rrr...ggg...bbb...aaa...). In the planar layout the
+     * ColorChannels have a stride of 1, so the channel operators,
+     * eg: I.r = I.g * I.b, run at full vector width.
+     *
+     * operator(), the ColorChannels, nextMipMap(), resized(), mix() and
+     * copying between images work in both layouts. A ConstImageView of a
+     * planar image reads an interleaved copy, so the functions which take
+     * one accept planar images, creating a mutable ImageView of a planar
+     * image throws std::logic_error. ImageMM::generateMipMaps()
+     * gives the levels the layout of the base level. Images which are
+     * views into the single buffer of a contiguous ImageArray/ImageMM are
+     * always interleaved, enabling the planar layout on one of them throws
+     * std::logic_error.
+     */
+    void setPlanar(bool enable)
+    {
+        if( enable == m_planar )
+            return;
+        if( m_view )
+            throw std::logic_error("The images of a contiguous ImageArray/ImageMM are always interleaved");
+        if( enable )
+            _checkPlanarSize(m_width, m_height, m_channels);
+        const size_t n = size_t(m_width) * m_height;
+        if( m_size )
+        {
+            // convert into a new buffer, any copies sharing the old one keep it
+            auto buffer = buffer_pool::global().allocate_shared(m_size);
+            if( enable )
+                detail::deinterleave(m_ptr, n, m_channels, buffer.get());
+            else
+                detail::interleave(m_ptr, n, m_channels, buffer.get());
+            m_buffer = std::move(buffer);
+            m_ptr    = m_buffer.get();
+            m_exclusive = true;
+        }
+        m_planar = enable;
+        _setChannels(m_width, m_height, m_channels);
+    }
+    bool isPlanar() const
+    {
+        return m_planar;
+    }
+
+    /**
+     * @brief _checkPlanarSize
+     *
+     * The ColorChannels address the planes with 32 bit offsets, throws
+     * std::length_error if the image does not fit in 4 GB.
+     */
+    static void _checkPlanarSize(uint32_t w, uint32_t h, uint32_t channels)
+    {
+        if( size_t(w) * h * channels > UINT32_MAX )
+            throw std::length_error("Planar images must be smaller than 4 GB");
+    }
+
+    /**
+     * @brief _copyPixels
+     * @param other
+     *
+     * Copies the pixels of an image of the same size, converting them
+     * to the layout of this image.
+     */
+    void _copyPixels(Image const & other)
+    {
+        const size_t n = size_t(m_width) * m_height;
+        if( m_planar == other.m_planar )
+            memcpy(m_ptr, other.m_ptr, m_size);
+        else if( m_planar )
+            detail::deinterleave(other.m_ptr, n, m_channels, m_ptr);
+        else
+            detail::interleave(other.m_ptr, n, m_channels, m_ptr);
+    }
+
+    bool _canShare() const
+    {
+        return m_cow && !m_view && m_buffer;
+    }
+
+    bool _isShared() const
+    {
+        return m_cow && !m_view && m_buffer.use_count() > 1;
+    }
+
+    void _share(Image const & other)
+    {
+        other.m_exclusive = false;
+        m_exclusive       = false;
+        m_buffer = other.m_buffer;
+        m_ptr    = other.m_ptr;
+        m_size   = other.m_size;
+        m_cow    = true;
+        m_view   = false;
+        m_planar = other.m_planar;
+        _setChannels( other.getWidth(), other.getHeight(), other.getChannels() );
+    }
+
+    /**
+     * @brief _detach
+     *
+     * Gives the image its own copy of the pixels if the buffer is
+     * shared with another image.
+     */
+    void _detach()
+    {
+        if( _isShared() )
+        {
+            auto buffer = buffer_pool::global().allocate_shared(m_size);
+            memcpy(buffer.get(), m_ptr, m_size);
+            m_buffer = std::move(buffer);
+            m_ptr    = m_buffer.get();
+            _setChannels(m_width, m_height, m_channels);
+        }
+        m_exclusive = true;
+    }
+
+    /**
+     * @brief _mutableData
+     * @return
+     *
+     * Returns the pixels for writing, detaching them first if needed.
+     * Only the first write after the buffer was shared has to check the
+     * reference count.
+     */
+    uint8_t * _mutableData()
+    {
+        if( !m_exclusive.load(std::memory_order_relaxed) )
+            _detach();
+        return m_ptr;
+    }
+
+    /**
+     * @brief _updateAnchor
+     *
+     * Points the anchor shared with copies of the ColorChannels at the
+     * current pixels. The anchor is created the first time a copy-on-write
+     * image has pixels.
+     */
+    void _updateAnchor()
+    {
+        if( m_cow && m_ptr && !m_anchor )
+            m_anchor = std::make_shared<detail::pixel_anchor>();
+        if( m_anchor )
+        {
+            m_anchor->ptr   = m_ptr;
+            m_anchor->owner = this;
+        }
+        r.m_anchor = g.m_anchor = b.m_anchor = a.m_anchor = m_anchor;
+    }
+
+    /**
+     * @brief _dropAnchor
+     *
+     * Called when the pixels of the image go away, copies of its
+     * ColorChannels no longer refer to anything.
+     */
+    void _dropAnchor()
+    {
+        if( m_anchor )
+        {
+            m_anchor->ptr   = nullptr;
+            m_anchor->owner = nullptr;
+            m_anchor.reset();
+        }
+    }
+
+    void resize(uint32_t w, uint32_t h, uint32_t channels=4)
+    {
+        assert( channels <= 4);
+        if( m_planar )
+            _checkPlanarSize(w, h, channels);
+        auto n = static_cast<size_t>(w)*h*channels;
+        if( n != m_size )
+        {
+            _reallocate(n);
+        }
+
+        m_channels = channels;
+
+        _setChannels(w,h,channels);
+    }
+
+    /**
+     * @brief _reallocate
+     * @param n
+     *
+     * Moves the image into a newly allocated, zeroed buffer of n bytes,
+     * keeping the first min(n,size()) bytes, the same as std::vector::resize.
+     * If the image was a view into shared storage it is detached from it.
+     * The buffer is taken from buffer_pool::global().
+     */
+    void _reallocate(size_t n)
+    {
+        std::shared_ptr<uint8_t> buffer;
+        if( n )
+        {
+            buffer = buffer_pool::global().allocate_shared(n);
+            const size_t k = m_ptr ? std::min(n, m_size) : 0;
+            if( k )
+                memcpy(buffer.get(), m_ptr, k);
+            memset(buffer.get() + k, 0, n - k);
+        }
+        m_buffer = std::move(buffer);
+        m_ptr    = m_buffer.get();
+        m_size   = n;
+        m_view   = false;
+        m_exclusive = true;
+    }
+
+    /**
+     * @brief _setStorage
+     * @param buffer
+     * @param ptr
+     *
+     * Turns the image into a view of w*h*ch bytes starting at ptr. The
+     * memory must be kept alive by buffer, eg: the single block allocated
+     * by ImageArray::allocateContiguous(). The current pixels are not copied.
+     */
+    void _setStorage(std::shared_ptr<uint8_t> const & buffer, uint8_t * ptr, uint32_t w, uint32_t h, uint32_t ch)
+    {
+        assert( ch <= 4);
+        m_buffer = std::shared_ptr<uint8_t>(buffer, ptr);
+        m_ptr    = ptr;
+        m_size   = static_cast<size_t>(w)*h*ch;
+        m_view   = true;
+        m_planar = false;
+        m_exclusive = true;
+        _setChannels(w,h,ch);
+    }
+
+    void _release()
+    {
+        m_buffer.reset();
+        m_ptr  = nullptr;
+        m_size = 0;
+        m_view = false;
+        m_planar = false;
+        m_exclusive = true;
+        _setChannels(0,0,0);
+    }
+
+    void _setChannels(uint32_t width, uint32_t height, uint32_t channels)
+    {
+        //assert( channels <= 4 && channels >= 1);
+        m_channels = channels;
+        m_width = width;
+        m_height = height;
+        if( m_planar )
+        {
+            // channel c is the plane starting at byte c*width*height, which
+            // _checkPlanarSize() has made sure fits the 32 bit offsets
+            const size_t   n = size_t(width) * height;
+            const uint32_t last = channels ? channels - 1 : 0;
+            auto plane = [n](uint32_t c) { return static_cast<uint32_t>(c * n); };
+            r.reset( m_ptr, 0,                          1, width, height);
+            g.reset( m_ptr, plane(std::min(1u, last)), 1, width, height);
+            b.reset( m_ptr, plane(std::min(2u, last)), 1, width, height);
+            a.reset( m_ptr, plane(last),               1, width, height);
+            _updateAnchor();
+            return;
+        }
+        if( channels == 4)
+        {
+            a.reset( m_ptr, 3, 4, width, height);
+            b.reset( m_ptr, 2, 4, width, height);
+            g.reset( m_ptr, 1, 4, width, height);
+            r.reset( m_ptr, 0, 4, width, height);
+        }
+        if( channels == 3)
+        {
+            a.reset( m_ptr, 2, 3, width, height);
+            b.reset( m_ptr, 2, 3, width, height);
+            g.reset( m_ptr, 1, 3, width, height);
+            r.reset( m_ptr, 0, 3, width, height);
+        }
+        if( channels == 2)
+        {
+            a.reset( m_ptr, 1, 2, width, height);
+            b.reset( m_ptr, 1, 2, width, height);
+            g.reset( m_ptr, 1, 2, width, height);
+            r.reset( m_ptr, 0, 2, width, height);
+        }
+        if( channels == 1)
+        {
+            a.reset( m_ptr, 0, 1, width, height);
+            b.reset( m_ptr, 0, 1, width, height);
+            g.reset( m_ptr, 0, 1, width, height);
+            r.reset( m_ptr, 0, 1, width, height);
+        }
+        if( channels == 0)
+        {
+            a.reset( m_ptr, 0, 0, width, height);
+            b.reset( m_ptr, 0, 0, width, height);
+            g.reset( m_ptr, 0, 0, width, height);
+            r.reset( m_ptr, 0, 0, width, height);
+        }
+        _updateAnchor();
+    }
+
+    /**
+     * @brief copyFromBuffer
+     *
+     * Copies interleaved pixels into the image. A planar image is switched
+     * back to the interleaved layout first, its old pixels are discarded.
+     */
+    void copyFromBuffer(void const * src, uint32_t totalBytes, uint32_t width, uint32_t height, uint32_t ch=4)
+    {
+          assert(totalBytes%sizeof(uint32_t)==0);
+
+          m_planar = false;
+          resize(width,height,ch);
+          memcpy(data(), src, totalBytes);
+    }
+
+    /**
+     * @brief Image
+     * @param V
+     *
+     * Copies the pixels of a view into a new image.
+     */
+    explicit Image(ConstImageView const & V);
+
+    /**
+     * @brief view
+     * @return
+     *
+     * Returns a non-owning view of the whole image. The view is
+     * invalidated if the image is resized or destroyed.
+     */
+    ImageView      view();
+    ConstImageView view() const;
+
+    /**
+     * @brief view
+     * @return
+     *
+     * Returns a non-owning view of the w x h rectangle starting at
+     * pixel (x,y).
+     */
+    ImageView      view(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+    ConstImageView view(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const;
+
+    uint8_t & operator()(uint32_t u, uint32_t v, uint32_t c)
+    {
+        return _mutableData()[ _index(u,v,c) ] ;//r.ptr[v*r.width+u];
+    }
+    uint8_t const & operator()(uint32_t u, uint32_t v, uint32_t c) const
+    {
+        return m_ptr[ _index(u,v,c) ] ;//r.ptr[v*r.width+u];
+    }
+    size_t _index(uint32_t u, uint32_t v, uint32_t c) const
+    {
+        if( m_planar )
+            return (size_t(c)*m_height + v)*m_width + u;
+        return (size_t(v)*m_width + u)*m_channels + c;
+    }
+    ColorChannel& operator[](size_t i)
+    {
+        return (&r)[i];
+    }
+    ColorChannel const& operator[](size_t i) const
+    {
+        return (&r)[i];
+    }
+    /**
+     * @brief sample
+     * @param u
+     * @param v
+     * @return
+     *
+     * Samples a 2x2 block of pixels and returns the average. really only used for
+     * the nextMipMap() method.
+     */
+    uint8_t sample(uint32_t u, uint32_t v, uint32_t c) const
+    {
+        auto & R = *this;
+
+        auto c1 = R(u,v    ,c);
+        auto c2 = R(u,v+1  ,c);
+        auto c3 = R(u+1,v  ,c);
+        auto c4 = R(u+1,v+1,c);
+
+        return  static_cast<uint8_t>( (static_cast<uint32_t>(c1) + static_cast<uint32_t>(c2) + static_cast<uint32_t>(c3) + static_cast<uint32_t>(c4) ) / 4u);
+    }
+
+    /**
+     * @brief nextMipMap
+     * @return
+     *
+     * Returns the next mipmap level of the image. The next mipmap level has
+     * width and height which is half the original.
+     */
+    Image nextMipMap() const
+    {
+        Image out;
+        nextMipMap(out);
+        return out;
+    }
+
+    /**
+     * @brief nextMipMap
+     * @param out
+     *
+     * Writes the next mipmap level into out, resizing it if required.
+     * Odd dimensions are filtered with a 3-tap box filter so that no
+     * row/column of the source image is dropped.
+     */
+    void nextMipMap(Image & out) const
+    {
+        if( out.getWidth()    != getWidth()/2  ||
+            out.getHeight()   != getHeight()/2 ||
+            out.getChannels() != getChannels() ||
+            out.isPlanar()    != isPlanar() )
+        {
+            if( !out.m_view )
+                out.m_planar = m_planar;
+            out.resize( getWidth()/2, getHeight()/2, getChannels());
+        }
+        _nextMipMapRows(out, 0, out.getHeight());
+    }
+
+    void _nextMipMapRows(Image & out, uint32_t row0, uint32_t row1) const
+    {
+        assert( out.isPlanar() == isPlanar() );
+        if( m_planar )
+        {
+            // each plane is a single channel image
+            const size_t n  = size_t(getWidth()) * getHeight();
+            const size_t dn = size_t(out.getWidth()) * out.getHeight();
+            for(uint32_t c = 0; c < getChannels(); c++)
+            {
+                detail::downsample_box( m_ptr + c*n, getWidth(), getHeight(), 1,
+                                        static_cast<uint8_t*>(out.data()) + c*dn, row0, row1);
+            }
+            return;
+        }
+        detail::downsample_box( static_cast<uint8_t const*>(data()), getWidth(), getHeight(), getChannels(),
+                                static_cast<uint8_t*>(out.data()), row0, row1);
+    }
+
+    /**
+     * @brief resized
+     * @param w
+     * @param h
+     * @param filter
+     * @return
+     *
+     * Returns the image resampled to w x h pixels. Box averages the covered
+     * pixels when shrinking and picks the nearest pixel when enlarging.
+     */
+    Image resized(uint32_t w, uint32_t h, ImageFilter filter = ImageFilter::Mitchell) const;
+
+    /**
+     * @brief resized
+     * @param pool
+     * @param w
+     * @param h
+     * @param filter
+     * @return
+     *
+     * Same as resized(w,h,filter), but the output rows are computed on the
+     * thread pool. The result is identical.
+     */
+    Image resized(thread_pool & pool, uint32_t w, uint32_t h, ImageFilter filter = ImageFilter::Mitchell) const;
+
+    Image allocateNextMipMap() const
+    {
+        Image out;
+        out.m_planar = m_planar;
+        out.resize( getWidth()/2, getHeight()/2, getChannels());
+        return out;
+    }
+
+    void const* data() const
+    {
+        return m_ptr;
+    }
+    void * data()
+    {
+        return _mutableData();
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    size_t byteSize() const
+    {
+        return m_size;
+    }
 
-      channel1f operator*( ColorChannel const & other) const
-      {
-          channel1f R(width,height);
+    uint32_t width() const
+    {
+        return m_width;
+    }
+    uint32_t height() const
+    {
+        return m_height;
+    }
 
-          auto & b1 = *this;
-          auto & b2 = other;
+    uint32_t getWidth() const
+    {
+        return m_width;
+    }
+    uint32_t getHeight() const
+    {
+        return m_height;
+    }
+    uint32_t getChannels() const
+    {
+        return m_channels;
+    }
 
-          const float sc = 1.0f / (255.0f*255.0f);
+    void clear()
+    {
+        _release();
+    }
+public:
 
-          for(uint32_t j = 0; j < getHeight(); j++)
-          {
-                for(uint32_t i = 0; i < getWidth(); i++)
-                {
-                    R(i,j) = ( static_cast<float>( b1(i,j) ) * static_cast<float>(b2(i,j))) * sc;
-                }
-          }
+    /**
+     * @brief hash
+     * @return
+     *
+     * Returns a 64-bit hash of the dimensions and all the bytes of the
+     * image, as they are stored: a planar image does not have the same
+     * hash as its interleaved copy. See hash64_stream.
+     */
+    uint64_t hash() const
+    {
+        auto H = hashStream( getWidth(), getHeight(), getChannels() );
+        H.update( data(), size() );
+        return H.digest();
+    }
 
-          return R;
-      }
+    /**
+     * @brief hashStream
+     * @return
+     *
+     * Returns a hash stream for an image of the given size which has not
+     * been loaded yet. Adding all the pixel data to the stream, in as many
+     * chunks as needed, gives the same value as Image::hash(), eg:
+     *
+     *     auto H = Image::hashStream(w,h,4);
+     *     while( auto n = file.read(chunk) )
+     *         H.update(chunk, n);
+     *     auto h = H.digest();
+     */
+    static hash64_stream hashStream(uint32_t w, uint32_t h, uint32_t ch)
+    {
+        hash64_stream H;
+        uint32_t header[3] = {w, h, ch};
+        H.update(header, sizeof(header));
+        return H;
+    }
+//#endif
 
-      template<typename Callable_t>
-      void apply( Callable_t C)
-      {
-          float sw = 1.0f / float(width);
-          float sh = 1.0f / float(height);
+    /**
+     * @brief The legacy_bytes class
+     *
+     * The pixels used to be stored in the public std::vector<uint8_t>
+     * m_data. It now stands in for that vector so that code which reads or
+     * writes the bytes through m_data.data(), size(), operator[] or
+     * begin()/end() keeps compiling. It cannot be resized or assigned, use
+     * resize() and copyFromBuffer(). New code should call data() and size().
+     */
+    class legacy_bytes
+    {
+    public:
+        explicit legacy_bytes(Image * owner) : m_owner(owner)
+        {
+        }
+        legacy_bytes(legacy_bytes const &) = delete;
+        legacy_bytes& operator=(legacy_bytes const &) = delete;
 
-          for(uint32_t v = 0; v < height; ++v)
-          for(uint32_t u = 0; u < width; ++u)
-          {
-              float x = static_cast<float>(u) * sw;
-              float y = static_cast<float>(v) * sh;
+        uint8_t * data()
+        {
+            return static_cast<uint8_t*>( m_owner->data() );
+        }
+        uint8_t const * data() const
+        {
+            return static_cast<uint8_t const*>( static_cast<Image const*>(m_owner)->data() );
+        }
+        size_t size() const
+        {
+            return m_owner->size();
+        }
+        bool empty() const
+        {
+            return size() == 0;
+        }
+        uint8_t & operator[](size_t i)
+        {
+            return data()[i];
+        }
+        uint8_t const & operator[](size_t i) const
+        {
+            return data()[i];
+        }
+        uint8_t * begin()
+        {
+            return data();
+        }
+        uint8_t * end()
+        {
+            return data() + size();
+        }
+        uint8_t const * begin() const
+        {
+            return data();
+        }
+        uint8_t const * end() const
+        {
+            return data() + size();
+        }
 
-              (*this)(u,v) =  static_cast<uint8_t>( C(x,y) * 255);
-          }
-      }
+    private:
+        Image * m_owner;
+    };
+
+    legacy_bytes             m_data{this};           // see legacy_bytes
+    std::shared_ptr<uint8_t> m_buffer;       // owns, or shares ownership of, the pixels
+    uint8_t *                m_ptr  = nullptr;
+    size_t                   m_size = 0;
+    uint32_t                 m_channels = 0;
+    uint32_t                 m_width    = 0;
+    uint32_t                 m_height   = 0;
+    bool                     m_cow      = false;  // copy-on-write, see setCopyOnWrite()
+    bool                     m_view     = false;  // m_buffer is part of a larger block, see _setStorage()
+    bool                     m_planar   = false;  // each channel is stored contiguously, see setPlanar()
+    mutable std::atomic<bool> m_exclusive = {true}; // the buffer is known not to be shared, see _mutableData()
+    std::shared_ptr<detail::pixel_anchor> m_anchor; // followed by copies of the channels, see _updateAnchor()
+    ColorChannel r;
+    ColorChannel g;
+    ColorChannel b;
+    ColorChannel a;
 
-      template<typename Callable_t>
-      ColorChannel& operator=( Callable_t C )
-      {
-          apply(C);
-          return *this;
-      }
+    /**
+     * @brief X
+     * @param width
+     * @param height
+     * @return
+     *
+     * Returns a oneD_Channel where the value of the channel increases
+     * linearly in the u direction
+     */
+    static channel1f X(uint32_t width, uint32_t height)
+    {
+        channel1f D(width,height);
+        _fillX(D, 0, height);
+        return D;
+    }
 
-      uint32_t getWidth() const
-      {
-          return width;
-      }
-      uint32_t getHeight() const
-      {
-          return height;
-      }
-      uint32_t getStride() const
-      {
-          return stride;
-      }
-    private:
-      uint32_t  width = 0;
-      uint32_t  height= 0;
-      uint8_t   *ptr =nullptr;
+    /**
+     * @brief X
+     * @param pool
+     * @param width
+     * @param height
+     * @return
+     *
+     * Same as X(width,height) but the rows are filled in on the thread pool
+     */
+    static channel1f X(thread_pool & pool, uint32_t width, uint32_t height)
+    {
+        channel1f D(width,height);
+        pool.parallel_for(0, height, [&D](size_t v0, size_t v1)
+        {
+            _fillX(D, static_cast<uint32_t>(v0), static_cast<uint32_t>(v1));
+        });
+        return D;
+    }
 
-      friend class Image;
+    static void _fillX(channel1f & D, uint32_t v0, uint32_t v1)
+    {
+        const auto width = D.getWidth();
+
+        float sc = 1.0f / float(width);
+        for( uint32_t v=v0; v< v1; ++v)
+        {
+            for( uint32_t u=0; u<width; ++u)
+            {
+                float x = static_cast<float>(u) * sc;
+                D(u,v) = x;
+            }
+        }
+    }
+
+    /**
+     * @brief Y
+     * @param width
+     * @param height
+     * @return
+     *
+     * Returns a oneD_Channel where the value of the channel increases
+     * linearly in the v direction
+     */
+    static channel1f Y(uint32_t width, uint32_t height)
+    {
+        channel1f D(width,height);
+        _fillY(D, 0, height);
+        return D;
+    }
+
+    /**
+     * @brief Y
+     * @param pool
+     * @param width
+     * @param height
+     * @return
+     *
+     * Same as Y(width,height) but the rows are filled in on the thread pool
+     */
+    static channel1f Y(thread_pool & pool, uint32_t width, uint32_t height)
+    {
+        channel1f D(width,height);
+        pool.parallel_for(0, height, [&D](size_t v0, size_t v1)
+        {
+            _fillY(D, static_cast<uint32_t>(v0), static_cast<uint32_t>(v1));
+        });
+        return D;
+    }
+
+    static void _fillY(channel1f & D, uint32_t v0, uint32_t v1)
+    {
+        const auto width  = D.getWidth();
+        const auto height = D.getHeight();
+
+        float sc = 1.0f / float(height);
+        for( uint32_t v=v0; v< v1; ++v)
+        {
+            float y = static_cast<float>(v) * sc;
+            for( uint32_t u=0; u<width; ++u)
+            {
+                D(u,v) = y;
+            }
+        }
+    }
 };
 
 
-inline channel1f operator * (ColorChannel const & a, float b)
+
+/**
+ * @brief The ImageView_t class
+ *
+ * A non-owning reference to a w x h rectangle of pixels with interleaved
+ * channels. Rows are getRowPitch() bytes apart, so a view can refer to
+ * a region of a larger image (eg: a tile of an atlas) without copying it.
+ * The memory must outlive the view.
+ *
+ * ImageView can modify the pixels, ConstImageView can only read them.
+ *
+ * A ConstImageView of a planar Image reads an interleaved copy of it,
+ * made when the view is created and kept alive by the view and the views
+ * copied from it. Later changes to the image are not seen by the view.
+ * An ImageView of a planar Image throws std::logic_error.
+ */
+template<typename T>
+class ImageView_t
 {
-    channel1f D( a.getWidth(), a.getHeight());
+public:
+    using value_type   = T;
+    using image_type   = typename std::conditional<std::is_const<T>::value, Image const, Image>::type;
+    using channel_type = ColorChannel;
+
+    ImageView_t()
+    {
+    }
+
+    /**
+     * @brief ImageView_t
+     * @param data
+     * @param w
+     * @param h
+     * @param ch
+     * @param rowPitch - bytes between rows, 0 if the rows are tightly packed
+     */
+    ImageView_t(T * data, uint32_t w, uint32_t h, uint32_t ch=4, size_t rowPitch=0) :
+        m_ptr(data), m_width(w), m_height(h), m_channels(ch),
+        m_rowPitch(rowPitch ? rowPitch : size_t(w)*ch)
+    {
+        assert( ch <= 4 );
+        assert( m_rowPitch >= size_t(w)*ch );
+    }
+
+    ImageView_t(image_type & I) :
+        ImageView_t( static_cast<T*>(I.data()), I.getWidth(), I.getHeight(), I.getChannels())
+    {
+        if( I.isPlanar() )
+        {
+            if constexpr( std::is_const<T>::value )
+            {
+                auto copy = std::make_shared<Image>(I);
+                copy->setPlanar(false);
+                m_ptr  = static_cast<T*>( copy->data() );
+                m_copy = std::move(copy);
+            }
+            else
+            {
+                throw std::logic_error("ImageViews need interleaved pixels, call setPlanar(false) first");
+            }
+        }
+    }
+
+    // ImageView -> ConstImageView
+    template<typename U, typename = typename std::enable_if< std::is_same<T, U const>::value && !std::is_same<T,U>::value >::type>
+    ImageView_t(ImageView_t<U> const & V) :
+        ImageView_t( V.data(), V.getWidth(), V.getHeight(), V.getChannels(), V.getRowPitch())
+    {
+    }
+
+    /**
+     * @brief subView
+     * @return
+     *
+     * Returns a view of the w x h rectangle starting at pixel (x,y)
+     * of this view.
+     */
+    ImageView_t subView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+    {
+        assert( x + w <= m_width && y + h <= m_height );
+        ImageView_t out( m_ptr + size_t(y)*m_rowPitch + size_t(x)*m_channels, w, h, m_channels, m_rowPitch );
+        out.m_copy = m_copy;
+        return out;
+    }
+
+    T * data() const
+    {
+        return m_ptr;
+    }
+    T * row(uint32_t v) const
+    {
+        return m_ptr + size_t(v)*m_rowPitch;
+    }
+    T & operator()(uint32_t u, uint32_t v, uint32_t c) const
+    {
+        return m_ptr[ size_t(v)*m_rowPitch + u*m_channels + c ];
+    }
 
-    auto *Y = &a(0,0);
+    /**
+     * @brief channel
+     * @param c
+     * @return
+     *
+     * Returns channel c as a ColorChannel which can be used in the channel
+     * expressions, eg: V.channel(0) = mix(V.channel(1), W.channel(2), 0.5f).
+     * Like Image, channels past the last one map to the last one.
+     *
+     * Only available on mutable views: a ColorChannel can always be
+     * written to, so a ConstImageView does not hand one out.
+     */
+    template<typename U = T, typename = typename std::enable_if< !std::is_const<U>::value >::type>
+    channel_type channel(uint32_t c) const
+    {
+        assert( m_channels != 0 );
+        return ColorChannel( m_ptr, std::min(c, m_channels-1), m_channels, m_width, m_height,
+                             static_cast<uint32_t>(m_rowPitch) );
+    }
 
-    const float sc = 1.0f/255.0f;
+    uint32_t getWidth() const
+    {
+        return m_width;
+    }
+    uint32_t getHeight() const
+    {
+        return m_height;
+    }
+    uint32_t getChannels() const
+    {
+        return m_channels;
+    }
+    size_t getRowPitch() const
+    {
+        return m_rowPitch;
+    }
+    size_t getRowSize() const
+    {
+        return size_t(m_width) * m_channels;
+    }
 
-    for(auto & v : D.data)
+    /**
+     * @brief isPacked
+     * @return
+     *
+     * Returns true if there are no gaps between the rows.
+     */
+    bool isPacked() const
     {
-        v = sc * *Y * b;
-        Y+=4;
+        return m_rowPitch == getRowSize();
     }
-    return D;
-}
 
-inline channel1f operator * (float b, ColorChannel const & a)
-{
-    return operator*(a,b);
-}
+    /**
+     * @brief copyTo
+     * @param out
+     *
+     * Copies the pixels into another view of the same size.
+     */
+    void copyTo(ImageView_t<uint8_t> const & out) const
+    {
+        _checkShape(out);
+        for(uint32_t j = 0; j < m_height; j++)
+        {
+            memcpy(out.row(j), row(j), getRowSize());
+        }
+    }
 
+    /**
+     * @brief nextMipMap
+     * @param out
+     *
+     * Writes the next mipmap level into out, which must be
+     * getWidth()/2 x getHeight()/2 pixels. See Image::nextMipMap()
+     */
+    void nextMipMap(ImageView_t<uint8_t> const & out) const
+    {
+        if( out.getWidth()    != m_width/2  ||
+            out.getHeight()   != m_height/2 ||
+            out.getChannels() != m_channels )
+        {
+            throw std::logic_error("Output view has the wrong size");
+        }
+        detail::downsample_box( m_ptr, m_width, m_height, m_channels,
+                                out.data(), 0, out.getHeight(),
+                                m_rowPitch, out.getRowPitch() );
+    }
 
+    Image nextMipMap() const;
 
-inline channel1f operator + (ColorChannel const & a, float b)
-{
-    //std::cout << "construct OneChannel+float" << std::endl;
-    channel1f D(a.getWidth(),a.getHeight());
+    /**
+     * @brief hash
+     * @return
+     *
+     * Hashes the pixels in the view. Gives the same value as Image::hash()
+     * on a copy of the view.
+     */
+    uint64_t hash() const
+    {
+        auto H = Image::hashStream(m_width, m_height, m_channels);
+        if( isPacked() )
+        {
+            H.update(m_ptr, getRowSize() * m_height);
+            return H.digest();
+        }
+        for(uint32_t j = 0; j < m_height; j++)
+        {
+            H.update( row(j), getRowSize() );
+        }
+        return H.digest();
+    }
 
-    auto *Y = &a(0,0);
+    template<typename U>
+    void _checkShape(ImageView_t<U> const & o) const
+    {
+        if( o.getWidth() != m_width || o.getHeight() != m_height || o.getChannels() != m_channels )
+        {
+            throw std::logic_error("Images are of different size");
+        }
+    }
 
-    float sc = 1.0f/255.0f;
+private:
+    T *      m_ptr      = nullptr;
+    uint32_t m_width    = 0;
+    uint32_t m_height   = 0;
+    uint32_t m_channels = 0;
+    size_t   m_rowPitch = 0;
+    std::shared_ptr<Image const> m_copy;  // interleaved copy of a planar image
+};
 
-    for(auto & v : D.data)
+inline void ColorChannel::_prepareWrite()
+{
+    if( m_anchor )
     {
-        v = *Y*sc + b;
-        Y+=4;
+        if( m_anchor->owner )
+            m_anchor->owner->_mutableData();
+        ptr = m_anchor->ptr;
     }
-    return D;
 }
 
-
-inline channel1f operator + (float b, ColorChannel const & a )
+inline Image::Image(ConstImageView const & V) : Image(V.getWidth(), V.getHeight(), V.getChannels())
+{
+    V.copyTo( view() );
+}
+inline ImageView Image::view()
+{
+    return ImageView(*this);
+}
+inline ConstImageView Image::view() const
 {
-    return operator+(a,b);
+    return ConstImageView(*this);
+}
+inline ImageView Image::view(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    return view().subView(x,y,w,h);
+}
+inline ConstImageView Image::view(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+{
+    return view().subView(x,y,w,h);
 }
 
+template<typename T>
+Image ImageView_t<T>::nextMipMap() const
+{
+    Image out(m_width/2, m_height/2, m_channels);
+    nextMipMap( out.view() );
+    return out;
+}
 
-inline channel1f&& operator + (channel1f && D, channel1f && E)
+/**
+ * @brief mix
+ * @param a
+ * @param b
+ * @param t
+ * @param out
+ *
+ * Linearly interpolates between two views and writes the result into out.
+ * All the views must be the same size. out may be the same as a or b.
+ */
+inline void mix( ConstImageView const & a, ConstImageView const & b, float t, ImageView const & out)
 {
-    //std::cout << "move OneChannel+OneChannel" << std::endl;
-    auto b = E.data.begin();
-    for(auto & v : D.data)
+    a._checkShape(b);
+    a._checkShape(out);
+    for(uint32_t j = 0; j < out.getHeight(); j++)
     {
-        v += *b++;
+        detail::mix_bytes( a.row(j), b.row(j), t, out.row(j), out.getRowSize() );
     }
-    return std::move(D);
 }
 
-inline channel1f&& operator + (channel1f && D, float b)
+/**
+ * @brief mix
+ * @param a
+ * @param b
+ * @param t
+ * @param out
+ *
+ * Same as above, but each byte is interpolated by the matching
+ * byte of t, ie: a*(1-t/255) + b*t/255
+ */
+inline void mix( ConstImageView const & a, ConstImageView const & b, ConstImageView const & t, ImageView const & out)
 {
-    for(auto & v : D.data)
+    a._checkShape(b);
+    a._checkShape(t);
+    a._checkShape(out);
+    for(uint32_t j = 0; j < out.getHeight(); j++)
     {
-        v += b;
+        detail::mix_bytes( a.row(j), b.row(j), t.row(j), out.row(j), out.getRowSize() );
     }
-    return std::move(D);
 }
 
-inline channel1f&& operator - (channel1f && D, float b)
+inline Image mix( ConstImageView const & a, ConstImageView const & b, float t)
 {
-    return operator+( std::move(D),-b);
+    Image D(a.getWidth(), a.getHeight(), a.getChannels());
+    mix(a, b, t, D.view());
+    return D;
 }
 
+inline Image mix( ConstImageView const & a, ConstImageView const & b, ConstImageView const & t)
+{
+    Image D(a.getWidth(), a.getHeight(), a.getChannels());
+    mix(a, b, t, D.view());
+    return D;
+}
 
+// ( (1-t)*a + t*b ) / 255
+inline ChannelMixExpr mix( ColorChannel const & a, ColorChannel const & b, float t)
+{
+    return { {ChannelRaw(a), ChannelRaw(b), ChannelScalar(t)}, ChannelScalar(1.0f / 255.0f) };
+}
 
-inline channel1f operator - (ColorChannel const & a, float b)
+inline ChannelMixChannelExpr mix( ColorChannel const & a, ColorChannel const & b, ColorChannel const & _t)
 {
-    return operator+(a,-b);
+    return { {ChannelRaw(a), ChannelRaw(b), _t}, ChannelScalar(1.0f / 255.0f) };
 }
 
+template<typename A, typename B>
+ChannelTernaryExpr<A,B,ChannelScalar,expr_mix> mix( ChannelExpr<A> const & a, ChannelExpr<B> const & b, float t)
+{
+    return {a.self(), b.self(), ChannelScalar(t)};
+}
 
-inline channel1f operator - (float b, ColorChannel const & a )
+template<typename A, typename B, typename T>
+ChannelTernaryExpr<A,B,T,expr_mix> mix( ChannelExpr<A> const & a, ChannelExpr<B> const & b, ChannelExpr<T> const & t)
 {
-    //std::cout << "Construct OneChannel+float" << std::endl;
-    channel1f D(a.getWidth(),a.getHeight());
+    return {a.self(), b.self(), t.self()};
+}
 
-    auto *Y = &a(0,0);
+// the same with temporary channel1fs as operands
+template<typename A, typename B, typename = enable_if_temp_operand<A,B> >
+ChannelTernaryExpr<expr_operand_t<A>,expr_operand_t<B>,ChannelScalar,expr_mix> mix( A && a, B && b, float t)
+{
+    return {expr_operand( std::forward<A>(a) ), expr_operand( std::forward<B>(b) ), ChannelScalar(t)};
+}
+template<typename A, typename B, typename T, typename = enable_if_temp_operand<A,B,T> >
+ChannelTernaryExpr<expr_operand_t<A>,expr_operand_t<B>,expr_operand_t<T>,expr_mix> mix( A && a, B && b, T && t)
+{
+    return {expr_operand( std::forward<A>(a) ), expr_operand( std::forward<B>(b) ), expr_operand( std::forward<T>(t) )};
+}
 
-    const float sc = 1.0f / 255.0f;
 
-    for(auto & v : D.data)
-    {
-        v = b - *Y*sc;
-        Y+=4;
-    }
-    return D;
+namespace detail
+{
+inline bool same_shape(Image const & a, Image const & b)
+{
+    return a.getWidth()    == b.getWidth()  &&
+           a.getHeight()   == b.getHeight() &&
+           a.getChannels() == b.getChannels() &&
+           a.isPlanar()    == b.isPlanar();
 }
 
-class Image
+/**
+ * @brief interleaved_copy
+ *
+ * Returns a copy of a planar image with interleaved pixels, for the
+ * functions which need all the channels of a pixel together.
+ */
+inline Image interleaved_copy(Image const & I)
 {
-public:
+    Image out(I);
+    out.setPlanar(false);
+    return out;
+}
+}
 
-    Image() : Image(8,8,4)
-    {
-    }
-    explicit Image(uint32_t w) : Image(w,w,4)
-    {
-    }
-    Image(uint32_t w, uint32_t h, uint32_t ch=4)
-    {
-        resize(w,h,ch);
-    }
+inline Image mix( Image const & a, Image const & b, Image const & _t)
+{
+    Image D;
+    assert( a.getWidth() == b.getWidth());
+    assert( a.getHeight() == b.getHeight());
+    assert( a.getChannels() == b.getChannels());
 
-    Image(const Image & other) : Image()
-    {
-        resize(other.getWidth(), other.getHeight(), other.getChannels());
-        m_data = other.m_data;
-        _setChannels( other.getWidth(), other.getHeight(), other.getChannels() );
-    }
+    assert( _t.getWidth() == b.getWidth());
+    assert( _t.getHeight() == b.getHeight());
+    assert( _t.getChannels() == b.getChannels());
+    D.m_planar = a.isPlanar();
+    D.resize(a.getWidth(), a.getHeight(), a.getChannels());
 
-    Image(Image && other) : Image(1,1,4)
+    if( detail::same_shape(a,b) && detail::same_shape(a,_t) )
     {
-        m_data = std::move(other.m_data);
-        _setChannels( other.getWidth(), other.getHeight(), other.getChannels() );
-        other.m_width = other.m_height = other.m_channels = 0;
+        detail::mix_bytes( static_cast<uint8_t const*>(a.data()),
+                           static_cast<uint8_t const*>(b.data()),
+                           static_cast<uint8_t const*>(_t.data()),
+                           static_cast<uint8_t*>(D.data()), D.size() );
+        return D;
     }
 
-    Image& operator=(const Image & other)
-    {
-        if( &other != this)
-        {
-            resize(other.getWidth(), other.getHeight(), other.getChannels());
+    auto w = std::min( a.getWidth(),    b.getWidth()   );
+    auto h = std::min( a.getHeight(),   b.getHeight()  );
+    auto C = std::min( a.getChannels(), b.getChannels());
 
-            auto & out = *this;
-            for(uint32_t j=0;j<out.getHeight();j++)
-            {
-                for(uint32_t i=0;i<out.getWidth();i++)
-                {
-                    for(uint32_t c =0; c < out.getChannels(); c++)
-                    {
-                        out(i,j,c) = other( i, j, c );
-                    }
-                }
-            }
-        }
-        return *this;
-    }
-    Image& operator=(Image && other)
-    {
-        if( &other != this)
-        {
-            m_data = std::move(other.m_data);
-            _setChannels( other.getWidth(), other.getHeight(), other.getChannels() );
-            other.m_width = other.m_height = other.m_channels = 0;
-        }
-        return *this;
-    }
 
-    void resize(uint32_t w, uint32_t h, uint32_t channels=4)
+    for(uint32_t j=0;j<h;j++)
     {
-        assert( channels <= 4);
-        if( w*h*channels != m_data.size())
+        for(uint32_t i=0;i<w;i++)
         {
-            m_data.resize(w*h*channels);
+            for(uint32_t c =0; c < C; c++)
+            {
+                float t = static_cast<float>(_t(i,j,c)) / 255.0f;
+                D(i,j,c) = mix( a(i,j,c), b(i,j,c), t );
+            }
         }
-
-        m_channels = channels;
-
-        _setChannels(w,h,channels);
     }
 
-    void _setChannels(uint32_t width, uint32_t height, uint32_t channels)
-    {
-        //assert( channels <= 4 && channels >= 1);
-        m_channels = channels;
-        m_width = width;
-        m_height = height;
-        if( channels == 4)
-        {
-            a.reset( m_data.data(), 3, 4, width, height);
-            b.reset( m_data.data(), 2, 4, width, height);
-            g.reset( m_data.data(), 1, 4, width, height);
-            r.reset( m_data.data(), 0, 4, width, height);
-        }
-        if( channels == 3)
-        {
-            a.reset( m_data.data(), 2, 3, width, height);
-            b.reset( m_data.data(), 2, 3, width, height);
-            g.reset( m_data.data(), 1, 3, width, height);
-            r.reset( m_data.data(), 0, 3, width, height);
-        }
-        if( channels == 2)
-        {
-            a.reset( m_data.data(), 1, 2, width, height);
-            b.reset( m_data.data(), 1, 2, width, height);
-            g.reset( m_data.data(), 1, 2, width, height);
-            r.reset( m_data.data(), 0, 2, width, height);
-        }
-        if( channels == 1)
-        {
-            a.reset( m_data.data(), 0, 1, width, height);
-            b.reset( m_data.data(), 0, 1, width, height);
-            g.reset( m_data.data(), 0, 1, width, height);
-            r.reset( m_data.data(), 0, 1, width, height);
-        }
-    }
+    return D;
+}
 
-    void copyFromBuffer(void const * src, uint32_t totalBytes, uint32_t width, uint32_t height, uint32_t ch=4)
-    {
-          assert(totalBytes%sizeof(uint32_t)==0);
+inline Image mix( Image const & a, Image const & b, float t)
+{
+    Image D;
+    assert( a.getWidth() == b.getWidth());
+    assert( a.getHeight() == b.getHeight());
+    assert( a.getChannels() == b.getChannels());
 
-          resize(width,height,ch);
-          memcpy(data(), src, totalBytes);
-    }
+    D.m_planar = a.isPlanar();
+    D.resize(a.getWidth(), a.getHeight(), a.getChannels());
 
-    uint8_t & operator()(uint32_t u, uint32_t v, uint32_t c)
-    {
-        return m_data[ (v*m_width + u)*m_channels +c ] ;//r.ptr[v*r.width+u];
-    }
-    uint8_t const & operator()(uint32_t u, uint32_t v, uint32_t c) const
-    {
-        return m_data[ (v*m_width + u)*m_channels +c ] ;//r.ptr[v*r.width+u];
-    }
-    ColorChannel& operator[](size_t i)
-    {
-        return (&r)[i];
-    }
-    ColorChannel const& operator[](size_t i) const
+    if( detail::same_shape(a,b) )
     {
-        return (&r)[i];
+        detail::mix_bytes( static_cast<uint8_t const*>(a.data()),
+                           static_cast<uint8_t const*>(b.data()),
+                           t,
+                           static_cast<uint8_t*>(D.data()), D.size() );
+        return D;
     }
-    /**
-     * @brief sample
-     * @param u
-     * @param v
-     * @return
-     *
-     * Samples a 2x2 block of pixels and returns the average. really only used for
-     * the nextMipMap() method.
-     */
-    uint8_t sample(uint32_t u, uint32_t v, uint32_t c) const
-    {
-        auto & R = *this;
 
-        auto c1 = R(u,v    ,c);
-        auto c2 = R(u,v+1  ,c);
-        auto c3 = R(u+1,v  ,c);
-        auto c4 = R(u+1,v+1,c);
+    auto w = std::min( a.getWidth(),    b.getWidth()   );
+    auto h = std::min( a.getHeight(),   b.getHeight()  );
+    auto C = std::min( a.getChannels(), b.getChannels());
 
-        return  static_cast<uint8_t>( (static_cast<uint32_t>(c1) + static_cast<uint32_t>(c2) + static_cast<uint32_t>(c3) + static_cast<uint32_t>(c4) ) / 4u);
-    }
 
-    /**
-     * @brief nextMipMap
-     * @return
-     *
-     * Returns the next mipmap level of the image. The next mipmap level has
-     * width and height which is half the original.
-     */
-    Image nextMipMap() const
+    for(uint32_t j=0;j<h;j++)
     {
-        Image out;
-        out.resize( getWidth()/2, getHeight()/2, getChannels());
-
-        for(uint32_t j=0;j<out.getHeight();j++)
+        for(uint32_t i=0;i<w;i++)
         {
-            for(uint32_t i=0;i<out.getWidth();i++)
+            for(uint32_t c =0; c < C; c++)
             {
-                for(uint32_t c=0; c < out.getChannels(); c++)
-                {
-                    out(i,j,c) = sample( i*2, j*2,c );
-                }
+                D(i,j,c) = mix( a(i,j,c), b(i,j,c), t );
             }
         }
-        return out;
     }
 
-    Image allocateNextMipMap() const
-    {
-        Image out;
-        out.resize( getWidth()/2, getHeight()/2, getChannels());
-        return out;
-    }
+    return D;
+}
 
-    void const* data() const
-    {
-        return m_data.data();
-    }
-    void * data()
-    {
-        return m_data.data();
-    }
-    size_t size() const
-    {
-        return m_data.size();
-    }
-    size_t byteSize() const
+/**
+ * @brief The MipMapSettings struct
+ *
+ * Controls how the mipmap levels are generated.
+ */
+struct MipMapSettings
+{
+    ImageFilter filter = ImageFilter::Box;
+
+    // The colour channels are sRGB encoded. They are converted to linear
+    // light before filtering. The alpha channel is always linear.
+    bool sRGB = false;
+
+    // If > 0, the alpha channel of each mip level is rescaled so that the
+    // fraction of pixels with alpha > alphaCoverage (0-1) is the same as in
+    // the base level. Keeps alpha tested geometry from thinning out.
+    float alphaCoverage = 0.0f;
+
+    bool isBox() const
     {
-        return m_data.size();
+        return filter == ImageFilter::Box && !sRGB;
     }
+};
 
-    uint32_t width() const
+namespace detail
+{
+
+/**
+ * @brief srgb_to_linear_lut
+ *
+ * 8-bit sRGB value -> linear light in the range 0-1
+ */
+inline std::vector<float> const & srgb_to_linear_lut()
+{
+    static const std::vector<float> lut = []()
     {
-        return m_width;
-    }
-    uint32_t height() const
+        std::vector<float> L(256);
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            const double c = i / 255.0;
+            L[i] = static_cast<float>( c <= 0.04045 ? c / 12.92 : std::pow( (c + 0.055) / 1.055, 2.4) );
+        }
+        return L;
+    }();
+    return lut;
+}
+
+inline std::vector<float> const & unorm8_to_float_lut()
+{
+    static const std::vector<float> lut = []()
     {
-        return m_height;
-    }
+        std::vector<float> L(256);
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            L[i] = static_cast<float>(i) / 255.0f;
+        }
+        return L;
+    }();
+    return lut;
+}
 
-    uint32_t getWidth() const
+constexpr uint32_t linear_to_srgb_lut_bits = 16;
+
+/**
+ * @brief linear_to_srgb_lut
+ *
+ * Linear light quantized to 16 bits -> 8-bit sRGB value
+ */
+inline std::vector<uint8_t> const & linear_to_srgb_lut()
+{
+    static const std::vector<uint8_t> lut = []()
     {
-        return m_width;
-    }
-    uint32_t getHeight() const
+        const uint32_t N = 1u << linear_to_srgb_lut_bits;
+        std::vector<uint8_t> L(N);
+        for(uint32_t i = 0; i < N; i++)
+        {
+            const double l = i / double(N-1);
+            const double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0/2.4) - 0.055;
+            L[i] = static_cast<uint8_t>( std::min(255.0, c * 255.0 + 0.5) );
+        }
+        return L;
+    }();
+    return lut;
+}
+
+inline uint8_t linear_to_srgb(float l)
+{
+    const float N = static_cast<float>( (1u << linear_to_srgb_lut_bits) - 1u );
+    l = std::min( std::max(l, 0.0f), 1.0f);
+    return linear_to_srgb_lut()[ static_cast<uint32_t>(l * N + 0.5f) ];
+}
+
+inline uint8_t float_to_unorm8(float l)
+{
+    l = std::min( std::max(l, 0.0f), 1.0f);
+    return static_cast<uint8_t>(l * 255.0f + 0.5f);
+}
+
+inline float sinc(float x)
+{
+    if( std::abs(x) < 1e-6f )
+        return 1.0f;
+    const float px = 3.14159265358979f * x;
+    return std::sin(px) / px;
+}
+
+// zeroth order modified bessel function of the first kind
+inline float bessel_i0(float x)
+{
+    float sum  = 1.0f;
+    float term = 1.0f;
+    for(int k = 1; k < 32; k++)
     {
-        return m_height;
+        const float t = x / (2.0f * static_cast<float>(k));
+        term *= t * t;
+        sum  += term;
+        if( term < sum * 1e-8f )
+            break;
     }
-    uint32_t getChannels() const
+    return sum;
+}
+
+/**
+ * @brief cubic_bc
+ *
+ * The Mitchell-Netravali family of cubic filters, x >= 0
+ */
+inline float cubic_bc(float x, float B, float C)
+{
+    const float x2 = x*x;
+    const float x3 = x2*x;
+    if( x < 1.0f )
+        return ( (12.0f - 9.0f*B - 6.0f*C)*x3 + (-18.0f + 12.0f*B + 6.0f*C)*x2 + (6.0f - 2.0f*B) ) / 6.0f;
+    return ( (-B - 6.0f*C)*x3 + (6.0f*B + 30.0f*C)*x2 + (-12.0f*B - 48.0f*C)*x + (8.0f*B + 24.0f*C) ) / 6.0f;
+}
+
+inline float filter_radius(ImageFilter f)
+{
+    switch(f)
     {
-        return m_channels;
+        case ImageFilter::Box:      return 0.5f;
+        case ImageFilter::Kaiser:   return 3.0f;
+        case ImageFilter::Lanczos3: return 3.0f;
+        case ImageFilter::Bilinear: return 1.0f;
+        case ImageFilter::Bicubic:  return 2.0f;
+        case ImageFilter::Mitchell: return 2.0f;
     }
+    return 0.5f;
+}
 
-    void clear()
+inline float filter_value(ImageFilter f, float x)
+{
+    const float R = filter_radius(f);
+    x = std::abs(x);
+    if( x >= R )
+        return f == ImageFilter::Box && x == R ? 1.0f : 0.0f;
+
+    switch(f)
     {
-        m_data.clear();
-        m_channels = 0;
-        m_width  = 0;
-        m_height = 0;
-        _setChannels(0,0,0);
+        case ImageFilter::Box:
+            return 1.0f;
+        case ImageFilter::Kaiser:
+        {
+            const float alpha = 4.0f;
+            const float t     = x / R;
+            return sinc(x) * bessel_i0( alpha * std::sqrt(1.0f - t*t) ) / bessel_i0(alpha);
+        }
+        case ImageFilter::Lanczos3:
+            return sinc(x) * sinc(x / R);
+        case ImageFilter::Bilinear:
+            return 1.0f - x;
+        case ImageFilter::Bicubic:
+            return cubic_bc(x, 0.0f, 0.5f);
+        case ImageFilter::Mitchell:
+            return cubic_bc(x, 1.0f/3.0f, 1.0f/3.0f);
     }
-public:
+    return 0.0f;
+}
 
-    size_t hash() const
-    {
-        auto     w = getWidth();
-        auto     h = getHeight();
-        uint32_t c = 4;
+/**
+ * @brief The filter_taps struct
+ *
+ * The source pixels and normalized weights which make up each output
+ * pixel along one axis. Every output pixel has the same number of taps,
+ * indices outside the image are clamped to the edge.
+ */
+struct filter_taps
+{
+    uint32_t              taps = 0;
+    std::vector<uint32_t> index;
+    std::vector<float>    weight;
+};
 
-        auto hashCo = [](size_t _seed, size_t h2)
-        {
-            _seed ^= h2 + 0x9e3779b9 + (_seed<<6) + (_seed>>2);
-            return _seed;
-        };
+/**
+ * @brief make_resize_taps
+ *
+ * Builds the taps for resampling an axis of size s to size d. When
+ * shrinking, the filter is stretched by s/d so that it covers all the
+ * source pixels of an output pixel.
+ */
+inline filter_taps make_resize_taps(uint32_t s, uint32_t d, ImageFilter f)
+{
+    filter_taps T;
+    if( d == 0 || s == 0 )
+        return T;
+
+    const float scale       = static_cast<float>(s) / static_cast<float>(d);
+    const float filterScale = std::max(scale, 1.0f);
+    const float radius      = filter_radius(f) * filterScale;
 
-        std::hash<uint32_t> Hu;
+    T.taps = static_cast<uint32_t>( std::ceil(radius) ) * 2 + 1;
+    T.index.resize( size_t(d) * T.taps );
+    T.weight.resize( size_t(d) * T.taps );
 
-        auto seed = Hu(w);
-        seed = hashCo(seed, Hu(h) );
-        seed = hashCo(seed, Hu(c) );
+    for(uint32_t i = 0; i < d; i++)
+    {
+        const float center = (static_cast<float>(i) + 0.5f) * scale;
+        const int   first  = static_cast<int>( std::floor(center - radius) );
 
-        auto * begin = static_cast<uint32_t const*>(data());
-        for(uint32_t i=0;i<w*h;i++)
+        float total = 0.0f;
+        for(uint32_t k = 0; k < T.taps; k++)
+        {
+            const int   x = first + static_cast<int>(k);
+            const float w = filter_value(f, (static_cast<float>(x) + 0.5f - center) / filterScale);
+            T.index [i*T.taps + k] = static_cast<uint32_t>( std::min( std::max(x, 0), static_cast<int>(s) - 1) );
+            T.weight[i*T.taps + k] = w;
+            total += w;
+        }
+        for(uint32_t k = 0; k < T.taps; k++)
         {
-            seed = hashCo(seed, Hu(*begin++));
+            T.weight[i*T.taps + k] /= total;
         }
-        return seed;
     }
-//#endif
+    return T;
+}
 
-    std::vector<uint8_t> m_data;
-    uint32_t             m_channels;
-    uint32_t             m_width;
-    uint32_t             m_height;
-    ColorChannel r;
-    ColorChannel g;
-    ColorChannel b;
-    ColorChannel a;
+/**
+ * @brief make_mip_taps
+ *
+ * Builds the taps for halving an axis of size s.
+ */
+inline filter_taps make_mip_taps(uint32_t s, ImageFilter f)
+{
+    const uint32_t d = s / 2;
 
-    /**
-     * @brief X
-     * @param width
-     * @param height
-     * @return
-     *
-     * Returns a oneD_Channel where the value of the channel increases
-     * linearly in the u direction
-     */
-    static channel1f X(uint32_t width, uint32_t height)
+    if( f == ImageFilter::Box )
     {
-        channel1f D(width,height);
-
-        float sc = 1.0f / float(width);
-        for( uint32_t v=0; v< height; ++v)
+        // exact coverage, see box_taps()
+        filter_taps T;
+        T.taps = (s & 1u) ? 3 : 2;
+        T.index.resize( size_t(d) * T.taps );
+        T.weight.resize( size_t(d) * T.taps );
+        for(uint32_t i = 0; i < d; i++)
         {
-            for( uint32_t u=0; u<width; ++u)
+            uint32_t w[3];
+            box_taps(s, i, w);
+            const float total = static_cast<float>( (s & 1u) ? s : 2u );
+            for(uint32_t k = 0; k < T.taps; k++)
             {
-                float x = static_cast<float>(u) * sc;
-                D(u,v) = x;
+                T.index [i*T.taps + k] = 2*i + k;
+                T.weight[i*T.taps + k] = static_cast<float>(w[k]) / total;
             }
         }
-        return D;
+        return T;
     }
+    return make_resize_taps(s, d, f);
+}
 
-    /**
-     * @brief Y
-     * @param width
-     * @param height
-     * @return
-     *
-     * Returns a oneD_Channel where the value of the channel increases
-     * linearly in the v direction
-     */
-    static channel1f Y(uint32_t width, uint32_t height)
+/**
+ * @brief alpha_channel_index
+ *
+ * Returns the index of the alpha channel or C if there isn't one
+ */
+inline uint32_t alpha_channel_index(uint32_t C)
+{
+    return (C == 4 || C == 2) ? C - 1 : C;
+}
+
+/**
+ * @brief resample_filtered
+ *
+ * Resamples an image using separable filter taps, the output size is
+ * given by the number of taps. Each source byte is converted to a float
+ * through a lookup table (sRGB->linear for the colour channels if sRGB is
+ * set) and converted back through a table on output. Only the output rows
+ * [row0,row1) are written.
+ */
+inline void resample_filtered(uint8_t const * src, uint32_t sw, uint32_t C,
+                              uint8_t * dst,
+                              filter_taps const & tx, filter_taps const & ty,
+                              bool sRGB,
+                              uint32_t row0, uint32_t row1)
+{
+    const uint32_t dw       = tx.taps ? static_cast<uint32_t>(tx.index.size() / tx.taps) : 0;
+    const size_t   srcPitch = size_t(sw) * C;
+    const size_t   dstPitch = size_t(dw) * C;
+    const uint32_t alpha    = alpha_channel_index(C);
+
+    float const * lut[4];
+    for(uint32_t c = 0; c < C; c++)
     {
-        channel1f D(width,height);
+        lut[c] = (sRGB && c != alpha) ? srgb_to_linear_lut().data() : unorm8_to_float_lut().data();
+    }
 
-        float sc = 1.0f / float(height);
-        for( uint32_t v=0; v< height; ++v)
+    // Source rows converted to float. Neighbouring output rows share most
+    // of their source rows, so they are kept in a ring which is large
+    // enough to hold all the taps of one output row.
+    const uint32_t ringSize = ty.taps + 2;
+    std::vector<float>    ring( size_t(ringSize) * srcPitch );
+    std::vector<uint32_t> ringRow( ringSize, 0xFFFFFFFFu );
+
+    auto sourceRow = [&](uint32_t y) -> float const*
+    {
+        const uint32_t slot = y % ringSize;
+        float * r = &ring[ slot * srcPitch ];
+        if( ringRow[slot] != y )
         {
-            float y = static_cast<float>(v) * sc;
-            for( uint32_t u=0; u<width; ++u)
+            ringRow[slot] = y;
+            auto * row = src + y * srcPitch;
+            for(uint32_t x = 0; x < sw; x++)
             {
-                D(u,v) = y;
+                for(uint32_t c = 0; c < C; c++)
+                {
+                    r[x*C + c] = lut[c][ row[x*C + c] ];
+                }
             }
         }
-        return D;
-    }
-};
+        return r;
+    };
+
+    std::vector<float> tmp(srcPitch);
 
+    for(uint32_t j = row0; j < row1; j++)
+    {
+        // vertical pass into a single row
+        std::fill(tmp.begin(), tmp.end(), 0.0f);
+        for(uint32_t k = 0; k < ty.taps; k++)
+        {
+            const float   w   = ty.weight[j*ty.taps + k];
+            float const * row = sourceRow( ty.index[j*ty.taps + k] );
+            size_t x = 0;
+#if defined(GUL_IMAGE_SSE2)
+            const __m128 W = _mm_set1_ps(w);
+            for(; x + 4 <= srcPitch; x += 4)
+            {
+                _mm_storeu_ps(&tmp[x], _mm_add_ps( _mm_loadu_ps(&tmp[x]), _mm_mul_ps(W, _mm_loadu_ps(row + x)) ));
+            }
+#endif
+            for(; x < srcPitch; x++)
+            {
+                tmp[x] += w * row[x];
+            }
+        }
 
+        // horizontal pass
+        uint8_t * out = dst + j * dstPitch;
+        for(uint32_t i = 0; i < dw; i++)
+        {
+            alignas(16) float v[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            float const * wi = &tx.weight[i*tx.taps];
+            uint32_t const * xi = &tx.index[i*tx.taps];
+#if defined(GUL_IMAGE_SSE2)
+            if( C == 4 )
+            {
+                __m128 acc = _mm_setzero_ps();
+                for(uint32_t k = 0; k < tx.taps; k++)
+                {
+                    acc = _mm_add_ps(acc, _mm_mul_ps( _mm_set1_ps(wi[k]), _mm_loadu_ps(&tmp[ xi[k] * 4 ]) ));
+                }
+                _mm_store_ps(v, acc);
+            }
+            else
+#endif
+            for(uint32_t k = 0; k < tx.taps; k++)
+            {
+                float const * px = &tmp[ xi[k] * C ];
+                for(uint32_t c = 0; c < C; c++)
+                {
+                    v[c] += wi[k] * px[c];
+                }
+            }
+            for(uint32_t c = 0; c < C; c++)
+            {
+                out[i*C + c] = (sRGB && c != alpha) ? linear_to_srgb(v[c]) : float_to_unorm8(v[c]);
+            }
+        }
+    }
+}
 
-inline channel1f mix( ColorChannel const & a, ColorChannel const & b, float t)
+/**
+ * @brief srgb_to_linear16_lut
+ *
+ * 8-bit sRGB value -> linear light in the range 0-65535
+ */
+inline std::vector<uint16_t> const & srgb_to_linear16_lut()
 {
+    static const std::vector<uint16_t> lut = []()
+    {
+        std::vector<uint16_t> L(256);
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            L[i] = static_cast<uint16_t>( srgb_to_linear_lut()[i] * 65535.0f + 0.5f );
+        }
+        return L;
+    }();
+    return lut;
+}
 
-    channel1f D( a.getWidth(), a.getHeight());
+/**
+ * @brief box2x2_srgb_row
+ *
+ * Same as box2x2_row() but the colour channels are averaged in linear
+ * light. Uses integer lookup tables in both directions. Channel alpha
+ * is averaged as is, pass C if there is no alpha channel.
+ */
+inline void box2x2_srgb_row(uint8_t const * r0, uint8_t const * r1, uint8_t * out, uint32_t dw, uint32_t C, uint32_t alpha)
+{
+    static_assert( linear_to_srgb_lut_bits == 16, "linear values are 16 bit");
 
-    auto * A = &a(0,0);
-    auto * B = &b(0,0);
+    auto const & toLinear = srgb_to_linear16_lut();
+    auto const & toSRGB   = linear_to_srgb_lut();
 
-    float sc = 1.0f/255.0f;
-    for(auto & v : D.data)
+    for(uint32_t i = 0; i < dw; i++)
     {
-
-        float x1 = static_cast<float>(*A);
-        float x2 = static_cast<float>(*B);
-        v   = ( (1.0f - t) * x1 + t * x2 ) * sc;
-
-        A+=4; B+=4;
+        auto * a = r0 + 2*i*C;
+        auto * b = r1 + 2*i*C;
+        for(uint32_t c = 0; c < C; c++)
+        {
+            if( c == alpha )
+            {
+                const uint32_t sum = uint32_t(a[c]) + uint32_t(a[c+C]) + uint32_t(b[c]) + uint32_t(b[c+C]);
+                out[i*C + c] = static_cast<uint8_t>( (sum + 2u) / 4u );
+            }
+            else
+            {
+                const uint32_t sum = uint32_t(toLinear[a[c]]) + uint32_t(toLinear[a[c+C]]) + uint32_t(toLinear[b[c]]) + uint32_t(toLinear[b[c+C]]);
+                out[i*C + c] = toSRGB[ (sum + 2u) / 4u ];
+            }
+        }
     }
-    return D;
 }
 
-inline channel1f mix( ColorChannel const & a, ColorChannel const & b, ColorChannel const & _t)
+inline void box2x2_srgb_row(uint8_t const * r0, uint8_t const * r1, uint8_t * out, uint32_t dw, uint32_t C)
+{
+    box2x2_srgb_row(r0, r1, out, dw, C, alpha_channel_index(C));
+}
+
+/**
+ * @brief alpha_layout
+ *
+ * Returns the byte offset of the first alpha value of the image and the
+ * distance between consecutive alpha values, in either layout.
+ */
+inline std::pair<size_t, size_t> alpha_layout(Image const & I, uint32_t alpha)
 {
-    channel1f D( a.getWidth(), a.getHeight());
+    if( I.isPlanar() )
+        return { size_t(alpha) * I.getWidth() * I.getHeight(), 1u };
+    return { alpha, I.getChannels() };
+}
 
-    auto * A = &a(0,0);
-    auto * B = &b(0,0);
-    auto * T = &_t(0,0);
+/**
+ * @brief alpha_coverage
+ *
+ * Returns the fraction of pixels whose alpha is greater than ref (0-1)
+ */
+inline float alpha_coverage(Image const & I, float ref)
+{
+    const uint32_t C     = I.getChannels();
+    const uint32_t alpha = alpha_channel_index(C);
+    const size_t   n     = size_t(I.getWidth()) * I.getHeight();
+    if( alpha == C || n == 0 )
+        return 0.0f;
+
+    const float  thresh = ref * 255.0f;
+    const auto   layout = alpha_layout(I, alpha);
+    auto *       d      = static_cast<uint8_t const*>(I.data()) + layout.first;
+    size_t       count  = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        count += static_cast<float>(d[i*layout.second]) > thresh ? 1u : 0u;
+    }
+    return static_cast<float>(count) / static_cast<float>(n);
+}
 
-    float sc = 1.0f/255.0f;
+/**
+ * @brief scale_alpha_to_coverage
+ *
+ * Scales the alpha channel so that alpha_coverage(I, ref) is as close
+ * as possible to coverage. The scale is found from a histogram of the
+ * alpha values and applied through a lookup table.
+ */
+inline void scale_alpha_to_coverage(Image & I, float ref, float coverage)
+{
+    const uint32_t C     = I.getChannels();
+    const uint32_t alpha = alpha_channel_index(C);
+    const size_t   n     = size_t(I.getWidth()) * I.getHeight();
+    if( alpha == C || n == 0 )
+        return;
+
+    const auto layout = alpha_layout(I, alpha);
+    auto *     d      = static_cast<uint8_t*>(I.data()) + layout.first;
+    const auto stride = layout.second;
+
+    size_t hist[256] = {};
+    for(size_t i = 0; i < n; i++)
+    {
+        hist[ d[i*stride] ]++;
+    }
 
-    for(auto & v : D.data)
+    // find the alpha value, k, where the number of pixels >= k is
+    // closest to the target
+    const double target = static_cast<double>(coverage) * static_cast<double>(n);
+    size_t   above = 0;
+    uint32_t best  = 256;
+    double   bestError = static_cast<double>(n) + 1.0;
+    for(uint32_t k = 255; k >= 1; k--)
     {
-        float t = *T * sc;
+        above += hist[k];
+        const double e = std::abs( static_cast<double>(above) - target );
+        if( e < bestError )
+        {
+            bestError = e;
+            best      = k;
+        }
+    }
+    if( best == 256 || coverage <= 0.0f )
+        return;
 
-        v  = ( (1.0f - t) * (*A) + t * (*B) ) * sc;
+    // map alpha=best-0.5 to the reference value
+    const float scale = (ref * 255.0f) / (static_cast<float>(best) - 0.5f);
 
-        A+=4; B+=4; T+=4;
+    uint8_t lut[256];
+    for(uint32_t k = 0; k < 256; k++)
+    {
+        lut[k] = static_cast<uint8_t>( std::min(255.0f, static_cast<float>(k) * scale + 0.5f) );
+        // make sure rounding does not move a value across the reference
+        const bool passes = k >= best;
+        if( passes && !(static_cast<float>(lut[k]) > ref*255.0f) )
+            lut[k] = static_cast<uint8_t>( std::min(255.0f, std::floor(ref*255.0f) + 1.0f) );
+        if( !passes && static_cast<float>(lut[k]) > ref*255.0f )
+            lut[k] = static_cast<uint8_t>( std::ceil(ref*255.0f) - 1.0f );
+    }
+    for(size_t i = 0; i < n; i++)
+    {
+        d[i*stride] = lut[ d[i*stride] ];
     }
-    return D;
 }
 
-
-inline Image mix( Image const & a, Image const & b, Image const & _t)
+/**
+ * @brief generate_mip_level
+ *
+ * Computes dst from src using the settings. If a thread pool is
+ * given the output rows are computed in parallel.
+ */
+inline void generate_mip_level(Image const & src, Image & dst, MipMapSettings const & settings, thread_pool * pool)
 {
-    Image D;
-    assert( a.getWidth() == b.getWidth());
-    assert( a.getHeight() == b.getHeight());
-    assert( a.getChannels() == b.getChannels());
+    if( dst.isPlanar() != src.isPlanar() )
+    {
+        dst.setPlanar( src.isPlanar() );
+    }
+    if( dst.getWidth()    != src.getWidth()/2  ||
+        dst.getHeight()   != src.getHeight()/2 ||
+        dst.getChannels() != src.getChannels() )
+    {
+        dst.resize( src.getWidth()/2, src.getHeight()/2, src.getChannels());
+    }
 
-    assert( _t.getWidth() == b.getWidth());
-    assert( _t.getHeight() == b.getHeight());
-    assert( _t.getChannels() == b.getChannels());
-    D.resize(a.getWidth(), a.getHeight(), a.getChannels());
+    // a planar image is processed as one single channel image per plane,
+    // the alpha plane is never converted from sRGB
+    const bool     planar = src.isPlanar();
+    const uint32_t planes = planar ? src.getChannels() : 1u;
+    const uint32_t C      = planar ? 1u : src.getChannels();
+    const uint32_t alpha  = alpha_channel_index(src.getChannels());
+    const size_t   sn     = planar ? size_t(src.getWidth()) * src.getHeight() : 0u;
+    const size_t   dn     = planar ? size_t(dst.getWidth()) * dst.getHeight() : 0u;
 
-    auto w = std::min( a.getWidth(),    b.getWidth()   );
-    auto h = std::min( a.getHeight(),   b.getHeight()  );
-    auto C = std::min( a.getChannels(), b.getChannels());
+    std::function<void(uint32_t,uint32_t)> rows;
+
+    filter_taps tx, ty;
+    if( settings.isBox() )
+    {
+        rows = [&](uint32_t r0, uint32_t r1)
+        {
+            src._nextMipMapRows(dst, r0, r1);
+        };
+    }
+    else if( settings.filter == ImageFilter::Box && (src.getWidth() % 2) == 0 && (src.getHeight() % 2) == 0 )
+    {
+        rows = [&](uint32_t r0, uint32_t r1)
+        {
+            const size_t   srcPitch = size_t(src.getWidth()) * C;
+            const size_t   dstPitch = size_t(dst.getWidth()) * C;
+            for(uint32_t p = 0; p < planes; p++)
+            {
+                auto * s = static_cast<uint8_t const*>(src.data()) + p*sn;
+                auto * d = static_cast<uint8_t*>(dst.data()) + p*dn;
+                const uint32_t a = planar ? (p == alpha ? 0u : 1u) : alpha;
+                for(uint32_t j = r0; j < r1; j++)
+                {
+                    box2x2_srgb_row(s + 2*j*srcPitch, s + (2*j+1)*srcPitch, d + j*dstPitch, dst.getWidth(), C, a);
+                }
+            }
+        };
+    }
+    else
+    {
+        tx = make_mip_taps(src.getWidth(),  settings.filter);
+        ty = make_mip_taps(src.getHeight(), settings.filter);
+        rows = [&](uint32_t r0, uint32_t r1)
+        {
+            for(uint32_t p = 0; p < planes; p++)
+            {
+                const bool sRGB = settings.sRGB && !(planar && p == alpha);
+                resample_filtered( static_cast<uint8_t const*>(src.data()) + p*sn, src.getWidth(), C,
+                                   static_cast<uint8_t*>(dst.data()) + p*dn,
+                                   tx, ty, sRGB, r0, r1);
+            }
+        };
+    }
 
+    if( pool )
+    {
+        pool->parallel_for(0, dst.getHeight(), [&](size_t r0, size_t r1)
+        {
+            rows( static_cast<uint32_t>(r0), static_cast<uint32_t>(r1) );
+        });
+    }
+    else
+    {
+        rows(0, dst.getHeight());
+    }
+}
 
-    for(uint32_t j=0;j<h;j++)
+/**
+ * @brief resize_image
+ *
+ * Resamples src into dst, which must already have the output size, using
+ * taps built by make_resize_taps(). The taps only depend on the sizes, so
+ * they can be shared by any number of images. If a thread pool is given
+ * the output rows are computed in parallel.
+ */
+inline void resize_image(Image const & src, Image & dst, filter_taps const & tx, filter_taps const & ty, thread_pool * pool)
+{
+    auto rows = [&](size_t r0, size_t r1)
     {
-        for(uint32_t i=0;i<w;i++)
+        if( src.isPlanar() )
         {
-            for(uint32_t c =0; c < C; c++)
+            // each plane is a single channel image
+            const size_t n  = size_t(src.getWidth()) * src.getHeight();
+            const size_t dn = size_t(dst.getWidth()) * dst.getHeight();
+            for(uint32_t c = 0; c < src.getChannels(); c++)
             {
-                float t = static_cast<float>(_t(i,j,c)) / 255.0f;
-                D(i,j,c) = mix( a(i,j,c), b(i,j,c), t );
+                resample_filtered( static_cast<uint8_t const*>(src.data()) + c*n, src.getWidth(), 1,
+                                   static_cast<uint8_t*>(dst.data()) + c*dn,
+                                   tx, ty, false, static_cast<uint32_t>(r0), static_cast<uint32_t>(r1));
             }
+            return;
         }
-    }
+        resample_filtered( static_cast<uint8_t const*>(src.data()), src.getWidth(), src.getChannels(),
+                           static_cast<uint8_t*>(dst.data()),
+                           tx, ty, false, static_cast<uint32_t>(r0), static_cast<uint32_t>(r1));
+    };
+    if( src.getWidth() == 0 || src.getHeight() == 0 )
+        return;
+    if( pool )
+        pool->parallel_for(0, dst.getHeight(), rows);
+    else
+        rows(0, dst.getHeight());
+}
 
-    return D;
 }
 
-inline Image mix( Image const & a, Image const & b, float t)
+inline Image Image::resized(uint32_t w, uint32_t h, ImageFilter filter) const
 {
-    Image D;
-    assert( a.getWidth() == b.getWidth());
-    assert( a.getHeight() == b.getHeight());
-    assert( a.getChannels() == b.getChannels());
+    Image out(w, h, getChannels());
+    out.setPlanar(m_planar);
+    detail::resize_image(*this, out, detail::make_resize_taps(getWidth(), w, filter), detail::make_resize_taps(getHeight(), h, filter), nullptr);
+    return out;
+}
 
-    D.resize(a.getWidth(), a.getHeight(), a.getChannels());
+inline Image Image::resized(thread_pool & pool, uint32_t w, uint32_t h, ImageFilter filter) const
+{
+    Image out(w, h, getChannels());
+    out.setPlanar(m_planar);
+    detail::resize_image(*this, out, detail::make_resize_taps(getWidth(), w, filter), detail::make_resize_taps(getHeight(), h, filter), &pool);
+    return out;
+}
 
-    auto w = std::min( a.getWidth(),    b.getWidth()   );
-    auto h = std::min( a.getHeight(),   b.getHeight()  );
-    auto C = std::min( a.getChannels(), b.getChannels());
+namespace detail
+{
 
+struct image_shape
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+};
 
-    for(uint32_t j=0;j<h;j++)
+inline uint32_t mip_level_count(uint32_t w, uint32_t h, uint32_t mips)
+{
+    auto maxMips = w && h ? uint32_t( std::log2( std::min(w,h) ) ) : 0u;
+    mips = mips == 0 ? maxMips : std::min(maxMips, mips);
+    return std::max(mips, 1u);
+}
+
+/**
+ * @brief The contiguous_storage struct
+ *
+ * Bookkeeping for a set of Images which are all views into a single
+ * aligned allocation. The Images own the allocation (through aliasing
+ * shared_ptrs), the storage only keeps a weak reference to it so that it
+ * can tell whether the Images are still using it.
+ */
+struct contiguous_storage
+{
+    std::weak_ptr<uint8_t> buffer;
+    uint8_t *              data      = nullptr;
+    size_t                 size      = 0;
+    size_t                 alignment = 0;
+    std::vector<size_t>    offsets;     // byte offset of each image, in packing order
+
+    /**
+     * @brief pack
+     *
+     * Allocates one block large enough for all the shapes, each starting
+     * on an alignment boundary, and makes images[i] a view of shapes[i].
+     * Pixels are copied over for images which already have that shape,
+     * everything else is zeroed. alignment must be a power of two.
+     */
+    void pack(std::vector<Image*> const & images, std::vector<image_shape> const & shapes, size_t _alignment)
     {
-        for(uint32_t i=0;i<w;i++)
+        assert( images.size() == shapes.size() );
+        assert( _alignment != 0 && (_alignment & (_alignment-1)) == 0 );
+
+        offsets.clear();
+        size_t total = 0;
+        for(auto & S : shapes)
         {
-            for(uint32_t c =0; c < C; c++)
+            total = (total + _alignment - 1) & ~(_alignment - 1);
+            offsets.push_back(total);
+            total += size_t(S.width) * S.height * S.channels;
+        }
+
+        std::shared_ptr<uint8_t> block( new uint8_t[total + _alignment](), std::default_delete<uint8_t[]>() );
+        auto base    = reinterpret_cast<uintptr_t>(block.get());
+        auto aligned = (base + _alignment - 1) & ~(uintptr_t(_alignment) - 1);
+
+        data      = block.get() + (aligned - base);
+        size      = total;
+        alignment = _alignment;
+        buffer    = block;
+
+        for(size_t i = 0; i < images.size(); i++)
+        {
+            auto & I = *images[i];
+            auto & S = shapes[i];
+            auto * p = data + offsets[i];
+            if( I.getWidth() == S.width && I.getHeight() == S.height && I.getChannels() == S.channels && I.size() )
             {
-                D(i,j,c) = mix( a(i,j,c), b(i,j,c), t );
+                memcpy(p, static_cast<Image const&>(I).data(), I.size());
             }
+            I._setStorage(block, p, S.width, S.height, S.channels);
         }
     }
 
-    return D;
+    /**
+     * @brief holds
+     *
+     * Returns true if the images are still views into this storage, ie:
+     * none of them have been resized or moved out since pack() was called.
+     */
+    template<typename ImagePtr>
+    bool holds(std::vector<ImagePtr> const & images) const
+    {
+        if( buffer.expired() || images.size() != offsets.size() )
+            return false;
+        for(size_t i = 0; i < images.size(); i++)
+        {
+            if( images[i]->data() != data + offsets[i] )
+                return false;
+        }
+        return true;
+    }
+};
+
 }
 
 /**
@@ -792,6 +4260,27 @@ struct ImageMM
         level.resize(1);
     }
 
+    /**
+     * @brief ImageMM
+     * @param other
+     *
+     * If other is contiguous, the copy is also contiguous with the
+     * same layout.
+     */
+    ImageMM(ImageMM const & other)
+    {
+        _copyFrom(other);
+    }
+    ImageMM(ImageMM &&) = default;
+
+    ImageMM& operator=(ImageMM const & other)
+    {
+        if( &other != this )
+            _copyFrom(other);
+        return *this;
+    }
+    ImageMM& operator=(ImageMM &&) = default;
+
 
     Image & getLevel(size_t i)
     {
@@ -831,6 +4320,53 @@ struct ImageMM
         return m;
     }
 
+    /**
+     * @brief generateMipMaps
+     * @param settings
+     *
+     * Fills in all the mipmap levels from the base level. By default a box
+     * filter is used, see MipMapSettings for the other options. If only
+     * the base level has been allocated, the full mipmap chain is
+     * allocated first.
+     */
+    void generateMipMaps(MipMapSettings const & settings = {})
+    {
+        _generateMipMaps(settings, nullptr);
+    }
+
+    /**
+     * @brief generateMipMaps
+     * @param pool
+     * @param settings
+     *
+     * Same as generateMipMaps() but the rows of each level are
+     * computed on the thread pool.
+     */
+    void generateMipMaps(thread_pool & pool, MipMapSettings const & settings = {})
+    {
+        _generateMipMaps(settings, &pool);
+    }
+
+    void _generateMipMaps(MipMapSettings const & settings, thread_pool * pool)
+    {
+        if( level.size() == 1 )
+            allocateMipMaps();
+
+        for(size_t i = 1; i < level.size(); i++)
+        {
+            detail::generate_mip_level(level[i-1], level[i], settings, pool);
+        }
+
+        if( settings.alphaCoverage > 0.0f )
+        {
+            const float coverage = detail::alpha_coverage(level[0], settings.alphaCoverage);
+            for(size_t i = 1; i < level.size(); i++)
+            {
+                detail::scale_alpha_to_coverage(level[i], settings.alphaCoverage, coverage);
+            }
+        }
+    }
+
     void allocateMipMaps(uint32_t mips=0)
     {
         auto maxMips = maxLevels();
@@ -843,7 +4379,7 @@ struct ImageMM
         {
             mips = maxMips;
         }
-        mips=mips-1;
+        mips = std::max(mips, 1u) - 1;
         level.resize(1);
         while(mips--)
         {
@@ -855,6 +4391,110 @@ struct ImageMM
     {
         level.resize(1);
     }
+
+    /**
+     * @brief allocateContiguous
+     * @param w
+     * @param h
+     * @param mips - number of levels, 0 for the full chain
+     * @param channels
+     * @param alignment - alignment of each level, must be a power of 2
+     *
+     * Allocates all the mipmap levels in a single buffer. Level i
+     * starts at getLevelOffsets()[i] bytes from contiguousData().
+     */
+    void allocateContiguous(uint32_t w, uint32_t h, uint32_t mips=0, uint32_t channels=4, size_t alignment=64)
+    {
+        auto count = detail::mip_level_count(w,h,mips);
+        level.assign(count, Image(0,0,channels));
+
+        std::vector<detail::image_shape> shapes;
+        for(uint32_t i = 0; i < count; i++)
+            shapes.push_back( {w >> i, h >> i, channels} );
+
+        m_storage.pack(_levelPtrs(), shapes, alignment);
+    }
+
+    /**
+     * @brief makeContiguous
+     * @param alignment
+     *
+     * Moves the existing levels into a single buffer, keeping their contents.
+     */
+    void makeContiguous(size_t alignment=64)
+    {
+        std::vector<detail::image_shape> shapes;
+        for(auto & L : level)
+            shapes.push_back( {L.getWidth(), L.getHeight(), L.getChannels()} );
+        m_storage.pack(_levelPtrs(), shapes, alignment);
+    }
+
+    /**
+     * @brief isContiguous
+     * @return
+     *
+     * Returns true if all levels are still views into the buffer created by
+     * allocateContiguous()/makeContiguous(). Resizing a level, or adding
+     * levels, detaches it.
+     */
+    bool isContiguous() const
+    {
+        std::vector<Image const*> p;
+        for(auto & L : level)
+            p.push_back(&L);
+        return m_storage.holds(p);
+    }
+
+    /**
+     * @brief getLevelOffsets
+     * @return
+     *
+     * Returns the byte offset of each level from contiguousData().
+     * Empty if the levels are not contiguous.
+     */
+    std::vector<size_t> getLevelOffsets() const
+    {
+        return isContiguous() ? m_storage.offsets : std::vector<size_t>{};
+    }
+
+    void const * contiguousData() const
+    {
+        return isContiguous() ? m_storage.data : nullptr;
+    }
+    void * contiguousData()
+    {
+        return isContiguous() ? m_storage.data : nullptr;
+    }
+    size_t contiguousByteSize() const
+    {
+        return isContiguous() ? m_storage.size : 0;
+    }
+
+    std::vector<Image*> _levelPtrs()
+    {
+        std::vector<Image*> p;
+        for(auto & L : level)
+            p.push_back(&L);
+        return p;
+    }
+
+    void _copyFrom(ImageMM const & other)
+    {
+        if( !other.isContiguous() )
+        {
+            level     = other.level;
+            m_storage = {};
+            return;
+        }
+        level.assign(other.level.size(), Image(0,0,0));
+        std::vector<detail::image_shape> shapes;
+        for(auto & L : other.level)
+            shapes.push_back( {L.getWidth(), L.getHeight(), L.getChannels()} );
+        m_storage.pack(_levelPtrs(), shapes, other.m_storage.alignment);
+        memcpy(m_storage.data, other.m_storage.data, m_storage.size);
+    }
+
+    detail::contiguous_storage m_storage;
 };
 
 struct ImageArray
@@ -881,6 +4521,27 @@ struct ImageArray
         layer.push_back( std::move(mm));
     }
 
+    /**
+     * @brief ImageArray
+     * @param other
+     *
+     * If other is contiguous, the copy is also contiguous with the
+     * same layout.
+     */
+    ImageArray(ImageArray const & other)
+    {
+        _copyFrom(other);
+    }
+    ImageArray(ImageArray &&) = default;
+
+    ImageArray& operator=(ImageArray const & other)
+    {
+        if( &other != this )
+            _copyFrom(other);
+        return *this;
+    }
+    ImageArray& operator=(ImageArray &&) = default;
+
     ImageMM& getLayer(size_t i)
     {
         return layer.at(i);
@@ -928,41 +4589,238 @@ struct ImageArray
         }
     }
 
-};
+    /**
+     * @brief resized
+     * @param w
+     * @param h
+     * @param filter
+     * @param pool - optional, resamples the rows in parallel
+     * @return
+     *
+     * Returns an array with the base level of every layer resampled to
+     * w x h pixels. The filter weights are computed once and shared by all
+     * the layers. The returned array has no mip levels, call
+     * generateMipMaps() to build them.
+     */
+    ImageArray resized(uint32_t w, uint32_t h, ImageFilter filter = ImageFilter::Mitchell, thread_pool * pool = nullptr) const
+    {
+        const auto tx = detail::make_resize_taps(getWidth(),  w, filter);
+        const auto ty = detail::make_resize_taps(getHeight(), h, filter);
 
-}
+        ImageArray out;
+        out.layer.resize(layer.size());
+        for(size_t l = 0; l < layer.size(); l++)
+        {
+            auto & src = layer[l].level.front();
+            auto & dst = out.layer[l].level.front();
+            dst.resize(w, h, src.getChannels());
+            detail::resize_image(src, dst, tx, ty, pool);
+        }
+        return out;
+    }
 
+    /**
+     * @brief generateMipMaps
+     * @param settings
+     *
+     * Generates the mipmaps for each of the layers.
+     * See ImageMM::generateMipMaps()
+     */
+    void generateMipMaps(MipMapSettings const & settings = {})
+    {
+        for(auto & l : layer)
+        {
+            l.generateMipMaps(settings);
+        }
+    }
 
-namespace std
-{
-template<>
-struct hash<gul::Image>
-{
-    static inline size_t hashCombine(size_t seed, size_t h2)
+    /**
+     * @brief generateMipMaps
+     * @param pool
+     * @param settings
+     *
+     * Generates the mipmaps for each of the layers. The layers
+     * are processed in parallel on the thread pool.
+     */
+    void generateMipMaps(thread_pool & pool, MipMapSettings const & settings = {})
     {
-        //std::hash<T> hasher;
-        seed ^= h2 + 0x9e3779b9 + (seed<<6) + (seed>>2);
-        return seed;
+        if( layer.size() == 1 )
+        {
+            layer.front().generateMipMaps(pool, settings);
+            return;
+        }
+        pool.parallel_for(0, layer.size(), [this, &settings](size_t l0, size_t l1)
+        {
+            for(size_t l = l0; l < l1; l++)
+            {
+                layer[l].generateMipMaps(settings);
+            }
+        });
     }
 
-    std::size_t operator()(gul::Image const & img) const noexcept
+    /**
+     * @brief allocateContiguous
+     * @param w
+     * @param h
+     * @param L - number of layers
+     * @param mips - number of mip levels per layer, 0 for the full chain
+     * @param channels
+     * @param alignment - alignment of each image, must be a power of 2
+     *
+     * Allocates every level of every layer in a single buffer. The buffer
+     * is ordered by mip level, then by layer, ie: all the base levels
+     * followed by all the second levels, etc. This is the order most
+     * graphics APIs expect when uploading an array texture.
+     */
+    void allocateContiguous(uint32_t w, uint32_t h, uint32_t L=1, uint32_t mips=1, uint32_t channels=4, size_t alignment=64)
+    {
+        auto count = detail::mip_level_count(w,h,mips);
+        layer.clear();
+        layer.resize(L);
+        for(auto & l : layer)
+            l.level.assign(count, Image(0,0,channels));
+
+        std::vector<detail::image_shape> shapes;
+        for(uint32_t i = 0; i < count; i++)
+            for(uint32_t j = 0; j < L; j++)
+                shapes.push_back( {w >> i, h >> i, channels} );
+
+        m_storage.pack(_imagePtrs(*this), shapes, alignment);
+    }
+
+    /**
+     * @brief makeContiguous
+     * @param alignment
+     *
+     * Moves all the existing images into a single buffer, keeping their
+     * contents. Uses the same ordering as allocateContiguous().
+     */
+    void makeContiguous(size_t alignment=64)
+    {
+        std::vector<detail::image_shape> shapes;
+        for(auto * I : _imagePtrs(*this))
+            shapes.push_back( {I->getWidth(), I->getHeight(), I->getChannels()} );
+        m_storage.pack(_imagePtrs(*this), shapes, alignment);
+    }
+
+    /**
+     * @brief isContiguous
+     * @return
+     *
+     * Returns true if all images are still views into the buffer created
+     * by allocateContiguous()/makeContiguous().
+     */
+    bool isContiguous() const
+    {
+        return m_storage.holds( _imagePtrs(*this) );
+    }
+
+    /**
+     * @brief getOffset
+     * @param layerIndex
+     * @param levelIndex
+     * @return
+     *
+     * Returns the byte offset of the image from contiguousData().
+     * The array must be contiguous.
+     */
+    size_t getOffset(uint32_t layerIndex, uint32_t levelIndex) const
+    {
+        assert( isContiguous() );
+        auto * I = static_cast<uint8_t const*>( layer.at(layerIndex).level.at(levelIndex).data() );
+        return static_cast<size_t>(I - m_storage.data);
+    }
+
+    /**
+     * @brief getLevelOffsets
+     * @return
+     *
+     * Returns the byte offset of each mip level from contiguousData(). The
+     * layers of a level follow each other, the stride between them is
+     * getOffset(1,i)-getOffset(0,i). Empty if the array is not contiguous.
+     */
+    std::vector<size_t> getLevelOffsets() const
     {
-        auto     w = img.getWidth();
-        auto     h = img.getHeight();
-        uint32_t c = img.getChannels();
+        std::vector<size_t> out;
+        if( isContiguous() )
+        {
+            for(uint32_t i = 0; i < layer.front().getLevelCount(); i++)
+                out.push_back( getOffset(0,i) );
+        }
+        return out;
+    }
 
-        std::hash<uint32_t> Hu;
+    void const * contiguousData() const
+    {
+        return isContiguous() ? m_storage.data : nullptr;
+    }
+    void * contiguousData()
+    {
+        return isContiguous() ? m_storage.data : nullptr;
+    }
+    size_t contiguousByteSize() const
+    {
+        return isContiguous() ? m_storage.size : 0;
+    }
 
-        auto seed = Hu(w);
-        seed = hashCombine(seed, Hu(h) );
-        seed = hashCombine(seed, Hu(c) );
+    /**
+     * @brief _imagePtrs
+     * @return
+     *
+     * Returns all the images ordered by mip level, then by layer.
+     */
+    template<typename Array>
+    static auto _imagePtrs(Array & A) -> std::vector<decltype(&A.layer[0].level[0])>
+    {
+        std::vector<decltype(&A.layer[0].level[0])> p;
+        size_t count = 0;
+        for(auto & l : A.layer)
+            count = std::max(count, l.level.size());
+        for(size_t i = 0; i < count; i++)
+        {
+            for(auto & l : A.layer)
+            {
+                if( i < l.level.size() )
+                    p.push_back( &l.level[i] );
+            }
+        }
+        return p;
+    }
 
-        auto * begin = static_cast<uint32_t const*>(img.data());
-        for(uint32_t i=0;i<w*h;i++)
+    void _copyFrom(ImageArray const & other)
+    {
+        if( !other.isContiguous() )
         {
-            seed = hashCombine(seed, Hu(*begin++));
+            layer     = other.layer;
+            m_storage = {};
+            return;
         }
-        return seed;
+        layer.clear();
+        layer.resize( other.layer.size() );
+        for(size_t j = 0; j < layer.size(); j++)
+            layer[j].level.assign(other.layer[j].level.size(), Image(0,0,0));
+
+        std::vector<detail::image_shape> shapes;
+        for(auto * I : _imagePtrs(other))
+            shapes.push_back( {I->getWidth(), I->getHeight(), I->getChannels()} );
+        m_storage.pack(_imagePtrs(*this), shapes, other.m_storage.alignment);
+        memcpy(m_storage.data, other.m_storage.data, m_storage.size);
+    }
+
+    detail::contiguous_storage m_storage;
+};
+
+}
+
+
+namespace std
+{
+template<>
+struct hash<gul::Image>
+{
+    std::size_t operator()(gul::Image const & img) const noexcept
+    {
+        return static_cast<std::size_t>( img.hash() );
     }
 };
 
@@ -0,0 +1,531 @@
+#ifndef GUL_ATLAS_PACKER_H
+#define GUL_ATLAS_PACKER_H
+
+#include "../Image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <string>
+
+namespace gul
+{
+
+/**
+ * @brief The SkylinePacker class
+ *
+ * Packs rectangles into a w x h area using the skyline bottom-left
+ * heuristic. The skyline is the list of horizontal segments making up the
+ * top edge of the rectangles placed so far. A new rectangle is placed on
+ * the segment where its top edge ends up lowest, ties are broken by the
+ * narrowest segment. Each insertion is linear in the number of segments,
+ * which stays small compared to the number of rectangles.
+ */
+class SkylinePacker
+{
+public:
+    SkylinePacker(uint32_t w = 0, uint32_t h = 0)
+    {
+        reset(w,h);
+    }
+
+    void reset(uint32_t w, uint32_t h)
+    {
+        m_width  = w;
+        m_height = h;
+        m_area   = 0;
+        m_usedWidth = m_usedHeight = 0;
+        m_nodes.clear();
+        m_nodes.push_back( {0, 0, w} );
+    }
+
+    /**
+     * @brief insert
+     * @param w
+     * @param h
+     * @param x - set to the position of the rectangle
+     * @param y
+     * @return
+     *
+     * Places a w x h rectangle. Returns false, and leaves the packer
+     * unchanged, if it does not fit.
+     */
+    bool insert(uint32_t w, uint32_t h, uint32_t & x, uint32_t & y)
+    {
+        if( w == 0 || h == 0 || w > m_width || h > m_height )
+            return false;
+
+        size_t   best      = m_nodes.size();
+        uint32_t bestTop   = std::numeric_limits<uint32_t>::max();
+        uint32_t bestWidth = std::numeric_limits<uint32_t>::max();
+        uint32_t bestY     = 0;
+
+        for(size_t i = 0; i < m_nodes.size(); i++)
+        {
+            uint32_t ny;
+            if( !_fit(i, w, h, ny) )
+                continue;
+            const uint32_t top = ny + h;
+            if( top < bestTop || (top == bestTop && m_nodes[i].width < bestWidth) )
+            {
+                best      = i;
+                bestTop   = top;
+                bestWidth = m_nodes[i].width;
+                bestY     = ny;
+            }
+        }
+        if( best == m_nodes.size() )
+            return false;
+
+        x = m_nodes[best].x;
+        y = bestY;
+        _addLevel(best, x, y + h, w);
+
+        m_area      += uint64_t(w) * h;
+        m_usedWidth  = std::max(m_usedWidth, x + w);
+        m_usedHeight = std::max(m_usedHeight, y + h);
+        return true;
+    }
+
+    uint32_t getWidth() const
+    {
+        return m_width;
+    }
+    uint32_t getHeight() const
+    {
+        return m_height;
+    }
+    /**
+     * @brief getUsedWidth
+     * @return
+     *
+     * The right most edge of all the rectangles placed so far.
+     */
+    uint32_t getUsedWidth() const
+    {
+        return m_usedWidth;
+    }
+    uint32_t getUsedHeight() const
+    {
+        return m_usedHeight;
+    }
+    /**
+     * @brief occupancy
+     * @return
+     *
+     * The fraction of the area covered by rectangles.
+     */
+    double occupancy() const
+    {
+        const double total = double(m_width) * double(m_height);
+        return total > 0.0 ? double(m_area) / total : 0.0;
+    }
+
+protected:
+    struct node
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    // the lowest y at which a w x h rectangle can sit with its left edge at node i
+    bool _fit(size_t i, uint32_t w, uint32_t h, uint32_t & y) const
+    {
+        if( m_nodes[i].x + w > m_width )
+            return false;
+        y = 0;
+        uint32_t left = w;
+        while( left > 0 )
+        {
+            y = std::max(y, m_nodes[i].y);
+            if( y + h > m_height )
+                return false;
+            left -= std::min(left, m_nodes[i].width);
+            i++;
+        }
+        return true;
+    }
+
+    // raises the skyline over [x, x+w) to y
+    void _addLevel(size_t i, uint32_t x, uint32_t y, uint32_t w)
+    {
+        m_nodes.insert( m_nodes.begin() + static_cast<std::ptrdiff_t>(i), node{x, y, w} );
+
+        // shrink or remove the segments now covered by the new one
+        const uint32_t end = x + w;
+        size_t j = i + 1;
+        while( j < m_nodes.size() && m_nodes[j].x < end )
+        {
+            const uint32_t nodeEnd = m_nodes[j].x + m_nodes[j].width;
+            if( nodeEnd <= end )
+            {
+                m_nodes.erase( m_nodes.begin() + static_cast<std::ptrdiff_t>(j) );
+                continue;
+            }
+            m_nodes[j].width = nodeEnd - end;
+            m_nodes[j].x     = end;
+            break;
+        }
+
+        // only the new segment can now be level with its neighbours
+        if( i + 1 < m_nodes.size() && m_nodes[i+1].y == y )
+        {
+            m_nodes[i].width += m_nodes[i+1].width;
+            m_nodes.erase( m_nodes.begin() + static_cast<std::ptrdiff_t>(i+1) );
+        }
+        if( i > 0 && m_nodes[i-1].y == y )
+        {
+            m_nodes[i-1].width += m_nodes[i].width;
+            m_nodes.erase( m_nodes.begin() + static_cast<std::ptrdiff_t>(i) );
+        }
+    }
+
+    std::vector<node> m_nodes;
+    uint32_t          m_width      = 0;
+    uint32_t          m_height     = 0;
+    uint32_t          m_usedWidth  = 0;
+    uint32_t          m_usedHeight = 0;
+    uint64_t          m_area       = 0;
+};
+
+/**
+ * @brief The AtlasSettings struct
+ *
+ * Each sprite is placed in a cell made up of the sprite, a gutter on
+ * every side and padding on the right and bottom:
+ *
+ *  - gutter:  the edge pixels of the sprite are repeated this many times
+ *             around it, so that bilinear filtering at the edge of the
+ *             sprite does not pick up its neighbours.
+ *  - padding: empty (zero) pixels between the cells.
+ *  - mipLevels: the cells are aligned to, and sized in multiples of,
+ *             2^(mipLevels-1) pixels so that every cell covers whole texels
+ *             in each of the first mipLevels levels and the sprites do not
+ *             bleed into each other when the atlas is mipmapped. Use a
+ *             gutter of at least 2^(mipLevels-1) to keep filtering clean in
+ *             the smallest level.
+ */
+struct AtlasSettings
+{
+    uint32_t pageWidth   = 2048;
+    uint32_t pageHeight  = 2048;
+    uint32_t channels    = 4;
+    uint32_t padding     = 1;
+    uint32_t gutter      = 0;
+    uint32_t mipLevels   = 1;
+    uint32_t maxPages    = 0;     // 0 for unlimited
+    bool     shrinkPages = true;  // shrink each page to the smallest power of two holding its cells
+};
+
+/**
+ * @brief The AtlasRect struct
+ *
+ * Where a sprite ended up. x,y,width,height are in pixels and exclude the
+ * gutter. The UVs cover the same rectangle, normalized by the page size.
+ */
+struct AtlasRect
+{
+    uint32_t page   = 0;
+    uint32_t x      = 0;
+    uint32_t y      = 0;
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    float    u0 = 0.0f;
+    float    v0 = 0.0f;
+    float    u1 = 0.0f;
+    float    v1 = 0.0f;
+};
+
+/**
+ * @brief The AtlasLayout struct
+ *
+ * The result of packing, without any pixels. rects is in the same order
+ * as the sprites.
+ */
+struct AtlasLayout
+{
+    struct page_size
+    {
+        uint32_t width;
+        uint32_t height;
+    };
+    std::vector<page_size> pages;
+    std::vector<AtlasRect> rects;
+};
+
+struct Atlas
+{
+    std::vector<Image>     pages;
+    std::vector<AtlasRect> rects;
+};
+
+/**
+ * @brief packAtlas
+ * @param count
+ * @param size
+ * @param settings
+ * @return
+ *
+ * Computes the placement of count sprites, the size of sprite i is
+ * given by size(i, w, h). Sprites are placed tallest first, each one into
+ * the first page it fits in. Throws std::runtime_error if a sprite is
+ * larger than a page or maxPages is reached.
+ */
+template<typename SizeFunc>
+AtlasLayout packAtlas(size_t count, SizeFunc && size, AtlasSettings const & settings = {})
+{
+    const uint32_t align  = 1u << std::min(settings.mipLevels ? settings.mipLevels - 1 : 0u, 16u);
+    const uint32_t g      = settings.gutter;
+    const uint32_t pad    = settings.padding;
+    // the padding of the cells on the right/bottom edge may hang off the page
+    const uint32_t packW  = (settings.pageWidth  / align) * align + pad;
+    const uint32_t packH  = (settings.pageHeight / align) * align + pad;
+
+    auto cellSize = [&](uint32_t s)
+    {
+        const uint64_t c = uint64_t(s) + 2u*g + pad;
+        return static_cast<uint32_t>( std::min<uint64_t>( (c + align - 1) / align * align, std::numeric_limits<uint32_t>::max() ) );
+    };
+
+    AtlasLayout L;
+    L.rects.resize(count);
+
+    std::vector<uint32_t> cw(count), ch(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        uint32_t w = 0, h = 0;
+        size(i, w, h);
+        L.rects[i].width  = w;
+        L.rects[i].height = h;
+        cw[i] = cellSize(w);
+        ch[i] = cellSize(h);
+        if( w && h && ( uint64_t(w) + 2u*g > settings.pageWidth || uint64_t(h) + 2u*g > settings.pageHeight ) )
+        {
+            throw std::runtime_error("Sprite " + std::to_string(i) + " is larger than the atlas page");
+        }
+    }
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        if( ch[a] != ch[b] ) return ch[a] > ch[b];
+        if( cw[a] != cw[b] ) return cw[a] > cw[b];
+        return a < b;
+    });
+
+    std::vector<SkylinePacker> packers;
+    for(auto i : order)
+    {
+        auto & R = L.rects[i];
+        if( R.width == 0 || R.height == 0 )
+            continue;
+
+        uint32_t x = 0, y = 0;
+        size_t   p = 0;
+        for(; p < packers.size(); p++)
+        {
+            if( packers[p].insert(cw[i], ch[i], x, y) )
+                break;
+        }
+        if( p == packers.size() )
+        {
+            if( settings.maxPages && packers.size() == settings.maxPages )
+                throw std::runtime_error("The sprites do not fit in " + std::to_string(settings.maxPages) + " atlas pages");
+            packers.emplace_back(packW, packH);
+            packers.back().insert(cw[i], ch[i], x, y);
+        }
+        R.page = static_cast<uint32_t>(p);
+        R.x    = x + g;
+        R.y    = y + g;
+    }
+
+    auto pageSize = [&](uint32_t used, uint32_t full)
+    {
+        if( !settings.shrinkPages )
+            return full;
+        uint32_t s = 1;
+        while( s < used && s < full )
+            s *= 2;
+        return std::min(s, full);
+    };
+    for(auto & P : packers)
+    {
+        // the used size includes the trailing padding, which may be dropped
+        const uint32_t uw = std::min(P.getUsedWidth(),  settings.pageWidth);
+        const uint32_t uh = std::min(P.getUsedHeight(), settings.pageHeight);
+        L.pages.push_back( { pageSize(uw, settings.pageWidth), pageSize(uh, settings.pageHeight) } );
+    }
+
+    for(auto & R : L.rects)
+    {
+        if( R.page >= L.pages.size() )
+            continue;
+        const float pw = float(L.pages[R.page].width);
+        const float ph = float(L.pages[R.page].height);
+        R.u0 = float(R.x) / pw;
+        R.v0 = float(R.y) / ph;
+        R.u1 = float(R.x + R.width)  / pw;
+        R.v1 = float(R.y + R.height) / ph;
+    }
+    return L;
+}
+
+namespace detail
+{
+
+/**
+ * @brief convert_pixels
+ *
+ * Converts w pixels from sC to dC channels. Grey is expanded to RGB,
+ * RGB is reduced to its first channel and a missing alpha becomes 255.
+ */
+inline void convert_pixels(uint8_t const * src, uint32_t sC, uint8_t * dst, uint32_t dC, uint32_t w)
+{
+    if( sC == dC )
+    {
+        std::memcpy(dst, src, size_t(w) * sC);
+        return;
+    }
+    const uint32_t sA = alpha_channel_index(sC);   // also the number of colour channels
+    const uint32_t dA = alpha_channel_index(dC);
+    for(uint32_t i = 0; i < w; i++)
+    {
+        uint8_t const * s = src + size_t(i) * sC;
+        uint8_t *       d = dst + size_t(i) * dC;
+        for(uint32_t c = 0; c < dA; c++)
+            d[c] = sA ? s[ std::min(c, sA-1) ] : 0;
+        if( dA < dC )
+            d[dA] = sA < sC ? s[sA] : 255;
+    }
+}
+
+/**
+ * @brief blit_sprite
+ *
+ * Copies a sprite into the page at (x,y) and fills the gutter of g pixels
+ * around it by repeating the edge pixels.
+ */
+inline void blit_sprite(ConstImageView const & S, Image & page, uint32_t x, uint32_t y, uint32_t g,
+                        std::vector<uint8_t> & row)
+{
+    const uint32_t C = page.getChannels();
+    const uint32_t w = S.getWidth();
+    const uint32_t h = S.getHeight();
+    const size_t   rowSize = size_t(w + 2*g) * C;
+    row.resize(rowSize);
+
+    auto * base = static_cast<uint8_t*>(page.data());
+    const size_t pitch = size_t(page.getWidth()) * C;
+
+    for(uint32_t j = 0; j < h; j++)
+    {
+        convert_pixels(S.row(j), S.getChannels(), row.data() + size_t(g) * C, C, w);
+        for(uint32_t i = 0; i < g; i++)
+        {
+            std::memcpy(row.data() + size_t(i) * C,         row.data() + size_t(g) * C,         C);
+            std::memcpy(row.data() + size_t(g + w + i) * C, row.data() + size_t(g + w - 1) * C, C);
+        }
+        auto * out = base + size_t(y + j) * pitch + size_t(x - g) * C;
+        std::memcpy(out, row.data(), rowSize);
+    }
+    for(uint32_t i = 0; i < g; i++)
+    {
+        auto * top    = base + size_t(y) * pitch + size_t(x - g) * C;
+        auto * bottom = base + size_t(y + h - 1) * pitch + size_t(x - g) * C;
+        std::memcpy(top    - size_t(i + 1) * pitch, top,    rowSize);
+        std::memcpy(bottom + size_t(i + 1) * pitch, bottom, rowSize);
+    }
+}
+
+inline Atlas build_atlas(std::vector<ConstImageView> const & sprites, AtlasSettings const & settings, thread_pool * pool)
+{
+    if( settings.channels == 0 || settings.channels > 4 )
+        throw std::logic_error("Atlas pages must have 1-4 channels");
+
+    auto L = packAtlas(sprites.size(), [&](size_t i, uint32_t & w, uint32_t & h)
+    {
+        w = sprites[i].getWidth();
+        h = sprites[i].getHeight();
+    }, settings);
+
+    Atlas A;
+    A.rects = std::move(L.rects);
+    for(auto & P : L.pages)
+        A.pages.emplace_back(P.width, P.height, settings.channels);
+
+    // the cells do not overlap, so the sprites can be copied in any order
+    auto blit = [&](size_t i0, size_t i1)
+    {
+        std::vector<uint8_t> row;
+        for(size_t i = i0; i < i1; i++)
+        {
+            auto & R = A.rects[i];
+            if( R.width && R.height )
+                blit_sprite(sprites[i], A.pages[R.page], R.x, R.y, settings.gutter, row);
+        }
+    };
+    if( pool )
+        pool->parallel_for(0, sprites.size(), blit, 64);
+    else
+        blit(0, sprites.size());
+    return A;
+}
+
+inline Atlas build_atlas(std::vector<Image> const & images, AtlasSettings const & settings, thread_pool * pool)
+{
+    // the views of planar sprites hold interleaved copies
+    std::vector<ConstImageView> V(images.begin(), images.end());
+    return build_atlas(V, settings, pool);
+}
+
+}
+
+/**
+ * @brief buildAtlas
+ * @param sprites
+ * @param settings
+ * @return
+ *
+ * Packs the sprites into one or more pages, see AtlasSettings. The
+ * sprites may have any number of channels, they are converted to
+ * settings.channels. Atlas::rects is in the same order as sprites.
+ */
+inline Atlas buildAtlas(std::vector<ConstImageView> const & sprites, AtlasSettings const & settings = {})
+{
+    return detail::build_atlas(sprites, settings, nullptr);
+}
+
+/**
+ * @brief buildAtlas
+ * @param pool
+ * @param sprites
+ * @param settings
+ * @return
+ *
+ * Same as buildAtlas(sprites, settings) but the sprites are copied into
+ * the pages on the thread pool. The result is identical.
+ */
+inline Atlas buildAtlas(thread_pool & pool, std::vector<ConstImageView> const & sprites, AtlasSettings const & settings = {})
+{
+    return detail::build_atlas(sprites, settings, &pool);
+}
+
+inline Atlas buildAtlas(std::vector<Image> const & sprites, AtlasSettings const & settings = {})
+{
+    return detail::build_atlas(sprites, settings, nullptr);
+}
+
+inline Atlas buildAtlas(thread_pool & pool, std::vector<Image> const & sprites, AtlasSettings const & settings = {})
+{
+    return detail::build_atlas(sprites, settings, &pool);
+}
+
+}
+
+#endif
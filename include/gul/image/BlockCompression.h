@@ -0,0 +1,1585 @@
+#ifndef GUL_IMAGE_BLOCK_COMPRESSION_H
+#define GUL_IMAGE_BLOCK_COMPRESSION_H
+
+#include "../Image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace gul
+{
+
+/**
+ * @brief The BCFormat enum
+ *
+ * The GPU block compression formats. Each format encodes 4x4 pixel blocks
+ * into a fixed number of bytes.
+ */
+enum class BCFormat
+{
+    BC1,  // RGB + 1-bit alpha, 8 bytes per block
+    BC3,  // RGBA, BC1 colour + BC4 alpha, 16 bytes per block
+    BC4,  // R, 8 bytes per block
+    BC5,  // RG, two BC4 blocks, 16 bytes per block
+    BC7   // RGBA, 16 bytes per block
+};
+
+/**
+ * @brief The BCSettings struct
+ *
+ * quality trades encoding speed for quality:
+ *
+ *   BC1/BC3/BC4/BC5: the number of endpoint refinement passes.
+ *   BC7: 0 - mode 6 only
+ *        1 - mode 6, plus mode 5 for blocks with varying alpha (default)
+ *        2 - also tries modes 4/5 with every channel rotation and the
+ *            two subset modes 1/3/7 with the 4 most promising partitions
+ *        3 - same as 2, but with the 16 most promising partitions
+ */
+struct BCSettings
+{
+    uint32_t quality = 1;
+};
+
+/**
+ * @brief The CompressedImage struct
+ *
+ * A block compressed image. The blocks are stored row by row,
+ * ceil(width/4) blocks per row. Images whose sizes are not a multiple
+ * of 4 are padded by repeating the last row/column.
+ */
+struct CompressedImage
+{
+    BCFormat             format = BCFormat::BC1;
+    uint32_t             width  = 0;
+    uint32_t             height = 0;
+    std::vector<uint8_t> data;
+
+    uint32_t blocksX() const
+    {
+        return (width + 3) / 4;
+    }
+    uint32_t blocksY() const
+    {
+        return (height + 3) / 4;
+    }
+};
+
+inline uint32_t bcBlockBytes(BCFormat f)
+{
+    return (f == BCFormat::BC1 || f == BCFormat::BC4) ? 8u : 16u;
+}
+
+/**
+ * @brief bcChannels
+ * @param f
+ * @return
+ *
+ * Returns the number of channels of a decompressed image.
+ */
+inline uint32_t bcChannels(BCFormat f)
+{
+    switch(f)
+    {
+        case BCFormat::BC4: return 1;
+        case BCFormat::BC5: return 2;
+        default:            return 4;
+    }
+}
+
+namespace detail
+{
+
+// ----------------------------------------------------------------------------
+// Block loading
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief bc_load_block
+ *
+ * Reads the 4x4 block (bx,by) as RGBA, clamping at the image edges.
+ * Missing channels are filled in the same way as a GPU samples them:
+ * 1 channel: (r,r,r,255), 2 channels: (r,g,0,255), 3 channels: (r,g,b,255)
+ * Both the interleaved and the planar layout can be read.
+ */
+inline void bc_load_block(Image const & I, uint32_t bx, uint32_t by, uint8_t px[16][4])
+{
+    const uint32_t C = I.getChannels();
+    // distance between two pixels of a channel and between two channels
+    const size_t pixelStep   = I.isPlanar() ? 1 : C;
+    const size_t channelStep = I.isPlanar() ? size_t(I.getWidth()) * I.getHeight() : 1;
+    for(uint32_t j = 0; j < 4; j++)
+    {
+        const uint32_t y = std::min(by*4 + j, I.getHeight() - 1);
+        for(uint32_t i = 0; i < 4; i++)
+        {
+            const uint32_t x = std::min(bx*4 + i, I.getWidth() - 1);
+            auto * s = static_cast<uint8_t const*>(I.data()) + (size_t(y) * I.getWidth() + x) * pixelStep;
+            auto * d = px[j*4 + i];
+            uint8_t v[4] = {0, 0, 0, 255};
+            for(uint32_t c = 0; c < C; c++)
+                v[c] = s[c * channelStep];
+            if( C == 1 )
+                v[1] = v[2] = v[0];
+            memcpy(d, v, 4);
+        }
+    }
+}
+
+inline void bc_store_block(Image & I, uint32_t bx, uint32_t by, uint8_t const px[16][4])
+{
+    const uint32_t C = I.getChannels();
+    auto * base = static_cast<uint8_t*>(I.data());
+    for(uint32_t j = 0; j < 4 && by*4 + j < I.getHeight(); j++)
+    {
+        for(uint32_t i = 0; i < 4 && bx*4 + i < I.getWidth(); i++)
+        {
+            auto * d = base + (size_t(by*4 + j) * I.getWidth() + bx*4 + i) * C;
+            memcpy(d, px[j*4 + i], C);
+        }
+    }
+}
+
+/**
+ * @brief The bc_bits struct
+ *
+ * Reads/writes bit fields of a 128-bit block, least significant bit first.
+ */
+struct bc_bits
+{
+    uint8_t * block;
+    uint32_t  pos = 0;
+
+    void write(uint32_t value, uint32_t bits)
+    {
+        for(uint32_t i = 0; i < bits; i++, pos++)
+        {
+            block[pos >> 3] = static_cast<uint8_t>( block[pos >> 3] | (((value >> i) & 1u) << (pos & 7u)) );
+        }
+    }
+    uint32_t read(uint32_t bits)
+    {
+        uint32_t v = 0;
+        for(uint32_t i = 0; i < bits; i++, pos++)
+        {
+            v |= ((static_cast<uint32_t>(block[pos >> 3]) >> (pos & 7u)) & 1u) << i;
+        }
+        return v;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// BC1
+// ----------------------------------------------------------------------------
+
+inline uint16_t bc_pack565(float r, float g, float b)
+{
+    auto q = [](float v, float m)
+    {
+        return static_cast<uint32_t>( std::min(std::max(v * m / 255.0f + 0.5f, 0.0f), m) );
+    };
+    return static_cast<uint16_t>( (q(r,31.0f) << 11) | (q(g,63.0f) << 5) | q(b,31.0f) );
+}
+
+inline void bc_unpack565(uint16_t c, int out[3])
+{
+    const int r = (c >> 11) & 31;
+    const int g = (c >> 5)  & 63;
+    const int b =  c        & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * @brief bc1_palette
+ *
+ * Computes the 4 colours of a BC1 block. In 3-colour mode
+ * (c0 <= c1 and !force4) the last entry is transparent black.
+ */
+inline void bc1_palette(uint16_t c0, uint16_t c1, bool force4, int pal[4][4])
+{
+    bc_unpack565(c0, pal[0]);
+    bc_unpack565(c1, pal[1]);
+    pal[0][3] = pal[1][3] = 255;
+    if( c0 > c1 || force4 )
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            pal[2][c] = (2*pal[0][c] +   pal[1][c] + 1) / 3;
+            pal[3][c] = (  pal[0][c] + 2*pal[1][c] + 1) / 3;
+        }
+        pal[2][3] = pal[3][3] = 255;
+    }
+    else
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            pal[2][c] = (pal[0][c] + pal[1][c]) / 2;
+            pal[3][c] = 0;
+        }
+        pal[2][3] = 255;
+        pal[3][3] = 0;
+    }
+}
+
+/**
+ * @brief bc1_nearest
+ *
+ * Chooses the closest palette entry (squared RGB distance) for each of
+ * the 16 pixels. Only the first `count` palette entries are considered.
+ * Returns the total error.
+ */
+inline uint32_t bc1_nearest(float const r[16], float const g[16], float const b[16], int const pal[4][4], int count, uint8_t idx[16])
+{
+    float err = 0.0f;
+#if defined(GUL_IMAGE_SSE2)
+    for(int i = 0; i < 16; i += 4)
+    {
+        const __m128 R = _mm_loadu_ps(r + i);
+        const __m128 G = _mm_loadu_ps(g + i);
+        const __m128 B = _mm_loadu_ps(b + i);
+        __m128  best    = _mm_set1_ps( std::numeric_limits<float>::max() );
+        __m128i bestIdx = _mm_setzero_si128();
+        for(int k = 0; k < count; k++)
+        {
+            __m128 dr = _mm_sub_ps(R, _mm_set1_ps( static_cast<float>(pal[k][0]) ));
+            __m128 dg = _mm_sub_ps(G, _mm_set1_ps( static_cast<float>(pal[k][1]) ));
+            __m128 db = _mm_sub_ps(B, _mm_set1_ps( static_cast<float>(pal[k][2]) ));
+            __m128 d  = _mm_add_ps( _mm_add_ps( _mm_mul_ps(dr,dr), _mm_mul_ps(dg,dg) ), _mm_mul_ps(db,db) );
+            __m128i lt = _mm_castps_si128( _mm_cmplt_ps(d, best) );
+            best    = _mm_min_ps(d, best);
+            bestIdx = _mm_or_si128( _mm_andnot_si128(lt, bestIdx), _mm_and_si128(lt, _mm_set1_epi32(k)) );
+        }
+        alignas(16) float   e[4];
+        alignas(16) int32_t n[4];
+        _mm_store_ps(e, best);
+        _mm_store_si128( reinterpret_cast<__m128i*>(n), bestIdx);
+        for(int j = 0; j < 4; j++)
+        {
+            idx[i+j] = static_cast<uint8_t>(n[j]);
+            err += e[j];
+        }
+    }
+#else
+    for(int i = 0; i < 16; i++)
+    {
+        float best = std::numeric_limits<float>::max();
+        int   bi   = 0;
+        for(int k = 0; k < count; k++)
+        {
+            const float dr = r[i] - static_cast<float>(pal[k][0]);
+            const float dg = g[i] - static_cast<float>(pal[k][1]);
+            const float db = b[i] - static_cast<float>(pal[k][2]);
+            const float d  = (dr*dr + dg*dg) + db*db;
+            if( d < best )
+            {
+                best = d;
+                bi   = k;
+            }
+        }
+        idx[i] = static_cast<uint8_t>(bi);
+        err += best;
+    }
+#endif
+    return static_cast<uint32_t>(err);
+}
+
+/**
+ * @brief bc1_principal_axis
+ *
+ * Finds the endpoints of the line through the colours of the block
+ * which best fits them, using the principal axis of their covariance.
+ */
+inline void bc1_principal_axis(float const r[16], float const g[16], float const b[16], uint16_t mask, float e0[3], float e1[3])
+{
+    float mean[3] = {0,0,0};
+    float n = 0.0f;
+    for(int i = 0; i < 16; i++)
+    {
+        if( !(mask >> i & 1) ) continue;
+        mean[0] += r[i]; mean[1] += g[i]; mean[2] += b[i];
+        n += 1.0f;
+    }
+    for(auto & m : mean) m /= n;
+
+    float cov[6] = {0,0,0,0,0,0};
+    for(int i = 0; i < 16; i++)
+    {
+        if( !(mask >> i & 1) ) continue;
+        const float x = r[i]-mean[0], y = g[i]-mean[1], z = b[i]-mean[2];
+        cov[0] += x*x; cov[1] += x*y; cov[2] += x*z;
+        cov[3] += y*y; cov[4] += y*z; cov[5] += z*z;
+    }
+
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for(int it = 0; it < 8; it++)
+    {
+        const float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        const float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        const float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        const float m = std::max( std::max(std::fabs(x), std::fabs(y)), std::fabs(z) );
+        if( m <= 0.0f )
+            break;
+        axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+    }
+
+    float lo = std::numeric_limits<float>::max();
+    float hi = -lo;
+    for(int i = 0; i < 16; i++)
+    {
+        if( !(mask >> i & 1) ) continue;
+        const float t = (r[i]-mean[0])*axis[0] + (g[i]-mean[1])*axis[1] + (b[i]-mean[2])*axis[2];
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    const float len2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    for(int c = 0; c < 3; c++)
+    {
+        e0[c] = mean[c] + axis[c] * hi / len2;
+        e1[c] = mean[c] + axis[c] * lo / len2;
+    }
+}
+
+/**
+ * @brief bc1_encode
+ * @param px
+ * @param out - 8 bytes
+ * @param force4 - always use 4-colour mode, required for the colour part of BC3
+ * @param iterations - least squares refinement passes
+ *
+ * Encodes the RGB part of a block. Unless force4 is set, blocks with
+ * pixels whose alpha is < 128 use 3-colour mode with transparent black.
+ */
+inline void bc1_encode(uint8_t const px[16][4], uint8_t out[8], bool force4, uint32_t iterations)
+{
+    float r[16], g[16], b[16];
+    uint16_t opaque = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        r[i] = px[i][0];
+        g[i] = px[i][1];
+        b[i] = px[i][2];
+        if( force4 || px[i][3] >= 128 )
+            opaque = static_cast<uint16_t>(opaque | (1u << i));
+    }
+
+    uint16_t c0 = 0, c1 = 0;
+    uint8_t  idx[16] = {};
+    const bool punchThrough = opaque != 0xFFFF;
+
+    if( opaque != 0 )
+    {
+        float e0[3], e1[3];
+        bc1_principal_axis(r, g, b, opaque, e0, e1);
+
+        // weights of endpoint 1 for each index
+        const float w4[4] = {0.0f, 1.0f, 1.0f/3.0f, 2.0f/3.0f};
+        const float w3[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+        auto const & w = punchThrough ? w3 : w4;
+
+        uint32_t bestErr = std::numeric_limits<uint32_t>::max();
+        for(uint32_t it = 0; it <= iterations; it++)
+        {
+            uint16_t a = bc_pack565(e0[0], e0[1], e0[2]);
+            uint16_t z = bc_pack565(e1[0], e1[1], e1[2]);
+            // 4-colour mode needs a > z, 3-colour mode needs a <= z
+            if( punchThrough ? (a > z) : (a < z) )
+                std::swap(a, z);
+
+            int pal[4][4];
+            bc1_palette(a, z, force4, pal);
+
+            uint8_t  cand[16];
+            uint32_t err = bc1_nearest(r, g, b, pal, punchThrough ? 3 : 4, cand);
+            if( punchThrough )
+            {
+                err = 0;
+                for(int i = 0; i < 16; i++)
+                {
+                    if( !(opaque >> i & 1) )
+                    {
+                        cand[i] = 3;
+                        continue;
+                    }
+                    for(int c = 0; c < 3; c++)
+                    {
+                        const int d = px[i][c] - pal[cand[i]][c];
+                        err += static_cast<uint32_t>(d*d);
+                    }
+                }
+            }
+            if( err < bestErr )
+            {
+                bestErr = err;
+                c0 = a; c1 = z;
+                memcpy(idx, cand, 16);
+            }
+            if( err == 0 || it == iterations )
+                break;
+
+            // least squares fit of the endpoints to the chosen indices
+            float aa = 0, bb = 0, ab = 0, ax[3] = {0,0,0}, bx[3] = {0,0,0};
+            for(int i = 0; i < 16; i++)
+            {
+                if( !(opaque >> i & 1) ) continue;
+                const float beta  = w[cand[i]];
+                const float alpha = 1.0f - beta;
+                aa += alpha*alpha; bb += beta*beta; ab += alpha*beta;
+                const float v[3] = {r[i], g[i], b[i]};
+                for(int c = 0; c < 3; c++)
+                {
+                    ax[c] += alpha*v[c];
+                    bx[c] += beta*v[c];
+                }
+            }
+            const float det = aa*bb - ab*ab;
+            if( std::fabs(det) < 1e-6f )
+                break;
+            for(int c = 0; c < 3; c++)
+            {
+                // the palette was built from (a,z), which may be swapped
+                const float A = (ax[c]*bb - bx[c]*ab) / det;
+                const float B = (bx[c]*aa - ax[c]*ab) / det;
+                e0[c] = A;
+                e1[c] = B;
+            }
+        }
+        if( c0 == c1 && !punchThrough )
+        {
+            memset(idx, 0, sizeof(idx));
+        }
+    }
+    else
+    {
+        // fully transparent
+        c0 = 0; c1 = 0xFFFF;
+        memset(idx, 3, sizeof(idx));
+    }
+
+    out[0] = static_cast<uint8_t>(c0 & 0xFF);
+    out[1] = static_cast<uint8_t>(c0 >> 8);
+    out[2] = static_cast<uint8_t>(c1 & 0xFF);
+    out[3] = static_cast<uint8_t>(c1 >> 8);
+    for(int j = 0; j < 4; j++)
+    {
+        out[4+j] = static_cast<uint8_t>( idx[4*j] | (idx[4*j+1] << 2) | (idx[4*j+2] << 4) | (idx[4*j+3] << 6) );
+    }
+}
+
+inline void bc1_decode(uint8_t const in[8], uint8_t px[16][4], bool force4)
+{
+    const uint16_t c0 = static_cast<uint16_t>( in[0] | (in[1] << 8) );
+    const uint16_t c1 = static_cast<uint16_t>( in[2] | (in[3] << 8) );
+    int pal[4][4];
+    bc1_palette(c0, c1, force4, pal);
+    for(int i = 0; i < 16; i++)
+    {
+        const int k = (in[4 + i/4] >> (2*(i%4))) & 3;
+        for(int c = 0; c < 4; c++)
+        {
+            px[i][c] = static_cast<uint8_t>(pal[k][c]);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// BC4
+// ----------------------------------------------------------------------------
+
+inline void bc4_palette(int a0, int a1, int pal[8])
+{
+    pal[0] = a0;
+    pal[1] = a1;
+    if( a0 > a1 )
+    {
+        for(int i = 1; i < 7; i++)
+            pal[i+1] = ((7-i)*a0 + i*a1 + 3) / 7;
+    }
+    else
+    {
+        for(int i = 1; i < 5; i++)
+            pal[i+1] = ((5-i)*a0 + i*a1 + 2) / 5;
+        pal[6] = 0;
+        pal[7] = 255;
+    }
+}
+
+/**
+ * @brief bc4_nearest
+ *
+ * Chooses the closest of the 8 palette values for each of the 16 values.
+ * Returns the total squared error.
+ */
+inline uint32_t bc4_nearest(uint8_t const v[16], int const pal[8], uint8_t idx[16])
+{
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i V = _mm_loadu_si128( reinterpret_cast<__m128i const*>(v) );
+    __m128i best    = _mm_set1_epi8( static_cast<char>(-1) );
+    __m128i bestIdx = _mm_setzero_si128();
+    for(int k = 0; k < 8; k++)
+    {
+        const __m128i P  = _mm_set1_epi8( static_cast<char>(pal[k]) );
+        const __m128i d  = _mm_or_si128( _mm_subs_epu8(V,P), _mm_subs_epu8(P,V) );
+        const __m128i m  = _mm_min_epu8(d, best);
+        const __m128i lt = _mm_andnot_si128( _mm_cmpeq_epi8(m, best), _mm_set1_epi8( static_cast<char>(-1) ) );
+        best    = m;
+        bestIdx = _mm_or_si128( _mm_andnot_si128(lt, bestIdx), _mm_and_si128(lt, _mm_set1_epi8( static_cast<char>(k) )) );
+    }
+    _mm_storeu_si128( reinterpret_cast<__m128i*>(idx), bestIdx);
+
+    // sum of squares
+    const __m128i z  = _mm_setzero_si128();
+    const __m128i lo = _mm_unpacklo_epi8(best, z);
+    const __m128i hi = _mm_unpackhi_epi8(best, z);
+    __m128i s = _mm_add_epi32( _mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi) );
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+    return static_cast<uint32_t>( _mm_cvtsi128_si32(s) );
+#else
+    uint32_t err = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        int best = 256, bi = 0;
+        for(int k = 0; k < 8; k++)
+        {
+            const int d = std::abs( int(v[i]) - pal[k] );
+            if( d < best )
+            {
+                best = d;
+                bi   = k;
+            }
+        }
+        idx[i] = static_cast<uint8_t>(bi);
+        err += static_cast<uint32_t>(best*best);
+    }
+    return err;
+#endif
+}
+
+/**
+ * @brief bc4_encode
+ *
+ * Encodes 16 values. Both the 8-value and the 6-value (with explicit
+ * 0 and 255) modes are tried. Each refinement pass also tries moving the
+ * endpoints inwards, by up to 2*iterations.
+ */
+inline void bc4_encode(uint8_t const v[16], uint8_t out[8], uint32_t iterations)
+{
+    int lo = 255, hi = 0, lo6 = 255, hi6 = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        lo = std::min<int>(lo, v[i]);
+        hi = std::max<int>(hi, v[i]);
+        if( v[i] != 0 && v[i] != 255 )
+        {
+            lo6 = std::min<int>(lo6, v[i]);
+            hi6 = std::max<int>(hi6, v[i]);
+        }
+    }
+
+    int      bestA0 = lo, bestA1 = lo;
+    uint8_t  bestIdx[16] = {};
+    uint32_t bestErr = std::numeric_limits<uint32_t>::max();
+
+    auto tryEndpoints = [&](int a0, int a1)
+    {
+        int pal[8];
+        uint8_t idx[16];
+        bc4_palette(a0, a1, pal);
+        const uint32_t err = bc4_nearest(v, pal, idx);
+        if( err < bestErr )
+        {
+            bestErr = err;
+            bestA0  = a0;
+            bestA1  = a1;
+            memcpy(bestIdx, idx, 16);
+        }
+    };
+
+    if( lo == hi )
+    {
+        tryEndpoints(lo, lo);
+    }
+    else
+    {
+        const int R = static_cast<int>(2*iterations);
+        for(int d0 = 0; d0 <= R && bestErr; d0++)
+        {
+            for(int d1 = 0; d1 <= R && bestErr; d1++)
+            {
+                if( hi - d0 > lo + d1 )
+                    tryEndpoints(hi - d0, lo + d1);
+                if( lo6 <= hi6 && lo6 + d0 <= hi6 - d1 )
+                    tryEndpoints(lo6 + d0, hi6 - d1);
+            }
+        }
+    }
+
+    out[0] = static_cast<uint8_t>(bestA0);
+    out[1] = static_cast<uint8_t>(bestA1);
+    uint64_t bits = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        bits |= uint64_t(bestIdx[i]) << (3*i);
+    }
+    for(int i = 0; i < 6; i++)
+    {
+        out[2+i] = static_cast<uint8_t>( bits >> (8*i) );
+    }
+}
+
+inline void bc4_decode(uint8_t const in[8], uint8_t v[16])
+{
+    int pal[8];
+    bc4_palette(in[0], in[1], pal);
+    uint64_t bits = 0;
+    for(int i = 0; i < 6; i++)
+    {
+        bits |= uint64_t(in[2+i]) << (8*i);
+    }
+    for(int i = 0; i < 16; i++)
+    {
+        v[i] = static_cast<uint8_t>( pal[ (bits >> (3*i)) & 7 ] );
+    }
+}
+
+// ----------------------------------------------------------------------------
+// BC7
+// ----------------------------------------------------------------------------
+
+struct bc7_mode_info
+{
+    uint8_t subsets;
+    uint8_t partitionBits;
+    uint8_t rotationBits;
+    uint8_t indexSelectionBits;
+    uint8_t colorBits;
+    uint8_t alphaBits;
+    uint8_t endpointPBits;   // one p-bit per endpoint
+    uint8_t sharedPBits;     // one p-bit per subset
+    uint8_t indexBits;
+    uint8_t indexBits2;      // separate alpha indices (modes 4 and 5)
+};
+
+inline bc7_mode_info const & bc7_mode(uint32_t m)
+{
+    static const bc7_mode_info modes[8] =
+    {
+        {3,4,0,0,4,0,1,0,3,0},
+        {2,6,0,0,6,0,0,1,3,0},
+        {3,6,0,0,5,0,0,0,2,0},
+        {2,6,0,0,7,0,1,0,2,0},
+        {1,0,2,1,5,6,0,0,2,3},
+        {1,0,2,0,7,8,0,0,2,2},
+        {1,0,0,0,7,7,1,0,4,0},
+        {2,6,0,0,5,5,1,0,2,0}
+    };
+    return modes[m];
+}
+
+// bit i is the subset of pixel i for the 64 two-subset partitions
+inline uint16_t bc7_partition2(uint32_t p)
+{
+    static const uint16_t table[64] =
+    {
+        0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+        0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+        0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+        0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+        0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+        0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+        0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+        0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+    };
+    return table[p];
+}
+
+// the pixel whose index has an implicit 0 msb in the second subset
+inline uint32_t bc7_anchor2(uint32_t p)
+{
+    static const uint8_t table[64] =
+    {
+        15,15,15,15,15,15,15,15, 15,15,15,15,15,15,15,15,
+        15, 2, 8, 2, 2, 8, 8,15,  2, 8, 2, 2, 8, 8, 2, 2,
+        15,15, 6, 8, 2, 8,15,15,  2, 8, 2, 2, 2,15,15, 6,
+         6, 2, 6, 8,15,15, 2, 2, 15,15,15,15,15, 2, 2,15
+    };
+    return table[p];
+}
+
+// bits 2i and 2i+1 are the subset of pixel i for the 64 three-subset partitions
+inline uint32_t bc7_partition3(uint32_t p)
+{
+    static const uint32_t table[64] =
+    {
+        0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+        0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+        0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+        0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+        0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+        0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+        0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+        0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254
+    };
+    return table[p];
+}
+
+// the pixels whose indices have an implicit 0 msb in the second (s=1)
+// and third (s=2) subsets of a three-subset partition
+inline uint32_t bc7_anchor3(uint32_t p, uint32_t s)
+{
+    static const uint8_t table[2][64] =
+    {
+        {
+             3,  3, 15, 15,  8,  3, 15, 15,   8,  8,  6,  6,  6,  5,  3,  3,
+             3,  3,  8, 15,  3,  3,  6, 10,   5,  8,  8,  6,  8,  5, 15, 15,
+             8, 15,  3,  5,  6, 10,  8, 15,  15,  3, 15,  5, 15, 15, 15, 15,
+             3, 15,  5,  5,  5,  8,  5, 10,   5, 10,  8, 13, 15, 12,  3,  3
+        },
+        {
+            15,  8,  8,  3, 15, 15,  3,  8,  15, 15, 15, 15, 15, 15, 15,  8,
+            15,  8, 15,  3, 15,  8, 15,  8,   3, 15,  6, 10, 15, 15, 10,  8,
+            15,  3, 15, 10, 10,  8,  9, 10,   6, 15,  8, 15,  3,  6,  6,  8,
+            15,  3, 15, 15, 15, 15, 15, 15,  15, 15, 15, 15,  3, 15, 15,  8
+        }
+    };
+    return table[s-1][p];
+}
+
+// the subset pixel i belongs to
+inline uint32_t bc7_subset(uint32_t subsets, uint32_t partition, uint32_t i)
+{
+    if( subsets == 2 )
+        return (uint32_t(bc7_partition2(partition)) >> i) & 1u;
+    if( subsets == 3 )
+        return (bc7_partition3(partition) >> (2*i)) & 3u;
+    return 0;
+}
+
+// true if the index of pixel i has an implicit 0 msb
+inline bool bc7_is_anchor(uint32_t subsets, uint32_t partition, uint32_t i)
+{
+    if( i == 0 )
+        return true;
+    if( subsets == 2 )
+        return i == bc7_anchor2(partition);
+    if( subsets == 3 )
+        return i == bc7_anchor3(partition, 1) || i == bc7_anchor3(partition, 2);
+    return false;
+}
+
+inline int const * bc7_weights(uint32_t bits)
+{
+    static const int w2[4]  = {0, 21, 43, 64};
+    static const int w3[8]  = {0, 9, 18, 27, 37, 46, 55, 64};
+    static const int w4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    return bits == 2 ? w2 : (bits == 3 ? w3 : w4);
+}
+
+inline int bc7_interpolate(int e0, int e1, int w)
+{
+    return ((64 - w)*e0 + w*e1 + 32) >> 6;
+}
+
+// expands an n-bit value to 8 bits by replicating its top bits
+inline int bc7_expand(int v, int n)
+{
+    v <<= (8 - n);
+    return v | (v >> n);
+}
+
+/**
+ * @brief bc7_decode
+ *
+ * Decodes a BC7 block in any of the 8 modes. The reserved mode (a
+ * first byte of 0) decodes to transparent black.
+ */
+inline void bc7_decode(uint8_t const in[16], uint8_t px[16][4])
+{
+    uint8_t block[16];
+    memcpy(block, in, 16);
+    bc_bits B{block};
+
+    uint32_t mode = 0;
+    while( mode < 8 && B.read(1) == 0 )
+        mode++;
+
+    if( mode >= 8 )
+    {
+        memset(px, 0, 64);
+        return;
+    }
+
+    auto const & M = bc7_mode(mode);
+    const uint32_t partition = B.read(M.partitionBits);
+    const uint32_t rotation  = B.read(M.rotationBits);
+    const uint32_t indexSel  = B.read(M.indexSelectionBits);
+
+    const uint32_t NS = M.subsets;
+    int ep[3][2][4] = {};   // [subset][endpoint][channel]
+    for(int c = 0; c < 3; c++)
+        for(uint32_t s = 0; s < NS; s++)
+            for(int e = 0; e < 2; e++)
+                ep[s][e][c] = static_cast<int>( B.read(M.colorBits) );
+    for(uint32_t s = 0; s < NS; s++)
+        for(int e = 0; e < 2; e++)
+            ep[s][e][3] = M.alphaBits ? static_cast<int>( B.read(M.alphaBits) ) : 255;
+
+    int cb = M.colorBits, ab = M.alphaBits;
+    if( M.endpointPBits || M.sharedPBits )
+    {
+        for(uint32_t s = 0; s < NS; s++)
+        {
+            const int p0 = static_cast<int>( B.read(1) );
+            const int p1 = M.endpointPBits ? static_cast<int>( B.read(1) ) : p0;
+            for(int c = 0; c < 4; c++)
+            {
+                if( c == 3 && !M.alphaBits )
+                    continue;
+                ep[s][0][c] = (ep[s][0][c] << 1) | p0;
+                ep[s][1][c] = (ep[s][1][c] << 1) | p1;
+            }
+        }
+        cb++;
+        if( ab ) ab++;
+    }
+    for(uint32_t s = 0; s < NS; s++)
+    {
+        for(int e = 0; e < 2; e++)
+        {
+            for(int c = 0; c < 3; c++)
+                ep[s][e][c] = bc7_expand(ep[s][e][c], cb);
+            if( ab )
+                ep[s][e][3] = bc7_expand(ep[s][e][3], ab);
+        }
+    }
+
+    uint32_t idx[16], idx2[16] = {};
+    for(uint32_t i = 0; i < 16; i++)
+    {
+        const bool anchor = bc7_is_anchor(NS, partition, i);
+        idx[i] = B.read(M.indexBits - (anchor ? 1u : 0u));
+    }
+    if( M.indexBits2 )
+    {
+        for(uint32_t i = 0; i < 16; i++)
+            idx2[i] = B.read(M.indexBits2 - (i == 0 ? 1u : 0u));
+    }
+
+    for(uint32_t i = 0; i < 16; i++)
+    {
+        const uint32_t s = bc7_subset(NS, partition, i);
+        int colorW, alphaW;
+        if( M.indexBits2 )
+        {
+            // mode 4/5, index selection swaps which set is used for colour
+            const int wa = bc7_weights(M.indexBits)[idx[i]];
+            const int wb = bc7_weights(M.indexBits2)[idx2[i]];
+            colorW = indexSel ? wb : wa;
+            alphaW = indexSel ? wa : wb;
+        }
+        else
+        {
+            colorW = alphaW = bc7_weights(M.indexBits)[idx[i]];
+        }
+
+        int p[4];
+        for(int c = 0; c < 3; c++)
+            p[c] = bc7_interpolate(ep[s][0][c], ep[s][1][c], colorW);
+        p[3] = bc7_interpolate(ep[s][0][3], ep[s][1][3], alphaW);
+
+        if( rotation )
+            std::swap(p[3], p[rotation - 1]);
+
+        for(int c = 0; c < 4; c++)
+            px[i][c] = static_cast<uint8_t>(p[c]);
+    }
+}
+
+/**
+ * @brief The bc7_endpoints struct
+ *
+ * The quantized endpoints and indices of one subset (or one index set).
+ */
+struct bc7_endpoints
+{
+    int      code[2][4] = {};  // quantized values
+    int      pbit[2]    = {};
+    uint8_t  idx[16]    = {};
+    uint64_t err        = std::numeric_limits<uint64_t>::max();
+};
+
+/**
+ * @brief bc7_fit
+ *
+ * Fits the endpoints of the pixels in mask, using channels [c0, c0+nc) of
+ * px (which may be rotated). bits is the number of bits per channel of the
+ * endpoints, pbits is 0 (none), 1 (one per endpoint) or 2 (shared).
+ */
+inline bc7_endpoints bc7_fit(int const px[16][4], uint16_t mask, int c0, int nc, int bits, int pbits, uint32_t indexBits, uint32_t iterations)
+{
+    const int * W      = bc7_weights(indexBits);
+    const int   levels = 1 << indexBits;
+
+    // initial endpoints from the principal axis
+    float mean[4] = {0,0,0,0};
+    float n = 0.0f;
+    for(int i = 0; i < 16; i++)
+    {
+        if( !(mask >> i & 1) ) continue;
+        for(int c = 0; c < nc; c++) mean[c] += static_cast<float>(px[i][c0+c]);
+        n += 1.0f;
+    }
+    for(int c = 0; c < nc; c++) mean[c] /= n;
+
+    float cov[4][4] = {};
+    for(int i = 0; i < 16; i++)
+    {
+        if( !(mask >> i & 1) ) continue;
+        float d[4];
+        for(int c = 0; c < nc; c++) d[c] = static_cast<float>(px[i][c0+c]) - mean[c];
+        for(int a = 0; a < nc; a++)
+            for(int b = 0; b < nc; b++)
+                cov[a][b] += d[a]*d[b];
+    }
+    float axis[4] = {1,1,1,1};
+    for(int it = 0; it < 8; it++)
+    {
+        float t[4] = {0,0,0,0};
+        float m = 0.0f;
+        for(int a = 0; a < nc; a++)
+        {
+            for(int b = 0; b < nc; b++) t[a] += cov[a][b]*axis[b];
+            m = std::max(m, std::fabs(t[a]));
+        }
+        if( m <= 0.0f ) break;
+        for(int a = 0; a < nc; a++) axis[a] = t[a] / m;
+    }
+    float lo = std::numeric_limits<float>::max(), hi = -lo, len2 = 0.0f;
+    for(int c = 0; c < nc; c++) len2 += axis[c]*axis[c];
+    for(int i = 0; i < 16; i++)
+    {
+        if( !(mask >> i & 1) ) continue;
+        float t = 0.0f;
+        for(int c = 0; c < nc; c++) t += (static_cast<float>(px[i][c0+c]) - mean[c]) * axis[c];
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    float e[2][4];
+    for(int c = 0; c < nc; c++)
+    {
+        e[0][c] = mean[c] + axis[c]*lo/len2;
+        e[1][c] = mean[c] + axis[c]*hi/len2;
+    }
+
+    const int total = bits + (pbits ? 1 : 0);
+    const int maxCode = (1 << bits) - 1;
+
+    // quantizes v with p-bit p, returns the code
+    auto quantize = [&](float v, int p)
+    {
+        const float full = v * float((1 << total) - 1) / 255.0f;
+        int q = pbits ? static_cast<int>( std::floor((full - float(p)) * 0.5f + 0.5f) )
+                      : static_cast<int>( std::floor(full + 0.5f) );
+        return std::min(std::max(q, 0), maxCode);
+    };
+    auto reconstruct = [&](int code, int p)
+    {
+        return pbits ? bc7_expand((code << 1) | p, total) : bc7_expand(code, bits);
+    };
+
+    bc7_endpoints best;
+    for(uint32_t it = 0; it <= iterations; it++)
+    {
+        // p-bit combinations to try
+        int combos[4][2] = {{0,0},{0,0},{0,0},{0,0}};
+        int nCombos = 1;
+        if( pbits == 1 )
+        {
+            nCombos = 4;
+            int k = 0;
+            for(int a = 0; a < 2; a++) for(int b = 0; b < 2; b++) { combos[k][0] = a; combos[k][1] = b; k++; }
+        }
+        else if( pbits == 2 )
+        {
+            nCombos = 2;
+            combos[1][0] = combos[1][1] = 1;
+        }
+
+        for(int pc = 0; pc < nCombos; pc++)
+        {
+            bc7_endpoints cand;
+            int rec[2][4];
+            for(int en = 0; en < 2; en++)
+            {
+                cand.pbit[en] = combos[pc][en];
+                for(int c = 0; c < nc; c++)
+                {
+                    cand.code[en][c] = quantize(e[en][c], cand.pbit[en]);
+                    rec[en][c]       = reconstruct(cand.code[en][c], cand.pbit[en]);
+                }
+            }
+
+            int pal[16][4];
+            for(int k = 0; k < levels; k++)
+                for(int c = 0; c < nc; c++)
+                    pal[k][c] = bc7_interpolate(rec[0][c], rec[1][c], W[k]);
+
+            uint64_t err = 0;
+            for(int i = 0; i < 16; i++)
+            {
+                if( !(mask >> i & 1) ) continue;
+                int bestD = std::numeric_limits<int>::max(), bi = 0;
+                for(int k = 0; k < levels; k++)
+                {
+                    int d = 0;
+                    for(int c = 0; c < nc; c++)
+                    {
+                        const int x = px[i][c0+c] - pal[k][c];
+                        d += x*x;
+                    }
+                    if( d < bestD )
+                    {
+                        bestD = d;
+                        bi    = k;
+                    }
+                }
+                cand.idx[i] = static_cast<uint8_t>(bi);
+                err += static_cast<uint64_t>(bestD);
+            }
+            cand.err = err;
+            if( err < best.err )
+                best = cand;
+        }
+
+        if( best.err == 0 || it == iterations )
+            break;
+
+        // least squares refinement using the best indices
+        float aa = 0, bb = 0, ab = 0, ax[4] = {0,0,0,0}, bx[4] = {0,0,0,0};
+        for(int i = 0; i < 16; i++)
+        {
+            if( !(mask >> i & 1) ) continue;
+            const float beta  = static_cast<float>(W[best.idx[i]]) / 64.0f;
+            const float alpha = 1.0f - beta;
+            aa += alpha*alpha; bb += beta*beta; ab += alpha*beta;
+            for(int c = 0; c < nc; c++)
+            {
+                ax[c] += alpha * static_cast<float>(px[i][c0+c]);
+                bx[c] += beta  * static_cast<float>(px[i][c0+c]);
+            }
+        }
+        const float det = aa*bb - ab*ab;
+        if( std::fabs(det) < 1e-6f )
+            break;
+        for(int c = 0; c < nc; c++)
+        {
+            e[0][c] = std::min(std::max( (ax[c]*bb - bx[c]*ab) / det, 0.0f), 255.0f);
+            e[1][c] = std::min(std::max( (bx[c]*aa - ax[c]*ab) / det, 0.0f), 255.0f);
+        }
+    }
+    return best;
+}
+
+// swaps the endpoints of a subset so that the anchor index has a 0 msb
+inline void bc7_fix_anchor(bc7_endpoints & E, uint16_t mask, uint32_t anchor, uint32_t indexBits)
+{
+    const int levels = 1 << indexBits;
+    if( E.idx[anchor] < levels/2 )
+        return;
+    for(int c = 0; c < 4; c++)
+        std::swap(E.code[0][c], E.code[1][c]);
+    std::swap(E.pbit[0], E.pbit[1]);
+    for(int i = 0; i < 16; i++)
+    {
+        if( mask >> i & 1 )
+            E.idx[i] = static_cast<uint8_t>(levels - 1 - E.idx[i]);
+    }
+}
+
+/**
+ * @brief bc7_pack
+ *
+ * Writes a block. For modes 4/5, E[0] holds the colour endpoints and E[1]
+ * the alpha endpoints (in channel 0), otherwise E[s] is subset s.
+ */
+inline void bc7_pack(uint32_t mode, uint32_t partition, uint32_t rotation, uint32_t indexSel,
+                     bc7_endpoints E[2], uint8_t out[16])
+{
+    memset(out, 0, 16);
+    bc_bits B{out};
+    auto const & M = bc7_mode(mode);
+
+    B.write(1u << mode, mode + 1);
+    B.write(partition, M.partitionBits);
+    B.write(rotation,  M.rotationBits);
+    B.write(indexSel,  M.indexSelectionBits);
+
+    const uint32_t NS = M.subsets;
+    if( M.indexBits2 )
+    {
+        for(int c = 0; c < 3; c++)
+            for(int e = 0; e < 2; e++)
+                B.write(static_cast<uint32_t>(E[0].code[e][c]), M.colorBits);
+        for(int e = 0; e < 2; e++)
+            B.write(static_cast<uint32_t>(E[1].code[e][0]), M.alphaBits);
+
+        // index selection 1 swaps which index set is stored first
+        auto & first  = indexSel ? E[1] : E[0];
+        auto & second = indexSel ? E[0] : E[1];
+        for(uint32_t i = 0; i < 16; i++)
+            B.write(first.idx[i], M.indexBits - (i == 0 ? 1u : 0u));
+        for(uint32_t i = 0; i < 16; i++)
+            B.write(second.idx[i], M.indexBits2 - (i == 0 ? 1u : 0u));
+        return;
+    }
+
+    for(int c = 0; c < 3; c++)
+        for(uint32_t s = 0; s < NS; s++)
+            for(int e = 0; e < 2; e++)
+                B.write(static_cast<uint32_t>(E[s].code[e][c]), M.colorBits);
+    if( M.alphaBits )
+        for(uint32_t s = 0; s < NS; s++)
+            for(int e = 0; e < 2; e++)
+                B.write(static_cast<uint32_t>(E[s].code[e][3]), M.alphaBits);
+    for(uint32_t s = 0; s < NS; s++)
+    {
+        B.write(static_cast<uint32_t>(E[s].pbit[0]), (M.endpointPBits || M.sharedPBits) ? 1u : 0u);
+        B.write(static_cast<uint32_t>(E[s].pbit[1]), M.endpointPBits ? 1u : 0u);
+    }
+
+    const uint16_t subsetMask = NS == 2 ? bc7_partition2(partition) : 0;
+    const uint32_t anchor2    = NS == 2 ? bc7_anchor2(partition) : 0;
+    for(uint32_t i = 0; i < 16; i++)
+    {
+        const uint32_t s = (subsetMask >> i) & 1u;
+        const bool anchor = i == 0 || (NS == 2 && i == anchor2);
+        B.write(E[s].idx[i], M.indexBits - (anchor ? 1u : 0u));
+    }
+}
+
+inline uint64_t bc7_block_error(uint8_t const block[16], uint8_t const px[16][4])
+{
+    uint8_t dec[16][4];
+    bc7_decode(block, dec);
+    uint64_t err = 0;
+    for(int i = 0; i < 16; i++)
+        for(int c = 0; c < 4; c++)
+        {
+            const int d = int(dec[i][c]) - int(px[i][c]);
+            err += static_cast<uint64_t>(d*d);
+        }
+    return err;
+}
+
+/**
+ * @brief bc7_partition_error
+ *
+ * Estimates how well a two subset partition fits the block: the part of
+ * the variance of each subset which is not along its principal axis.
+ */
+inline float bc7_partition_error(int const px[16][4], uint16_t mask, int nc)
+{
+    float total = 0.0f;
+    for(int s = 0; s < 2; s++)
+    {
+        const uint16_t m = static_cast<uint16_t>( s ? mask : ~mask );
+        float mean[4] = {0,0,0,0}, n = 0.0f;
+        for(int i = 0; i < 16; i++)
+        {
+            if( !(m >> i & 1) ) continue;
+            for(int c = 0; c < nc; c++) mean[c] += static_cast<float>(px[i][c]);
+            n += 1.0f;
+        }
+        if( n == 0.0f ) continue;
+        for(int c = 0; c < nc; c++) mean[c] /= n;
+
+        float cov[4][4] = {}, trace = 0.0f;
+        for(int i = 0; i < 16; i++)
+        {
+            if( !(m >> i & 1) ) continue;
+            float d[4];
+            for(int c = 0; c < nc; c++) d[c] = static_cast<float>(px[i][c]) - mean[c];
+            for(int a = 0; a < nc; a++)
+                for(int b = 0; b < nc; b++)
+                    cov[a][b] += d[a]*d[b];
+        }
+        for(int c = 0; c < nc; c++) trace += cov[c][c];
+
+        float axis[4] = {1,1,1,1}, lambda = 0.0f;
+        for(int it = 0; it < 6; it++)
+        {
+            float t[4] = {0,0,0,0}, mag = 0.0f;
+            for(int a = 0; a < nc; a++)
+            {
+                for(int b = 0; b < nc; b++) t[a] += cov[a][b]*axis[b];
+                mag += t[a]*t[a];
+            }
+            if( mag <= 0.0f ) break;
+            mag = std::sqrt(mag);
+            for(int a = 0; a < nc; a++) axis[a] = t[a] / mag;
+            lambda = mag;
+        }
+        total += std::max(trace - lambda, 0.0f);
+    }
+    return total;
+}
+
+/**
+ * @brief bc7_single_color
+ *
+ * For each 8-bit value, the pair of 7-bit mode 5 endpoints whose
+ * interpolation with index 1 reproduces it most closely. Solid blocks
+ * are encoded losslessly with these.
+ */
+inline uint8_t const (&bc7_single_color())[256][2]
+{
+    struct table
+    {
+        uint8_t v[256][2];
+        table()
+        {
+            for(int x = 0; x < 256; x++)
+            {
+                int best = 256;
+                for(int a = 0; a < 128 && best; a++)
+                {
+                    for(int b = 0; b < 128 && best; b++)
+                    {
+                        const int d = std::abs(bc7_interpolate(bc7_expand(a,7), bc7_expand(b,7), bc7_weights(2)[1]) - x);
+                        if( d < best )
+                        {
+                            best = d;
+                            v[x][0] = static_cast<uint8_t>(a);
+                            v[x][1] = static_cast<uint8_t>(b);
+                        }
+                    }
+                }
+            }
+        }
+    };
+    static const table T;
+    return T.v;
+}
+
+inline void bc7_encode(uint8_t const px8[16][4], uint8_t out[16], uint32_t quality)
+{
+    if( std::all_of(px8 + 1, px8 + 16, [&](uint8_t const * p){ return memcmp(p, px8[0], 4) == 0; }) )
+    {
+        auto const & T = bc7_single_color();
+        bc7_endpoints E[2];
+        for(int c = 0; c < 3; c++)
+        {
+            E[0].code[0][c] = T[px8[0][c]][0];
+            E[0].code[1][c] = T[px8[0][c]][1];
+        }
+        E[1].code[0][0] = E[1].code[1][0] = px8[0][3];
+        memset(E[0].idx, 1, 16);
+        bc7_pack(5, 0, 0, 0, E, out);
+        return;
+    }
+
+    int px[16][4];
+    bool opaque = true, constAlpha = true;
+    for(int i = 0; i < 16; i++)
+    {
+        for(int c = 0; c < 4; c++) px[i][c] = px8[i][c];
+        opaque     = opaque && px8[i][3] == 255;
+        constAlpha = constAlpha && px8[i][3] == px8[0][3];
+    }
+
+    const uint32_t iterations = quality == 0 ? 1 : 3;
+    uint8_t  block[16];
+    uint64_t bestErr = std::numeric_limits<uint64_t>::max();
+
+    auto consider = [&](uint8_t const candidate[16])
+    {
+        const uint64_t err = bc7_block_error(candidate, px8);
+        if( err < bestErr )
+        {
+            bestErr = err;
+            memcpy(out, candidate, 16);
+        }
+    };
+
+    // mode 6: RGBA endpoints, 4-bit indices
+    {
+        bc7_endpoints E[2];
+        E[0] = bc7_fit(px, 0xFFFF, 0, 4, 7, 1, 4, iterations);
+        bc7_fix_anchor(E[0], 0xFFFF, 0, 4);
+        bc7_pack(6, 0, 0, 0, E, block);
+        consider(block);
+    }
+
+    // modes 4/5: separate colour and alpha indices
+    if( bestErr && (quality >= 2 || (quality >= 1 && !constAlpha)) )
+    {
+        const uint32_t maxRotation = quality >= 2 ? 3 : 0;
+        for(uint32_t rot = 0; rot <= maxRotation; rot++)
+        {
+            int r[16][4];
+            for(int i = 0; i < 16; i++)
+            {
+                for(int c = 0; c < 4; c++) r[i][c] = px[i][c];
+                if( rot ) std::swap(r[i][3], r[i][rot-1]);
+            }
+            for(uint32_t mode = 5; mode >= 4; mode--)
+            {
+                if( mode == 4 && quality < 2 )
+                    break;
+                auto const & M = bc7_mode(mode);
+                const uint32_t maxSel = mode == 4 ? 1 : 0;
+                for(uint32_t sel = 0; sel <= maxSel; sel++)
+                {
+                    const uint32_t colorIdx = sel ? M.indexBits2 : M.indexBits;
+                    const uint32_t alphaIdx = sel ? M.indexBits  : M.indexBits2;
+                    bc7_endpoints E[2];
+                    E[0] = bc7_fit(r, 0xFFFF, 0, 3, M.colorBits, 0, colorIdx, iterations);
+                    E[1] = bc7_fit(r, 0xFFFF, 3, 1, M.alphaBits, 0, alphaIdx, iterations);
+                    bc7_fix_anchor(E[0], 0xFFFF, 0, colorIdx);
+                    bc7_fix_anchor(E[1], 0xFFFF, 0, alphaIdx);
+                    bc7_pack(mode, 0, rot, sel, E, block);
+                    consider(block);
+                }
+            }
+        }
+    }
+
+    // two subset modes, opaque: 1 and 3, alpha: 7
+    if( bestErr && quality >= 2 )
+    {
+        const int nc = opaque ? 3 : 4;
+        std::pair<float,uint32_t> ranked[64];
+        for(uint32_t p = 0; p < 64; p++)
+            ranked[p] = { bc7_partition_error(px, bc7_partition2(p), nc), p };
+        const uint32_t tries = quality >= 3 ? 16 : 4;
+        std::partial_sort(ranked, ranked + tries, ranked + 64);
+
+        const uint32_t modes[2] = { opaque ? 1u : 7u, 3u };
+        for(uint32_t t = 0; t < tries; t++)
+        {
+            const uint32_t p    = ranked[t].second;
+            const uint16_t mask = bc7_partition2(p);
+            for(uint32_t m = 0; m < (opaque ? 2u : 1u); m++)
+            {
+                const uint32_t mode = modes[m];
+                auto const & M = bc7_mode(mode);
+                const int pb = M.endpointPBits ? 1 : (M.sharedPBits ? 2 : 0);
+                bc7_endpoints E[2];
+                E[0] = bc7_fit(px, static_cast<uint16_t>(~mask), 0, nc, M.colorBits, pb, M.indexBits, iterations);
+                E[1] = bc7_fit(px, mask,                         0, nc, M.colorBits, pb, M.indexBits, iterations);
+                bc7_fix_anchor(E[0], static_cast<uint16_t>(~mask), 0, M.indexBits);
+                bc7_fix_anchor(E[1], mask, bc7_anchor2(p), M.indexBits);
+                bc7_pack(mode, p, 0, 0, E, block);
+                consider(block);
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+inline void bc_encode_block(BCFormat format, uint8_t const px[16][4], uint8_t * out, uint32_t quality)
+{
+    uint8_t ch[16];
+    switch(format)
+    {
+        case BCFormat::BC1:
+            bc1_encode(px, out, false, quality + 1);
+            break;
+        case BCFormat::BC3:
+            for(int i = 0; i < 16; i++) ch[i] = px[i][3];
+            bc4_encode(ch, out, quality);
+            bc1_encode(px, out + 8, true, quality + 1);
+            break;
+        case BCFormat::BC4:
+            for(int i = 0; i < 16; i++) ch[i] = px[i][0];
+            bc4_encode(ch, out, quality);
+            break;
+        case BCFormat::BC5:
+            for(int i = 0; i < 16; i++) ch[i] = px[i][0];
+            bc4_encode(ch, out, quality);
+            for(int i = 0; i < 16; i++) ch[i] = px[i][1];
+            bc4_encode(ch, out + 8, quality);
+            break;
+        case BCFormat::BC7:
+            bc7_encode(px, out, quality);
+            break;
+    }
+}
+
+// decodes to RGBA, unused channels are 0 (alpha 255)
+inline void bc_decode_block(BCFormat format, uint8_t const * in, uint8_t px[16][4])
+{
+    uint8_t ch[16];
+    switch(format)
+    {
+        case BCFormat::BC1:
+            bc1_decode(in, px, false);
+            break;
+        case BCFormat::BC3:
+            bc1_decode(in + 8, px, true);
+            bc4_decode(in, ch);
+            for(int i = 0; i < 16; i++) px[i][3] = ch[i];
+            break;
+        case BCFormat::BC4:
+            bc4_decode(in, ch);
+            for(int i = 0; i < 16; i++) { px[i][0] = ch[i]; px[i][1] = px[i][2] = 0; px[i][3] = 255; }
+            break;
+        case BCFormat::BC5:
+            bc4_decode(in, ch);
+            for(int i = 0; i < 16; i++) { px[i][0] = ch[i]; px[i][2] = 0; px[i][3] = 255; }
+            bc4_decode(in + 8, ch);
+            for(int i = 0; i < 16; i++) px[i][1] = ch[i];
+            break;
+        case BCFormat::BC7:
+            bc7_decode(in, px);
+            break;
+    }
+}
+
+inline void bc_compress_rows(Image const & I, CompressedImage & out, BCSettings const & settings, uint32_t by0, uint32_t by1)
+{
+    const uint32_t bytes = bcBlockBytes(out.format);
+    uint8_t px[16][4];
+    for(uint32_t by = by0; by < by1; by++)
+    {
+        for(uint32_t bx = 0; bx < out.blocksX(); bx++)
+        {
+            bc_load_block(I, bx, by, px);
+            bc_encode_block(out.format, px, out.data.data() + (size_t(by) * out.blocksX() + bx) * bytes, settings.quality);
+        }
+    }
+}
+
+inline void bc_decompress_rows(CompressedImage const & C, Image & out, uint32_t by0, uint32_t by1)
+{
+    const uint32_t bytes = bcBlockBytes(C.format);
+    uint8_t px[16][4];
+    for(uint32_t by = by0; by < by1; by++)
+    {
+        for(uint32_t bx = 0; bx < C.blocksX(); bx++)
+        {
+            bc_decode_block(C.format, C.data.data() + (size_t(by) * C.blocksX() + bx) * bytes, px);
+            bc_store_block(out, bx, by, px);
+        }
+    }
+}
+
+inline CompressedImage bc_allocate(Image const & I, BCFormat format)
+{
+    CompressedImage out;
+    out.format = format;
+    out.width  = I.getWidth();
+    out.height = I.getHeight();
+    out.data.resize( size_t(out.blocksX()) * out.blocksY() * bcBlockBytes(format) );
+    return out;
+}
+
+}
+
+/**
+ * @brief compressBC
+ * @param I
+ * @param format
+ * @param settings
+ * @return
+ *
+ * Block compresses an image. The channels of images with fewer than 4
+ * channels are expanded as described in detail::bc_load_block(). BC4 uses
+ * the first channel, BC5 the first two.
+ */
+inline CompressedImage compressBC(Image const & I, BCFormat format, BCSettings const & settings = {})
+{
+    auto out = detail::bc_allocate(I, format);
+    if( !out.data.empty() )
+        detail::bc_compress_rows(I, out, settings, 0, out.blocksY());
+    return out;
+}
+
+/**
+ * @brief compressBC
+ * @param pool
+ * @param I
+ * @param format
+ * @param settings
+ * @return
+ *
+ * Same as compressBC(I, format, settings), but the rows of blocks are
+ * encoded on the thread pool. The output is identical.
+ */
+inline CompressedImage compressBC(thread_pool & pool, Image const & I, BCFormat format, BCSettings const & settings = {})
+{
+    auto out = detail::bc_allocate(I, format);
+    if( !out.data.empty() )
+    {
+        pool.parallel_for(0, out.blocksY(), [&](size_t by0, size_t by1)
+        {
+            detail::bc_compress_rows(I, out, settings, static_cast<uint32_t>(by0), static_cast<uint32_t>(by1));
+        });
+    }
+    return out;
+}
+
+/**
+ * @brief compressBC
+ * @param MM
+ * @param format
+ * @param settings
+ * @return
+ *
+ * Compresses every level of a mip chain.
+ */
+inline std::vector<CompressedImage> compressBC(ImageMM const & MM, BCFormat format, BCSettings const & settings = {})
+{
+    std::vector<CompressedImage> out;
+    for(auto & L : MM.level)
+        out.push_back( compressBC(L, format, settings) );
+    return out;
+}
+
+inline std::vector<CompressedImage> compressBC(thread_pool & pool, ImageMM const & MM, BCFormat format, BCSettings const & settings = {})
+{
+    std::vector<CompressedImage> out;
+    for(auto & L : MM.level)
+        out.push_back( compressBC(pool, L, format, settings) );
+    return out;
+}
+
+/**
+ * @brief decompressBC
+ * @param C
+ * @return
+ *
+ * Decodes a block compressed image. BC1/BC3/BC7 decode to 4 channels,
+ * BC4 to 1 channel and BC5 to 2 channels.
+ */
+inline Image decompressBC(CompressedImage const & C)
+{
+    Image out(C.width, C.height, bcChannels(C.format));
+    if( out.size() )
+        detail::bc_decompress_rows(C, out, 0, C.blocksY());
+    return out;
+}
+
+inline Image decompressBC(thread_pool & pool, CompressedImage const & C)
+{
+    Image out(C.width, C.height, bcChannels(C.format));
+    if( out.size() )
+    {
+        pool.parallel_for(0, C.blocksY(), [&](size_t by0, size_t by1)
+        {
+            detail::bc_decompress_rows(C, out, static_cast<uint32_t>(by0), static_cast<uint32_t>(by1));
+        });
+    }
+    return out;
+}
+
+}
+
+#endif
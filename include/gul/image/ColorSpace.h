@@ -0,0 +1,1101 @@
+#ifndef GUL_IMAGE_COLOR_SPACE_H
+#define GUL_IMAGE_COLOR_SPACE_H
+
+#include "../Image.h"
+#include "TypedImage.h"
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gul
+{
+
+/**
+ * @brief The YCbCrMatrix enum
+ *
+ * The luma coefficients used to convert between RGB and YCbCr. BT601 is
+ * used by JPEG and SD video, BT709 by HD video and most camera pipelines.
+ */
+enum class YCbCrMatrix
+{
+    BT601,
+    BT709
+};
+
+/**
+ * @brief The YCbCrFormat struct
+ *
+ * Limited (video) range stores Y in 16-235 and Cb/Cr in 16-240, full
+ * range uses 0-255 for all three.
+ */
+struct YCbCrFormat
+{
+    YCbCrMatrix matrix    = YCbCrMatrix::BT709;
+    bool        fullRange = false;
+};
+
+/**
+ * @brief The YCbCr420Image struct
+ *
+ * 4:2:0 planar YCbCr (I420). y is a single channel image of the full
+ * size, cb and cr are single channel images of half the width and height,
+ * rounded up. Each chroma value covers a 2x2 block of pixels.
+ */
+struct YCbCr420Image
+{
+    Image y;
+    Image cb;
+    Image cr;
+};
+
+/**
+ * @brief The NV12Image struct
+ *
+ * Same as YCbCr420Image with the chroma interleaved into a single two
+ * channel image, Cb in the first channel and Cr in the second.
+ */
+struct NV12Image
+{
+    Image y;
+    Image uv;
+};
+
+namespace detail
+{
+
+constexpr int ycbcr_shift = 13;
+
+/**
+ * @brief The color_matrix struct
+ *
+ * out_k = (m[k][0]*c0 + m[k][1]*c1 + m[k][2]*c2 + k[k]) >> ycbcr_shift,
+ * clamped to 0-255. The rounding is folded into k.
+ */
+struct color_matrix
+{
+    int16_t m[3][3];
+    int32_t k[3];
+};
+
+inline void ycbcr_luma(YCbCrMatrix M, double & Kr, double & Kb)
+{
+    if( M == YCbCrMatrix::BT601 )
+    {
+        Kr = 0.299;
+        Kb = 0.114;
+    }
+    else
+    {
+        Kr = 0.2126;
+        Kb = 0.0722;
+    }
+}
+
+// quantizes out = A*(in - inOff) + outOff
+inline color_matrix make_color_matrix(double const A[3][3], double const inOff[3], double const outOff[3])
+{
+    const double s = double(1 << ycbcr_shift);
+    color_matrix C;
+    for(int r = 0; r < 3; r++)
+    {
+        double k = outOff[r] + 0.5;
+        for(int c = 0; c < 3; c++)
+        {
+            C.m[r][c] = static_cast<int16_t>( std::lround(A[r][c] * s) );
+            k        -= A[r][c] * inOff[c];
+        }
+        C.k[r] = static_cast<int32_t>( std::lround(k * s) );
+    }
+    return C;
+}
+
+inline color_matrix rgb_to_ycbcr_matrix(YCbCrFormat f)
+{
+    double Kr, Kb;
+    ycbcr_luma(f.matrix, Kr, Kb);
+    const double Kg = 1.0 - Kr - Kb;
+    const double sY = f.fullRange ? 1.0 : 219.0 / 255.0;
+    const double sC = f.fullRange ? 1.0 : 224.0 / 255.0;
+    const double cb = sC / (2.0 * (1.0 - Kb));
+    const double cr = sC / (2.0 * (1.0 - Kr));
+
+    const double A[3][3] = { { sY*Kr,             sY*Kg,    sY*Kb },
+                             { -cb*Kr,           -cb*Kg,    cb*(1.0-Kb) },
+                             { cr*(1.0-Kr),      -cr*Kg,   -cr*Kb } };
+    const double inOff[3]  = {0.0, 0.0, 0.0};
+    const double outOff[3] = {f.fullRange ? 0.0 : 16.0, 128.0, 128.0};
+    auto C = make_color_matrix(A, inOff, outOff);
+
+    // make the rows sum exactly to the scale of Y and to 0 for the
+    // chroma, so black and white map to the end points of the range and
+    // greys have no colour
+    C.m[0][1] = static_cast<int16_t>( std::lround(sY * (1 << ycbcr_shift)) - C.m[0][0] - C.m[0][2] );
+    for(int r = 1; r < 3; r++)
+        C.m[r][1] = static_cast<int16_t>( -C.m[r][0] - C.m[r][2] );
+    return C;
+}
+
+inline color_matrix ycbcr_to_rgb_matrix(YCbCrFormat f)
+{
+    double Kr, Kb;
+    ycbcr_luma(f.matrix, Kr, Kb);
+    const double Kg = 1.0 - Kr - Kb;
+    const double y  = f.fullRange ? 1.0 : 255.0 / 219.0;
+    const double c  = f.fullRange ? 1.0 : 255.0 / 224.0;
+
+    const double A[3][3] = { { y,  0.0,                               c*2.0*(1.0-Kr) },
+                             { y, -c*2.0*Kb*(1.0-Kb)/Kg,             -c*2.0*Kr*(1.0-Kr)/Kg },
+                             { y,  c*2.0*(1.0-Kb),                    0.0 } };
+    const double inOff[3]  = {f.fullRange ? 0.0 : 16.0, 128.0, 128.0};
+    const double outOff[3] = {0.0, 0.0, 0.0};
+    return make_color_matrix(A, inOff, outOff);
+}
+
+inline uint8_t color_matrix_scalar(uint8_t c0, uint8_t c1, uint8_t c2, int16_t const * m, int32_t k)
+{
+    const int32_t v = ( int32_t(m[0])*c0 + int32_t(m[1])*c1 + int32_t(m[2])*c2 + k ) >> ycbcr_shift;
+    return static_cast<uint8_t>( std::min(255, std::max(0, v)) );
+}
+
+/**
+ * @brief color_matrix_row
+ *
+ * Computes one output plane of a color_matrix from three input planes
+ * of n bytes each, 16 (SSE2) or 32 (AVX2) values at a time.
+ */
+inline void color_matrix_row(uint8_t const * c0, uint8_t const * c1, uint8_t const * c2,
+                             int16_t const * m, int32_t k, uint8_t * out, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_AVX2)
+    {
+        const __m256i z   = _mm256_setzero_si256();
+        const __m256i m01 = _mm256_unpacklo_epi16( _mm256_set1_epi16(m[0]), _mm256_set1_epi16(m[1]) );
+        const __m256i m2  = _mm256_unpacklo_epi16( _mm256_set1_epi16(m[2]), z );
+        const __m256i K   = _mm256_set1_epi32(k);
+        auto dot = [&](__m256i a, __m256i b, __m256i c)
+        {
+            // 16 values in 16-bit lanes -> 16 clamped values in 16-bit lanes
+            __m256i lo = _mm256_add_epi32( _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpacklo_epi16(a,b), m01 ),
+                                                             _mm256_madd_epi16( _mm256_unpacklo_epi16(c,z), m2 ) ), K );
+            __m256i hi = _mm256_add_epi32( _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpackhi_epi16(a,b), m01 ),
+                                                             _mm256_madd_epi16( _mm256_unpackhi_epi16(c,z), m2 ) ), K );
+            return _mm256_packs_epi32( _mm256_srai_epi32(lo, ycbcr_shift), _mm256_srai_epi32(hi, ycbcr_shift) );
+        };
+        for(; i + 32 <= n; i += 32)
+        {
+            const __m256i a = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(c0 + i) );
+            const __m256i b = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(c1 + i) );
+            const __m256i c = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(c2 + i) );
+            const __m256i lo = dot( _mm256_unpacklo_epi8(a,z), _mm256_unpacklo_epi8(b,z), _mm256_unpacklo_epi8(c,z) );
+            const __m256i hi = dot( _mm256_unpackhi_epi8(a,z), _mm256_unpackhi_epi8(b,z), _mm256_unpackhi_epi8(c,z) );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>(out + i), _mm256_packus_epi16(lo, hi) );
+        }
+    }
+#endif
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128i z   = _mm_setzero_si128();
+        const __m128i m01 = _mm_unpacklo_epi16( _mm_set1_epi16(m[0]), _mm_set1_epi16(m[1]) );
+        const __m128i m2  = _mm_unpacklo_epi16( _mm_set1_epi16(m[2]), z );
+        const __m128i K   = _mm_set1_epi32(k);
+        auto dot = [&](__m128i a, __m128i b, __m128i c)
+        {
+            __m128i lo = _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16(a,b), m01 ),
+                                                       _mm_madd_epi16( _mm_unpacklo_epi16(c,z), m2 ) ), K );
+            __m128i hi = _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi16(a,b), m01 ),
+                                                       _mm_madd_epi16( _mm_unpackhi_epi16(c,z), m2 ) ), K );
+            return _mm_packs_epi32( _mm_srai_epi32(lo, ycbcr_shift), _mm_srai_epi32(hi, ycbcr_shift) );
+        };
+        for(; i + 16 <= n; i += 16)
+        {
+            const __m128i a = _mm_loadu_si128( reinterpret_cast<__m128i const*>(c0 + i) );
+            const __m128i b = _mm_loadu_si128( reinterpret_cast<__m128i const*>(c1 + i) );
+            const __m128i c = _mm_loadu_si128( reinterpret_cast<__m128i const*>(c2 + i) );
+            const __m128i lo = dot( _mm_unpacklo_epi8(a,z), _mm_unpacklo_epi8(b,z), _mm_unpacklo_epi8(c,z) );
+            const __m128i hi = dot( _mm_unpackhi_epi8(a,z), _mm_unpackhi_epi8(b,z), _mm_unpackhi_epi8(c,z) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        out[i] = color_matrix_scalar(c0[i], c1[i], c2[i], m, k);
+    }
+}
+
+/**
+ * @brief average2x2_row
+ *
+ * out[i] = the rounded average of a[2i], a[2i+1], b[2i] and b[2i+1] for
+ * the (n+1)/2 outputs of two rows of n bytes. If n is odd the last
+ * column is repeated.
+ */
+inline void average2x2_row(uint8_t const * a, uint8_t const * b, size_t n, uint8_t * out)
+{
+    const size_t half = n / 2;
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128i mLo = _mm_set1_epi16(0xFF);
+        const __m128i two = _mm_set1_epi16(2);
+        auto sums = [&](uint8_t const * p)
+        {
+            const __m128i x = _mm_loadu_si128( reinterpret_cast<__m128i const*>(p) );
+            return _mm_add_epi16( _mm_and_si128(x, mLo), _mm_srli_epi16(x, 8) );
+        };
+        for(; i + 16 <= half; i += 16)
+        {
+            __m128i lo = _mm_add_epi16( _mm_add_epi16( sums(a + 2*i),      sums(b + 2*i) ),      two );
+            __m128i hi = _mm_add_epi16( _mm_add_epi16( sums(a + 2*i + 16), sums(b + 2*i + 16) ), two );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i),
+                              _mm_packus_epi16( _mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2) ) );
+        }
+    }
+#endif
+    for(; i < half; i++)
+    {
+        out[i] = static_cast<uint8_t>( (uint32_t(a[2*i]) + a[2*i+1] + b[2*i] + b[2*i+1] + 2u) >> 2 );
+    }
+    if( n & 1 )
+    {
+        out[half] = static_cast<uint8_t>( (2u*a[n-1] + 2u*b[n-1] + 2u) >> 2 );
+    }
+}
+
+/**
+ * @brief upsample2x_row
+ *
+ * out[i] = c[i/2] for i < n
+ */
+inline void upsample2x_row(uint8_t const * c, size_t n, uint8_t * out)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    for(; i + 32 <= n; i += 32)
+    {
+        const __m128i x = _mm_loadu_si128( reinterpret_cast<__m128i const*>(c + i/2) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i),      _mm_unpacklo_epi8(x, x) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i + 16), _mm_unpackhi_epi8(x, x) );
+    }
+#endif
+    for(; i < n; i++)
+    {
+        out[i] = c[i/2];
+    }
+}
+
+inline void check_rgb(ConstImageView const & V)
+{
+    if( V.getChannels() != 3 && V.getChannels() != 4 )
+        throw std::logic_error("Expected an RGB or RGBA image");
+}
+
+inline void check_output_channels(uint32_t C)
+{
+    if( C != 3 && C != 4 )
+        throw std::logic_error("The output must have 3 or 4 channels");
+}
+
+// runs f(j0, j1) over [0, n) on the pool, or on the calling thread
+template<typename F>
+void for_rows(thread_pool * pool, uint32_t n, F && f, size_t grain = 16)
+{
+    if( pool )
+        pool->parallel_for(0, n, f, grain);
+    else
+        f(size_t(0), size_t(n));
+}
+
+// pixels per block when a row is split into planes
+constexpr uint32_t color_block = 256;
+
+/**
+ * @brief rgb_to_ycbcr444
+ *
+ * Writes the three planes of a planar image, out[c] + j*w.
+ */
+inline void rgb_to_ycbcr444(ConstImageView const & src, color_matrix const & M, uint8_t * const out[3], thread_pool * pool)
+{
+    const uint32_t w = src.getWidth();
+    const uint32_t C = src.getChannels();
+    for_rows(pool, src.getHeight(), [&](size_t j0, size_t j1)
+    {
+        uint8_t P[4*color_block];
+        for(size_t j = j0; j < j1; j++)
+        {
+            for(uint32_t i = 0; i < w; i += color_block)
+            {
+                const uint32_t n = std::min(color_block, w - i);
+                deinterleave(src.row(uint32_t(j)) + size_t(i)*C, n, C, P);
+                for(uint32_t k = 0; k < 3; k++)
+                    color_matrix_row(P, P + n, P + 2*n, M.m[k], M.k[k], out[k] + j*w + i, n);
+            }
+        }
+    });
+}
+
+/**
+ * @brief ycbcr444_to_rgb
+ *
+ * in[c] + j*w are the rows of the three planes, or in[0] + 3*j*w the
+ * rows of an interleaved image if interleaved is true.
+ */
+inline void ycbcr444_to_rgb(uint8_t const * const in[3], bool interleaved, color_matrix const & M, ImageView const & dst, thread_pool * pool)
+{
+    const uint32_t w = dst.getWidth();
+    const uint32_t C = dst.getChannels();
+    for_rows(pool, dst.getHeight(), [&](size_t j0, size_t j1)
+    {
+        uint8_t P[3*color_block];
+        uint8_t Q[4*color_block];
+        for(size_t j = j0; j < j1; j++)
+        {
+            for(uint32_t i = 0; i < w; i += color_block)
+            {
+                const uint32_t n = std::min(color_block, w - i);
+                uint8_t const * c[3];
+                if( interleaved )
+                {
+                    deinterleave(in[0] + (j*w + i)*3, n, 3, P);
+                    c[0] = P; c[1] = P + n; c[2] = P + 2*n;
+                }
+                else
+                {
+                    for(uint32_t k = 0; k < 3; k++)
+                        c[k] = in[k] + j*w + i;
+                }
+                for(uint32_t k = 0; k < 3; k++)
+                    color_matrix_row(c[0], c[1], c[2], M.m[k], M.k[k], Q + k*n, n);
+                if( C == 4 )
+                    std::fill(Q + 3*n, Q + 4*n, uint8_t(255));
+                interleave(Q, n, C, dst.row(uint32_t(j)) + size_t(i)*C);
+            }
+        }
+    });
+}
+
+/**
+ * @brief rgb_to_ycbcr420
+ *
+ * Converts a pair of rows at a time. The chroma is the chroma of the
+ * 2x2 averaged RGB values. If uv is not null the chroma is written
+ * interleaved to it instead of cb and cr.
+ */
+inline void rgb_to_ycbcr420(ConstImageView const & src, color_matrix const & M,
+                            ImageView const & y, ImageView const * cb, ImageView const * cr, ImageView const * uv,
+                            thread_pool * pool)
+{
+    const uint32_t w = src.getWidth();
+    const uint32_t h = src.getHeight();
+    const uint32_t C = src.getChannels();
+    for_rows(pool, (h + 1) / 2, [&](size_t c0, size_t c1)
+    {
+        uint8_t P0[4*color_block], P1[4*color_block];
+        uint8_t A[3*color_block/2], U[color_block];
+        for(size_t jc = c0; jc < c1; jc++)
+        {
+            const uint32_t y0 = uint32_t(2*jc);
+            const uint32_t y1 = std::min(y0 + 1, h - 1);
+            for(uint32_t i = 0; i < w; i += color_block)
+            {
+                const uint32_t n  = std::min(color_block, w - i);
+                const uint32_t nc = (n + 1) / 2;
+                deinterleave(src.row(y0) + size_t(i)*C, n, C, P0);
+                deinterleave(src.row(y1) + size_t(i)*C, n, C, P1);
+                color_matrix_row(P0, P0 + n, P0 + 2*n, M.m[0], M.k[0], y.row(y0) + i, n);
+                if( y1 != y0 )
+                    color_matrix_row(P1, P1 + n, P1 + 2*n, M.m[0], M.k[0], y.row(y1) + i, n);
+
+                for(uint32_t k = 0; k < 3; k++)
+                    average2x2_row(P0 + k*n, P1 + k*n, n, A + k*nc);
+                if( uv )
+                {
+                    color_matrix_row(A, A + nc, A + 2*nc, M.m[1], M.k[1], U,      nc);
+                    color_matrix_row(A, A + nc, A + 2*nc, M.m[2], M.k[2], U + nc, nc);
+                    interleave(U, nc, 2, uv->row(uint32_t(jc)) + i);
+                }
+                else
+                {
+                    color_matrix_row(A, A + nc, A + 2*nc, M.m[1], M.k[1], cb->row(uint32_t(jc)) + i/2, nc);
+                    color_matrix_row(A, A + nc, A + 2*nc, M.m[2], M.k[2], cr->row(uint32_t(jc)) + i/2, nc);
+                }
+            }
+        }
+    });
+}
+
+/**
+ * @brief ycbcr420_to_rgb
+ *
+ * The chroma is repeated over each 2x2 block. Either cb and cr, or uv
+ * must not be null.
+ */
+inline void ycbcr420_to_rgb(ConstImageView const & y, ConstImageView const * cb, ConstImageView const * cr, ConstImageView const * uv,
+                            color_matrix const & M, ImageView const & dst, thread_pool * pool)
+{
+    const uint32_t w = dst.getWidth();
+    const uint32_t C = dst.getChannels();
+    for_rows(pool, dst.getHeight(), [&](size_t j0, size_t j1)
+    {
+        uint8_t U[color_block];
+        uint8_t P[2*color_block];
+        uint8_t Q[4*color_block];
+        for(size_t j = j0; j < j1; j++)
+        {
+            const uint32_t jc = uint32_t(j / 2);
+            for(uint32_t i = 0; i < w; i += color_block)
+            {
+                const uint32_t n  = std::min(color_block, w - i);
+                const uint32_t nc = (n + 1) / 2;
+                uint8_t const * b;
+                uint8_t const * r;
+                if( uv )
+                {
+                    deinterleave(uv->row(jc) + i, nc, 2, U);
+                    b = U;
+                    r = U + nc;
+                }
+                else
+                {
+                    b = cb->row(jc) + i/2;
+                    r = cr->row(jc) + i/2;
+                }
+                upsample2x_row(b, n, P);
+                upsample2x_row(r, n, P + n);
+                uint8_t const * Y = y.row(uint32_t(j)) + i;
+                for(uint32_t k = 0; k < 3; k++)
+                    color_matrix_row(Y, P, P + n, M.m[k], M.k[k], Q + k*n, n);
+                if( C == 4 )
+                    std::fill(Q + 3*n, Q + 4*n, uint8_t(255));
+                interleave(Q, n, C, dst.row(uint32_t(j)) + size_t(i)*C);
+            }
+        }
+    });
+}
+
+inline void check_ycbcr420(ConstImageView const & y, ConstImageView const & c, uint32_t channels)
+{
+    if( y.getChannels() != 1 || c.getChannels() != channels ||
+        c.getWidth()  != (y.getWidth()  + 1) / 2 ||
+        c.getHeight() != (y.getHeight() + 1) / 2 )
+    {
+        throw std::logic_error("The chroma planes must be half the size of the luma plane");
+    }
+}
+
+/*
+ * HSV with all three components in 0-255. The hue wraps around, 256
+ * is 360 degrees, red is 0, green is 85 and blue is 171.
+ */
+constexpr float hsv_hue_scale = 256.0f / 6.0f;
+
+inline void rgb_to_hsv_scalar(uint8_t R, uint8_t G, uint8_t B, uint8_t & H, uint8_t & S, uint8_t & V)
+{
+    const float r = R, g = G, b = B;
+    const float mx = std::max(std::max(r, g), b);
+    const float mn = std::min(std::min(r, g), b);
+    const float d  = mx - mn;
+    const float inv = 1.0f / (d == 0.0f ? 1.0f : d);
+    float h = mx == r ? (g - b) * inv
+            : mx == g ? (b - r) * inv + 2.0f
+                      : (r - g) * inv + 4.0f;
+    h *= hsv_hue_scale;
+    if( h < 0.0f )
+        h += 256.0f;
+    if( d == 0.0f )
+        h = 0.0f;
+    const float s = mx == 0.0f ? 0.0f : (d * 255.0f) / mx;
+    H = static_cast<uint8_t>( static_cast<int32_t>(h + 0.5f) & 0xFF );
+    S = static_cast<uint8_t>( s + 0.5f );
+    V = static_cast<uint8_t>( mx );
+}
+
+inline void hsv_to_rgb_scalar(uint8_t H, uint8_t S, uint8_t V, uint8_t & R, uint8_t & G, uint8_t & B)
+{
+    const float h6 = H * (6.0f / 256.0f);
+    const float i  = std::floor(h6);
+    const float f  = h6 - i;
+    const float v  = V;
+    const float s  = S * (1.0f / 255.0f);
+    const float p  = v * (1.0f - s);
+    const float q  = v * (1.0f - s * f);
+    const float t  = v * (1.0f - s * (1.0f - f));
+    float r, g, b;
+    switch( static_cast<int>(i) )
+    {
+        case 0:  r = v; g = t; b = p; break;
+        case 1:  r = q; g = v; b = p; break;
+        case 2:  r = p; g = v; b = t; break;
+        case 3:  r = p; g = q; b = v; break;
+        case 4:  r = t; g = p; b = v; break;
+        default: r = v; g = p; b = q; break;
+    }
+    R = static_cast<uint8_t>( r + 0.5f );
+    G = static_cast<uint8_t>( g + 0.5f );
+    B = static_cast<uint8_t>( b + 0.5f );
+}
+
+#if defined(GUL_IMAGE_SSE2)
+inline __m128 sse_load_u8x4(uint8_t const * p)
+{
+    int32_t x;
+    memcpy(&x, p, 4);
+    const __m128i z = _mm_setzero_si128();
+    return _mm_cvtepi32_ps( _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128(x), z), z) );
+}
+// rounds 4 values in 0-255 and stores them as bytes
+inline void sse_store_u8x4(uint8_t * p, __m128 v)
+{
+    const __m128i i = _mm_cvttps_epi32( _mm_add_ps(v, _mm_set1_ps(0.5f)) );
+    const __m128i b = _mm_packus_epi16( _mm_packs_epi32(i, i), _mm_setzero_si128() );
+    const int32_t x = _mm_cvtsi128_si32(b);
+    memcpy(p, &x, 4);
+}
+inline __m128 sse_select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps( _mm_and_ps(mask, a), _mm_andnot_ps(mask, b) );
+}
+#endif
+
+/**
+ * @brief rgb_to_hsv_planes
+ *
+ * Converts n values of the r, g and b planes, 4 at a time with SSE2.
+ */
+inline void rgb_to_hsv_planes(uint8_t const * r, uint8_t const * g, uint8_t const * b,
+                              uint8_t * H, uint8_t * S, uint8_t * V, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128 zero  = _mm_setzero_ps();
+    const __m128 one   = _mm_set1_ps(1.0f);
+    const __m128 two   = _mm_set1_ps(2.0f);
+    const __m128 four  = _mm_set1_ps(4.0f);
+    const __m128 c255  = _mm_set1_ps(255.0f);
+    const __m128 c256  = _mm_set1_ps(256.0f);
+    const __m128 scale = _mm_set1_ps(hsv_hue_scale);
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128 R = sse_load_u8x4(r + i);
+        const __m128 G = sse_load_u8x4(g + i);
+        const __m128 B = sse_load_u8x4(b + i);
+        const __m128 mx = _mm_max_ps( _mm_max_ps(R, G), B );
+        const __m128 mn = _mm_min_ps( _mm_min_ps(R, G), B );
+        const __m128 d  = _mm_sub_ps(mx, mn);
+        const __m128 dz = _mm_cmpeq_ps(d, zero);
+        const __m128 inv = _mm_div_ps( one, sse_select(dz, one, d) );
+
+        const __m128 isR = _mm_cmpeq_ps(mx, R);
+        const __m128 isG = _mm_cmpeq_ps(mx, G);
+        __m128 h = sse_select( isR, _mm_mul_ps( _mm_sub_ps(G, B), inv ),
+                   sse_select( isG, _mm_add_ps( _mm_mul_ps( _mm_sub_ps(B, R), inv ), two ),
+                                    _mm_add_ps( _mm_mul_ps( _mm_sub_ps(R, G), inv ), four ) ) );
+        h = _mm_mul_ps(h, scale);
+        h = _mm_add_ps(h, _mm_and_ps( _mm_cmplt_ps(h, zero), c256 ) );
+        h = _mm_andnot_ps(dz, h);
+
+        const __m128 s = _mm_andnot_ps( _mm_cmpeq_ps(mx, zero),
+                                        _mm_div_ps( _mm_mul_ps(d, c255), sse_select(_mm_cmpeq_ps(mx, zero), one, mx) ) );
+
+        // the hue can round up to 256, which wraps to 0
+        const __m128i hi = _mm_and_si128( _mm_cvttps_epi32( _mm_add_ps(h, _mm_set1_ps(0.5f)) ), _mm_set1_epi32(0xFF) );
+        const __m128i hb = _mm_packus_epi16( _mm_packs_epi32(hi, hi), _mm_setzero_si128() );
+        const int32_t x  = _mm_cvtsi128_si32(hb);
+        memcpy(H + i, &x, 4);
+        sse_store_u8x4(S + i, s);
+        sse_store_u8x4(V + i, mx);
+    }
+#endif
+    for(; i < n; i++)
+    {
+        rgb_to_hsv_scalar(r[i], g[i], b[i], H[i], S[i], V[i]);
+    }
+}
+
+/**
+ * @brief hsv_to_rgb_planes
+ *
+ * The inverse of rgb_to_hsv_planes().
+ */
+inline void hsv_to_rgb_planes(uint8_t const * H, uint8_t const * S, uint8_t const * V,
+                              uint8_t * r, uint8_t * g, uint8_t * b, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 h6s  = _mm_set1_ps(6.0f / 256.0f);
+    const __m128 s255 = _mm_set1_ps(1.0f / 255.0f);
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128 h6 = _mm_mul_ps( sse_load_u8x4(H + i), h6s );
+        const __m128 k  = _mm_cvtepi32_ps( _mm_cvttps_epi32(h6) ); // floor, h6 >= 0
+        const __m128 f  = _mm_sub_ps(h6, k);
+        const __m128 v  = sse_load_u8x4(V + i);
+        const __m128 s  = _mm_mul_ps( sse_load_u8x4(S + i), s255 );
+        const __m128 p  = _mm_mul_ps( v, _mm_sub_ps(one, s) );
+        const __m128 q  = _mm_mul_ps( v, _mm_sub_ps(one, _mm_mul_ps(s, f)) );
+        const __m128 t  = _mm_mul_ps( v, _mm_sub_ps(one, _mm_mul_ps(s, _mm_sub_ps(one, f))) );
+
+        __m128 sec[6];
+        for(int j = 0; j < 6; j++)
+            sec[j] = _mm_cmpeq_ps( k, _mm_set1_ps(float(j)) );
+        auto pick = [&](__m128 const (&x)[6])
+        {
+            __m128 o = _mm_setzero_ps();
+            for(int j = 0; j < 6; j++)
+                o = _mm_or_ps(o, _mm_and_ps(sec[j], x[j]));
+            return o;
+        };
+        const __m128 R[6] = {v, q, p, p, t, v};
+        const __m128 G[6] = {t, v, v, q, p, p};
+        const __m128 B[6] = {p, p, t, v, v, q};
+        sse_store_u8x4(r + i, pick(R));
+        sse_store_u8x4(g + i, pick(G));
+        sse_store_u8x4(b + i, pick(B));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        hsv_to_rgb_scalar(H[i], S[i], V[i], r[i], g[i], b[i]);
+    }
+}
+
+/**
+ * @brief convert_hsv
+ *
+ * Converts the first three channels of each pixel, the alpha channel
+ * is copied.
+ */
+inline void convert_hsv(ConstImageView const & src, ImageView const & dst, bool toHSV, thread_pool * pool)
+{
+    const uint32_t w = src.getWidth();
+    const uint32_t C = src.getChannels();
+    for_rows(pool, src.getHeight(), [&](size_t j0, size_t j1)
+    {
+        uint8_t P[4*color_block], Q[4*color_block];
+        for(size_t j = j0; j < j1; j++)
+        {
+            for(uint32_t i = 0; i < w; i += color_block)
+            {
+                const uint32_t n = std::min(color_block, w - i);
+                deinterleave(src.row(uint32_t(j)) + size_t(i)*C, n, C, P);
+                if( toHSV )
+                    rgb_to_hsv_planes(P, P + n, P + 2*n, Q, Q + n, Q + 2*n, n);
+                else
+                    hsv_to_rgb_planes(P, P + n, P + 2*n, Q, Q + n, Q + 2*n, n);
+                if( C == 4 )
+                    memcpy(Q + 3*n, P + 3*n, n);
+                interleave(Q, n, C, dst.row(uint32_t(j)) + size_t(i)*C);
+            }
+        }
+    });
+}
+
+// the index of the alpha channel, or C if there is none
+inline uint32_t alpha_channel(uint32_t C)
+{
+    return C == 4 ? 3u : C == 2 ? 1u : C;
+}
+
+inline void srgb_to_linear(ConstImageView const & src, float * dst, thread_pool * pool)
+{
+    const uint32_t w = src.getWidth();
+    const uint32_t C = src.getChannels();
+    const uint32_t alpha = alpha_channel(C);
+    float const * lut[4];
+    for(uint32_t c = 0; c < 4; c++)
+        lut[c] = c == alpha ? unorm8_to_float_lut().data() : srgb_to_linear_lut().data();
+
+    for_rows(pool, src.getHeight(), [&](size_t j0, size_t j1)
+    {
+        for(size_t j = j0; j < j1; j++)
+        {
+            uint8_t const * s = src.row(uint32_t(j));
+            float * d = dst + j * size_t(w) * C;
+            if( C == 4 )
+            {
+                for(size_t i = 0; i < size_t(w) * 4; i += 4)
+                {
+                    d[i]   = lut[0][s[i]];
+                    d[i+1] = lut[0][s[i+1]];
+                    d[i+2] = lut[0][s[i+2]];
+                    d[i+3] = lut[3][s[i+3]];
+                }
+            }
+            else
+            {
+                for(size_t i = 0; i < size_t(w) * C; i++)
+                    d[i] = lut[i % C][s[i]];
+            }
+        }
+    }, 64);
+}
+
+/**
+ * @brief linear_to_srgb_row
+ *
+ * Quantizes n linear values to the linear_to_srgb_lut() index, 4 at a
+ * time with SSE2, and looks them up. If alpha is true, every 4th value
+ * is stored linearly instead.
+ */
+inline void linear_to_srgb_row(float const * src, size_t n, uint32_t C, uint32_t alpha, uint8_t * dst)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    if( C == 4 || alpha == C )
+    {
+        auto const * lut = linear_to_srgb_lut().data();
+        const float N = static_cast<float>( (1u << linear_to_srgb_lut_bits) - 1u );
+        const __m128 lo = _mm_setzero_ps();
+        const __m128 hi = _mm_set1_ps(1.0f);
+        const __m128 sN = _mm_set1_ps(N);
+        const __m128 h  = _mm_set1_ps(0.5f);
+        alignas(16) int32_t k[4];
+        for(; i + 4 <= n; i += 4)
+        {
+            const __m128 v = _mm_min_ps( _mm_max_ps( _mm_loadu_ps(src + i), lo), hi );
+            _mm_store_si128( reinterpret_cast<__m128i*>(k), _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps(v, sN), h) ) );
+            dst[i]   = lut[k[0]];
+            dst[i+1] = lut[k[1]];
+            dst[i+2] = lut[k[2]];
+            dst[i+3] = alpha == C ? lut[k[3]] : float_to_unorm8(src[i+3]);
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        dst[i] = (i % C) == alpha ? float_to_unorm8(src[i]) : linear_to_srgb(src[i]);
+    }
+}
+
+inline void linear_to_srgb(float const * src, ImageView const & dst, thread_pool * pool)
+{
+    const uint32_t C = dst.getChannels();
+    const size_t   n = dst.getRowSize();
+    const uint32_t alpha = alpha_channel(C);
+    for_rows(pool, dst.getHeight(), [&](size_t j0, size_t j1)
+    {
+        for(size_t j = j0; j < j1; j++)
+            linear_to_srgb_row(src + j*n, n, C, alpha, dst.row(uint32_t(j)));
+    }, 64);
+}
+
+inline Image rgb_to_ycbcr(ConstImageView const & rgb, YCbCrFormat f, thread_pool * pool)
+{
+    check_rgb(rgb);
+    Image out(rgb.getWidth(), rgb.getHeight(), 3);
+    out.setPlanar(true);
+    auto * d = static_cast<uint8_t*>( out.data() );
+    const size_t n = size_t(rgb.getWidth()) * rgb.getHeight();
+    uint8_t * const planes[3] = {d, d + n, d + 2*n};
+    rgb_to_ycbcr444(rgb, rgb_to_ycbcr_matrix(f), planes, pool);
+    return out;
+}
+
+inline Image ycbcr_to_rgb(Image const & ycbcr, uint32_t channels, YCbCrFormat f, thread_pool * pool)
+{
+    if( ycbcr.getChannels() != 3 )
+        throw std::logic_error("Expected a 3 channel YCbCr image");
+    check_output_channels(channels);
+    Image out(ycbcr.getWidth(), ycbcr.getHeight(), channels);
+    auto const * s = static_cast<uint8_t const*>( ycbcr.data() );
+    const size_t n = size_t(ycbcr.getWidth()) * ycbcr.getHeight();
+    uint8_t const * const planes[3] = {s, s + n, s + 2*n};
+    ycbcr444_to_rgb(planes, !ycbcr.isPlanar(), ycbcr_to_rgb_matrix(f), out, pool);
+    return out;
+}
+
+inline YCbCr420Image rgb_to_ycbcr420(ConstImageView const & rgb, YCbCrFormat f, thread_pool * pool)
+{
+    check_rgb(rgb);
+    const uint32_t w = rgb.getWidth(), h = rgb.getHeight();
+    YCbCr420Image out{ Image(w, h, 1), Image((w+1)/2, (h+1)/2, 1), Image((w+1)/2, (h+1)/2, 1) };
+    ImageView cb(out.cb), cr(out.cr);
+    rgb_to_ycbcr420(rgb, rgb_to_ycbcr_matrix(f), out.y, &cb, &cr, nullptr, pool);
+    return out;
+}
+
+inline NV12Image rgb_to_nv12(ConstImageView const & rgb, YCbCrFormat f, thread_pool * pool)
+{
+    check_rgb(rgb);
+    const uint32_t w = rgb.getWidth(), h = rgb.getHeight();
+    NV12Image out{ Image(w, h, 1), Image((w+1)/2, (h+1)/2, 2) };
+    ImageView uv(out.uv);
+    rgb_to_ycbcr420(rgb, rgb_to_ycbcr_matrix(f), out.y, nullptr, nullptr, &uv, pool);
+    return out;
+}
+
+inline Image ycbcr420_to_rgb(ConstImageView const & y, ConstImageView const & cb, ConstImageView const & cr,
+                             uint32_t channels, YCbCrFormat f, thread_pool * pool)
+{
+    check_ycbcr420(y, cb, 1);
+    check_ycbcr420(y, cr, 1);
+    check_output_channels(channels);
+    Image out(y.getWidth(), y.getHeight(), channels);
+    ycbcr420_to_rgb(y, &cb, &cr, nullptr, ycbcr_to_rgb_matrix(f), out, pool);
+    return out;
+}
+
+inline Image nv12_to_rgb(ConstImageView const & y, ConstImageView const & uv, uint32_t channels, YCbCrFormat f, thread_pool * pool)
+{
+    check_ycbcr420(y, uv, 2);
+    check_output_channels(channels);
+    Image out(y.getWidth(), y.getHeight(), channels);
+    ycbcr420_to_rgb(y, nullptr, nullptr, &uv, ycbcr_to_rgb_matrix(f), out, pool);
+    return out;
+}
+
+inline Image hsv_convert(ConstImageView const & src, bool toHSV, thread_pool * pool)
+{
+    check_rgb(src);
+    Image out(src.getWidth(), src.getHeight(), src.getChannels());
+    convert_hsv(src, out, toHSV, pool);
+    return out;
+}
+
+inline Image32f srgb_to_linear(ConstImageView const & src, thread_pool * pool)
+{
+    Image32f out(src.getWidth(), src.getHeight(), src.getChannels());
+    srgb_to_linear(src, out.data(), pool);
+    return out;
+}
+
+inline Image linear_to_srgb(Image32f const & src, thread_pool * pool)
+{
+    Image out(src.getWidth(), src.getHeight(), src.getChannels());
+    linear_to_srgb(src.data(), out, pool);
+    return out;
+}
+
+}
+
+/**
+ * @brief rgbToYCbCr
+ * @param rgb
+ * @param format
+ * @return
+ *
+ * Converts an RGB or RGBA image to 4:4:4 YCbCr. The result is a planar
+ * 3 channel image (see Image::setPlanar()) with Y in r, Cb in g and Cr
+ * in b. The alpha channel is dropped.
+ *
+ * The conversions between RGB and YCbCr use 13-bit fixed point math and
+ * agree with the exact conversion to within 1.
+ */
+inline Image rgbToYCbCr(ConstImageView const & rgb, YCbCrFormat format = {})
+{
+    return detail::rgb_to_ycbcr(rgb, format, nullptr);
+}
+
+inline Image rgbToYCbCr(thread_pool & pool, ConstImageView const & rgb, YCbCrFormat format = {})
+{
+    return detail::rgb_to_ycbcr(rgb, format, &pool);
+}
+
+/**
+ * @brief yCbCrToRGB
+ * @param ycbcr
+ * @param channels
+ * @param format
+ * @return
+ *
+ * Converts a 3 channel YCbCr image, planar or interleaved, to an RGB
+ * (channels=3) or RGBA (channels=4) image. Alpha is set to 255.
+ */
+inline Image yCbCrToRGB(Image const & ycbcr, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::ycbcr_to_rgb(ycbcr, channels, format, nullptr);
+}
+
+inline Image yCbCrToRGB(thread_pool & pool, Image const & ycbcr, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::ycbcr_to_rgb(ycbcr, channels, format, &pool);
+}
+
+/**
+ * @brief rgbToYCbCr420
+ * @param rgb
+ * @param format
+ * @return
+ *
+ * Converts an RGB or RGBA image to 4:2:0 planar YCbCr. The chroma of
+ * each 2x2 block is computed from the average of its pixels.
+ */
+inline YCbCr420Image rgbToYCbCr420(ConstImageView const & rgb, YCbCrFormat format = {})
+{
+    return detail::rgb_to_ycbcr420(rgb, format, nullptr);
+}
+
+inline YCbCr420Image rgbToYCbCr420(thread_pool & pool, ConstImageView const & rgb, YCbCrFormat format = {})
+{
+    return detail::rgb_to_ycbcr420(rgb, format, &pool);
+}
+
+/**
+ * @brief yCbCr420ToRGB
+ * @param y
+ * @param cb
+ * @param cr
+ * @param channels
+ * @param format
+ * @return
+ *
+ * Converts 4:2:0 planar YCbCr to RGB (channels=3) or RGBA (channels=4).
+ * The planes can be views of external memory, eg: a decoded video frame.
+ * The chroma of each 2x2 block is used for all of its pixels.
+ */
+inline Image yCbCr420ToRGB(ConstImageView const & y, ConstImageView const & cb, ConstImageView const & cr,
+                           uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::ycbcr420_to_rgb(y, cb, cr, channels, format, nullptr);
+}
+
+inline Image yCbCr420ToRGB(thread_pool & pool, ConstImageView const & y, ConstImageView const & cb, ConstImageView const & cr,
+                           uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::ycbcr420_to_rgb(y, cb, cr, channels, format, &pool);
+}
+
+inline Image yCbCr420ToRGB(YCbCr420Image const & I, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::ycbcr420_to_rgb(I.y, I.cb, I.cr, channels, format, nullptr);
+}
+
+inline Image yCbCr420ToRGB(thread_pool & pool, YCbCr420Image const & I, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::ycbcr420_to_rgb(I.y, I.cb, I.cr, channels, format, &pool);
+}
+
+/**
+ * @brief rgbToNV12
+ * @param rgb
+ * @param format
+ * @return
+ *
+ * Same as rgbToYCbCr420() with the chroma interleaved.
+ */
+inline NV12Image rgbToNV12(ConstImageView const & rgb, YCbCrFormat format = {})
+{
+    return detail::rgb_to_nv12(rgb, format, nullptr);
+}
+
+inline NV12Image rgbToNV12(thread_pool & pool, ConstImageView const & rgb, YCbCrFormat format = {})
+{
+    return detail::rgb_to_nv12(rgb, format, &pool);
+}
+
+/**
+ * @brief nv12ToRGB
+ * @param y
+ * @param uv
+ * @param channels
+ * @param format
+ * @return
+ *
+ * Converts an NV12 frame to RGB (channels=3) or RGBA (channels=4). y is
+ * a single channel view and uv a two channel view of half the size,
+ * eg: for a w x h frame in a single buffer with a row pitch of p:
+ *
+ *     gul::ConstImageView y(buf, w, h, 1, p);
+ *     gul::ConstImageView uv(buf + p*h, (w+1)/2, (h+1)/2, 2, p);
+ *     auto I = gul::nv12ToRGB(pool, y, uv);
+ */
+inline Image nv12ToRGB(ConstImageView const & y, ConstImageView const & uv, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::nv12_to_rgb(y, uv, channels, format, nullptr);
+}
+
+inline Image nv12ToRGB(thread_pool & pool, ConstImageView const & y, ConstImageView const & uv, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::nv12_to_rgb(y, uv, channels, format, &pool);
+}
+
+inline Image nv12ToRGB(NV12Image const & I, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::nv12_to_rgb(I.y, I.uv, channels, format, nullptr);
+}
+
+inline Image nv12ToRGB(thread_pool & pool, NV12Image const & I, uint32_t channels = 4, YCbCrFormat format = {})
+{
+    return detail::nv12_to_rgb(I.y, I.uv, channels, format, &pool);
+}
+
+/**
+ * @brief rgbToHSV
+ * @param rgb
+ * @return
+ *
+ * Converts an RGB or RGBA image to HSV, stored in the first three
+ * channels. The alpha channel is copied. All components are in the range
+ * 0-255, the hue wraps around with 256 being 360 degrees.
+ */
+inline Image rgbToHSV(ConstImageView const & rgb)
+{
+    return detail::hsv_convert(rgb, true, nullptr);
+}
+
+inline Image rgbToHSV(thread_pool & pool, ConstImageView const & rgb)
+{
+    return detail::hsv_convert(rgb, true, &pool);
+}
+
+/**
+ * @brief hsvToRGB
+ * @param hsv
+ * @return
+ *
+ * The inverse of rgbToHSV().
+ */
+inline Image hsvToRGB(ConstImageView const & hsv)
+{
+    return detail::hsv_convert(hsv, false, nullptr);
+}
+
+inline Image hsvToRGB(thread_pool & pool, ConstImageView const & hsv)
+{
+    return detail::hsv_convert(hsv, false, &pool);
+}
+
+/**
+ * @brief srgbToLinear
+ * @param srgb
+ * @return
+ *
+ * Converts an sRGB encoded image to linear light in the range 0-1
+ * through a lookup table. The alpha channel (the 4th channel of RGBA
+ * images or the 2nd of two channel images) is only normalized.
+ */
+inline Image32f srgbToLinear(ConstImageView const & srgb)
+{
+    return detail::srgb_to_linear(srgb, nullptr);
+}
+
+inline Image32f srgbToLinear(thread_pool & pool, ConstImageView const & srgb)
+{
+    return detail::srgb_to_linear(srgb, &pool);
+}
+
+/**
+ * @brief linearToSRGB
+ * @param linear
+ * @return
+ *
+ * The inverse of srgbToLinear(). Values are clamped to 0-1 and encoded
+ * through a 16-bit lookup table.
+ */
+inline Image linearToSRGB(Image32f const & linear)
+{
+    return detail::linear_to_srgb(linear, nullptr);
+}
+
+inline Image linearToSRGB(thread_pool & pool, Image32f const & linear)
+{
+    return detail::linear_to_srgb(linear, &pool);
+}
+
+}
+
+#endif
@@ -0,0 +1,616 @@
+#ifndef GUL_IMAGE_CONVOLUTION_H
+#define GUL_IMAGE_CONVOLUTION_H
+
+#include "../Image.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gul
+{
+
+/**
+ * @brief The EdgeMode enum
+ *
+ * How pixels outside the image are sampled by filters.
+ */
+enum class EdgeMode
+{
+    Clamp,  // repeat the edge pixel:      aaa|abcd|ddd
+    Wrap,   // tile the image:             bcd|abcd|abc
+    Mirror  // reflect about the edge:     dcb|abcd|cba
+};
+
+/**
+ * @brief The Kernel1D struct
+ *
+ * A 1D convolution kernel. weights[center] is applied to the pixel
+ * itself, weights[center-1] to the pixel before it, etc. The weights
+ * are used as they are, they are not normalized. There must be at least
+ * one weight and center must index one of them, see validate().
+ */
+struct Kernel1D
+{
+    std::vector<float> weights = {1.0f};
+    uint32_t           center  = 0;
+
+    uint32_t size() const
+    {
+        return static_cast<uint32_t>(weights.size());
+    }
+    uint32_t left() const
+    {
+        return center;
+    }
+    uint32_t right() const
+    {
+        return size() - 1 - center;
+    }
+
+    /**
+     * @brief validate
+     *
+     * Throws std::invalid_argument if the kernel has no weights or the
+     * center is not one of them, left() and right() are only valid
+     * after this check.
+     */
+    void validate() const
+    {
+        if( weights.empty() || weights.size() > UINT32_MAX )
+            throw std::invalid_argument("Kernel1D must have between 1 and 2^32-1 weights");
+        if( center >= weights.size() )
+            throw std::invalid_argument("Kernel1D center must index one of the weights");
+    }
+
+    /**
+     * @brief gaussian
+     * @param sigma
+     * @param radius - 0 to use ceil(3*sigma)
+     * @return
+     *
+     * Returns a normalized gaussian kernel with 2*radius+1 taps.
+     */
+    static Kernel1D gaussian(float sigma, uint32_t radius = 0)
+    {
+        Kernel1D K;
+        if( !(sigma > 0.0f) )
+            return K;
+        if( radius == 0 )
+            radius = static_cast<uint32_t>( std::ceil(3.0f * sigma) );
+
+        K.center = radius;
+        K.weights.resize(2*radius + 1);
+        float total = 0.0f;
+        for(uint32_t i = 0; i < K.weights.size(); i++)
+        {
+            const float x = static_cast<float>(i) - static_cast<float>(radius);
+            K.weights[i] = std::exp( -x*x / (2.0f*sigma*sigma) );
+            total += K.weights[i];
+        }
+        for(auto & w : K.weights)
+            w /= total;
+        return K;
+    }
+
+    /**
+     * @brief box
+     * @param radius
+     * @return
+     *
+     * Returns a normalized box kernel with 2*radius+1 taps.
+     */
+    static Kernel1D box(uint32_t radius)
+    {
+        Kernel1D K;
+        K.center = radius;
+        K.weights.assign(2*radius + 1, 1.0f / static_cast<float>(2*radius + 1));
+        return K;
+    }
+};
+
+/**
+ * @brief The BlurMethod enum
+ *
+ * Exact convolves with a gaussian kernel, the cost grows with sigma.
+ * Box approximates the gaussian with 3 box filters which cost the same
+ * for any sigma. Auto uses Box for sigma >= 6.
+ */
+enum class BlurMethod
+{
+    Auto,
+    Exact,
+    Box
+};
+
+namespace detail
+{
+
+/**
+ * @brief edge_index
+ *
+ * Maps the index i, which may be outside [0,n), to a pixel of the row.
+ */
+inline uint32_t edge_index(int64_t i, uint32_t n, EdgeMode mode)
+{
+    const int64_t N = n;
+    if( i >= 0 && i < N )
+        return static_cast<uint32_t>(i);
+    switch(mode)
+    {
+        case EdgeMode::Wrap:
+        {
+            const int64_t m = i % N;
+            return static_cast<uint32_t>( m < 0 ? m + N : m );
+        }
+        case EdgeMode::Mirror:
+        {
+            if( N == 1 )
+                return 0;
+            const int64_t period = 2*N - 2;
+            int64_t m = i % period;
+            if( m < 0 ) m += period;
+            return static_cast<uint32_t>( m < N ? m : period - m );
+        }
+        default:
+            return i < 0 ? 0 : n - 1;
+    }
+}
+
+/**
+ * @brief pad_row
+ *
+ * Copies a row of n values to dst with `left` and `right` extra values
+ * on either side, filled in according to the edge mode.
+ */
+inline void pad_row(float const * src, uint32_t n, uint32_t left, uint32_t right, EdgeMode mode, float * dst)
+{
+    for(uint32_t i = 0; i < left; i++)
+        dst[i] = src[ edge_index( int64_t(i) - int64_t(left), n, mode) ];
+    std::copy(src, src + n, dst + left);
+    for(uint32_t i = 0; i < right; i++)
+        dst[left + n + i] = src[ edge_index( int64_t(n) + int64_t(i), n, mode) ];
+}
+
+/**
+ * @brief convolve_row
+ *
+ * out[x] = sum_k w[k] * p[x+k] for x in [0,n), where p is a padded row
+ * of n+taps-1 values. The SIMD versions accumulate in the same order.
+ */
+inline void convolve_row(float const * p, uint32_t n, float const * w, uint32_t taps, float * out)
+{
+    uint32_t x = 0;
+#if defined(GUL_IMAGE_AVX2)
+    for(; x + 8 <= n; x += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for(uint32_t k = 0; k < taps; k++)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps( _mm256_set1_ps(w[k]), _mm256_loadu_ps(p + x + k) ));
+        _mm256_storeu_ps(out + x, acc);
+    }
+#endif
+#if defined(GUL_IMAGE_SSE2)
+    for(; x + 4 <= n; x += 4)
+    {
+        __m128 acc = _mm_setzero_ps();
+        for(uint32_t k = 0; k < taps; k++)
+            acc = _mm_add_ps(acc, _mm_mul_ps( _mm_set1_ps(w[k]), _mm_loadu_ps(p + x + k) ));
+        _mm_storeu_ps(out + x, acc);
+    }
+#endif
+    for(; x < n; x++)
+    {
+        float acc = 0.0f;
+        for(uint32_t k = 0; k < taps; k++)
+            acc += w[k] * p[x + k];
+        out[x] = acc;
+    }
+}
+
+/**
+ * @brief box_row
+ *
+ * Box filter of radius r using a running sum, the cost does not depend
+ * on r. p is a padded row of n+2r values.
+ */
+inline void box_row(float const * p, uint32_t n, uint32_t r, float * out)
+{
+    const double scale = 1.0 / double(2*r + 1);
+    double sum = 0.0;
+    for(uint32_t k = 0; k < 2*r + 1; k++)
+        sum += double(p[k]);
+    for(uint32_t x = 0; x < n; x++)
+    {
+        out[x] = static_cast<float>(sum * scale);
+        sum += double(p[x + 2*r + 1]) - double(p[x]);
+    }
+}
+
+/**
+ * @brief gaussian_box_radii
+ *
+ * The radii of n box filters which, applied one after another,
+ * approximate a gaussian with the given sigma.
+ * (P. Kovesi, "Fast almost-gaussian filtering")
+ */
+inline std::vector<uint32_t> gaussian_box_radii(float sigma, uint32_t n = 3)
+{
+    const double s  = double(sigma);
+    const double N  = double(n);
+    int wl = static_cast<int>( std::floor( std::sqrt(12.0*s*s/N + 1.0) ) );
+    if( wl % 2 == 0 ) wl--;
+    wl = std::max(wl, 1);
+    const int    wu = wl + 2;
+    const double m  = std::round( (12.0*s*s - N*wl*wl - 4.0*N*wl - 3.0*N) / (-4.0*wl - 4.0) );
+
+    std::vector<uint32_t> radii(n);
+    for(uint32_t i = 0; i < n; i++)
+        radii[i] = static_cast<uint32_t>( (double(i) < m ? wl : wu) / 2 );
+    return radii;
+}
+
+/**
+ * @brief transpose
+ *
+ * Transposes the rows [row0,row1) of a w x h matrix into the h x w
+ * matrix dst. Works on 32x32 blocks so that both the reads and the
+ * writes stay in cache, with 4x4 SSE transposes inside each block.
+ */
+inline void transpose(float const * src, uint32_t w, uint32_t h, float * dst, uint32_t row0, uint32_t row1)
+{
+    constexpr uint32_t B = 32;
+    for(uint32_t y0 = row0; y0 < row1; y0 += B)
+    {
+        const uint32_t y1 = std::min(row1, y0 + B);
+        for(uint32_t x0 = 0; x0 < w; x0 += B)
+        {
+            const uint32_t x1 = std::min(w, x0 + B);
+            uint32_t y = y0;
+#if defined(GUL_IMAGE_SSE2)
+            for(; y + 4 <= y1; y += 4)
+            {
+                uint32_t x = x0;
+                for(; x + 4 <= x1; x += 4)
+                {
+                    __m128 r0 = _mm_loadu_ps(src + size_t(y+0)*w + x);
+                    __m128 r1 = _mm_loadu_ps(src + size_t(y+1)*w + x);
+                    __m128 r2 = _mm_loadu_ps(src + size_t(y+2)*w + x);
+                    __m128 r3 = _mm_loadu_ps(src + size_t(y+3)*w + x);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(dst + size_t(x+0)*h + y, r0);
+                    _mm_storeu_ps(dst + size_t(x+1)*h + y, r1);
+                    _mm_storeu_ps(dst + size_t(x+2)*h + y, r2);
+                    _mm_storeu_ps(dst + size_t(x+3)*h + y, r3);
+                }
+                for(; x < x1; x++)
+                    for(uint32_t k = 0; k < 4; k++)
+                        dst[size_t(x)*h + y + k] = src[size_t(y + k)*w + x];
+            }
+#endif
+            for(; y < y1; y++)
+                for(uint32_t x = x0; x < x1; x++)
+                    dst[size_t(x)*h + y] = src[size_t(y)*w + x];
+        }
+    }
+}
+
+/**
+ * @brief The row_filter struct
+ *
+ * The filter applied along one axis: either a kernel, or a sequence of
+ * box filters.
+ */
+struct row_filter
+{
+    Kernel1D const *      kernel = nullptr;
+    std::vector<uint32_t> boxRadii;
+    EdgeMode              edge = EdgeMode::Clamp;
+
+    void apply(float * row, uint32_t n, std::vector<float> & scratch) const
+    {
+        if( kernel )
+        {
+            scratch.resize( size_t(n) + kernel->size() );
+            pad_row(row, n, kernel->left(), kernel->right(), edge, scratch.data());
+            convolve_row(scratch.data(), n, kernel->weights.data(), kernel->size(), row);
+            return;
+        }
+        for(auto r : boxRadii)
+        {
+            scratch.resize( size_t(n) + 2*r + 1 );
+            pad_row(row, n, r, r + 1, edge, scratch.data());
+            box_row(scratch.data(), n, r, row);
+        }
+    }
+};
+
+inline void filter_rows(float * data, uint32_t w, uint32_t h, row_filter const & F, thread_pool * pool)
+{
+    auto rows = [&](size_t r0, size_t r1)
+    {
+        std::vector<float> scratch;
+        for(size_t r = r0; r < r1; r++)
+            F.apply(data + r*w, w, scratch);
+    };
+    if( pool )
+        pool->parallel_for(0, h, rows);
+    else
+        rows(0, h);
+}
+
+inline void transpose(float const * src, uint32_t w, uint32_t h, float * dst, thread_pool * pool)
+{
+    if( pool )
+    {
+        // whole 32 row blocks per task
+        pool->parallel_for(0, (h + 31) / 32, [&](size_t b0, size_t b1)
+        {
+            transpose(src, w, h, dst, static_cast<uint32_t>(b0*32), static_cast<uint32_t>( std::min<size_t>(h, b1*32) ));
+        });
+    }
+    else
+    {
+        transpose(src, w, h, dst, 0, h);
+    }
+}
+
+/**
+ * @brief separable_filter
+ *
+ * Filters a w x h plane in place. The rows are filtered, the plane is
+ * transposed so that the columns become contiguous rows, filtered again
+ * and transposed back.
+ */
+inline void separable_filter(float * data, uint32_t w, uint32_t h, row_filter const & fx, row_filter const & fy, thread_pool * pool)
+{
+    if( w == 0 || h == 0 )
+        return;
+    std::vector<float> tmp( size_t(w) * h );
+    filter_rows(data, w, h, fx, pool);
+    transpose(data, w, h, tmp.data(), pool);
+    filter_rows(tmp.data(), h, w, fy, pool);
+    transpose(tmp.data(), h, w, data, pool);
+}
+
+/**
+ * @brief separable_filter
+ *
+ * Filters every channel of an image, converting to float and back. The
+ * output has the same layout as I.
+ */
+inline Image separable_filter(Image const & I, row_filter const & fx, row_filter const & fy, thread_pool * pool)
+{
+    const uint32_t w = I.getWidth(), h = I.getHeight(), C = I.getChannels();
+    const size_t   n = size_t(w) * h;
+    Image out(w, h, C);
+    out.setPlanar(I.isPlanar());
+    // distance between two pixels of a channel and between two channels
+    const size_t pixelStep   = I.isPlanar() ? 1 : C;
+    const size_t channelStep = I.isPlanar() ? n : 1;
+    std::vector<float> plane(n);
+    auto const & lut = unorm8_to_float_lut();
+    for(uint32_t c = 0; c < C; c++)
+    {
+        auto * src = static_cast<uint8_t const*>(I.data()) + c * channelStep;
+        auto * dst = static_cast<uint8_t*>(out.data()) + c * channelStep;
+        for(size_t i = 0; i < n; i++)
+            plane[i] = lut[ src[i*pixelStep] ];
+        separable_filter(plane.data(), w, h, fx, fy, pool);
+        for(size_t i = 0; i < n; i++)
+            dst[i*pixelStep] = float_to_unorm8(plane[i]);
+    }
+    return out;
+}
+
+inline row_filter gaussian_row_filter(float sigma, BlurMethod method, EdgeMode edge, Kernel1D & K)
+{
+    row_filter F;
+    F.edge = edge;
+    if( method == BlurMethod::Box || (method == BlurMethod::Auto && sigma >= 6.0f) )
+    {
+        F.boxRadii = gaussian_box_radii(sigma);
+    }
+    else
+    {
+        K = Kernel1D::gaussian(sigma);
+        F.kernel = &K;
+    }
+    return F;
+}
+
+inline channel1f convolve(channel1f const & C, Kernel1D const & kx, Kernel1D const & ky, EdgeMode edge, thread_pool * pool)
+{
+    kx.validate();
+    ky.validate();
+    channel1f out = C;
+    row_filter fx, fy;
+    fx.kernel = &kx; fx.edge = edge;
+    fy.kernel = &ky; fy.edge = edge;
+    separable_filter(out.data.data(), C.getWidth(), C.getHeight(), fx, fy, pool);
+    return out;
+}
+
+inline Image convolve(Image const & I, Kernel1D const & kx, Kernel1D const & ky, EdgeMode edge, thread_pool * pool)
+{
+    kx.validate();
+    ky.validate();
+    row_filter fx, fy;
+    fx.kernel = &kx; fx.edge = edge;
+    fy.kernel = &ky; fy.edge = edge;
+    return separable_filter(I, fx, fy, pool);
+}
+
+inline channel1f box_blur(channel1f const & C, uint32_t radius, EdgeMode edge, thread_pool * pool)
+{
+    channel1f out = C;
+    row_filter F;
+    F.boxRadii = {radius};
+    F.edge     = edge;
+    separable_filter(out.data.data(), C.getWidth(), C.getHeight(), F, F, pool);
+    return out;
+}
+
+inline Image box_blur(Image const & I, uint32_t radius, EdgeMode edge, thread_pool * pool)
+{
+    row_filter F;
+    F.boxRadii = {radius};
+    F.edge     = edge;
+    return separable_filter(I, F, F, pool);
+}
+
+inline channel1f gaussian_blur(channel1f const & C, float sigma, EdgeMode edge, BlurMethod method, thread_pool * pool)
+{
+    Kernel1D K;
+    auto F = gaussian_row_filter(sigma, method, edge, K);
+    channel1f out = C;
+    separable_filter(out.data.data(), C.getWidth(), C.getHeight(), F, F, pool);
+    return out;
+}
+
+inline Image gaussian_blur(Image const & I, float sigma, EdgeMode edge, BlurMethod method, thread_pool * pool)
+{
+    Kernel1D K;
+    auto F = gaussian_row_filter(sigma, method, edge, K);
+    return separable_filter(I, F, F, pool);
+}
+
+inline Image unsharp_mask(Image const & I, float sigma, float amount, thread_pool * pool)
+{
+    Image blurred = gaussian_blur(I, sigma, EdgeMode::Clamp, BlurMethod::Auto, pool);
+    auto * s = static_cast<uint8_t const*>(I.data());
+    auto * b = static_cast<uint8_t*>(blurred.data());
+    for(size_t i = 0; i < I.size(); i++)
+    {
+        const float v = float(s[i]) + amount * (float(s[i]) - float(b[i]));
+        b[i] = clamp_u8(v + 0.5f);
+    }
+    return blurred;
+}
+
+}
+
+/**
+ * @brief convolve
+ * @param C
+ * @param kx - kernel applied along the rows
+ * @param ky - kernel applied along the columns
+ * @param edge
+ * @return
+ *
+ * Convolves with a separable kernel. Throws std::invalid_argument if
+ * either kernel is invalid, see Kernel1D::validate().
+ */
+inline channel1f convolve(channel1f const & C, Kernel1D const & kx, Kernel1D const & ky, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::convolve(C, kx, ky, edge, nullptr);
+}
+
+inline channel1f convolve(thread_pool & pool, channel1f const & C, Kernel1D const & kx, Kernel1D const & ky, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::convolve(C, kx, ky, edge, &pool);
+}
+
+/**
+ * @brief convolve
+ * @param I
+ * @param kx
+ * @param ky
+ * @param edge
+ * @return
+ *
+ * Convolves every channel of an image with a separable kernel. The
+ * channels are filtered as floats and rounded back to 8 bits.
+ */
+inline Image convolve(Image const & I, Kernel1D const & kx, Kernel1D const & ky, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::convolve(I, kx, ky, edge, nullptr);
+}
+
+inline Image convolve(thread_pool & pool, Image const & I, Kernel1D const & kx, Kernel1D const & ky, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::convolve(I, kx, ky, edge, &pool);
+}
+
+/**
+ * @brief boxBlur
+ * @param C
+ * @param radius
+ * @param edge
+ * @return
+ *
+ * Averages the (2*radius+1)^2 pixels around each pixel. Uses running
+ * sums, so the cost does not depend on the radius.
+ */
+inline channel1f boxBlur(channel1f const & C, uint32_t radius, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::box_blur(C, radius, edge, nullptr);
+}
+
+inline channel1f boxBlur(thread_pool & pool, channel1f const & C, uint32_t radius, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::box_blur(C, radius, edge, &pool);
+}
+
+inline Image boxBlur(Image const & I, uint32_t radius, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::box_blur(I, radius, edge, nullptr);
+}
+
+inline Image boxBlur(thread_pool & pool, Image const & I, uint32_t radius, EdgeMode edge = EdgeMode::Clamp)
+{
+    return detail::box_blur(I, radius, edge, &pool);
+}
+
+/**
+ * @brief gaussianBlur
+ * @param C
+ * @param sigma
+ * @param edge
+ * @param method - see BlurMethod
+ * @return
+ */
+inline channel1f gaussianBlur(channel1f const & C, float sigma, EdgeMode edge = EdgeMode::Clamp, BlurMethod method = BlurMethod::Auto)
+{
+    return detail::gaussian_blur(C, sigma, edge, method, nullptr);
+}
+
+inline channel1f gaussianBlur(thread_pool & pool, channel1f const & C, float sigma, EdgeMode edge = EdgeMode::Clamp, BlurMethod method = BlurMethod::Auto)
+{
+    return detail::gaussian_blur(C, sigma, edge, method, &pool);
+}
+
+inline Image gaussianBlur(Image const & I, float sigma, EdgeMode edge = EdgeMode::Clamp, BlurMethod method = BlurMethod::Auto)
+{
+    return detail::gaussian_blur(I, sigma, edge, method, nullptr);
+}
+
+inline Image gaussianBlur(thread_pool & pool, Image const & I, float sigma, EdgeMode edge = EdgeMode::Clamp, BlurMethod method = BlurMethod::Auto)
+{
+    return detail::gaussian_blur(I, sigma, edge, method, &pool);
+}
+
+/**
+ * @brief unsharpMask
+ * @param I
+ * @param sigma
+ * @param amount
+ * @return
+ *
+ * Sharpens an image: I + amount * (I - gaussianBlur(I, sigma))
+ */
+inline Image unsharpMask(Image const & I, float sigma, float amount)
+{
+    return detail::unsharp_mask(I, sigma, amount, nullptr);
+}
+
+inline Image unsharpMask(thread_pool & pool, Image const & I, float sigma, float amount)
+{
+    return detail::unsharp_mask(I, sigma, amount, &pool);
+}
+
+}
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef GUL_DISTANCE_FIELD_H
+#define GUL_DISTANCE_FIELD_H
+
+#include "../Image.h"
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gul
+{
+
+/**
+ * @brief The SDFSettings struct
+ *
+ * threshold:  mask values >= threshold are inside the shape.
+ * downsample: the output image is downsample times smaller than the mask,
+ *             each output pixel is the average distance over its block.
+ * spread:     the distance, in output pixels, which maps to 0 (outside)
+ *             and 255 (inside). The edge of the shape is at 128.
+ */
+struct SDFSettings
+{
+    uint8_t  threshold  = 128;
+    uint32_t downsample = 1;
+    float    spread     = 4.0f;
+};
+
+namespace detail
+{
+
+/**
+ * @brief sdf_columns
+ *
+ * First pass of the distance transform. For every pixel of the columns
+ * [col0,col1), stores the distance along the column to the nearest pixel
+ * on the other side of the edge: positive outside the shape, negative
+ * inside, infinite if the column has no such pixel. The columns are
+ * scanned together a row at a time so the memory is accessed in order.
+ */
+inline void sdf_columns(ColorChannel const & mask, uint8_t threshold, float * G, uint32_t col0, uint32_t col1)
+{
+    const uint32_t w   = mask.getWidth();
+    const uint32_t h   = mask.getHeight();
+    const uint32_t n   = col1 - col0;
+    const float    inf = std::numeric_limits<float>::infinity();
+
+    // position of the last inside/outside pixel seen in each column
+    std::vector<int64_t> lastIn(n, -1), lastOut(n, -1);
+    for(uint32_t y = 0; y < h; y++)
+    {
+        float * g = G + size_t(y) * w + col0;
+        for(uint32_t i = 0; i < n; i++)
+        {
+            if( mask(col0 + i, y) >= threshold )
+            {
+                lastIn[i] = y;
+                g[i] = lastOut[i] < 0 ? -inf : -static_cast<float>(int64_t(y) - lastOut[i]);
+            }
+            else
+            {
+                lastOut[i] = y;
+                g[i] = lastIn[i] < 0 ? inf : static_cast<float>(int64_t(y) - lastIn[i]);
+            }
+        }
+    }
+    // and bottom to top, the sign tells which side a pixel is on
+    std::fill(lastIn.begin(),  lastIn.end(),  -1);
+    std::fill(lastOut.begin(), lastOut.end(), -1);
+    for(uint32_t y = h; y-- > 0; )
+    {
+        float * g = G + size_t(y) * w + col0;
+        for(uint32_t i = 0; i < n; i++)
+        {
+            if( g[i] < 0.0f )
+            {
+                lastIn[i] = y;
+                if( lastOut[i] >= 0 )
+                    g[i] = std::max(g[i], -static_cast<float>(lastOut[i] - int64_t(y)));
+            }
+            else
+            {
+                lastOut[i] = y;
+                if( lastIn[i] >= 0 )
+                    g[i] = std::min(g[i], static_cast<float>(lastIn[i] - int64_t(y)));
+            }
+        }
+    }
+}
+
+/**
+ * @brief The edt_envelope struct
+ *
+ * Felzenszwalb-Huttenlocher squared distance transform along a line:
+ * d(q) = min_p (q-p)^2 + f(p), computed as the lower envelope of the
+ * parabolas rooted at each source p, so it is linear in the number of
+ * sources. Sources must be added in increasing order of p. All values are
+ * integers so the intersections are compared exactly, without divisions.
+ */
+struct edt_envelope
+{
+    // positions and values fit in 32 bits for lines of up to 2^15 pixels
+    std::vector<int32_t> v;   // source position
+    std::vector<int32_t> f;   // source value
+    std::vector<int64_t> zn;  // left edge of the parabola's interval, zn/zd
+    std::vector<int32_t> zd;
+    size_t   k = 0;
+    size_t   count = 0;
+
+    void reset(size_t n)
+    {
+        if( v.size() < n )
+        {
+            v.resize(n);
+            f.resize(n);
+            zn.resize(n);
+            zd.resize(n);
+        }
+        k = count = 0;
+    }
+
+    void add(int32_t q, int32_t fq)
+    {
+        if( count == 0 )
+        {
+            v[0] = q;
+            f[0] = fq;
+            count = 1;
+            return;
+        }
+        size_t  j = count - 1;
+        const int64_t fqq = int64_t(fq) + int64_t(q)*q;
+        int64_t num, den;
+        for(;;)
+        {
+            const int64_t p = v[j];
+            num = fqq - (f[j] + p*p);
+            den = 2 * (q - p);
+            // the new parabola hides parabola j if they cross left of where j starts
+            if( j > 0 && num * zd[j] <= zn[j] * den )
+            {
+                j--;
+                continue;
+            }
+            break;
+        }
+        j++;
+        v[j]  = q;
+        f[j]  = fq;
+        zn[j] = num;
+        zd[j] = static_cast<int32_t>(den);
+        count = j + 1;
+        k = 0;
+    }
+
+    // queries must be made in increasing order of q
+    int64_t eval(int32_t q)
+    {
+        while( k + 1 < count && zn[k+1] < int64_t(q) * zd[k+1] )
+            k++;
+        const int64_t d = q - v[k];
+        return d*d + f[k];
+    }
+};
+
+/**
+ * @brief sdf_rows
+ *
+ * Second pass of the distance transform, over the rows [row0,row1).
+ * Replaces the column distances in G with the signed Euclidean distance.
+ *
+ * For the pixels on one side of the edge, the sources are the pixels on
+ * that side (with their column distance) and the pixels on the other side
+ * which end a run in the row (with 0). The pixels inside a run on the
+ * other side are always further away than its ends, so they are skipped.
+ */
+inline void sdf_rows(float * G, uint32_t w, uint32_t row0, uint32_t row1)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    edt_envelope E;
+
+    for(uint32_t y = row0; y < row1; y++)
+    {
+        float * g = G + size_t(y) * w;
+        // side 0: distances of the outside pixels (g > 0) to the shape,
+        // side 1: distances of the inside pixels (g < 0) to the outside
+        for(int side = 0; side < 2; side++)
+        {
+            const float sign = side == 0 ? 1.0f : -1.0f;
+            E.reset(w);
+            bool any = false;
+            for(uint32_t x = 0; x < w; x++)
+            {
+                const float s = g[x] * sign;
+                if( s > 0.0f )
+                {
+                    any = true;
+                    if( s != inf )
+                        E.add(static_cast<int32_t>(x), static_cast<int32_t>(s * s));
+                }
+                else if( (x > 0 && g[x-1] * sign > 0.0f) || (x + 1 < w && g[x+1] * sign > 0.0f) )
+                {
+                    E.add(static_cast<int32_t>(x), 0);
+                }
+            }
+            if( !any )
+                continue;
+            for(uint32_t x = 0; x < w; x++)
+            {
+                if( g[x] * sign <= 0.0f )
+                    continue;
+                // the edge lies half way between the pixel centres
+                const float dist = E.count ? std::sqrt( static_cast<float>(E.eval(static_cast<int32_t>(x))) ) - 0.5f : inf;
+                g[x] = sign * dist;
+            }
+        }
+    }
+}
+
+inline channel1f signed_distance(ColorChannel const & mask, uint8_t threshold, thread_pool * pool)
+{
+    const uint32_t w = mask.getWidth();
+    const uint32_t h = mask.getHeight();
+    if( w > 32768 || h > 32768 )
+        throw std::logic_error("Distance fields are limited to 32768x32768 pixels");
+    channel1f D(w, h);
+    float * G = D.data.data();
+
+    if( pool )
+    {
+        pool->parallel_for(0, w, [&](size_t x0, size_t x1)
+        {
+            sdf_columns(mask, threshold, G, static_cast<uint32_t>(x0), static_cast<uint32_t>(x1));
+        }, 64);
+        pool->parallel_for(0, h, [&](size_t y0, size_t y1)
+        {
+            sdf_rows(G, w, static_cast<uint32_t>(y0), static_cast<uint32_t>(y1));
+        }, 16);
+    }
+    else
+    {
+        sdf_columns(mask, threshold, G, 0, w);
+        sdf_rows(G, w, 0, h);
+    }
+    return D;
+}
+
+inline Image signed_distance_image(ColorChannel const & mask, SDFSettings const & settings, thread_pool * pool)
+{
+    if( settings.downsample == 0 || !(settings.spread > 0.0f) )
+        throw std::logic_error("SDFSettings: downsample and spread must be positive");
+
+    const auto D = signed_distance(mask, settings.threshold, pool);
+    const uint32_t s  = settings.downsample;
+    const uint32_t w  = D.getWidth();
+    const uint32_t h  = D.getHeight();
+    const uint32_t ow = (w + s - 1) / s;
+    const uint32_t oh = (h + s - 1) / s;
+    // distance in output pixels, scaled so that +-spread maps to 0 and 1
+    const float scale = 1.0f / (2.0f * settings.spread * float(s));
+
+    Image out(ow, oh, 1);
+    auto * dst = static_cast<uint8_t*>(out.data());
+    auto rows = [&](size_t j0, size_t j1)
+    {
+        for(size_t j = j0; j < j1; j++)
+        {
+            const uint32_t y0 = static_cast<uint32_t>(j) * s;
+            const uint32_t y1 = std::min(y0 + s, h);
+            for(uint32_t i = 0; i < ow; i++)
+            {
+                const uint32_t x0 = i * s;
+                const uint32_t x1 = std::min(x0 + s, w);
+                float sum = 0.0f;
+                for(uint32_t y = y0; y < y1; y++)
+                    for(uint32_t x = x0; x < x1; x++)
+                        sum += D(x,y);
+                const float dist = sum / float((y1 - y0) * (x1 - x0));
+                dst[j * ow + i] = float_to_unorm8(0.5f - dist * scale);
+            }
+        }
+    };
+    if( pool )
+        pool->parallel_for(0, oh, rows, 8);
+    else
+        rows(0, oh);
+    return out;
+}
+
+}
+
+/**
+ * @brief signedDistanceField
+ * @param mask
+ * @param threshold
+ * @return
+ *
+ * Returns the exact Euclidean signed distance, in pixels, from each pixel
+ * to the edge of the shape given by mask >= threshold. Distances are
+ * negative inside the shape and positive outside. The edge is taken to lie
+ * half way between the inside and outside pixels, so pixels next to it are
+ * at +-0.5. If the mask is all inside or all outside, the distances are
+ * infinite.
+ *
+ * Uses the Felzenszwalb-Huttenlocher separable distance transform, one
+ * pass along the columns and one along the rows, in O(w*h).
+ */
+inline channel1f signedDistanceField(ColorChannel const & mask, uint8_t threshold = 128)
+{
+    return detail::signed_distance(mask, threshold, nullptr);
+}
+
+/**
+ * @brief signedDistanceField
+ * @param pool
+ * @param mask
+ * @param threshold
+ * @return
+ *
+ * Same as signedDistanceField(mask, threshold), the row pass and the
+ * column pass are split across the thread pool.
+ */
+inline channel1f signedDistanceField(thread_pool & pool, ColorChannel const & mask, uint8_t threshold = 128)
+{
+    return detail::signed_distance(mask, threshold, &pool);
+}
+
+/**
+ * @brief signedDistanceImage
+ * @param mask
+ * @param settings
+ * @return
+ *
+ * Returns a single channel image encoding the signed distance field of
+ * mask, see SDFSettings, eg: for a font atlas rendered at 8x:
+ *
+ *     auto sdf = signedDistanceImage(glyphs.r, {128, 8, 4.0f});
+ *
+ * Values above 128 are inside the shape.
+ */
+inline Image signedDistanceImage(ColorChannel const & mask, SDFSettings const & settings = {})
+{
+    return detail::signed_distance_image(mask, settings, nullptr);
+}
+
+inline Image signedDistanceImage(thread_pool & pool, ColorChannel const & mask, SDFSettings const & settings = {})
+{
+    return detail::signed_distance_image(mask, settings, &pool);
+}
+
+/**
+ * @brief signedDistanceImage
+ * @param mask
+ * @param settings
+ * @return
+ *
+ * Uses the alpha channel of the image as the mask, which is the only
+ * channel of a single channel image.
+ */
+inline Image signedDistanceImage(Image const & mask, SDFSettings const & settings = {})
+{
+    return detail::signed_distance_image(mask.a, settings, nullptr);
+}
+
+inline Image signedDistanceImage(thread_pool & pool, Image const & mask, SDFSettings const & settings = {})
+{
+    return detail::signed_distance_image(mask.a, settings, &pool);
+}
+
+}
+
+#endif
@@ -0,0 +1,482 @@
+#ifndef GUL_HEIGHT_MAPS_H
+#define GUL_HEIGHT_MAPS_H
+
+#include "../Image.h"
+#include "Convolution.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gul
+{
+
+/**
+ * @brief The GradientFilter enum
+ *
+ * The 3x3 kernel used to estimate the slope of a height map.
+ * Scharr is more rotationally symmetric than Sobel.
+ */
+enum class GradientFilter
+{
+    Sobel,  // 1  2 1
+    Scharr  // 3 10 3
+};
+
+/**
+ * @brief The NormalMapSettings struct
+ *
+ * heightScale: the height of the full 0-255 range, in pixels.
+ * filter:      the gradient kernel.
+ * edge:        how the height map is sampled past its edges, use
+ *              EdgeMode::Wrap for tiling terrain.
+ * greenUp:     true for the OpenGL convention, where +y points to the
+ *              top of the image, false for DirectX.
+ */
+struct NormalMapSettings
+{
+    float          heightScale = 8.0f;
+    GradientFilter filter      = GradientFilter::Sobel;
+    EdgeMode       edge        = EdgeMode::Clamp;
+    bool           greenUp     = true;
+};
+
+/**
+ * @brief The CavitySettings struct
+ *
+ * The cavity is the difference between the height and its average over a
+ * box of the given radius: 128 is flat, bumps are brighter and creases
+ * are darker. strength scales the difference.
+ */
+struct CavitySettings
+{
+    uint32_t radius   = 4;
+    float    strength = 4.0f;
+    EdgeMode edge     = EdgeMode::Clamp;
+};
+
+/**
+ * @brief The AOSettings struct
+ *
+ * Horizon based ambient occlusion. The horizon is searched in 8
+ * directions at 1, 2, 3, 4, 6, 9... pixels, up to radius. heightScale has the
+ * same meaning as in NormalMapSettings and strength scales the occlusion.
+ */
+struct AOSettings
+{
+    uint32_t radius      = 16;
+    float    heightScale = 8.0f;
+    float    strength    = 1.0f;
+    EdgeMode edge        = EdgeMode::Clamp;
+};
+
+namespace detail
+{
+
+/**
+ * @brief The height_plane struct
+ *
+ * A height channel converted to floats in [0,1] with pad extra pixels on
+ * every side, so the kernels can read their neighbours without any edge
+ * tests. row(y) is valid for y in [-pad, height+pad).
+ */
+struct height_plane
+{
+    std::vector<float> data;
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    uint32_t pad    = 0;
+    size_t   pitch  = 0;
+
+    float const * row(int64_t y) const
+    {
+        return data.data() + size_t(y + pad) * pitch + pad;
+    }
+};
+
+inline height_plane make_height_plane(ColorChannel const & H, uint32_t pad, EdgeMode edge, thread_pool * pool)
+{
+    height_plane P;
+    P.width  = H.getWidth();
+    P.height = H.getHeight();
+    P.pad    = pad;
+    P.pitch  = size_t(P.width) + 2*pad;
+    if( P.width == 0 || P.height == 0 )
+        return P;
+    P.data.resize( P.pitch * (size_t(P.height) + 2*pad) );
+
+    auto const & lut = unorm8_to_float_lut();
+    std::vector<uint32_t> cols(P.pitch);
+    for(size_t i = 0; i < P.pitch; i++)
+        cols[i] = edge_index(int64_t(i) - pad, P.width, edge);
+
+    auto rows = [&](size_t j0, size_t j1)
+    {
+        for(size_t j = j0; j < j1; j++)
+        {
+            const uint32_t y = edge_index(int64_t(j) - pad, P.height, edge);
+            float * dst = P.data.data() + j * P.pitch;
+            for(size_t i = 0; i < P.pitch; i++)
+                dst[i] = lut[ H(cols[i], y) ];
+        }
+    };
+    const size_t n = size_t(P.height) + 2*pad;
+    if( pool )
+        pool->parallel_for(0, n, rows, 32);
+    else
+        rows(0, n);
+    return P;
+}
+
+/**
+ * @brief normal_row
+ *
+ * Computes the unit normals of n pixels from the rows above (a), at (b)
+ * and below (c), each padded by one pixel. e and m are the edge and
+ * middle weights of the gradient kernel, k scales the gradient to a
+ * slope and sy is the sign of the y axis.
+ */
+inline void normal_row(float const * a, float const * b, float const * c, uint32_t n,
+                       float e, float m, float k, float sy,
+                       float * nx, float * ny, float * nz)
+{
+    uint32_t x = 0;
+#if defined(GUL_IMAGE_SSE2)
+    {
+        const __m128 E  = _mm_set1_ps(e);
+        const __m128 M  = _mm_set1_ps(m);
+        const __m128 K  = _mm_set1_ps(k);
+        const __m128 SY = _mm_set1_ps(sy);
+        const __m128 ONE = _mm_set1_ps(1.0f);
+        for(; x + 4 <= n; x += 4)
+        {
+            const __m128 a0 = _mm_loadu_ps(a + x - 1), a1 = _mm_loadu_ps(a + x), a2 = _mm_loadu_ps(a + x + 1);
+            const __m128 b0 = _mm_loadu_ps(b + x - 1),                            b2 = _mm_loadu_ps(b + x + 1);
+            const __m128 c0 = _mm_loadu_ps(c + x - 1), c1 = _mm_loadu_ps(c + x), c2 = _mm_loadu_ps(c + x + 1);
+
+            __m128 gx = _mm_add_ps( _mm_mul_ps(E, _mm_sub_ps(a2, a0)), _mm_mul_ps(M, _mm_sub_ps(b2, b0)) );
+            gx = _mm_mul_ps( _mm_add_ps(gx, _mm_mul_ps(E, _mm_sub_ps(c2, c0))), K );
+            __m128 gy = _mm_add_ps( _mm_mul_ps(E, _mm_sub_ps(c0, a0)), _mm_mul_ps(M, _mm_sub_ps(c1, a1)) );
+            gy = _mm_mul_ps( _mm_add_ps(gy, _mm_mul_ps(E, _mm_sub_ps(c2, a2))), K );
+
+            const __m128 len2 = _mm_add_ps( _mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), ONE );
+            const __m128 inv  = _mm_div_ps( ONE, _mm_sqrt_ps(len2) );
+            _mm_storeu_ps(nx + x, _mm_mul_ps( _mm_sub_ps(_mm_setzero_ps(), gx), inv) );
+            _mm_storeu_ps(ny + x, _mm_mul_ps( _mm_mul_ps(gy, SY), inv) );
+            _mm_storeu_ps(nz + x, inv );
+        }
+    }
+#endif
+    for(; x < n; x++)
+    {
+        float const * A = a + x;
+        float const * B = b + x;
+        float const * D = c + x;
+        float gx = e * (A[1] - A[-1]) + m * (B[1] - B[-1]);
+        gx = (gx + e * (D[1] - D[-1])) * k;
+        float gy = e * (D[-1] - A[-1]) + m * (D[0] - A[0]);
+        gy = (gy + e * (D[1] - A[1])) * k;
+
+        const float inv = 1.0f / std::sqrt( (gx * gx + gy * gy) + 1.0f );
+        nx[x] = (0.0f - gx) * inv;
+        ny[x] = (gy * sy) * inv;
+        nz[x] = inv;
+    }
+}
+
+/**
+ * @brief horizon_row
+ *
+ * tmax[x] = max(tmax[x], (q[x] - b[x]) * f), the tangent of the horizon
+ * seen from b at one step along a direction.
+ */
+inline void horizon_row(float const * b, float const * q, float f, uint32_t n, float * tmax)
+{
+    uint32_t x = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128 F = _mm_set1_ps(f);
+    for(; x + 4 <= n; x += 4)
+    {
+        const __m128 t = _mm_mul_ps( _mm_sub_ps(_mm_loadu_ps(q + x), _mm_loadu_ps(b + x)), F );
+        _mm_storeu_ps(tmax + x, _mm_max_ps( _mm_loadu_ps(tmax + x), t ));
+    }
+#endif
+    for(; x < n; x++)
+    {
+        const float t = (q[x] - b[x]) * f;
+        tmax[x] = std::max(tmax[x], t);
+    }
+}
+
+/**
+ * @brief occlusion_row
+ *
+ * occ[x] += sin(atan(tmax[x])), the occlusion of one direction.
+ */
+inline void occlusion_row(float const * tmax, uint32_t n, float * occ)
+{
+    uint32_t x = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128 ONE = _mm_set1_ps(1.0f);
+    for(; x + 4 <= n; x += 4)
+    {
+        const __m128 t = _mm_loadu_ps(tmax + x);
+        const __m128 s = _mm_div_ps( t, _mm_sqrt_ps( _mm_add_ps(_mm_mul_ps(t, t), ONE) ) );
+        _mm_storeu_ps(occ + x, _mm_add_ps( _mm_loadu_ps(occ + x), s ));
+    }
+#endif
+    for(; x < n; x++)
+    {
+        const float t = tmax[x];
+        occ[x] += t / std::sqrt(t * t + 1.0f);
+    }
+}
+
+inline void check_output(ColorChannel const & H, uint32_t w, uint32_t h)
+{
+    if( H.getWidth() != w || H.getHeight() != h )
+        throw std::logic_error("Channels are of different size");
+}
+
+inline void normal_map(ColorChannel const & H, Image & out, NormalMapSettings const & settings, thread_pool * pool)
+{
+    const uint32_t w = H.getWidth();
+    const uint32_t h = H.getHeight();
+    if( out.getWidth() != w || out.getHeight() != h || out.getChannels() < 3 )
+        throw std::logic_error("The normal map must be the size of the height map with at least 3 channels");
+
+    // read everything before writing so H may be a channel of out
+    const auto P = make_height_plane(H, 1, settings.edge, pool);
+    if( w == 0 || h == 0 )
+        return;
+
+    const bool  scharr = settings.filter == GradientFilter::Scharr;
+    const float e  = scharr ? 3.0f  : 1.0f;
+    const float m  = scharr ? 10.0f : 2.0f;
+    // the kernel sums 2*(2e+m) differences one pixel apart
+    const float k  = settings.heightScale / (2.0f * (2.0f * e + m));
+    // the normal is (-gx, -gy, 1) with y going down the rows, OpenGL's +y
+    // points up the image
+    const float sy = settings.greenUp ? 1.0f : -1.0f;
+
+    // distance between two pixels of a channel and between two channels
+    const size_t pixelStep   = out.isPlanar() ? 1 : out.getChannels();
+    const size_t channelStep = out.isPlanar() ? size_t(w) * h : 1;
+    auto * dst = static_cast<uint8_t*>(out.data());
+    auto rows = [&](size_t j0, size_t j1)
+    {
+        std::vector<float> N(3 * size_t(w));
+        float * nx = N.data();
+        float * ny = nx + w;
+        float * nz = ny + w;
+        for(size_t j = j0; j < j1; j++)
+        {
+            const int64_t y = int64_t(j);
+            normal_row(P.row(y-1), P.row(y), P.row(y+1), w, e, m, k, sy, nx, ny, nz);
+            uint8_t * d = dst + j * w * pixelStep;
+            for(uint32_t x = 0; x < w; x++, d += pixelStep)
+            {
+                d[0]             = float_to_unorm8(nx[x] * 0.5f + 0.5f);
+                d[channelStep]   = float_to_unorm8(ny[x] * 0.5f + 0.5f);
+                d[2*channelStep] = float_to_unorm8(nz[x] * 0.5f + 0.5f);
+            }
+        }
+    };
+    if( pool )
+        pool->parallel_for(0, h, rows, 16);
+    else
+        rows(0, h);
+}
+
+inline void cavity_map(ColorChannel const & H, ColorChannel & out, CavitySettings const & settings, thread_pool * pool)
+{
+    const uint32_t w = H.getWidth();
+    const uint32_t h = H.getHeight();
+    check_output(out, w, h);
+
+    channel1f F(w, h);
+    auto const & lut = unorm8_to_float_lut();
+    for(uint32_t y = 0; y < h; y++)
+        for(uint32_t x = 0; x < w; x++)
+            F(x,y) = lut[ H(x,y) ];
+    const auto B = box_blur(F, settings.radius, settings.edge, pool);
+
+    out._prepareWrite();
+    auto rows = [&](size_t j0, size_t j1)
+    {
+        for(size_t j = j0; j < j1; j++)
+        {
+            const uint32_t y = static_cast<uint32_t>(j);
+            for(uint32_t x = 0; x < w; x++)
+                out._at(x,y) = float_to_unorm8( 0.5f + settings.strength * (F(x,y) - B(x,y)) );
+        }
+    };
+    if( pool )
+        pool->parallel_for(0, h, rows, 32);
+    else
+        rows(0, h);
+}
+
+inline void ambient_occlusion_map(ColorChannel const & H, ColorChannel & out, AOSettings const & settings, thread_pool * pool)
+{
+    const uint32_t w = H.getWidth();
+    const uint32_t h = H.getHeight();
+    check_output(out, w, h);
+
+    const uint32_t R = settings.radius;
+    const auto P = make_height_plane(H, R, settings.edge, pool);
+    if( w == 0 || h == 0 )
+        return;
+
+    static const int dirs[8][2] = { {1,0}, {1,1}, {0,1}, {-1,1}, {-1,0}, {-1,-1}, {0,-1}, {1,-1} };
+
+    out._prepareWrite();
+    auto rows = [&](size_t j0, size_t j1)
+    {
+        std::vector<float> occ(w), tmax(w);
+        for(size_t j = j0; j < j1; j++)
+        {
+            const int64_t y = int64_t(j);
+            float const * b = P.row(y);
+            std::fill(occ.begin(), occ.end(), 0.0f);
+            for(auto & d : dirs)
+            {
+                // only the directions above the horizontal occlude
+                std::fill(tmax.begin(), tmax.end(), 0.0f);
+                const float unit = (d[0] != 0 && d[1] != 0) ? std::sqrt(2.0f) : 1.0f;
+                for(uint32_t s = 1; s <= R; s += std::max(1u, s / 2))
+                {
+                    float const * q = P.row(y + d[1] * int64_t(s)) + d[0] * int64_t(s);
+                    horizon_row(b, q, settings.heightScale / (float(s) * unit), w, tmax.data());
+                }
+                occlusion_row(tmax.data(), w, occ.data());
+            }
+            const uint32_t v = static_cast<uint32_t>(j);
+            for(uint32_t x = 0; x < w; x++)
+                out._at(x,v) = float_to_unorm8( 1.0f - settings.strength * occ[x] * 0.125f );
+        }
+    };
+    if( pool )
+        pool->parallel_for(0, h, rows, 8);
+    else
+        rows(0, h);
+}
+
+}
+
+/**
+ * @brief normalMap
+ * @param height
+ * @param out
+ * @param settings
+ *
+ * Writes the tangent space normals of the height map into the r, g and b
+ * channels of out, which must have the same size as height and at least
+ * 3 channels. The other channels are left untouched, so the height can be
+ * kept in the alpha channel:
+ *
+ *     gul::normalMap(I.a, I, {16.0f, gul::GradientFilter::Scharr, gul::EdgeMode::Wrap});
+ */
+inline void normalMap(ColorChannel const & height, Image & out, NormalMapSettings const & settings = {})
+{
+    detail::normal_map(height, out, settings, nullptr);
+}
+
+inline void normalMap(thread_pool & pool, ColorChannel const & height, Image & out, NormalMapSettings const & settings = {})
+{
+    detail::normal_map(height, out, settings, &pool);
+}
+
+/**
+ * @brief normalMap
+ * @param height
+ * @param settings
+ * @return
+ *
+ * Returns a new 3 channel normal map of the height map.
+ */
+inline Image normalMap(ColorChannel const & height, NormalMapSettings const & settings = {})
+{
+    Image out(height.getWidth(), height.getHeight(), 3);
+    detail::normal_map(height, out, settings, nullptr);
+    return out;
+}
+
+inline Image normalMap(thread_pool & pool, ColorChannel const & height, NormalMapSettings const & settings = {})
+{
+    Image out(height.getWidth(), height.getHeight(), 3);
+    detail::normal_map(height, out, settings, &pool);
+    return out;
+}
+
+/**
+ * @brief cavityMap
+ * @param height
+ * @param out
+ * @param settings
+ *
+ * Writes the cavity of the height map into the channel out, which must
+ * have the same size, see CavitySettings.
+ */
+inline void cavityMap(ColorChannel const & height, ColorChannel & out, CavitySettings const & settings = {})
+{
+    detail::cavity_map(height, out, settings, nullptr);
+}
+
+inline void cavityMap(thread_pool & pool, ColorChannel const & height, ColorChannel & out, CavitySettings const & settings = {})
+{
+    detail::cavity_map(height, out, settings, &pool);
+}
+
+inline Image cavityMap(ColorChannel const & height, CavitySettings const & settings = {})
+{
+    Image out(height.getWidth(), height.getHeight(), 1);
+    detail::cavity_map(height, out.r, settings, nullptr);
+    return out;
+}
+
+inline Image cavityMap(thread_pool & pool, ColorChannel const & height, CavitySettings const & settings = {})
+{
+    Image out(height.getWidth(), height.getHeight(), 1);
+    detail::cavity_map(height, out.r, settings, &pool);
+    return out;
+}
+
+/**
+ * @brief ambientOcclusionMap
+ * @param height
+ * @param out
+ * @param settings
+ *
+ * Writes the ambient occlusion of the height map into the channel out,
+ * which must have the same size: 255 is unoccluded. See AOSettings.
+ */
+inline void ambientOcclusionMap(ColorChannel const & height, ColorChannel & out, AOSettings const & settings = {})
+{
+    detail::ambient_occlusion_map(height, out, settings, nullptr);
+}
+
+inline void ambientOcclusionMap(thread_pool & pool, ColorChannel const & height, ColorChannel & out, AOSettings const & settings = {})
+{
+    detail::ambient_occlusion_map(height, out, settings, &pool);
+}
+
+inline Image ambientOcclusionMap(ColorChannel const & height, AOSettings const & settings = {})
+{
+    Image out(height.getWidth(), height.getHeight(), 1);
+    detail::ambient_occlusion_map(height, out.r, settings, nullptr);
+    return out;
+}
+
+inline Image ambientOcclusionMap(thread_pool & pool, ColorChannel const & height, AOSettings const & settings = {})
+{
+    Image out(height.getWidth(), height.getHeight(), 1);
+    detail::ambient_occlusion_map(height, out.r, settings, &pool);
+    return out;
+}
+
+}
+
+#endif
@@ -0,0 +1,447 @@
+#ifndef GUL_IMAGE_CONTAINER_H
+#define GUL_IMAGE_CONTAINER_H
+
+#include "../Image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace gul
+{
+
+/**
+ * @brief The ImageContainerHeader struct
+ *
+ * The raw image container is a simple binary format which can be memory
+ * mapped and used directly, without decoding or copying:
+ *
+ *   [ImageContainerHeader]                          64 bytes
+ *   [ImageContainerEntry] x (levels*layers)         offset table
+ *   [pixel data]                                    each image starts on an
+ *                                                   `alignment` boundary
+ *
+ * The offset table is ordered by mip level, then by layer, the same order
+ * as ImageArray::allocateContiguous(). Pixels are tightly packed 8-bit
+ * interleaved channels. The header and table are stored in the byte order
+ * of the machine which wrote the file, so that they can be used straight
+ * from the mapping. Opening a file written with the other byte order
+ * fails with an error.
+ */
+struct ImageContainerHeader
+{
+    static constexpr uint32_t magic_value   = 0x494C5547; // "GULI"
+    static constexpr uint32_t version_value = 1;
+
+    uint32_t magic     = magic_value;
+    uint32_t version   = version_value;
+    uint32_t width     = 0;
+    uint32_t height    = 0;
+    uint32_t channels  = 0;
+    uint32_t layers    = 0;
+    uint32_t levels    = 0;
+    uint32_t alignment = 0;
+    uint64_t tableOffset = 0;   // byte offset of the first ImageContainerEntry
+    uint64_t fileSize    = 0;
+    uint8_t  reserved[16] = {};
+};
+
+struct ImageContainerEntry
+{
+    uint64_t offset = 0;        // byte offset of the pixels from the start of the file
+    uint64_t size   = 0;        // width*height*channels
+    uint32_t width  = 0;
+    uint32_t height = 0;
+};
+
+static_assert( sizeof(ImageContainerHeader) == 64, "ImageContainerHeader must be 64 bytes");
+static_assert( sizeof(ImageContainerEntry)  == 24, "ImageContainerEntry must be 24 bytes");
+
+namespace detail
+{
+/**
+ * @brief write_image_container
+ *
+ * Writes layers*levels images to a raw image container, image(l,i)
+ * returns level i of layer l. The caller checks that every layer has
+ * the same number of levels.
+ */
+template<typename ImageAt>
+void write_image_container(std::string const & path, uint32_t layers, uint32_t levels, ImageAt && image, uint32_t alignment)
+{
+    if( alignment == 0 || (alignment & (alignment-1)) != 0 )
+        throw std::runtime_error("Alignment must be a power of 2");
+    if( layers == 0 || levels == 0 )
+        throw std::runtime_error("There are no images to write");
+
+    Image const & base = image(0u, 0u);
+
+    ImageContainerHeader H;
+    H.width     = base.getWidth();
+    H.height    = base.getHeight();
+    H.channels  = base.getChannels();
+    H.layers    = layers;
+    H.levels    = levels;
+    H.alignment = alignment;
+    H.tableOffset = sizeof(ImageContainerHeader);
+
+    auto alignUp = [alignment](uint64_t x)
+    {
+        return (x + alignment - 1) & ~uint64_t(alignment - 1);
+    };
+
+    std::vector<ImageContainerEntry> table;
+    std::vector<Image const*>        images;
+    uint64_t offset = H.tableOffset + sizeof(ImageContainerEntry) * uint64_t(H.layers) * H.levels;
+    for(uint32_t i = 0; i < H.levels; i++)
+    {
+        for(uint32_t l = 0; l < H.layers; l++)
+        {
+            Image const & I = image(l, i);
+            if( I.getChannels() != H.channels || (i == 0 && (I.getWidth() != H.width || I.getHeight() != H.height)) )
+                throw std::runtime_error("All layers must have the same size and channel count");
+
+            ImageContainerEntry E;
+            offset   = alignUp(offset);
+            E.offset = offset;
+            E.size   = I.size();
+            E.width  = I.getWidth();
+            E.height = I.getHeight();
+            offset  += E.size;
+
+            table.push_back(E);
+            images.push_back(&I);
+        }
+    }
+    H.fileSize = offset;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if( !out )
+        throw std::runtime_error("Could not open " + path + " for writing");
+
+    out.write( reinterpret_cast<char const*>(&H), sizeof(H) );
+    out.write( reinterpret_cast<char const*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(ImageContainerEntry)) );
+
+    uint64_t pos = H.tableOffset + table.size() * sizeof(ImageContainerEntry);
+    std::vector<char> zeros(alignment, 0);
+    for(size_t i = 0; i < table.size(); i++)
+    {
+        out.write( zeros.data(), static_cast<std::streamsize>(table[i].offset - pos) );
+        if( images[i]->isPlanar() )
+        {
+            // the file always stores interleaved pixels
+            const auto L = interleaved_copy(*images[i]);
+            out.write( static_cast<char const*>(L.data()), static_cast<std::streamsize>(table[i].size) );
+        }
+        else
+        {
+            out.write( static_cast<char const*>(images[i]->data()), static_cast<std::streamsize>(table[i].size) );
+        }
+        pos = table[i].offset + table[i].size;
+    }
+
+    if( !out )
+        throw std::runtime_error("Error writing " + path);
+}
+}
+
+/**
+ * @brief writeImageContainer
+ * @param path
+ * @param A
+ * @param alignment - alignment of each image in the file, must be a power of 2
+ *
+ * Writes all the layers and mip levels of A to a raw image container. All
+ * the layers must have the same size, channel count and number of levels.
+ * The default alignment is the page size so that each level can be paged
+ * in independently when the file is mapped.
+ *
+ * Throws std::runtime_error if the array can't be stored or the file
+ * can't be written.
+ */
+inline void writeImageContainer(std::string const & path, ImageArray const & A, uint32_t alignment = 4096)
+{
+    const uint32_t levels = A.getLayerCount() ? A.getLevelCount() : 0;
+    for(uint32_t l = 0; l < A.getLayerCount(); l++)
+    {
+        if( A.getLayer(l).getLevelCount() != levels )
+            throw std::runtime_error("All layers must have the same number of mip levels");
+    }
+    detail::write_image_container(path, A.getLayerCount(), levels, [&A](uint32_t l, uint32_t i) -> Image const &
+    {
+        return A.getLayer(l).getLevel(i);
+    }, alignment);
+}
+
+/**
+ * @brief writeImageContainer
+ * @param path
+ * @param MM
+ * @param alignment
+ *
+ * Writes a single mip chain, as a container with one layer.
+ */
+inline void writeImageContainer(std::string const & path, ImageMM const & MM, uint32_t alignment = 4096)
+{
+    detail::write_image_container(path, 1, MM.getLevelCount(), [&MM](uint32_t, uint32_t i) -> Image const &
+    {
+        return MM.getLevel(i);
+    }, alignment);
+}
+
+/**
+ * @brief The MappedImageContainer class
+ *
+ * Memory maps a raw image container and exposes the images as views into
+ * the mapping, nothing is read or copied until the pixels are accessed.
+ * Pages are loaded by the OS the first time each level is touched.
+ *
+ *     MappedImageContainer F("textures.gimg");
+ *     ImageArray A = F.getArray();      // no pixel data is read here
+ *     auto & base = A.layer[3].level[0]; // first access pages in this level
+ *
+ * The mapping is private: writing to the images modifies the process'
+ * copy of the pages, never the file. The images keep the mapping alive,
+ * so they can outlive the MappedImageContainer.
+ */
+class MappedImageContainer
+{
+public:
+    MappedImageContainer()
+    {
+    }
+
+    explicit MappedImageContainer(std::string const & path)
+    {
+        open(path);
+    }
+
+    /**
+     * @brief open
+     * @param path
+     *
+     * Maps the file and validates the header and offset table.
+     * Throws std::runtime_error on failure.
+     */
+    void open(std::string const & path)
+    {
+        size_t size = 0;
+        m_mapping = _map(path, size);
+        m_size    = size;
+
+        if( m_size < sizeof(ImageContainerHeader) )
+            throw std::runtime_error(path + " is not an image container");
+
+        memcpy(&m_header, m_mapping.get(), sizeof(m_header));
+        auto & H = m_header;
+        if( H.magic == _byteSwap(ImageContainerHeader::magic_value) )
+            throw std::runtime_error(path + " was written on a machine with a different byte order");
+        if( H.magic != ImageContainerHeader::magic_value || H.version != ImageContainerHeader::version_value )
+            throw std::runtime_error(path + " is not an image container");
+
+        // every value comes from the file, so the checks are written so
+        // that they can't overflow
+        const uint64_t count = uint64_t(H.layers) * H.levels;
+        if( H.fileSize != m_size || H.channels == 0 || H.channels > 4 ||
+            H.layers == 0 || H.levels == 0 ||
+            H.alignment == 0 || (H.alignment & (H.alignment-1)) != 0 ||
+            H.tableOffset > m_size ||
+            count > (m_size - H.tableOffset) / sizeof(ImageContainerEntry) )
+        {
+            throw std::runtime_error(path + " is corrupt");
+        }
+
+        m_table.resize( static_cast<size_t>(count) );
+        memcpy(m_table.data(), m_mapping.get() + H.tableOffset, m_table.size() * sizeof(ImageContainerEntry));
+        for(auto & E : m_table)
+        {
+            const uint64_t pixels = uint64_t(E.width) * E.height;
+            if( E.offset > m_size || E.size > m_size - E.offset ||
+                pixels > E.size / H.channels || pixels * H.channels != E.size )
+            {
+                throw std::runtime_error(path + " is corrupt");
+            }
+        }
+    }
+
+    ImageContainerHeader const & getHeader() const
+    {
+        return m_header;
+    }
+
+    ImageContainerEntry const & getEntry(uint32_t layer, uint32_t level) const
+    {
+        return m_table.at( size_t(level) * m_header.layers + layer );
+    }
+
+    /**
+     * @brief getArray
+     * @return
+     *
+     * Returns an ImageArray whose images are views into the mapping.
+     * The array is contiguous, getOffset(layer,level) is the position of
+     * the image in the file.
+     */
+    ImageArray getArray() const
+    {
+        ImageArray A;
+        A.layer.clear();
+        A.layer.resize(m_header.layers);
+        for(auto & MM : A.layer)
+        {
+            MM.level.assign(m_header.levels, Image(0,0,0));
+        }
+
+        auto & S = A.m_storage;
+        S.buffer    = m_mapping;
+        S.data      = m_mapping.get();
+        S.size      = m_size;
+        S.alignment = m_header.alignment;
+        S.offsets.clear();
+
+        for(uint32_t i = 0; i < m_header.levels; i++)
+        {
+            for(uint32_t l = 0; l < m_header.layers; l++)
+            {
+                auto & E = getEntry(l, i);
+                A.layer[l].level[i]._setStorage(m_mapping, m_mapping.get() + E.offset, E.width, E.height, m_header.channels);
+                S.offsets.push_back( static_cast<size_t>(E.offset) );
+            }
+        }
+        return A;
+    }
+
+    /**
+     * @brief getLayer
+     * @param layer
+     * @return
+     *
+     * Returns the mip chain of a single layer as views into the mapping.
+     */
+    ImageMM getLayer(uint32_t layer) const
+    {
+        ImageMM MM;
+        MM.level.assign(m_header.levels, Image(0,0,0));
+        for(uint32_t i = 0; i < m_header.levels; i++)
+        {
+            auto & E = getEntry(layer, i);
+            MM.level[i]._setStorage(m_mapping, m_mapping.get() + E.offset, E.width, E.height, m_header.channels);
+        }
+        return MM;
+    }
+
+    /**
+     * @brief prefetch
+     * @param layer
+     * @param level
+     *
+     * Hints the OS to start reading the pages of an image in the
+     * background, before it is accessed.
+     */
+    void prefetch(uint32_t layer, uint32_t level) const
+    {
+        auto & E = getEntry(layer, level);
+#if defined(_WIN32)
+        WIN32_MEMORY_RANGE_ENTRY R;
+        R.VirtualAddress = m_mapping.get() + E.offset;
+        R.NumberOfBytes  = static_cast<SIZE_T>(E.size);
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &R, 0);
+#else
+        const auto page  = static_cast<uint64_t>( sysconf(_SC_PAGESIZE) );
+        const auto begin = E.offset & ~(page - 1);
+        madvise( m_mapping.get() + begin, static_cast<size_t>(E.offset + E.size - begin), MADV_WILLNEED );
+#endif
+    }
+
+    size_t byteSize() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief _map
+     *
+     * Maps the whole file with private (copy-on-write) pages. The
+     * returned pointer unmaps the file when the last reference goes.
+     */
+    static std::shared_ptr<uint8_t> _map(std::string const & path, size_t & size)
+    {
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if( file == INVALID_HANDLE_VALUE )
+            throw std::runtime_error("Could not open " + path);
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        size = static_cast<size_t>(fileSize.QuadPart);
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file);
+        if( !mapping )
+            throw std::runtime_error("Could not map " + path);
+
+        auto * p = static_cast<uint8_t*>( MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) );
+        CloseHandle(mapping);
+        if( !p )
+            throw std::runtime_error("Could not map " + path);
+
+        return std::shared_ptr<uint8_t>(p, [](uint8_t * q)
+        {
+            UnmapViewOfFile(q);
+        });
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if( fd < 0 )
+            throw std::runtime_error("Could not open " + path);
+
+        struct stat st;
+        if( fstat(fd, &st) != 0 || st.st_size <= 0 )
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not open " + path);
+        }
+        size = static_cast<size_t>(st.st_size);
+
+        void * p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if( p == MAP_FAILED )
+            throw std::runtime_error("Could not map " + path);
+
+        return std::shared_ptr<uint8_t>(static_cast<uint8_t*>(p), [size](uint8_t * q)
+        {
+            munmap(q, size);
+        });
+#endif
+    }
+
+private:
+    static uint32_t _byteSwap(uint32_t x)
+    {
+        return (x >> 24) | ((x >> 8) & 0xFF00u) | ((x << 8) & 0xFF0000u) | (x << 24);
+    }
+
+    std::shared_ptr<uint8_t>         m_mapping;
+    size_t                           m_size = 0;
+    ImageContainerHeader             m_header;
+    std::vector<ImageContainerEntry> m_table;
+};
+
+}
+
+#endif
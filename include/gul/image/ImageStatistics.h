@@ -0,0 +1,639 @@
+#ifndef GUL_IMAGE_STATISTICS_H
+#define GUL_IMAGE_STATISTICS_H
+
+#include "../Image.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gul
+{
+
+/**
+ * @brief The ChannelStatistics struct
+ *
+ * The histogram of a channel and the values derived from it. An empty
+ * channel has all its values set to 0.
+ */
+struct ChannelStatistics
+{
+    uint8_t                  min    = 0;
+    uint8_t                  max    = 0;
+    double                   mean   = 0.0;
+    double                   stddev = 0.0;
+    std::array<uint64_t,256> histogram = {};
+};
+
+/**
+ * @brief The ImageComparison struct
+ *
+ * The per channel differences between two images, see compareImages().
+ * psnr is infinite for identical channels and ssim is 1.
+ */
+struct ImageComparison
+{
+    uint32_t              channels = 0;
+    std::array<double,4>  mse  = {};
+    std::array<double,4>  psnr = {};
+    std::array<double,4>  ssim = {};
+
+    double meanMSE() const
+    {
+        return _average(mse);
+    }
+    double meanSSIM() const
+    {
+        return _average(ssim);
+    }
+    /**
+     * @brief meanPSNR
+     * @return
+     *
+     * The PSNR of the mean squared error over all channels, not the
+     * average of the per channel PSNRs.
+     */
+    double meanPSNR() const;
+
+    double _average(std::array<double,4> const & v) const
+    {
+        double s = 0.0;
+        for(uint32_t c = 0; c < channels; c++)
+            s += v[c];
+        return channels ? s / channels : 0.0;
+    }
+};
+
+namespace detail
+{
+
+/**
+ * @brief histogram_rows
+ *
+ * Adds the bytes of the rows [row0,row1) of V to the histograms
+ * H[c*256 + value]. Neighbouring bytes are counted in 4 separate tables
+ * so that runs of equal values do not stall on the same counter.
+ */
+inline void histogram_rows(ConstImageView const & V, uint32_t row0, uint32_t row1, uint64_t * H)
+{
+    const uint32_t C = V.getChannels();
+    const size_t   n = V.getRowSize();
+    if( C == 0 || n == 0 )
+        return;
+
+    // each table gets at most 1/4 of the bytes, flush before 2^32
+    const size_t flushRows = std::max<size_t>(1, (size_t(1) << 33) / n);
+    std::vector<uint32_t> T(4 * 4 * 256, 0u);
+    auto flush = [&]()
+    {
+        for(uint32_t k = 0; k < 4; k++)
+            for(uint32_t i = 0; i < C * 256; i++)
+                H[i] += T[k * 1024 + i];
+        std::fill(T.begin(), T.end(), 0u);
+    };
+
+    // channel of the byte i is i % C, the table is i % 4
+    uint32_t * T0 = T.data();
+    uint32_t * T1 = T0 + 1024;
+    uint32_t * T2 = T1 + 1024;
+    uint32_t * T3 = T2 + 1024;
+    size_t pending = 0;
+    for(uint32_t y = row0; y < row1; y++)
+    {
+        uint8_t const * p = V.row(y);
+        size_t i = 0;
+        if( C == 1 )
+        {
+            for(; i + 4 <= n; i += 4)
+            {
+                T0[p[i]]++; T1[p[i+1]]++; T2[p[i+2]]++; T3[p[i+3]]++;
+            }
+        }
+        else if( C == 2 )
+        {
+            for(; i + 4 <= n; i += 4)
+            {
+                T0[p[i]]++; T1[256 + p[i+1]]++; T2[p[i+2]]++; T3[256 + p[i+3]]++;
+            }
+        }
+        else if( C == 4 )
+        {
+            for(; i + 4 <= n; i += 4)
+            {
+                T0[p[i]]++; T1[256 + p[i+1]]++; T2[512 + p[i+2]]++; T3[768 + p[i+3]]++;
+            }
+        }
+        for(; i < n; i++)
+            T[ (i & 3u) * 1024 + (i % C) * 256 + p[i] ]++;
+
+        if( ++pending == flushRows )
+        {
+            flush();
+            pending = 0;
+        }
+    }
+    flush();
+}
+
+inline void check_same_shape(ConstImageView const & a, ConstImageView const & b)
+{
+    if( a.getWidth()    != b.getWidth()  ||
+        a.getHeight()   != b.getHeight() ||
+        a.getChannels() != b.getChannels() )
+        throw std::logic_error("Images are of different size");
+}
+
+/**
+ * @brief sqdiff_row
+ *
+ * acc[i] += (a[i]-b[i])^2 for n bytes. The accumulators are per byte,
+ * the channels are separated once the rows are summed.
+ */
+inline void sqdiff_row(uint8_t const * a, uint8_t const * b, size_t n, uint32_t * acc)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i z = _mm_setzero_si128();
+    for(; i + 16 <= n; i += 16)
+    {
+        const __m128i A = _mm_loadu_si128( reinterpret_cast<__m128i const*>(a + i) );
+        const __m128i B = _mm_loadu_si128( reinterpret_cast<__m128i const*>(b + i) );
+        const __m128i d = _mm_or_si128( _mm_subs_epu8(A, B), _mm_subs_epu8(B, A) );
+        // d^2 <= 65025 fits in 16 bits
+        const __m128i lo = _mm_unpacklo_epi8(d, z);
+        const __m128i hi = _mm_unpackhi_epi8(d, z);
+        const __m128i q[2] = { _mm_mullo_epi16(lo, lo), _mm_mullo_epi16(hi, hi) };
+        for(uint32_t k = 0; k < 2; k++)
+        {
+            __m128i * s = reinterpret_cast<__m128i*>(acc + i + 8*k);
+            _mm_storeu_si128(s,     _mm_add_epi32( _mm_loadu_si128(s),     _mm_unpacklo_epi16(q[k], z) ));
+            _mm_storeu_si128(s + 1, _mm_add_epi32( _mm_loadu_si128(s + 1), _mm_unpackhi_epi16(q[k], z) ));
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        const int32_t d = int32_t(a[i]) - int32_t(b[i]);
+        acc[i] += uint32_t(d * d);
+    }
+}
+
+/**
+ * @brief moments_row
+ *
+ * Adds x, y, x^2, y^2 and xy of n bytes to the per byte sums
+ * S[0..5n), used by the SSIM windows.
+ */
+inline void moments_row(uint8_t const * a, uint8_t const * b, size_t n, uint32_t * S)
+{
+    uint32_t * sx  = S;
+    uint32_t * sy  = S + n;
+    uint32_t * sxx = S + 2*n;
+    uint32_t * syy = S + 3*n;
+    uint32_t * sxy = S + 4*n;
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i z = _mm_setzero_si128();
+    auto add = [&](uint32_t * s, __m128i v16)
+    {
+        __m128i * p = reinterpret_cast<__m128i*>(s);
+        _mm_storeu_si128(p,     _mm_add_epi32( _mm_loadu_si128(p),     _mm_unpacklo_epi16(v16, z) ));
+        _mm_storeu_si128(p + 1, _mm_add_epi32( _mm_loadu_si128(p + 1), _mm_unpackhi_epi16(v16, z) ));
+    };
+    for(; i + 16 <= n; i += 16)
+    {
+        const __m128i A = _mm_loadu_si128( reinterpret_cast<__m128i const*>(a + i) );
+        const __m128i B = _mm_loadu_si128( reinterpret_cast<__m128i const*>(b + i) );
+        const __m128i X[2] = { _mm_unpacklo_epi8(A, z), _mm_unpackhi_epi8(A, z) };
+        const __m128i Y[2] = { _mm_unpacklo_epi8(B, z), _mm_unpackhi_epi8(B, z) };
+        for(uint32_t k = 0; k < 2; k++)
+        {
+            const size_t j = i + 8*k;
+            add(sx  + j, X[k]);
+            add(sy  + j, Y[k]);
+            add(sxx + j, _mm_mullo_epi16(X[k], X[k]));
+            add(syy + j, _mm_mullo_epi16(Y[k], Y[k]));
+            add(sxy + j, _mm_mullo_epi16(X[k], Y[k]));
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        const uint32_t x = a[i];
+        const uint32_t y = b[i];
+        sx[i]  += x;
+        sy[i]  += y;
+        sxx[i] += x * x;
+        syy[i] += y * y;
+        sxy[i] += x * y;
+    }
+}
+
+/**
+ * @brief absdiff_row
+ *
+ * out[i] = |a[i]-b[i]|, scaled by lut if it is not null.
+ */
+inline void absdiff_row(uint8_t const * a, uint8_t const * b, size_t n, uint8_t const * lut, uint8_t * out)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    if( !lut )
+    {
+        for(; i + 16 <= n; i += 16)
+        {
+            const __m128i A = _mm_loadu_si128( reinterpret_cast<__m128i const*>(a + i) );
+            const __m128i B = _mm_loadu_si128( reinterpret_cast<__m128i const*>(b + i) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i), _mm_or_si128( _mm_subs_epu8(A, B), _mm_subs_epu8(B, A) ) );
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        const uint8_t d = a[i] > b[i] ? uint8_t(a[i] - b[i]) : uint8_t(b[i] - a[i]);
+        out[i] = lut ? lut[d] : d;
+    }
+}
+
+inline double psnr_from_mse(double mse)
+{
+    if( mse <= 0.0 )
+        return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10( 255.0 * 255.0 / mse );
+}
+
+inline std::vector<ChannelStatistics> image_statistics(ConstImageView const & V, thread_pool * pool)
+{
+    const uint32_t C = V.getChannels();
+    std::vector<uint64_t> H(size_t(C) * 256, 0u);
+    if( pool )
+    {
+        std::mutex m;
+        pool->parallel_for(0, V.getHeight(), [&](size_t j0, size_t j1)
+        {
+            std::vector<uint64_t> h(H.size(), 0u);
+            histogram_rows(V, uint32_t(j0), uint32_t(j1), h.data());
+            std::lock_guard<std::mutex> L(m);
+            for(size_t i = 0; i < H.size(); i++)
+                H[i] += h[i];
+        }, 64);
+    }
+    else
+    {
+        histogram_rows(V, 0, V.getHeight(), H.data());
+    }
+
+    std::vector<ChannelStatistics> S(C);
+    const uint64_t total = uint64_t(V.getWidth()) * V.getHeight();
+    for(uint32_t c = 0; c < C; c++)
+    {
+        auto & s = S[c];
+        std::copy(H.begin() + c*256, H.begin() + (c+1)*256, s.histogram.begin());
+        if( total == 0 )
+            continue;
+        uint64_t sum = 0, sum2 = 0;
+        bool first = true;
+        for(uint32_t v = 0; v < 256; v++)
+        {
+            const uint64_t k = s.histogram[v];
+            if( !k )
+                continue;
+            if( first )
+            {
+                s.min = uint8_t(v);
+                first = false;
+            }
+            s.max = uint8_t(v);
+            sum  += k * v;
+            sum2 += k * v * v;
+        }
+        s.mean   = double(sum) / double(total);
+        s.stddev = std::sqrt( std::max(0.0, double(sum2) / double(total) - s.mean * s.mean) );
+    }
+    return S;
+}
+
+/**
+ * @brief squared_error
+ *
+ * Returns the per channel sums of the squared differences, summed with
+ * integers so the result does not depend on how the rows were split.
+ */
+inline std::array<uint64_t,4> squared_error(ConstImageView const & a, ConstImageView const & b, thread_pool * pool)
+{
+    check_same_shape(a, b);
+    const uint32_t C = a.getChannels();
+    const size_t   n = a.getRowSize();
+    std::array<uint64_t,4> E = {};
+
+    auto rows = [&](size_t j0, size_t j1, std::array<uint64_t,4> & e)
+    {
+        // a row adds at most 65025 per accumulator
+        const size_t flushRows = 66000;
+        std::vector<uint32_t> acc(n, 0u);
+        size_t pending = 0;
+        auto flush = [&]()
+        {
+            for(size_t i = 0; i < n; i++)
+                e[i % C] += acc[i];
+            std::fill(acc.begin(), acc.end(), 0u);
+        };
+        for(size_t j = j0; j < j1; j++)
+        {
+            sqdiff_row(a.row(uint32_t(j)), b.row(uint32_t(j)), n, acc.data());
+            if( ++pending == flushRows )
+            {
+                flush();
+                pending = 0;
+            }
+        }
+        flush();
+    };
+    if( C == 0 || n == 0 )
+        return E;
+    if( pool )
+    {
+        std::mutex m;
+        pool->parallel_for(0, a.getHeight(), [&](size_t j0, size_t j1)
+        {
+            std::array<uint64_t,4> e = {};
+            rows(j0, j1, e);
+            std::lock_guard<std::mutex> L(m);
+            for(uint32_t c = 0; c < C; c++)
+                E[c] += e[c];
+        }, 64);
+    }
+    else
+    {
+        rows(0, a.getHeight(), E);
+    }
+    return E;
+}
+
+/**
+ * @brief ssim_channels
+ *
+ * Computes the SSIM of every window x window tile and returns the per
+ * channel average over the tiles. The tiles on the right and bottom
+ * edges may be smaller. The tile sums of each band of rows are stored
+ * by band and added up in order, so the pool does not change the result.
+ */
+inline std::array<double,4> ssim_channels(ConstImageView const & a, ConstImageView const & b, uint32_t window, thread_pool * pool)
+{
+    check_same_shape(a, b);
+    const uint32_t w = a.getWidth();
+    const uint32_t h = a.getHeight();
+    const uint32_t C = a.getChannels();
+    const size_t   n = a.getRowSize();
+    std::array<double,4> R = {};
+    if( C == 0 || n == 0 || h == 0 )
+        return R;
+
+    // a tile of 16x16 pixels keeps the sums of x^2 under 2^32
+    window = std::min(std::max(window, 1u), 16u);
+    const uint32_t tilesX = (w + window - 1) / window;
+    const uint32_t bands  = (h + window - 1) / window;
+    std::vector<double> bandSum(size_t(bands) * C, 0.0);
+
+    const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+    const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+    auto run = [&](size_t b0, size_t b1)
+    {
+        std::vector<uint32_t> S(5 * n);
+        for(size_t band = b0; band < b1; band++)
+        {
+            std::fill(S.begin(), S.end(), 0u);
+            const uint32_t y0 = uint32_t(band) * window;
+            const uint32_t y1 = std::min(h, y0 + window);
+            for(uint32_t y = y0; y < y1; y++)
+                moments_row(a.row(y), b.row(y), n, S.data());
+
+            for(uint32_t t = 0; t < tilesX; t++)
+            {
+                const uint32_t x0 = t * window;
+                const uint32_t x1 = std::min(w, x0 + window);
+                const double   N  = double(x1 - x0) * double(y1 - y0);
+                for(uint32_t c = 0; c < C; c++)
+                {
+                    uint64_t m[5] = {0, 0, 0, 0, 0};
+                    for(uint32_t x = x0; x < x1; x++)
+                        for(uint32_t k = 0; k < 5; k++)
+                            m[k] += S[k*n + size_t(x)*C + c];
+                    const double mx  = double(m[0]) / N;
+                    const double my  = double(m[1]) / N;
+                    const double vx  = double(m[2]) / N - mx * mx;
+                    const double vy  = double(m[3]) / N - my * my;
+                    const double cxy = double(m[4]) / N - mx * my;
+                    bandSum[band * C + c] += ( (2.0 * mx * my + C1) * (2.0 * cxy + C2) ) /
+                                             ( (mx * mx + my * my + C1) * (vx + vy + C2) );
+                }
+            }
+        }
+    };
+    if( pool )
+        pool->parallel_for(0, bands, run, 1);
+    else
+        run(0, bands);
+
+    for(size_t band = 0; band < bands; band++)
+        for(uint32_t c = 0; c < C; c++)
+            R[c] += bandSum[band * C + c];
+    for(uint32_t c = 0; c < C; c++)
+        R[c] /= double(tilesX) * double(bands);
+    return R;
+}
+
+inline ImageComparison compare_images(ConstImageView const & a, ConstImageView const & b, uint32_t window, thread_pool * pool)
+{
+    ImageComparison out;
+    out.channels = a.getChannels();
+    const auto   E = squared_error(a, b, pool);
+    const double N = double(a.getWidth()) * a.getHeight();
+    out.ssim = ssim_channels(a, b, window, pool);
+    for(uint32_t c = 0; c < out.channels; c++)
+    {
+        out.mse[c]  = N > 0 ? double(E[c]) / N : 0.0;
+        out.psnr[c] = psnr_from_mse(out.mse[c]);
+    }
+    return out;
+}
+
+inline double mean_squared_error(ConstImageView const & a, ConstImageView const & b, thread_pool * pool)
+{
+    const auto   E = squared_error(a, b, pool);
+    const double N = double(a.getWidth()) * a.getHeight() * a.getChannels();
+    uint64_t s = 0;
+    for(auto e : E)
+        s += e;
+    return N > 0 ? double(s) / N : 0.0;
+}
+
+inline void difference_image(ConstImageView const & a, ConstImageView const & b, float scale, ImageView const & out, thread_pool * pool)
+{
+    check_same_shape(a, b);
+    if( out.getWidth() != a.getWidth() || out.getHeight() != a.getHeight() || out.getChannels() != a.getChannels() )
+        throw std::logic_error("Images are of different size");
+
+    uint8_t lut[256];
+    const bool scaled = scale != 1.0f;
+    if( scaled )
+    {
+        for(uint32_t i = 0; i < 256; i++)
+            lut[i] = clamp_u8( float(i) * scale + 0.5f );
+    }
+    const size_t n = a.getRowSize();
+    auto rows = [&](size_t j0, size_t j1)
+    {
+        for(size_t j = j0; j < j1; j++)
+            absdiff_row(a.row(uint32_t(j)), b.row(uint32_t(j)), n, scaled ? lut : nullptr, out.row(uint32_t(j)));
+    };
+    if( pool )
+        pool->parallel_for(0, a.getHeight(), rows, 64);
+    else
+        rows(0, a.getHeight());
+}
+
+}
+
+inline double ImageComparison::meanPSNR() const
+{
+    return detail::psnr_from_mse( meanMSE() );
+}
+
+/**
+ * @brief imageStatistics
+ * @param I
+ * @return
+ *
+ * Returns the histogram, min, max, mean and standard deviation of every
+ * channel of the image (or view). All of them are computed in a single
+ * pass over the pixels.
+ */
+inline std::vector<ChannelStatistics> imageStatistics(ConstImageView const & I)
+{
+    return detail::image_statistics(I, nullptr);
+}
+
+inline std::vector<ChannelStatistics> imageStatistics(thread_pool & pool, ConstImageView const & I)
+{
+    return detail::image_statistics(I, &pool);
+}
+
+/**
+ * @brief compareImages
+ * @param a
+ * @param b
+ * @param window
+ * @return
+ *
+ * Returns the per channel MSE, PSNR and SSIM between two images of the
+ * same size. The SSIM is the average over window x window tiles (at
+ * most 16), eg: to check an output against a golden image:
+ *
+ *     auto D = gul::compareImages(pool, output, golden);
+ *     REQUIRE( D.meanPSNR() > 40.0 );
+ *     REQUIRE( D.meanSSIM() > 0.98 );
+ *
+ * Throws std::logic_error if the images have different sizes.
+ */
+inline ImageComparison compareImages(ConstImageView const & a, ConstImageView const & b, uint32_t window = 8)
+{
+    return detail::compare_images(a, b, window, nullptr);
+}
+
+inline ImageComparison compareImages(thread_pool & pool, ConstImageView const & a, ConstImageView const & b, uint32_t window = 8)
+{
+    return detail::compare_images(a, b, window, &pool);
+}
+
+/**
+ * @brief meanSquaredError
+ * @param a
+ * @param b
+ * @return
+ *
+ * Returns the mean squared error over all the channels.
+ */
+inline double meanSquaredError(ConstImageView const & a, ConstImageView const & b)
+{
+    return detail::mean_squared_error(a, b, nullptr);
+}
+
+inline double meanSquaredError(thread_pool & pool, ConstImageView const & a, ConstImageView const & b)
+{
+    return detail::mean_squared_error(a, b, &pool);
+}
+
+/**
+ * @brief psnr
+ * @param a
+ * @param b
+ * @return
+ *
+ * Returns the peak signal to noise ratio in dB over all the channels,
+ * infinity if the images are identical.
+ */
+inline double psnr(ConstImageView const & a, ConstImageView const & b)
+{
+    return detail::psnr_from_mse( detail::mean_squared_error(a, b, nullptr) );
+}
+
+inline double psnr(thread_pool & pool, ConstImageView const & a, ConstImageView const & b)
+{
+    return detail::psnr_from_mse( detail::mean_squared_error(a, b, &pool) );
+}
+
+/**
+ * @brief ssim
+ * @param a
+ * @param b
+ * @param window
+ * @return
+ *
+ * Returns the structural similarity averaged over the channels.
+ */
+inline double ssim(ConstImageView const & a, ConstImageView const & b, uint32_t window = 8)
+{
+    const auto S = detail::ssim_channels(a, b, window, nullptr);
+    return ImageComparison{a.getChannels(), {}, {}, S}.meanSSIM();
+}
+
+inline double ssim(thread_pool & pool, ConstImageView const & a, ConstImageView const & b, uint32_t window = 8)
+{
+    const auto S = detail::ssim_channels(a, b, window, &pool);
+    return ImageComparison{a.getChannels(), {}, {}, S}.meanSSIM();
+}
+
+/**
+ * @brief differenceImage
+ * @param a
+ * @param b
+ * @param scale
+ * @return
+ *
+ * Returns an image holding |a-b| for every channel, multiplied by scale
+ * to make small differences visible.
+ */
+inline Image differenceImage(ConstImageView const & a, ConstImageView const & b, float scale = 1.0f)
+{
+    Image out(a.getWidth(), a.getHeight(), a.getChannels());
+    detail::difference_image(a, b, scale, out, nullptr);
+    return out;
+}
+
+inline Image differenceImage(thread_pool & pool, ConstImageView const & a, ConstImageView const & b, float scale = 1.0f)
+{
+    Image out(a.getWidth(), a.getHeight(), a.getChannels());
+    detail::difference_image(a, b, scale, out, &pool);
+    return out;
+}
+
+}
+
+#endif
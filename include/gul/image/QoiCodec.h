@@ -0,0 +1,692 @@
+#ifndef GUL_IMAGE_QOI_CODEC_H
+#define GUL_IMAGE_QOI_CODEC_H
+
+#include "../Image.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace gul
+{
+
+/**
+ * @brief The QoiHeader struct
+ *
+ * A fast lossless codec based on QOI ("Quite OK Image format"), meant for
+ * cache files rather than interchange:
+ *
+ *   [QoiHeader]                         24 bytes
+ *   [chunk 0][chunk 1]...               encoded pixels
+ *   [uint64_t chunkEnd] x chunkCount    end offset of each chunk from the
+ *                                       start of the stream
+ *
+ * The rows are split into chunks of chunkRows rows. Each chunk starts with
+ * a fresh encoder state, so chunks can be encoded and decoded in parallel.
+ *
+ * The opcodes are the same as QOI. Images with 1-3 channels are encoded
+ * as RGBA pixels with the missing channels set to 0 (alpha 255) and the
+ * literal op only stores the channels which exist, so the encoding is not
+ * compatible with .qoi files. All values are little endian.
+ */
+struct QoiHeader
+{
+    static constexpr uint32_t magic_value   = 0x514C5547; // "GULQ"
+    static constexpr uint32_t version_value = 1;
+
+    uint32_t magic     = magic_value;
+    uint32_t version   = version_value;
+    uint32_t width     = 0;
+    uint32_t height    = 0;
+    uint32_t channels  = 0;
+    uint32_t chunkRows = 0;
+
+    uint32_t chunkCount() const
+    {
+        // 64 bit so that a large chunkRows cannot wrap around
+        return chunkRows ? static_cast<uint32_t>( (uint64_t(height) + chunkRows - 1) / chunkRows ) : 0;
+    }
+};
+
+static_assert( sizeof(QoiHeader) == 24, "QoiHeader must be 24 bytes");
+
+/**
+ * @brief qoiMaxEncodedSize
+ * @return
+ *
+ * Returns the largest number of bytes an image of this size can be
+ * encoded to. A buffer of this size can always hold the encoded image.
+ */
+inline size_t qoiMaxEncodedSize(uint32_t width, uint32_t height, uint32_t channels, uint32_t chunkRows = 64)
+{
+    QoiHeader H;
+    H.height    = height;
+    H.chunkRows = chunkRows;
+    return sizeof(QoiHeader) + size_t(width) * height * (channels + 1) + sizeof(uint64_t) * H.chunkCount();
+}
+
+namespace detail
+{
+
+enum : uint8_t
+{
+    qoi_op_index = 0x00,
+    qoi_op_diff  = 0x40,
+    qoi_op_luma  = 0x80,
+    qoi_op_run   = 0xC0,
+    qoi_op_rgb   = 0xFE,
+    qoi_op_rgba  = 0xFF,
+    qoi_mask_2   = 0xC0
+};
+
+// pixels are packed as r | g << 8 | b << 16 | a << 24
+inline uint32_t qoi_hash(uint32_t px)
+{
+    const uint32_t r = px & 0xFF, g = (px >> 8) & 0xFF, b = (px >> 16) & 0xFF, a = px >> 24;
+    return (r*3 + g*5 + b*7 + a*11) & 63u;
+}
+
+template<uint32_t C>
+inline uint32_t qoi_load(uint8_t const * p)
+{
+    switch(C)
+    {
+        case 1:  return uint32_t(p[0]) | 0xFF000000u;
+        case 2:  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | 0xFF000000u;
+        case 3:  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | 0xFF000000u;
+        default: { uint32_t v; memcpy(&v, p, 4); return v; }
+    }
+}
+
+template<uint32_t C>
+inline void qoi_store(uint8_t * p, uint32_t px)
+{
+    if( C == 4 )
+    {
+        memcpy(p, &px, 4);
+        return;
+    }
+    for(uint32_t c = 0; c < C; c++)
+        p[c] = static_cast<uint8_t>(px >> (8*c));
+}
+
+/**
+ * @brief The qoi_state struct
+ *
+ * The state shared by the encoder and the decoder, reset at the
+ * start of every chunk.
+ */
+struct qoi_state
+{
+    uint32_t index[64];
+    uint32_t prev;
+    uint32_t run;
+
+    void reset()
+    {
+        memset(index, 0, sizeof(index));
+        prev = 0xFF000000u;
+        run  = 0;
+    }
+};
+
+inline uint8_t * qoi_flush_run(qoi_state & S, uint8_t * out)
+{
+    if( S.run )
+    {
+        *out++ = static_cast<uint8_t>(qoi_op_run | (S.run - 1));
+        S.run  = 0;
+    }
+    return out;
+}
+
+/**
+ * @brief qoi_encode_pixels
+ *
+ * Encodes count pixels. A run which is still open at the end is kept in
+ * the state so that it can continue with the next call, call
+ * qoi_flush_run() at the end of the chunk.
+ *
+ * At most count*(C+1) bytes are written.
+ */
+template<uint32_t C>
+inline uint8_t * qoi_encode_pixels(qoi_state & S, uint8_t const * src, size_t count, uint8_t * out)
+{
+    uint32_t prev = S.prev;
+    uint32_t run  = S.run;
+    for(size_t i = 0; i < count; i++, src += C)
+    {
+        const uint32_t px = qoi_load<C>(src);
+        if( px == prev )
+        {
+            if( ++run == 62 )
+            {
+                *out++ = static_cast<uint8_t>(qoi_op_run | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if( run )
+        {
+            *out++ = static_cast<uint8_t>(qoi_op_run | (run - 1));
+            run = 0;
+        }
+
+        const uint32_t h = qoi_hash(px);
+        if( S.index[h] == px )
+        {
+            *out++ = static_cast<uint8_t>(qoi_op_index | h);
+        }
+        else
+        {
+            S.index[h] = px;
+            if( (px >> 24) == (prev >> 24) )
+            {
+                const int8_t dr = static_cast<int8_t>( (px       & 0xFF) - (prev       & 0xFF) );
+                const int8_t dg = static_cast<int8_t>( (px >> 8  & 0xFF) - (prev >> 8  & 0xFF) );
+                const int8_t db = static_cast<int8_t>( (px >> 16 & 0xFF) - (prev >> 16 & 0xFF) );
+                const int dr_dg = dr - dg;
+                const int db_dg = db - dg;
+
+                if( dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2 )
+                {
+                    *out++ = static_cast<uint8_t>( qoi_op_diff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2) );
+                }
+                else if( dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8 )
+                {
+                    *out++ = static_cast<uint8_t>( qoi_op_luma | (dg + 32) );
+                    *out++ = static_cast<uint8_t>( (dr_dg + 8) << 4 | (db_dg + 8) );
+                }
+                else
+                {
+                    *out++ = qoi_op_rgb;
+                    for(uint32_t c = 0; c < (C < 3 ? C : 3); c++)
+                        *out++ = static_cast<uint8_t>(px >> (8*c));
+                }
+            }
+            else
+            {
+                // only possible with 4 channels
+                *out++ = qoi_op_rgba;
+                memcpy(out, &px, 4);
+                out += 4;
+            }
+        }
+        prev = px;
+    }
+    S.prev = prev;
+    S.run  = run;
+    return out;
+}
+
+template<uint32_t C>
+inline ptrdiff_t qoi_op_size(uint8_t op)
+{
+    if( op == qoi_op_rgba ) return 5;
+    if( op == qoi_op_rgb )  return 1 + (C < 3 ? C : 3);
+    return (op & qoi_mask_2) == qoi_op_luma ? 2 : 1;
+}
+
+/**
+ * @brief qoi_decode_pixels
+ *
+ * Decodes count pixels from [in, end). Throws std::runtime_error if the
+ * data is truncated or runs past the end of the chunk.
+ */
+template<uint32_t C>
+inline void qoi_decode_pixels(uint8_t const * in, uint8_t const * end, uint8_t * dst, size_t count)
+{
+    uint32_t index[64] = {};
+    uint32_t px = 0xFF000000u;
+    uint8_t * const dstEnd = dst + count * C;
+
+    auto fail = []()
+    {
+        throw std::runtime_error("Corrupt QOI chunk");
+    };
+
+    while( dst < dstEnd )
+    {
+        // the longest op is 5 bytes, only check each op near the end
+        if( end - in < 5 && (in >= end || end - in < qoi_op_size<C>(*in)) )
+            fail();
+
+        const uint8_t b1 = *in++;
+        if( b1 == qoi_op_rgb )
+        {
+            for(uint32_t c = 0; c < (C < 3 ? C : 3); c++)
+            {
+                px = (px & ~(0xFFu << (8*c))) | uint32_t(*in++) << (8*c);
+            }
+        }
+        else if( b1 == qoi_op_rgba )
+        {
+            memcpy(&px, in, 4);
+            in += 4;
+        }
+        else
+        {
+            switch(b1 & qoi_mask_2)
+            {
+                case qoi_op_index:
+                    px = index[b1];
+                    qoi_store<C>(dst, px);
+                    dst += C;
+                    continue;
+                case qoi_op_diff:
+                {
+                    const uint32_t r = ((px       & 0xFF) + ((b1 >> 4) & 3u) - 2u) & 0xFF;
+                    const uint32_t g = ((px >> 8  & 0xFF) + ((b1 >> 2) & 3u) - 2u) & 0xFF;
+                    const uint32_t b = ((px >> 16 & 0xFF) + ( b1       & 3u) - 2u) & 0xFF;
+                    px = r | g << 8 | b << 16 | (px & 0xFF000000u);
+                    break;
+                }
+                case qoi_op_luma:
+                {
+                    const uint8_t  b2 = *in++;
+                    const uint32_t dg = (b1 & 0x3Fu) - 32u;
+                    const uint32_t r = ((px       & 0xFF) + dg - 8u + ((b2 >> 4) & 0x0Fu)) & 0xFF;
+                    const uint32_t g = ((px >> 8  & 0xFF) + dg) & 0xFF;
+                    const uint32_t b = ((px >> 16 & 0xFF) + dg - 8u + ( b2       & 0x0Fu)) & 0xFF;
+                    px = r | g << 8 | b << 16 | (px & 0xFF000000u);
+                    break;
+                }
+                default:
+                {
+                    const size_t run = (b1 & 0x3Fu) + 1u;
+                    if( run > size_t(dstEnd - dst) / C )
+                        fail();
+                    for(size_t i = 0; i < run; i++, dst += C)
+                        qoi_store<C>(dst, px);
+                    continue;
+                }
+            }
+        }
+        index[qoi_hash(px)] = px;
+        qoi_store<C>(dst, px);
+        dst += C;
+    }
+}
+
+inline uint8_t * qoi_encode_pixels(uint32_t channels, qoi_state & S, uint8_t const * src, size_t count, uint8_t * out)
+{
+    switch(channels)
+    {
+        case 1:  return qoi_encode_pixels<1>(S, src, count, out);
+        case 2:  return qoi_encode_pixels<2>(S, src, count, out);
+        case 3:  return qoi_encode_pixels<3>(S, src, count, out);
+        default: return qoi_encode_pixels<4>(S, src, count, out);
+    }
+}
+
+inline void qoi_decode_pixels(uint32_t channels, uint8_t const * in, uint8_t const * end, uint8_t * dst, size_t count)
+{
+    switch(channels)
+    {
+        case 1:  qoi_decode_pixels<1>(in, end, dst, count); break;
+        case 2:  qoi_decode_pixels<2>(in, end, dst, count); break;
+        case 3:  qoi_decode_pixels<3>(in, end, dst, count); break;
+        default: qoi_decode_pixels<4>(in, end, dst, count); break;
+    }
+}
+
+inline void qoi_write64(uint8_t * p, uint64_t v)
+{
+    for(int i = 0; i < 8; i++)
+        p[i] = static_cast<uint8_t>(v >> (8*i));
+}
+
+inline uint64_t qoi_read64(uint8_t const * p)
+{
+    uint64_t v = 0;
+    for(int i = 0; i < 8; i++)
+        v |= uint64_t(p[i]) << (8*i);
+    return v;
+}
+
+inline void qoi_check_channels(uint32_t channels)
+{
+    if( channels < 1 || channels > 4 )
+        throw std::logic_error("QOI encoding needs 1-4 channels");
+}
+
+}
+
+/**
+ * @brief The QoiEncoder class
+ *
+ * Encodes an image into a caller provided buffer, a few rows at a time.
+ *
+ *     std::vector<uint8_t> buffer( qoiMaxEncodedSize(w,h,4) );
+ *     QoiEncoder E(w, h, 4, buffer.data(), buffer.size());
+ *     while( ... )
+ *         E.addRows(rows, rowCount);
+ *     buffer.resize( E.finish() );
+ *
+ * Throws std::runtime_error if the buffer is too small.
+ */
+class QoiEncoder
+{
+public:
+    QoiEncoder(uint32_t width, uint32_t height, uint32_t channels, void * dst, size_t capacity, uint32_t chunkRows = 64)
+        : m_out(static_cast<uint8_t*>(dst)), m_capacity(capacity)
+    {
+        detail::qoi_check_channels(channels);
+        m_header.width     = width;
+        m_header.height    = height;
+        m_header.channels  = channels;
+        m_header.chunkRows = chunkRows ? std::min(chunkRows, std::max(height, 1u)) : std::max(height, 1u);
+        m_chunkEnds.reserve(m_header.chunkCount());
+
+        _reserve(sizeof(QoiHeader));
+        memcpy(m_out, &m_header, sizeof(QoiHeader));
+        m_size = sizeof(QoiHeader);
+        m_state.reset();
+    }
+
+    QoiHeader const & getHeader() const
+    {
+        return m_header;
+    }
+
+    /**
+     * @brief addRows
+     * @param rows - rowCount tightly packed rows
+     * @param rowCount
+     */
+    void addRows(void const * rows, uint32_t rowCount)
+    {
+        if( m_row + rowCount > m_header.height )
+            throw std::logic_error("More rows than the height of the image");
+
+        auto * src = static_cast<uint8_t const*>(rows);
+        const size_t rowBytes = size_t(m_header.width) * m_header.channels;
+        while( rowCount )
+        {
+            // stop at the end of the chunk
+            const uint32_t n = std::min(rowCount, m_header.chunkRows - m_row % m_header.chunkRows);
+            const size_t pixels = size_t(n) * m_header.width;
+
+            _reserve( pixels * (m_header.channels + 1) + 1 );
+            m_size = static_cast<size_t>( detail::qoi_encode_pixels(m_header.channels, m_state, src, pixels, m_out + m_size) - m_out );
+
+            src      += n * rowBytes;
+            m_row    += n;
+            rowCount -= n;
+            if( m_row % m_header.chunkRows == 0 || m_row == m_header.height )
+            {
+                m_size = static_cast<size_t>( detail::qoi_flush_run(m_state, m_out + m_size) - m_out );
+                m_chunkEnds.push_back(m_size);
+                m_state.reset();
+            }
+        }
+    }
+
+    /**
+     * @brief addChunk
+     * @param data - an encoded chunk, see encodeQOIChunk()
+     *
+     * Appends a chunk which was encoded separately. Can only be called
+     * on a chunk boundary.
+     */
+    void addChunk(void const * data, size_t bytes)
+    {
+        if( m_row % m_header.chunkRows != 0 || m_row >= m_header.height )
+            throw std::logic_error("addChunk() must be called on a chunk boundary");
+        _reserve(bytes);
+        memcpy(m_out + m_size, data, bytes);
+        m_size += bytes;
+        m_row   = static_cast<uint32_t>( std::min<uint64_t>(m_header.height, uint64_t(m_row) + m_header.chunkRows) );
+        m_chunkEnds.push_back(m_size);
+    }
+
+    /**
+     * @brief finish
+     * @return the total number of bytes written
+     *
+     * Writes the chunk table. All the rows must have been added.
+     */
+    size_t finish()
+    {
+        if( m_row != m_header.height )
+            throw std::logic_error("Not all rows have been added");
+        _reserve( m_chunkEnds.size() * sizeof(uint64_t) );
+        for(auto e : m_chunkEnds)
+        {
+            detail::qoi_write64(m_out + m_size, e);
+            m_size += sizeof(uint64_t);
+        }
+        return m_size;
+    }
+
+protected:
+    void _reserve(size_t bytes) const
+    {
+        if( m_size + bytes > m_capacity )
+            throw std::runtime_error("QOI output buffer is too small");
+    }
+
+    QoiHeader             m_header;
+    detail::qoi_state     m_state;
+    uint8_t *             m_out      = nullptr;
+    size_t                m_capacity = 0;
+    size_t                m_size     = 0;
+    uint32_t              m_row      = 0;
+    std::vector<uint64_t> m_chunkEnds;
+};
+
+/**
+ * @brief encodeQOIChunk
+ * @param I
+ * @param chunk
+ * @param chunkRows
+ * @param dst - at least qoiMaxEncodedSize(width, chunkRows, channels) bytes
+ * @return the number of bytes written
+ *
+ * Encodes a single chunk of rows of I. The rows of a planar image are
+ * interleaved first.
+ */
+inline size_t encodeQOIChunk(Image const & I, uint32_t chunk, uint32_t chunkRows, void * dst)
+{
+    const uint32_t y0 = chunk * chunkRows;
+    const uint32_t y1 = static_cast<uint32_t>( std::min<uint64_t>(I.getHeight(), uint64_t(y0) + chunkRows) );
+    const uint32_t C  = I.getChannels();
+    const size_t   count = size_t(y1 - y0) * I.getWidth();
+    detail::qoi_state S;
+    S.reset();
+    auto * out = static_cast<uint8_t*>(dst);
+    auto * src = static_cast<uint8_t const*>(I.data()) + size_t(y0) * I.getWidth() * (I.isPlanar() ? 1 : C);
+
+    std::vector<uint8_t> rows;
+    if( I.isPlanar() )
+    {
+        const size_t n = size_t(I.getWidth()) * I.getHeight();
+        rows.resize(count * C);
+        for(uint32_t c = 0; c < C; c++)
+            for(size_t i = 0; i < count; i++)
+                rows[i*C + c] = src[c*n + i];
+        src = rows.data();
+    }
+    auto * e = detail::qoi_encode_pixels(C, S, src, count, out);
+    e = detail::qoi_flush_run(S, e);
+    return static_cast<size_t>(e - out);
+}
+
+/**
+ * @brief encodeQOI
+ * @param I
+ * @param dst
+ * @param capacity - qoiMaxEncodedSize() is always enough
+ * @param chunkRows - rows per independently decodable chunk, 0 for a single chunk
+ * @return the number of bytes written
+ *
+ * The stream always stores interleaved pixels, a planar image is
+ * converted first.
+ */
+inline size_t encodeQOI(Image const & I, void * dst, size_t capacity, uint32_t chunkRows = 64)
+{
+    if( I.isPlanar() )
+        return encodeQOI(detail::interleaved_copy(I), dst, capacity, chunkRows);
+    QoiEncoder E(I.getWidth(), I.getHeight(), I.getChannels(), dst, capacity, chunkRows);
+    if( I.getHeight() )
+        E.addRows(I.data(), I.getHeight());
+    return E.finish();
+}
+
+inline std::vector<uint8_t> encodeQOI(Image const & I, uint32_t chunkRows = 64)
+{
+    std::vector<uint8_t> out( qoiMaxEncodedSize(I.getWidth(), I.getHeight(), I.getChannels(), chunkRows ? chunkRows : I.getHeight()) );
+    out.resize( encodeQOI(I, out.data(), out.size(), chunkRows) );
+    out.shrink_to_fit();
+    return out;
+}
+
+/**
+ * @brief encodeQOI
+ * @param pool
+ * @param I
+ * @param chunkRows
+ * @return
+ *
+ * Encodes the chunks on the thread pool. The output is identical to
+ * the single threaded version.
+ */
+inline std::vector<uint8_t> encodeQOI(thread_pool & pool, Image const & I, uint32_t chunkRows = 64)
+{
+    chunkRows = chunkRows ? std::min(chunkRows, std::max(I.getHeight(), 1u)) : std::max(I.getHeight(), 1u);
+    detail::qoi_check_channels(I.getChannels());
+
+    QoiHeader H;
+    H.height    = I.getHeight();
+    H.chunkRows = chunkRows;
+    const uint32_t chunks    = H.chunkCount();
+    const size_t   chunkSize = size_t(chunkRows) * I.getWidth() * (I.getChannels() + 1);
+
+    std::vector<uint8_t> scratch( chunkSize * chunks );
+    std::vector<size_t>  sizes(chunks);
+    pool.parallel_for(0, chunks, [&](size_t c0, size_t c1)
+    {
+        for(size_t c = c0; c < c1; c++)
+            sizes[c] = encodeQOIChunk(I, static_cast<uint32_t>(c), chunkRows, scratch.data() + c*chunkSize);
+    });
+
+    size_t total = sizeof(QoiHeader) + sizeof(uint64_t) * chunks;
+    for(auto s : sizes)
+        total += s;
+
+    std::vector<uint8_t> out(total);
+    QoiEncoder E(I.getWidth(), I.getHeight(), I.getChannels(), out.data(), out.size(), chunkRows);
+    for(uint32_t c = 0; c < chunks; c++)
+        E.addChunk(scratch.data() + c*chunkSize, sizes[c]);
+    E.finish();
+    return out;
+}
+
+/**
+ * @brief readQOIHeader
+ * @param data
+ * @param bytes
+ * @return
+ *
+ * Validates and returns the header of an encoded image. Throws
+ * std::runtime_error if the data is not a valid stream, including
+ * when the image is larger than the stream could possibly encode.
+ */
+inline QoiHeader readQOIHeader(void const * data, size_t bytes)
+{
+    QoiHeader H;
+    if( bytes < sizeof(QoiHeader) )
+        throw std::runtime_error("QOI stream is truncated");
+    memcpy(&H, data, sizeof(QoiHeader));
+    if( H.magic != QoiHeader::magic_value || H.version != QoiHeader::version_value )
+        throw std::runtime_error("Not a QOI stream");
+    if( H.channels < 1 || H.channels > 4 || (H.height && H.chunkRows == 0) )
+        throw std::runtime_error("Invalid QOI header");
+    const uint64_t tableBytes = sizeof(uint64_t) * uint64_t(H.chunkCount());
+    if( bytes < sizeof(QoiHeader) + tableBytes )
+        throw std::runtime_error("QOI stream is truncated");
+
+    // a run op covers at most 62 pixels per byte, reject the header before
+    // the image is allocated
+    const uint64_t pixels = uint64_t(H.width) * H.height;
+    const uint64_t opBytes = bytes - sizeof(QoiHeader) - tableBytes;
+    if( pixels > opBytes * 62u )
+        throw std::runtime_error("QOI stream is too short for the image size");
+    return H;
+}
+
+namespace detail
+{
+
+inline void qoi_decode_chunks(QoiHeader const & H, uint8_t const * in, size_t bytes, Image & out, uint32_t c0, uint32_t c1)
+{
+    const size_t   tableOffset = bytes - sizeof(uint64_t) * H.chunkCount();
+    const uint8_t * table = in + tableOffset;
+    for(uint32_t c = c0; c < c1; c++)
+    {
+        const uint64_t begin = c ? qoi_read64(table + 8*(c-1)) : sizeof(QoiHeader);
+        const uint64_t end   = qoi_read64(table + 8*c);
+        if( end < begin || end > tableOffset )
+            throw std::runtime_error("Corrupt QOI chunk table");
+
+        const uint32_t y0 = c * H.chunkRows;
+        const uint32_t y1 = static_cast<uint32_t>( std::min<uint64_t>(H.height, uint64_t(y0) + H.chunkRows) );
+        auto * dst = static_cast<uint8_t*>(out.data()) + size_t(y0) * H.width * H.channels;
+        qoi_decode_pixels(H.channels, in + begin, in + end, dst, size_t(y1 - y0) * H.width);
+    }
+}
+
+}
+
+/**
+ * @brief decodeQOI
+ * @param data
+ * @param bytes
+ * @return
+ *
+ * Decodes an image written by encodeQOI() or QoiEncoder. Throws
+ * std::runtime_error if the data is corrupt.
+ */
+inline Image decodeQOI(void const * data, size_t bytes)
+{
+    auto H = readQOIHeader(data, bytes);
+    Image out(H.width, H.height, H.channels);
+    detail::qoi_decode_chunks(H, static_cast<uint8_t const*>(data), bytes, out, 0, H.chunkCount());
+    return out;
+}
+
+inline Image decodeQOI(std::vector<uint8_t> const & data)
+{
+    return decodeQOI(data.data(), data.size());
+}
+
+/**
+ * @brief decodeQOI
+ * @param pool
+ * @param data
+ * @param bytes
+ * @return
+ *
+ * Decodes the chunks on the thread pool.
+ */
+inline Image decodeQOI(thread_pool & pool, void const * data, size_t bytes)
+{
+    auto H = readQOIHeader(data, bytes);
+    Image out(H.width, H.height, H.channels);
+    pool.parallel_for(0, H.chunkCount(), [&](size_t c0, size_t c1)
+    {
+        detail::qoi_decode_chunks(H, static_cast<uint8_t const*>(data), bytes, out, static_cast<uint32_t>(c0), static_cast<uint32_t>(c1));
+    });
+    return out;
+}
+
+inline Image decodeQOI(thread_pool & pool, std::vector<uint8_t> const & data)
+{
+    return decodeQOI(pool, data.data(), data.size());
+}
+
+}
+
+#endif
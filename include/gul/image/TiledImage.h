@@ -0,0 +1,616 @@
+#ifndef GUL_TILED_IMAGE_H
+#define GUL_TILED_IMAGE_H
+
+#include "../Image.h"
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gul
+{
+
+/**
+ * @brief The PixelLayout enum
+ *
+ * How the pixels of a TiledImage are ordered inside each tile. The
+ * tiles themselves are always stored row by row.
+ *
+ * Tiled:  the rows of a tile are stored one after the other, so a tile
+ *         can be used as an ImageView, see TiledImage::tile().
+ * Morton: Z-order, the bits of x and y are interleaved. Every aligned
+ *         2^k x 2^k block of pixels is contiguous.
+ */
+enum class PixelLayout
+{
+    Tiled,
+    Morton
+};
+
+namespace detail
+{
+
+/**
+ * @brief part1by1
+ *
+ * Spreads the lower 16 bits of x over the even bits.
+ */
+inline uint32_t part1by1(uint32_t x)
+{
+    x &= 0x0000ffffu;
+    x = (x | (x << 8)) & 0x00ff00ffu;
+    x = (x | (x << 4)) & 0x0f0f0f0fu;
+    x = (x | (x << 2)) & 0x33333333u;
+    x = (x | (x << 1)) & 0x55555555u;
+    return x;
+}
+
+/**
+ * @brief box4_run
+ *
+ * Averages every 4 consecutive pixels of src into n output pixels, ie:
+ * the 2x2 blocks of a tile in Morton order. Same result as box2x2_row.
+ */
+inline void box4_run(uint8_t const * src, size_t n, uint32_t C, uint8_t * dst)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128i z = _mm_setzero_si128();
+    if( C == 4 )
+    {
+        for(; i < n; i++)
+        {
+            const __m128i a = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 16*i) );
+            __m128i s = _mm_add_epi16( _mm_unpacklo_epi8(a,z), _mm_unpackhi_epi8(a,z) );
+            s = _mm_srli_epi16( _mm_add_epi16(s, _mm_srli_si128(s,8)), 2 );
+            const int32_t p = _mm_cvtsi128_si32( _mm_packus_epi16(s,s) );
+            memcpy(dst + 4*i, &p, 4);
+        }
+    }
+    else if( C == 1 )
+    {
+        // 16 source pixels -> 4 output pixels
+        const __m128i ones = _mm_set1_epi16(1);
+        for(; i + 4 <= n; i += 4)
+        {
+            const __m128i a  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + 4*i) );
+            const __m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8(a,z), ones );
+            const __m128i hi = _mm_madd_epi16( _mm_unpackhi_epi8(a,z), ones );
+            __m128i s = _mm_madd_epi16( _mm_packs_epi32(lo,hi), ones );
+            s = _mm_srli_epi32(s, 2);
+            s = _mm_packs_epi32(s, s);
+            const int32_t p = _mm_cvtsi128_si32( _mm_packus_epi16(s,s) );
+            memcpy(dst + i, &p, 4);
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        uint8_t const * p = src + 4*i*C;
+        for(uint32_t c = 0; c < C; c++)
+        {
+            const uint32_t sum = uint32_t(p[c]) + uint32_t(p[c+C]) + uint32_t(p[c+2*C]) + uint32_t(p[c+3*C]);
+            dst[i*C + c] = static_cast<uint8_t>(sum / 4u);
+        }
+    }
+}
+
+template<uint32_t C>
+inline void copy_pixel(uint8_t * dst, uint8_t const * src)
+{
+    for(uint32_t c = 0; c < C; c++)
+        dst[c] = src[c];
+}
+
+}
+
+/**
+ * @brief The TiledImage class
+ *
+ * An image with 8-bit interleaved channels, like Image, whose pixels are
+ * stored in square tiles of getTileSize() pixels instead of in rows. Two
+ * pixels which are close in x and y are close in memory, so column
+ * heavy work (vertical filters, transposes, rotations, mip mapping of
+ * very large images) stays in the cache.
+ *
+ * The image is padded to a whole number of tiles. The padding is never
+ * read by toImage().
+ *
+ * The index of a pixel is (X[u] + Y[v]) * channels, where the two
+ * tables are built once, so the accessors do not depend on the layout:
+ *
+ *     auto T = gul::TiledImage::fromImage(I, gul::PixelLayout::Morton);
+ *     auto M = T.nextMipMap();
+ *     Image out = M.toImage();
+ */
+class TiledImage
+{
+public:
+    TiledImage()
+    {
+    }
+
+    /**
+     * @brief TiledImage
+     * @param w
+     * @param h
+     * @param ch
+     * @param layout
+     * @param tileSize must be a power of two between 2 and 256
+     */
+    TiledImage(uint32_t w, uint32_t h, uint32_t ch = 4, PixelLayout layout = PixelLayout::Tiled, uint32_t tileSize = 32)
+    {
+        resize(w, h, ch, layout, tileSize);
+    }
+
+    void resize(uint32_t w, uint32_t h, uint32_t ch = 4, PixelLayout layout = PixelLayout::Tiled, uint32_t tileSize = 32)
+    {
+        assert( ch <= 4 );
+        if( tileSize < 2 || tileSize > 256 || (tileSize & (tileSize - 1)) != 0 )
+            throw std::invalid_argument("The tile size must be a power of two between 2 and 256");
+
+        m_width    = w;
+        m_height   = h;
+        m_channels = ch;
+        m_layout   = layout;
+        m_tileSize = tileSize;
+        m_tileShift = 0;
+        while( (1u << m_tileShift) < tileSize )
+            m_tileShift++;
+        m_tilesX = (w + tileSize - 1) >> m_tileShift;
+        m_tilesY = (h + tileSize - 1) >> m_tileShift;
+
+        const size_t tilePixels = size_t(tileSize) * tileSize;
+        const uint32_t mask = tileSize - 1;
+        m_X.resize( size_t(m_tilesX) << m_tileShift );
+        m_Y.resize( size_t(m_tilesY) << m_tileShift );
+        for(uint32_t u = 0; u < m_X.size(); u++)
+        {
+            const uint32_t i = u & mask;
+            m_X[u] = size_t(u >> m_tileShift) * tilePixels + (layout == PixelLayout::Morton ? detail::part1by1(i) : i);
+        }
+        for(uint32_t v = 0; v < m_Y.size(); v++)
+        {
+            const uint32_t j = v & mask;
+            m_Y[v] = size_t(v >> m_tileShift) * m_tilesX * tilePixels +
+                     (layout == PixelLayout::Morton ? size_t(detail::part1by1(j)) << 1 : size_t(j) << m_tileShift);
+        }
+        m_data.assign( size_t(m_tilesX) * m_tilesY * tilePixels * ch, 0 );
+    }
+
+    uint32_t getWidth() const
+    {
+        return m_width;
+    }
+    uint32_t getHeight() const
+    {
+        return m_height;
+    }
+    uint32_t getChannels() const
+    {
+        return m_channels;
+    }
+    PixelLayout getLayout() const
+    {
+        return m_layout;
+    }
+    uint32_t getTileSize() const
+    {
+        return m_tileSize;
+    }
+    uint32_t getTilesX() const
+    {
+        return m_tilesX;
+    }
+    uint32_t getTilesY() const
+    {
+        return m_tilesY;
+    }
+
+    void const * data() const
+    {
+        return m_data.data();
+    }
+    void * data()
+    {
+        return m_data.data();
+    }
+    /**
+     * @brief size
+     * @return
+     *
+     * The number of bytes, including the padding of the edge tiles.
+     */
+    size_t size() const
+    {
+        return m_data.size();
+    }
+
+    /**
+     * @brief pixelIndex
+     * @return
+     *
+     * Returns the index of the first byte of pixel (u,v) in data().
+     */
+    size_t pixelIndex(uint32_t u, uint32_t v) const
+    {
+        return (m_X[u] + m_Y[v]) * m_channels;
+    }
+
+    uint8_t & operator()(uint32_t u, uint32_t v, uint32_t c)
+    {
+        return m_data[ pixelIndex(u,v) + c ];
+    }
+    uint8_t const & operator()(uint32_t u, uint32_t v, uint32_t c) const
+    {
+        return m_data[ pixelIndex(u,v) + c ];
+    }
+
+    /**
+     * @brief tile
+     * @param tx
+     * @param ty
+     * @return
+     *
+     * Returns a view of the pixels of tile (tx,ty), clipped to the size
+     * of the image. Only available with PixelLayout::Tiled, so any
+     * ImageView kernel can be run tile by tile, eg:
+     *
+     *     pool.parallel_for(0, T.getTilesY(), [&](size_t j0, size_t j1) {
+     *         for(auto j = j0; j < j1; j++)
+     *             for(uint32_t i = 0; i < T.getTilesX(); i++)
+     *                 gul::mix(T.tile(i,j), U.tile(i,j), 0.5f, T.tile(i,j));
+     *     });
+     */
+    ImageView tile(uint32_t tx, uint32_t ty)
+    {
+        assert( m_layout == PixelLayout::Tiled );
+        return ImageView( _tileData(tx,ty), _tileWidth(tx), _tileHeight(ty), m_channels, size_t(m_tileSize) * m_channels );
+    }
+    ConstImageView tile(uint32_t tx, uint32_t ty) const
+    {
+        assert( m_layout == PixelLayout::Tiled );
+        return ConstImageView( _tileData(tx,ty), _tileWidth(tx), _tileHeight(ty), m_channels, size_t(m_tileSize) * m_channels );
+    }
+
+    /**
+     * @brief fromImage
+     * @param I
+     * @param layout
+     * @param tileSize
+     * @return
+     *
+     * Returns a copy of an image (or view) in the tiled layout.
+     */
+    static TiledImage fromImage(ConstImageView const & I, PixelLayout layout = PixelLayout::Tiled, uint32_t tileSize = 32)
+    {
+        TiledImage T(I.getWidth(), I.getHeight(), I.getChannels(), layout, tileSize);
+        T._convert(I, nullptr);
+        return T;
+    }
+
+    static TiledImage fromImage(thread_pool & pool, ConstImageView const & I, PixelLayout layout = PixelLayout::Tiled, uint32_t tileSize = 32)
+    {
+        TiledImage T(I.getWidth(), I.getHeight(), I.getChannels(), layout, tileSize);
+        T._convert(I, &pool);
+        return T;
+    }
+
+    /**
+     * @brief toImage
+     * @return
+     *
+     * Returns a copy of the pixels in an Image, ie: row-major order.
+     */
+    Image toImage() const
+    {
+        Image out(m_width, m_height, m_channels);
+        copyTo(out);
+        return out;
+    }
+    Image toImage(thread_pool & pool) const
+    {
+        Image out(m_width, m_height, m_channels);
+        copyTo(pool, out);
+        return out;
+    }
+
+    /**
+     * @brief copyTo
+     * @param out
+     *
+     * Copies the pixels into a view of the same size.
+     */
+    void copyTo(ImageView const & out) const
+    {
+        const_cast<TiledImage*>(this)->_convert(out, nullptr);
+    }
+    void copyTo(thread_pool & pool, ImageView const & out) const
+    {
+        const_cast<TiledImage*>(this)->_convert(out, &pool);
+    }
+
+    /**
+     * @brief nextMipMap
+     * @return
+     *
+     * Returns the next mip level in the same layout and tile size. The
+     * pixels are identical to Image::nextMipMap(). When both dimensions
+     * are even, every output tile is computed from the (up to) 4 source
+     * tiles it covers, in Morton order it is the average of every 4
+     * consecutive source pixels.
+     */
+    TiledImage nextMipMap() const
+    {
+        TiledImage out;
+        _nextMipMap(out, nullptr);
+        return out;
+    }
+    TiledImage nextMipMap(thread_pool & pool) const
+    {
+        TiledImage out;
+        _nextMipMap(out, &pool);
+        return out;
+    }
+
+    /**
+     * @brief transposed
+     * @return
+     *
+     * Returns the image flipped along its diagonal, ie: out(v,u) = (u,v).
+     * Each output tile reads a single source tile.
+     */
+    TiledImage transposed() const
+    {
+        return _remap(m_height, m_width, false, nullptr);
+    }
+    TiledImage transposed(thread_pool & pool) const
+    {
+        return _remap(m_height, m_width, false, &pool);
+    }
+
+    /**
+     * @brief rotated90
+     * @return
+     *
+     * Returns the image rotated 90 degrees clockwise.
+     */
+    TiledImage rotated90() const
+    {
+        return _remap(m_height, m_width, true, nullptr);
+    }
+    TiledImage rotated90(thread_pool & pool) const
+    {
+        return _remap(m_height, m_width, true, &pool);
+    }
+
+    uint8_t * _tileData(uint32_t tx, uint32_t ty)
+    {
+        return m_data.data() + pixelIndex(tx << m_tileShift, ty << m_tileShift);
+    }
+    uint8_t const * _tileData(uint32_t tx, uint32_t ty) const
+    {
+        return m_data.data() + pixelIndex(tx << m_tileShift, ty << m_tileShift);
+    }
+    uint32_t _tileWidth(uint32_t tx) const
+    {
+        return std::min(m_tileSize, m_width - (tx << m_tileShift));
+    }
+    uint32_t _tileHeight(uint32_t ty) const
+    {
+        return std::min(m_tileSize, m_height - (ty << m_tileShift));
+    }
+
+    template<typename F>
+    static void _forTileRows(uint32_t tilesY, thread_pool * pool, F && f)
+    {
+        if( pool )
+            pool->parallel_for(0, tilesY, [&](size_t j0, size_t j1)
+            {
+                for(size_t j = j0; j < j1; j++)
+                    f(static_cast<uint32_t>(j));
+            });
+        else
+            for(uint32_t j = 0; j < tilesY; j++)
+                f(j);
+    }
+
+    /**
+     * @brief _convert
+     *
+     * Copies between the tiles and a row-major view, a row of tiles at a
+     * time. toTiles is implied by the constness of the view's pixels.
+     */
+    template<typename T>
+    void _convert(ImageView_t<T> const & V, thread_pool * pool)
+    {
+        if( V.getWidth() != m_width || V.getHeight() != m_height || V.getChannels() != m_channels )
+            throw std::logic_error("Images are of different size");
+        constexpr bool toTiles = std::is_const<T>::value;
+
+        switch( m_channels )
+        {
+            case 1: _convertC<1, toTiles>(V, pool); break;
+            case 2: _convertC<2, toTiles>(V, pool); break;
+            case 3: _convertC<3, toTiles>(V, pool); break;
+            case 4: _convertC<4, toTiles>(V, pool); break;
+            default: break;
+        }
+    }
+
+    template<uint32_t C, bool toTiles, typename T>
+    void _convertC(ImageView_t<T> const & V, thread_pool * pool)
+    {
+        _forTileRows(m_tilesY, pool, [&](uint32_t ty)
+        {
+            const uint32_t y0 = ty << m_tileShift;
+            const uint32_t y1 = y0 + _tileHeight(ty);
+            for(uint32_t tx = 0; tx < m_tilesX; tx++)
+            {
+                const uint32_t x0 = tx << m_tileShift;
+                const uint32_t n  = _tileWidth(tx);
+                for(uint32_t y = y0; y < y1; y++)
+                {
+                    auto * row = V.row(y) + size_t(x0) * C;
+                    if( m_layout == PixelLayout::Tiled )
+                    {
+                        // the row of a tile is contiguous
+                        uint8_t * t = m_data.data() + pixelIndex(x0, y);
+                        if( toTiles )
+                            memcpy(t, row, size_t(n) * C);
+                        else
+                            memcpy(const_cast<uint8_t*>(row), t, size_t(n) * C);
+                        continue;
+                    }
+                    uint8_t * t  = m_data.data() + m_Y[y] * C;
+                    size_t const * X = m_X.data() + x0;
+                    for(uint32_t i = 0; i < n; i++)
+                    {
+                        if( toTiles )
+                            detail::copy_pixel<C>(t + X[i] * C, row + size_t(i) * C);
+                        else
+                            detail::copy_pixel<C>(const_cast<uint8_t*>(row) + size_t(i) * C, t + X[i] * C);
+                    }
+                }
+            }
+        });
+    }
+
+    void _nextMipMap(TiledImage & out, thread_pool * pool) const
+    {
+        const uint32_t dw = m_width / 2;
+        const uint32_t dh = m_height / 2;
+        const uint32_t C  = m_channels;
+        out.resize(dw, dh, C, m_layout, m_tileSize);
+        if( dw == 0 || dh == 0 )
+            return;
+
+        const uint32_t T  = m_tileSize;
+        const uint32_t H  = T / 2;
+        const size_t   tileBytes = size_t(T) * T * C;
+
+        if( (m_width & 1u) == 0 && (m_height & 1u) == 0 )
+        {
+            // output tile (tx,ty) quadrant (qx,qy) is source tile (2tx+qx, 2ty+qy)
+            _forTileRows(out.m_tilesY, pool, [&](uint32_t ty)
+            {
+                for(uint32_t tx = 0; tx < out.m_tilesX; tx++)
+                {
+                    uint8_t * d = out._tileData(tx, ty);
+                    for(uint32_t q = 0; q < 4; q++)
+                    {
+                        const uint32_t sx = 2*tx + (q & 1u);
+                        const uint32_t sy = 2*ty + (q >> 1);
+                        if( sx >= m_tilesX || sy >= m_tilesY )
+                            continue;
+                        uint8_t const * s = _tileData(sx, sy);
+                        if( m_layout == PixelLayout::Morton )
+                        {
+                            // the quadrant is a contiguous quarter of the
+                            // output tile, and each of its pixels is the
+                            // average of 4 consecutive source pixels
+                            detail::box4_run(s, size_t(H) * H, C, d + q * (tileBytes / 4));
+                        }
+                        else
+                        {
+                            detail::downsample_box(s, T, T, C, d + (size_t(q >> 1) * H * T + size_t(q & 1u) * H) * C, 0, H,
+                                                   size_t(T) * C, size_t(T) * C);
+                        }
+                    }
+                }
+            });
+            return;
+        }
+
+        // odd sizes use the 3-tap filter of detail::box_taps, which can
+        // straddle two tiles
+        const uint64_t divX = (m_width  & 1u) ? m_width  : 2u;
+        const uint64_t divY = (m_height & 1u) ? m_height : 2u;
+        _forTileRows(out.m_tilesY, pool, [&](uint32_t ty)
+        {
+            for(uint32_t tx = 0; tx < out.m_tilesX; tx++)
+            {
+                const uint32_t x0 = tx * T, x1 = x0 + out._tileWidth(tx);
+                const uint32_t y0 = ty * T, y1 = y0 + out._tileHeight(ty);
+                for(uint32_t j = y0; j < y1; j++)
+                {
+                    uint32_t wy[3];
+                    const uint32_t ny = detail::box_taps(m_height, j, wy);
+                    for(uint32_t i = x0; i < x1; i++)
+                    {
+                        uint32_t wx[3];
+                        const uint32_t nx = detail::box_taps(m_width, i, wx);
+                        uint8_t * d = &out(i, j, 0);
+                        for(uint32_t c = 0; c < C; c++)
+                        {
+                            uint64_t sum = 0;
+                            for(uint32_t y = 0; y < ny; y++)
+                            {
+                                uint64_t rs = 0;
+                                for(uint32_t x = 0; x < nx; x++)
+                                    rs += uint64_t(wx[x]) * (*this)(2*i + x, 2*j + y, c);
+                                sum += rs * wy[y];
+                            }
+                            d[c] = static_cast<uint8_t>( sum / (divX * divY) );
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    TiledImage _remap(uint32_t w, uint32_t h, bool rotate, thread_pool * pool) const
+    {
+        TiledImage out(w, h, m_channels, m_layout, m_tileSize);
+        switch( m_channels )
+        {
+            case 1: _remapC<1>(out, rotate, pool); break;
+            case 2: _remapC<2>(out, rotate, pool); break;
+            case 3: _remapC<3>(out, rotate, pool); break;
+            case 4: _remapC<4>(out, rotate, pool); break;
+            default: break;
+        }
+        return out;
+    }
+
+    template<uint32_t C>
+    void _remapC(TiledImage & out, bool rotate, thread_pool * pool) const
+    {
+        const uint32_t T = m_tileSize;
+        _forTileRows(out.m_tilesY, pool, [&](uint32_t ty)
+        {
+            for(uint32_t tx = 0; tx < out.m_tilesX; tx++)
+            {
+                const uint32_t x0 = tx * T, x1 = x0 + out._tileWidth(tx);
+                const uint32_t y0 = ty * T, y1 = y0 + out._tileHeight(ty);
+                // walk the output tile by columns so the source is read by rows
+                for(uint32_t x = x0; x < x1; x++)
+                {
+                    // transpose: out(x,y) = in(y,x), rotate: out(x,y) = in(y, h_in-1-x)
+                    uint8_t const * s = m_data.data() + m_Y[ rotate ? (m_height - 1 - x) : x ] * C;
+                    uint8_t * d       = out.m_data.data() + out.m_X[x] * C;
+                    for(uint32_t y = y0; y < y1; y++)
+                        detail::copy_pixel<C>(d + out.m_Y[y] * C, s + m_X[y] * C);
+                }
+            }
+        });
+    }
+
+protected:
+    std::vector<uint8_t> m_data;
+    std::vector<size_t>  m_X;           // offset of column u, in pixels
+    std::vector<size_t>  m_Y;           // offset of row v, in pixels
+    uint32_t    m_width     = 0;
+    uint32_t    m_height    = 0;
+    uint32_t    m_channels  = 0;
+    uint32_t    m_tileSize  = 32;
+    uint32_t    m_tileShift = 5;
+    uint32_t    m_tilesX    = 0;
+    uint32_t    m_tilesY    = 0;
+    PixelLayout m_layout    = PixelLayout::Tiled;
+};
+
+}
+
+#endif
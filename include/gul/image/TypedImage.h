@@ -0,0 +1,993 @@
+#ifndef GUL_TYPED_IMAGE_H
+#define GUL_TYPED_IMAGE_H
+
+#include "../Image.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+// F16C half <-> float conversion instructions, eg: -mf16c or -march=haswell
+#if !defined(GUL_IMAGE_NO_SIMD)
+    #if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+        #define GUL_IMAGE_F16C
+        #include <immintrin.h>
+    #endif
+#endif
+
+namespace gul
+{
+
+namespace detail
+{
+
+/**
+ * @brief float_to_half
+ *
+ * Converts a float to IEEE 754 binary16 bits, rounding to nearest even.
+ * Values too large for a half become infinity, tiny values become half
+ * denormals. Gives the same bits as the F16C instruction.
+ */
+inline uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t       absx = x & 0x7FFFFFFFu;
+
+    if( absx >= 0x47800000u ) // 2^16 and above: inf, or NaN with a quiet bit
+    {
+        const uint32_t nan = absx > 0x7F800000u ? 0x200u | ((absx >> 13) & 0x3FFu) : 0u;
+        return static_cast<uint16_t>(sign | 0x7C00u | nan);
+    }
+    if( absx < 0x38800000u ) // below 2^-14: half denormal or zero
+    {
+        // adding 0.5 puts the ulp of the float at 2^-24, the half denormal
+        // step, so the FPU does the rounding
+        float v;
+        std::memcpy(&v, &absx, sizeof(v));
+        v += 0.5f;
+        std::memcpy(&absx, &v, sizeof(v));
+        return static_cast<uint16_t>(sign | (absx - 0x3F000000u));
+    }
+
+    const uint32_t odd = (absx >> 13) & 1u;
+    absx += 0xC8000FFFu + odd; // rebias the exponent by -112 and round, may carry into inf
+    return static_cast<uint16_t>(sign | (absx >> 13));
+}
+
+/**
+ * @brief half_to_float
+ *
+ * Converts IEEE 754 binary16 bits to a float. Every half is exactly
+ * representable.
+ */
+inline float half_to_float(uint16_t h)
+{
+    const uint32_t sign = uint32_t(h & 0x8000u) << 16;
+    const uint32_t e    = (h >> 10) & 0x1Fu;
+    const uint32_t m    = h & 0x3FFu;
+
+    uint32_t x;
+    if( e == 0 )
+    {
+        float v = static_cast<float>(m) * 5.9604644775390625e-8f; // m * 2^-24
+        std::memcpy(&x, &v, sizeof(x));
+        x |= sign;
+    }
+    else if( e == 31 )
+    {
+        x = sign | 0x7F800000u | (m << 13);
+    }
+    else
+    {
+        x = sign | ((e + 112u) << 23) | (m << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+}
+
+/**
+ * @brief The half struct
+ *
+ * A 16-bit IEEE 754 floating point value. Only used for storage, all
+ * arithmetic is done after converting to float.
+ */
+struct half
+{
+    uint16_t bits = 0;
+
+    half() = default;
+    explicit half(float f) : bits( detail::float_to_half(f) )
+    {
+    }
+    explicit operator float() const
+    {
+        return detail::half_to_float(bits);
+    }
+    static half fromBits(uint16_t b)
+    {
+        half h;
+        h.bits = b;
+        return h;
+    }
+    friend bool operator==(half a, half b)
+    {
+        return a.bits == b.bits;
+    }
+    friend bool operator!=(half a, half b)
+    {
+        return a.bits != b.bits;
+    }
+};
+
+/**
+ * @brief The component_traits struct
+ *
+ * Describes how a component type maps to float. Integer components are
+ * normalized, ie: 0 to max maps to 0.0-1.0. Floating point components
+ * are stored as is and may hold any value.
+ */
+template<typename T>
+struct component_traits;
+
+template<>
+struct component_traits<uint8_t>
+{
+    static constexpr bool     normalized = true;
+    static constexpr uint32_t format     = 1;
+
+    static float toFloat(uint8_t v)
+    {
+        return static_cast<float>(v) / 255.0f;
+    }
+    static uint8_t fromFloat(float x)
+    {
+        x = x > 0.0f ? x : 0.0f; // also maps NaN to 0
+        x = x < 1.0f ? x : 1.0f;
+        return static_cast<uint8_t>( x * 255.0f + 0.5f );
+    }
+};
+
+template<>
+struct component_traits<uint16_t>
+{
+    static constexpr bool     normalized = true;
+    static constexpr uint32_t format     = 2;
+
+    static float toFloat(uint16_t v)
+    {
+        return static_cast<float>(v) / 65535.0f;
+    }
+    static uint16_t fromFloat(float x)
+    {
+        x = x > 0.0f ? x : 0.0f;
+        x = x < 1.0f ? x : 1.0f;
+        return static_cast<uint16_t>( x * 65535.0f + 0.5f );
+    }
+};
+
+template<>
+struct component_traits<half>
+{
+    static constexpr bool     normalized = false;
+    static constexpr uint32_t format     = 3;
+
+    static float toFloat(half v)
+    {
+        return static_cast<float>(v);
+    }
+    static half fromFloat(float x)
+    {
+        return half(x);
+    }
+};
+
+template<>
+struct component_traits<float>
+{
+    static constexpr bool     normalized = false;
+    static constexpr uint32_t format     = 4;
+
+    static float toFloat(float v)
+    {
+        return v;
+    }
+    static float fromFloat(float x)
+    {
+        return x;
+    }
+};
+
+namespace detail
+{
+
+/**
+ * Row conversions between the component types and float. The SIMD
+ * versions give the same results as component_traits.
+ */
+inline void load_components(uint8_t const * src, float * dst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128  div  = _mm_set1_ps(255.0f);
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= n; i += 16)
+    {
+        const __m128i v  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + i) );
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(dst + i,      _mm_div_ps( _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), div) );
+        _mm_storeu_ps(dst + i + 4,  _mm_div_ps( _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), div) );
+        _mm_storeu_ps(dst + i + 8,  _mm_div_ps( _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), div) );
+        _mm_storeu_ps(dst + i + 12, _mm_div_ps( _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), div) );
+    }
+#endif
+    for(; i < n; i++)
+        dst[i] = component_traits<uint8_t>::toFloat(src[i]);
+}
+
+inline void load_components(uint16_t const * src, float * dst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128  div  = _mm_set1_ps(65535.0f);
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= n; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128( reinterpret_cast<__m128i const*>(src + i) );
+        _mm_storeu_ps(dst + i,     _mm_div_ps( _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), div) );
+        _mm_storeu_ps(dst + i + 4, _mm_div_ps( _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), div) );
+    }
+#endif
+    for(; i < n; i++)
+        dst[i] = component_traits<uint16_t>::toFloat(src[i]);
+}
+
+inline void load_components(half const * src, float * dst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_F16C)
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128i v = _mm_loadl_epi64( reinterpret_cast<__m128i const*>(src + i) );
+        _mm_storeu_ps(dst + i, _mm_cvtph_ps(v));
+    }
+#endif
+    for(; i < n; i++)
+        dst[i] = component_traits<half>::toFloat(src[i]);
+}
+
+inline void load_components(float const * src, float * dst, size_t n)
+{
+    if( n )
+        std::memcpy(dst, src, n * sizeof(float));
+}
+
+#if defined(GUL_IMAGE_SSE2)
+// clamps to 0-1, scales and rounds, NaN becomes 0 as in component_traits
+inline __m128i sse_unorm(__m128 x, __m128 scale)
+{
+    x = _mm_min_ps( _mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f) );
+    return _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps(x, scale), _mm_set1_ps(0.5f) ) );
+}
+#endif
+
+inline void store_components(float const * src, uint8_t * dst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for(; i + 16 <= n; i += 16)
+    {
+        const __m128i a = sse_unorm( _mm_loadu_ps(src + i),      scale);
+        const __m128i b = sse_unorm( _mm_loadu_ps(src + i + 4),  scale);
+        const __m128i c = sse_unorm( _mm_loadu_ps(src + i + 8),  scale);
+        const __m128i d = sse_unorm( _mm_loadu_ps(src + i + 12), scale);
+        const __m128i v = _mm_packus_epi16( _mm_packs_epi32(a, b), _mm_packs_epi32(c, d) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i), v);
+    }
+#endif
+    for(; i < n; i++)
+        dst[i] = component_traits<uint8_t>::fromFloat(src[i]);
+}
+
+inline void store_components(float const * src, uint16_t * dst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_SSE2)
+    const __m128  scale = _mm_set1_ps(65535.0f);
+    const __m128i bias  = _mm_set1_epi32(32768);
+    const __m128i flip  = _mm_set1_epi16( static_cast<short>(0x8000) );
+    for(; i + 8 <= n; i += 8)
+    {
+        // SSE2 has no unsigned 32->16 pack, so pack signed and flip the top bit back
+        const __m128i a = _mm_sub_epi32( sse_unorm( _mm_loadu_ps(src + i),     scale), bias);
+        const __m128i b = _mm_sub_epi32( sse_unorm( _mm_loadu_ps(src + i + 4), scale), bias);
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128( _mm_packs_epi32(a, b), flip) );
+    }
+#endif
+    for(; i < n; i++)
+        dst[i] = component_traits<uint16_t>::fromFloat(src[i]);
+}
+
+inline void store_components(float const * src, half * dst, size_t n)
+{
+    size_t i = 0;
+#if defined(GUL_IMAGE_F16C)
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128i v = _mm_cvtps_ph( _mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storel_epi64( reinterpret_cast<__m128i*>(dst + i), v);
+    }
+#endif
+    for(; i < n; i++)
+        dst[i] = component_traits<half>::fromFloat(src[i]);
+}
+
+inline void store_components(float const * src, float * dst, size_t n)
+{
+    if( n )
+        std::memcpy(dst, src, n * sizeof(float));
+}
+
+/**
+ * @brief convert_components
+ *
+ * Converts n components from S to D through a small float buffer
+ * which stays in the L1 cache.
+ */
+template<typename S, typename D>
+void convert_components(S const * src, D * dst, size_t n)
+{
+    if( std::is_same<S,D>::value )
+    {
+        if( n )
+            std::memcpy(static_cast<void*>(dst), static_cast<void const*>(src), n * sizeof(S));
+        return;
+    }
+    constexpr size_t block = 256;
+    float tmp[block];
+    for(size_t i = 0; i < n; i += block)
+    {
+        const size_t k = std::min(block, n - i);
+        load_components(src + i, tmp, k);
+        store_components(tmp, dst + i, k);
+    }
+}
+
+}
+
+template<typename T>
+class Image_t;
+
+/**
+ * @brief The ImageChannel_t struct
+ *
+ * A single channel of an Image_t, the equivalent of ColorChannel. It can
+ * be used in channel expressions, in which it evaluates to the float value
+ * of the component (0-1 for integer types), eg:
+ *
+ *     Image_t<half> H(64,64,3);
+ *     H.r = 4.0f * I.r + H.g;
+ */
+template<typename T>
+struct ImageChannel_t : public ChannelExpr< ImageChannel_t<T> >
+{
+    Image_t<T> * m_owner = nullptr;
+    uint32_t     m_index = 0;
+
+    ImageChannel_t() = default;
+    // copies the handle, operator= copies the values
+    ImageChannel_t(ImageChannel_t const &) = default;
+
+    T & operator()(uint32_t u, uint32_t v)
+    {
+        return (*m_owner)(u, v, m_index);
+    }
+    T const & operator()(uint32_t u, uint32_t v) const
+    {
+        return (*m_owner)(u, v, m_index);
+    }
+    float eval(uint32_t u, uint32_t v) const
+    {
+        return component_traits<T>::toFloat( (*this)(u,v) );
+    }
+    uint32_t getWidth() const
+    {
+        return m_owner->getWidth();
+    }
+    uint32_t getHeight() const
+    {
+        return m_owner->getHeight();
+    }
+
+    ImageChannel_t& operator=(T value)
+    {
+        const uint32_t C = m_owner->getChannels();
+        T * p = m_owner->data() + m_index;
+        const size_t n = size_t(getWidth()) * getHeight();
+        for(size_t i = 0; i < n; i++)
+            p[i*C] = value;
+        return *this;
+    }
+
+    ImageChannel_t& operator=(ImageChannel_t const & other)
+    {
+        if( getWidth() != other.getWidth() || getHeight() != other.getHeight() )
+        {
+            throw std::logic_error("Channels are of different size");
+        }
+        const uint32_t C  = m_owner->getChannels();
+        const uint32_t oC = other.m_owner->getChannels();
+        T const * src = other.m_owner->data() + other.m_index;
+        T *       dst = m_owner->data() + m_index;
+        const size_t n = size_t(getWidth()) * getHeight();
+        for(size_t i = 0; i < n; i++)
+            dst[i*C] = src[i*oC];
+        return *this;
+    }
+
+    /**
+     * @brief operator =
+     * @param E_
+     * @return
+     *
+     * Evaluates a channel expression into this channel. The float values
+     * are converted with component_traits<T>::fromFloat().
+     */
+    template<typename E>
+    ImageChannel_t& operator=(ChannelExpr<E> const & E_)
+    {
+        auto & e = E_.self();
+        const uint32_t w = getWidth();
+        const uint32_t h = getHeight();
+        if( (e.getWidth()  != 0 && e.getWidth()  != w) ||
+            (e.getHeight() != 0 && e.getHeight() != h) )
+        {
+            throw std::logic_error("Channels are of different size");
+        }
+        for(uint32_t v = 0; v < h; v++)
+        {
+            for(uint32_t u = 0; u < w; u++)
+            {
+                (*this)(u,v) = component_traits<T>::fromFloat( e.eval(u,v) );
+            }
+        }
+        return *this;
+    }
+};
+
+/**
+ * @brief The Image_t class
+ *
+ * An image with 1-4 interleaved channels of type T, which can be uint8_t,
+ * uint16_t, half or float. It provides the same channel accessors, mipmap,
+ * mix and hash functions as Image so that HDR data such as lightmaps and
+ * environment maps can be processed the same way.
+ *
+ * Image remains the 8-bit image used by the rest of the library, with
+ * views, copy-on-write and the optimized channel kernels. Use convert()
+ * and the Image constructor/toImage() to move between the two.
+ */
+template<typename T>
+class Image_t
+{
+public:
+    using value_type  = T;
+    using traits_type = component_traits<T>;
+
+    Image_t() : Image_t(8,8,4)
+    {
+    }
+    Image_t(uint32_t w, uint32_t h, uint32_t ch=4)
+    {
+        resize(w,h,ch);
+    }
+
+    /**
+     * @brief Image_t
+     * @param I
+     *
+     * Converts an 8-bit image, normalized values are mapped to 0-1. The
+     * pixels of a planar image are interleaved first.
+     */
+    explicit Image_t(Image const & I) : Image_t(I.getWidth(), I.getHeight(), I.getChannels())
+    {
+        if( I.isPlanar() )
+        {
+            const auto L = detail::interleaved_copy(I);
+            detail::convert_components( static_cast<uint8_t const*>(L.data()), data(), size() );
+            return;
+        }
+        detail::convert_components( static_cast<uint8_t const*>(I.data()), data(), size() );
+    }
+
+    Image_t(Image_t const & other) :
+        m_data(other.m_data)
+    {
+        _setChannels(other.m_width, other.m_height, other.m_channels);
+    }
+    Image_t(Image_t && other) :
+        m_data( std::move(other.m_data) )
+    {
+        _setChannels(other.m_width, other.m_height, other.m_channels);
+        other.clear();
+    }
+    Image_t& operator=(Image_t const & other)
+    {
+        if( &other != this )
+        {
+            m_data = other.m_data;
+            _setChannels(other.m_width, other.m_height, other.m_channels);
+        }
+        return *this;
+    }
+    Image_t& operator=(Image_t && other)
+    {
+        if( &other != this )
+        {
+            m_data = std::move(other.m_data);
+            _setChannels(other.m_width, other.m_height, other.m_channels);
+            other.clear();
+        }
+        return *this;
+    }
+
+    void resize(uint32_t w, uint32_t h, uint32_t channels=4)
+    {
+        assert( channels <= 4);
+        m_data.resize( size_t(w) * h * channels );
+        _setChannels(w, h, channels);
+    }
+
+    void clear()
+    {
+        m_data.clear();
+        m_data.shrink_to_fit();
+        _setChannels(0,0,0);
+    }
+
+    void _setChannels(uint32_t width, uint32_t height, uint32_t channels)
+    {
+        m_width    = width;
+        m_height   = height;
+        m_channels = channels;
+
+        // same mapping as Image: missing channels alias the last one
+        const uint32_t last = channels ? channels - 1 : 0;
+        r.m_index = 0;
+        g.m_index = std::min(1u, last);
+        b.m_index = std::min(2u, last);
+        a.m_index = last;
+        r.m_owner = g.m_owner = b.m_owner = a.m_owner = this;
+    }
+
+    T & operator()(uint32_t u, uint32_t v, uint32_t c)
+    {
+        return m_data[ (size_t(v)*m_width + u)*m_channels + c ];
+    }
+    T const & operator()(uint32_t u, uint32_t v, uint32_t c) const
+    {
+        return m_data[ (size_t(v)*m_width + u)*m_channels + c ];
+    }
+    ImageChannel_t<T>& operator[](size_t i)
+    {
+        return (&r)[i];
+    }
+    ImageChannel_t<T> const& operator[](size_t i) const
+    {
+        return (&r)[i];
+    }
+
+    T * data()
+    {
+        return m_data.data();
+    }
+    T const * data() const
+    {
+        return m_data.data();
+    }
+    /**
+     * @brief size
+     * @return
+     *
+     * Returns the number of components, width*height*channels.
+     * See byteSize() for the size in bytes.
+     */
+    size_t size() const
+    {
+        return m_data.size();
+    }
+    size_t byteSize() const
+    {
+        return m_data.size() * sizeof(T);
+    }
+
+    uint32_t width() const
+    {
+        return m_width;
+    }
+    uint32_t height() const
+    {
+        return m_height;
+    }
+    uint32_t getWidth() const
+    {
+        return m_width;
+    }
+    uint32_t getHeight() const
+    {
+        return m_height;
+    }
+    uint32_t getChannels() const
+    {
+        return m_channels;
+    }
+
+    /**
+     * @brief convert
+     * @return
+     *
+     * Returns a copy of the image with components of type U. Normalized
+     * integer values map to 0-1, values outside that range are clamped
+     * when converting to an integer type.
+     */
+    template<typename U>
+    Image_t<U> convert() const
+    {
+        Image_t<U> out(m_width, m_height, m_channels);
+        detail::convert_components( data(), out.data(), size() );
+        return out;
+    }
+
+    /**
+     * @brief convert
+     * @param pool
+     * @return
+     *
+     * Same as convert(), with the rows converted on the thread pool.
+     */
+    template<typename U>
+    Image_t<U> convert(thread_pool & pool) const
+    {
+        Image_t<U> out(m_width, m_height, m_channels);
+        const size_t rowSize = size_t(m_width) * m_channels;
+        pool.parallel_for(0, m_height, [&](size_t v0, size_t v1)
+        {
+            detail::convert_components( data() + v0*rowSize, out.data() + v0*rowSize, (v1-v0)*rowSize );
+        });
+        return out;
+    }
+
+    /**
+     * @brief toImage
+     * @return
+     *
+     * Converts to an 8-bit Image, see convert().
+     */
+    Image toImage() const
+    {
+        Image out(m_width, m_height, m_channels);
+        detail::convert_components( data(), static_cast<uint8_t*>(out.data()), size() );
+        return out;
+    }
+
+    /**
+     * @brief nextMipMap
+     * @return
+     *
+     * Returns the next mipmap level, half the width and height. Uses the
+     * same box filter as Image::nextMipMap(), computed in float, so odd
+     * dimensions do not drop any pixels. Integer types are rounded to
+     * nearest.
+     */
+    Image_t nextMipMap() const
+    {
+        Image_t out(m_width/2, m_height/2, m_channels);
+        _nextMipMapRows(out, 0, out.getHeight());
+        return out;
+    }
+
+    void nextMipMap(Image_t & out) const
+    {
+        if( out.getWidth()    != m_width/2  ||
+            out.getHeight()   != m_height/2 ||
+            out.getChannels() != m_channels )
+        {
+            out.resize(m_width/2, m_height/2, m_channels);
+        }
+        _nextMipMapRows(out, 0, out.getHeight());
+    }
+
+    Image_t allocateNextMipMap() const
+    {
+        return Image_t(m_width/2, m_height/2, m_channels);
+    }
+
+    void _nextMipMapRows(Image_t & out, uint32_t row0, uint32_t row1) const
+    {
+        const uint32_t C  = m_channels;
+        const uint32_t dw = m_width / 2;
+        const float divX = float( (m_width  & 1u) ? m_width  : 2u );
+        const float divY = float( (m_height & 1u) ? m_height : 2u );
+        const float norm = 1.0f / (divX * divY);
+
+        std::vector<float> rows[3];
+        std::vector<float> acc( size_t(dw) * C );
+        for(auto & R : rows)
+            R.resize( size_t(m_width) * C );
+
+        for(uint32_t j = row0; j < row1; j++)
+        {
+            uint32_t wy[3];
+            const uint32_t ty = detail::box_taps(m_height, j, wy);
+            std::fill(acc.begin(), acc.end(), 0.0f);
+
+            for(uint32_t y = 0; y < ty; y++)
+            {
+                auto & R = rows[y];
+                detail::load_components( data() + size_t(2*j+y) * m_width * C, R.data(), R.size() );
+
+                const float fy = float(wy[y]);
+                for(uint32_t i = 0; i < dw; i++)
+                {
+                    uint32_t wx[3];
+                    const uint32_t tx = detail::box_taps(m_width, i, wx);
+                    for(uint32_t c = 0; c < C; c++)
+                    {
+                        float s = 0.0f;
+                        for(uint32_t x = 0; x < tx; x++)
+                            s += float(wx[x]) * R[ size_t(2*i + x) * C + c ];
+                        acc[size_t(i)*C + c] += s * fy;
+                    }
+                }
+            }
+            for(auto & v : acc)
+                v *= norm;
+            detail::store_components( acc.data(), out.data() + size_t(j) * dw * C, acc.size() );
+        }
+    }
+
+    /**
+     * @brief hash
+     * @return
+     *
+     * Returns a 64-bit hash of the dimensions, the component type and the
+     * pixels. Image_t<uint8_t> hashes to the same value as an Image with
+     * the same pixels.
+     */
+    uint64_t hash() const
+    {
+        auto H = hashStream(m_width, m_height, m_channels);
+        H.update( data(), byteSize() );
+        return H.digest();
+    }
+
+    /**
+     * @brief hashStream
+     * @return
+     *
+     * Returns a hash stream for an image of the given size, see
+     * Image::hashStream().
+     */
+    static hash64_stream hashStream(uint32_t w, uint32_t h, uint32_t ch)
+    {
+        auto H = Image::hashStream(w, h, ch);
+        if( !std::is_same<T, uint8_t>::value )
+        {
+            const uint32_t format = traits_type::format;
+            H.update(&format, sizeof(format));
+        }
+        return H;
+    }
+
+    std::vector<T> m_data;
+    uint32_t       m_width    = 0;
+    uint32_t       m_height   = 0;
+    uint32_t       m_channels = 0;
+
+    ImageChannel_t<T> r;
+    ImageChannel_t<T> g;
+    ImageChannel_t<T> b;
+    ImageChannel_t<T> a;
+};
+
+using Image8u  = Image_t<uint8_t>;
+using Image16u = Image_t<uint16_t>;
+using Image16f = Image_t<half>;
+using Image32f = Image_t<float>;
+
+namespace detail
+{
+template<typename T>
+void check_same_shape(Image_t<T> const & a, Image_t<T> const & b)
+{
+    if( a.getWidth()    != b.getWidth()  ||
+        a.getHeight()   != b.getHeight() ||
+        a.getChannels() != b.getChannels() )
+    {
+        throw std::logic_error("Images are of different size");
+    }
+}
+
+// (1-t)*a + t*b over n components, t is either a constant or per component
+template<typename T>
+void mix_components(T const * a, T const * b, T const * t, float tc, T * out, size_t n)
+{
+    constexpr size_t block = 256;
+    float fa[block], fb[block], ft[block];
+    for(size_t i = 0; i < n; i += block)
+    {
+        const size_t k = std::min(block, n - i);
+        load_components(a + i, fa, k);
+        load_components(b + i, fb, k);
+        if( t )
+            load_components(t + i, ft, k);
+        for(size_t j = 0; j < k; j++)
+        {
+            const float s = t ? ft[j] : tc;
+            fa[j] = (1.0f - s) * fa[j] + s * fb[j];
+        }
+        store_components(fa, out + i, k);
+    }
+}
+}
+
+/**
+ * @brief mix
+ * @param a
+ * @param b
+ * @param t
+ * @return
+ *
+ * Returns (1-t)*a + t*b. The images must have the same size.
+ */
+template<typename T>
+Image_t<T> mix(Image_t<T> const & a, Image_t<T> const & b, float t)
+{
+    detail::check_same_shape(a, b);
+    Image_t<T> D(a.getWidth(), a.getHeight(), a.getChannels());
+    detail::mix_components<T>(a.data(), b.data(), nullptr, t, D.data(), D.size());
+    return D;
+}
+
+/**
+ * @brief mix
+ * @param a
+ * @param b
+ * @param t
+ * @return
+ *
+ * Same as above with a per component blend factor, normalized for
+ * integer types.
+ */
+template<typename T>
+Image_t<T> mix(Image_t<T> const & a, Image_t<T> const & b, Image_t<T> const & t)
+{
+    detail::check_same_shape(a, b);
+    detail::check_same_shape(a, t);
+    Image_t<T> D(a.getWidth(), a.getHeight(), a.getChannels());
+    detail::mix_components<T>(a.data(), b.data(), t.data(), 0.0f, D.data(), D.size());
+    return D;
+}
+
+/**
+ * @brief The ImageMM_t class
+ *
+ * A mipmap chain of Image_t, the equivalent of ImageMM.
+ */
+template<typename T>
+class ImageMM_t
+{
+public:
+    std::vector< Image_t<T> > level;
+
+    ImageMM_t() : ImageMM_t(8,8,4)
+    {
+    }
+    ImageMM_t(uint32_t w, uint32_t h, uint32_t ch=4)
+    {
+        level.emplace_back(w, h, ch);
+    }
+    explicit ImageMM_t(Image_t<T> base)
+    {
+        level.push_back( std::move(base) );
+    }
+
+    Image_t<T> & getLevel(size_t i)
+    {
+        return level.at(i);
+    }
+    Image_t<T> const& getLevel(size_t i) const
+    {
+        return level.at(i);
+    }
+    uint32_t getChannels() const
+    {
+        return level.front().getChannels();
+    }
+    uint32_t getHeight() const
+    {
+        return level.front().getHeight();
+    }
+    uint32_t getWidth() const
+    {
+        return level.front().getWidth();
+    }
+    uint32_t getLevelCount() const
+    {
+        return static_cast<uint32_t>(level.size());
+    }
+
+    uint32_t maxLevels() const
+    {
+        const auto m = std::min( getWidth(), getHeight() );
+        return m ? uint32_t( std::log2(m) ) : 0u;
+    }
+
+    /**
+     * @brief allocateMipMaps
+     * @param mips
+     *
+     * Allocates the mip levels below the base level, the same number as
+     * ImageMM::allocateMipMaps().
+     */
+    void allocateMipMaps(uint32_t mips=0)
+    {
+        const auto maxMips = maxLevels();
+        mips = mips ? std::min(maxMips, mips) : maxMips;
+        mips = std::max(mips, 1u) - 1;
+        level.resize(1);
+        while(mips--)
+        {
+            auto m = level.back().allocateNextMipMap();
+            level.push_back( std::move(m) );
+        }
+    }
+
+    /**
+     * @brief generateMipMaps
+     *
+     * Fills in all the mipmap levels from the base level, allocating
+     * them first if only the base level exists.
+     */
+    void generateMipMaps()
+    {
+        if( level.size() == 1 )
+            allocateMipMaps();
+        for(size_t i = 1; i < level.size(); i++)
+            level[i-1].nextMipMap(level[i]);
+    }
+
+    /**
+     * @brief generateMipMaps
+     * @param pool
+     *
+     * Same as generateMipMaps() but the rows of each level are computed
+     * on the thread pool.
+     */
+    void generateMipMaps(thread_pool & pool)
+    {
+        if( level.size() == 1 )
+            allocateMipMaps();
+        for(size_t i = 1; i < level.size(); i++)
+        {
+            auto & src = level[i-1];
+            auto & dst = level[i];
+            pool.parallel_for(0, dst.getHeight(), [&](size_t v0, size_t v1)
+            {
+                src._nextMipMapRows(dst, static_cast<uint32_t>(v0), static_cast<uint32_t>(v1));
+            });
+        }
+    }
+};
+
+}
+
+#endif
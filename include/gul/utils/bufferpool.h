@@ -0,0 +1,460 @@
+#ifndef GUL_BUFFER_POOL_H
+#define GUL_BUFFER_POOL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifndef GUL_NAMESPACE
+    #define GUL_NAMESPACE gul
+#endif
+
+namespace GUL_NAMESPACE
+{
+
+/**
+ * @brief The buffer_pool class
+ *
+ * A cache of freed memory blocks, bucketed by size, used for the pixels
+ * of Images and the values of channel1fs. Code which creates and destroys
+ * the same sized images every frame gets the same blocks back instead of
+ * going through malloc/free (and mmap/munmap for large blocks) each time.
+ *
+ * Requests are rounded up to one of four size classes per power of two,
+ * so at most 25% of a block is unused. Each thread keeps a few free
+ * blocks of each class for itself, which are taken without locking.
+ * Blocks which do not fit in the thread's cache go to a shared list,
+ * protected by a mutex, which holds at most capacity() bytes; anything
+ * beyond that is returned to the heap. When a thread exits, its cached
+ * blocks are moved to the shared list.
+ *
+ * The pool is disabled by default, every block then comes from the heap
+ * and is freed straight away. Enable it, and optionally raise the
+ * capacities from their defaults of 32MB shared and 8MB per thread,
+ * before creating the images:
+ *
+ *     auto & P = gul::buffer_pool::global();
+ *     P.set_capacity(size_t(256) << 20);
+ *     P.set_thread_capacity(size_t(64) << 20);
+ *     P.set_enabled(true);
+ *     ...
+ *     auto s = P.stats();
+ *     std::cout << s.hit_rate() << std::endl;
+ *
+ * All blocks are aligned to 64 bytes.
+ */
+class buffer_pool
+{
+public:
+    static constexpr size_t alignment        = 64;
+    static constexpr size_t min_block_size   = 256;
+    static constexpr uint32_t max_size_class = 1 + 4*(30-8); // 1.25GB, larger blocks are not pooled
+    static constexpr uint32_t num_classes    = max_size_class + 1;
+
+    struct statistics
+    {
+        uint64_t local_hits   = 0; // taken from the calling thread's cache
+        uint64_t shared_hits  = 0; // taken from the shared list
+        uint64_t misses       = 0; // allocated from the heap
+        uint64_t returns      = 0; // deallocated blocks which were kept for reuse
+        uint64_t discards     = 0; // deallocated blocks which were freed because the pool was full
+        size_t   shared_bytes = 0; // bytes currently held in the shared list
+
+        uint64_t hits() const
+        {
+            return local_hits + shared_hits;
+        }
+        double hit_rate() const
+        {
+            const uint64_t n = hits() + misses;
+            return n ? static_cast<double>( hits() ) / static_cast<double>(n) : 0.0;
+        }
+    };
+
+    /**
+     * @brief global
+     * @return
+     *
+     * Returns the pool used by Image and channel1f.
+     */
+    static buffer_pool & global()
+    {
+        // never destroyed, so that static Images can still give their
+        // blocks back when the program exits
+        static buffer_pool * P = new buffer_pool();
+        return *P;
+    }
+
+    buffer_pool(buffer_pool const &) = delete;
+    buffer_pool & operator=(buffer_pool const &) = delete;
+
+    /**
+     * @brief size_class
+     * @param bytes
+     * @return
+     *
+     * Returns the size class a block of this many bytes is taken from.
+     * Classes go 256, 320, 384, 448, 512, 640, 768... Blocks larger
+     * than the largest class return max_size_class+1.
+     */
+    static uint32_t size_class(size_t bytes)
+    {
+        if( bytes <= min_block_size )
+            return 0;
+        if( bytes > class_size(max_size_class) )
+            return max_size_class + 1;
+        uint32_t e = 8;
+        while( (size_t(2) << e) < bytes )
+            e++;
+        // 2^e < bytes <= 2^(e+1)
+        const size_t step = size_t(1) << (e-2);
+        const size_t m    = ( bytes - (size_t(1) << e) + step - 1 ) / step;
+        return 1 + 4*(e-8) + static_cast<uint32_t>(m-1);
+    }
+
+    /**
+     * @brief class_size
+     * @param cls
+     * @return
+     *
+     * Returns the number of bytes in the blocks of a size class.
+     */
+    static size_t class_size(uint32_t cls)
+    {
+        if( cls == 0 )
+            return min_block_size;
+        const uint32_t e = 8 + (cls-1)/4;
+        const size_t   m = (cls-1)%4 + 1;
+        return (size_t(1) << e) + m * (size_t(1) << (e-2));
+    }
+
+    /**
+     * @brief allocate
+     * @param bytes
+     * @return
+     *
+     * Returns an uninitialized block of at least this many bytes. It
+     * must be given back with deallocate() using the same size.
+     */
+    void * allocate(size_t bytes)
+    {
+        if( bytes == 0 )
+            return nullptr;
+        const uint32_t c = size_class(bytes);
+        if( c > max_size_class || !enabled() )
+        {
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            return _alloc( c > max_size_class ? bytes : class_size(c) );
+        }
+
+        auto * L = _local();
+        if( L && !L->blocks[c].empty() )
+        {
+            void * p = L->blocks[c].back();
+            L->blocks[c].pop_back();
+            L->bytes -= class_size(c);
+            m_localHits.fetch_add(1, std::memory_order_relaxed);
+            return p;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if( !m_shared[c].empty() )
+            {
+                void * p = m_shared[c].back();
+                m_shared[c].pop_back();
+                m_sharedBytes -= class_size(c);
+                m_sharedHits.fetch_add(1, std::memory_order_relaxed);
+                return p;
+            }
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return _alloc( class_size(c) );
+    }
+
+    /**
+     * @brief deallocate
+     * @param p
+     * @param bytes
+     *
+     * Gives a block returned by allocate(bytes) back to the pool.
+     */
+    void deallocate(void * p, size_t bytes)
+    {
+        if( !p )
+            return;
+        const uint32_t c = size_class(bytes);
+        if( c > max_size_class )
+        {
+            _free(p);
+            return;
+        }
+        const size_t n = class_size(c);
+        if( enabled() )
+        {
+            auto * L = _local();
+            if( L && L->blocks[c].size() < thread_blocks_per_class && L->bytes + n <= m_threadCapacity.load(std::memory_order_relaxed) )
+            {
+                L->blocks[c].push_back(p);
+                L->bytes += n;
+                m_returns.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if( _pushShared(p, c) )
+                return;
+        }
+        m_discards.fetch_add(1, std::memory_order_relaxed);
+        _free(p);
+    }
+
+    /**
+     * @brief allocate_shared
+     * @param bytes
+     * @return
+     *
+     * Same as allocate() but the block is given back to the pool when
+     * the last shared_ptr to it is destroyed.
+     */
+    std::shared_ptr<uint8_t> allocate_shared(size_t bytes)
+    {
+        auto p = static_cast<uint8_t*>( allocate(bytes) );
+        return std::shared_ptr<uint8_t>( p, [this, bytes](uint8_t * q)
+        {
+            deallocate(q, bytes);
+        });
+    }
+
+    statistics stats() const
+    {
+        statistics s;
+        s.local_hits  = m_localHits.load(std::memory_order_relaxed);
+        s.shared_hits = m_sharedHits.load(std::memory_order_relaxed);
+        s.misses      = m_misses.load(std::memory_order_relaxed);
+        s.returns     = m_returns.load(std::memory_order_relaxed);
+        s.discards    = m_discards.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            s.shared_bytes = m_sharedBytes;
+        }
+        return s;
+    }
+
+    void reset_stats()
+    {
+        m_localHits  = 0;
+        m_sharedHits = 0;
+        m_misses     = 0;
+        m_returns    = 0;
+        m_discards   = 0;
+    }
+
+    /**
+     * @brief set_capacity
+     * @param bytes
+     *
+     * Sets the maximum number of bytes held in the shared list. Blocks
+     * above the new capacity are freed.
+     */
+    void set_capacity(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = bytes;
+        _trimShared(bytes);
+    }
+    size_t capacity() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_capacity;
+    }
+
+    /**
+     * @brief set_thread_capacity
+     * @param bytes
+     *
+     * Sets the maximum number of bytes each thread keeps for itself.
+     */
+    void set_thread_capacity(size_t bytes)
+    {
+        m_threadCapacity = bytes;
+    }
+    size_t thread_capacity() const
+    {
+        return m_threadCapacity;
+    }
+
+    /**
+     * @brief set_enabled
+     * @param enable
+     *
+     * The pool starts out disabled. When disabled, every allocation goes
+     * to the heap and every deallocation is freed straight away.
+     */
+    void set_enabled(bool enable)
+    {
+        m_enabled = enable;
+        if( !enable )
+            release_cached();
+    }
+    bool enabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief release_cached
+     *
+     * Frees the blocks in the shared list and in the calling thread's
+     * cache. Other threads keep their own caches.
+     */
+    void release_cached()
+    {
+        if( auto * L = _local() )
+        {
+            for(auto & b : L->blocks)
+            {
+                for(auto p : b)
+                    _free(p);
+                b.clear();
+            }
+            L->bytes = 0;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        _trimShared(0);
+    }
+
+protected:
+    static constexpr size_t thread_blocks_per_class = 4;
+
+    buffer_pool() = default;
+
+    struct local_cache
+    {
+        std::array<std::vector<void*>, num_classes> blocks;
+        size_t bytes = 0;
+
+        ~local_cache()
+        {
+            _threadExited() = true;
+            auto & P = buffer_pool::global();
+            for(uint32_t c = 0; c < num_classes; c++)
+            {
+                for(auto p : blocks[c])
+                {
+                    if( !P._pushShared(p, c) )
+                        _free(p);
+                }
+            }
+        }
+    };
+
+    static bool & _threadExited()
+    {
+        static thread_local bool exited = false;
+        return exited;
+    }
+
+    // the calling thread's cache, or null once the thread's
+    // thread_local objects have been destroyed
+    static local_cache * _local()
+    {
+        if( _threadExited() )
+            return nullptr;
+        static thread_local local_cache L;
+        return &L;
+    }
+
+    static void * _alloc(size_t bytes)
+    {
+        return ::operator new(bytes, std::align_val_t(alignment));
+    }
+    static void _free(void * p)
+    {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    bool _pushShared(void * p, uint32_t c)
+    {
+        const size_t n = class_size(c);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if( m_sharedBytes + n > m_capacity )
+            return false;
+        m_shared[c].push_back(p);
+        m_sharedBytes += n;
+        m_returns.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // frees the largest blocks first until at most bytes are held, m_mutex must be locked
+    void _trimShared(size_t bytes)
+    {
+        for(uint32_t c = num_classes; c-- > 0 && m_sharedBytes > bytes; )
+        {
+            while( !m_shared[c].empty() && m_sharedBytes > bytes )
+            {
+                _free( m_shared[c].back() );
+                m_shared[c].pop_back();
+                m_sharedBytes -= class_size(c);
+            }
+        }
+    }
+
+    mutable std::mutex                           m_mutex;
+    std::array<std::vector<void*>, num_classes>  m_shared;
+    size_t                                       m_sharedBytes = 0;
+    size_t                                       m_capacity    = size_t(32) << 20;
+
+    std::atomic<size_t>   m_threadCapacity = {size_t(8) << 20};
+    std::atomic<bool>     m_enabled    = {false};
+    std::atomic<uint64_t> m_localHits  = {0};
+    std::atomic<uint64_t> m_sharedHits = {0};
+    std::atomic<uint64_t> m_misses     = {0};
+    std::atomic<uint64_t> m_returns    = {0};
+    std::atomic<uint64_t> m_discards   = {0};
+};
+
+/**
+ * @brief The pool_allocator class
+ *
+ * A std::allocator replacement which takes its memory from
+ * buffer_pool::global(), eg: std::vector<float, pool_allocator<float>>.
+ */
+template<typename T>
+struct pool_allocator
+{
+    using value_type = T;
+
+    pool_allocator() = default;
+    template<typename U>
+    pool_allocator(pool_allocator<U> const &)
+    {
+    }
+
+    T * allocate(size_t n)
+    {
+        return static_cast<T*>( buffer_pool::global().allocate(n * sizeof(T)) );
+    }
+    void deallocate(T * p, size_t n)
+    {
+        buffer_pool::global().deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(pool_allocator<U> const &) const
+    {
+        return true;
+    }
+    template<typename U>
+    bool operator!=(pool_allocator<U> const &) const
+    {
+        return false;
+    }
+};
+
+}
+
+#endif
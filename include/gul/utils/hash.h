@@ -0,0 +1,294 @@
+#ifndef GUL_HASH_H
+#define GUL_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// SIMD paths can be disabled by defining GUL_HASH_NO_SIMD (or GUL_IMAGE_NO_SIMD)
+#if !defined(GUL_HASH_NO_SIMD) && !defined(GUL_IMAGE_NO_SIMD)
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define GUL_HASH_SSE2
+        #include <emmintrin.h>
+    #endif
+    #if defined(__AVX2__)
+        #define GUL_HASH_AVX2
+        #include <immintrin.h>
+    #endif
+#endif
+
+#ifndef GUL_NAMESPACE
+    #define GUL_NAMESPACE gul
+#endif
+
+namespace GUL_NAMESPACE
+{
+
+/**
+ * @brief The hash64_stream class
+ *
+ * A fast, non-cryptographic 64-bit hash for large buffers, modelled on
+ * xxHash3. The input is split into 64 byte stripes which are accumulated
+ * into 8 independent 64-bit lanes, so there is no dependency chain between
+ * consecutive words and the lanes map directly onto SSE2/AVX2 registers.
+ * The scalar and SIMD versions give identical results.
+ *
+ * Data can be added in chunks of any size, the result only depends on the
+ * concatenated bytes:
+ *
+ *     hash64_stream H;
+ *     H.update(chunk1, size1);
+ *     H.update(chunk2, size2);
+ *     auto h = H.digest();   // == hash64(chunk1+chunk2)
+ *
+ * Note: this is not compatible with the reference xxHash3 implementation.
+ */
+class hash64_stream
+{
+public:
+    static constexpr size_t   stripe_size      = 64;
+    static constexpr size_t   stripes_per_block = 16;
+    static constexpr uint64_t prime32_1 = 0x9E3779B1u;
+    static constexpr uint64_t prime64_1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t prime64_2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t prime64_3 = 0x165667B19E3779F9ull;
+
+    explicit hash64_stream(uint64_t seed = 0)
+    {
+        reset(seed);
+    }
+
+    void reset(uint64_t seed = 0)
+    {
+        for(size_t i = 0; i < 8; i++)
+        {
+            m_acc[i] = (i & 1u) ? prime64_1 - seed : prime64_2 + seed;
+        }
+        m_seed     = seed;
+        m_buffered = 0;
+        m_stripe   = 0;
+        m_length   = 0;
+    }
+
+    /**
+     * @brief update
+     * @param data
+     * @param bytes
+     *
+     * Adds bytes to the hash.
+     */
+    void update(void const * data, size_t bytes)
+    {
+        auto * p = static_cast<uint8_t const*>(data);
+        m_length += bytes;
+
+        // fill up the partial stripe first. A full buffer is only consumed
+        // once more data arrives so that digest() always has a last stripe.
+        if( m_buffered && m_buffered + bytes > stripe_size )
+        {
+            const size_t n = stripe_size - m_buffered;
+            memcpy(m_buffer + m_buffered, p, n);
+            p     += n;
+            bytes -= n;
+            _consume(m_buffer, 1);
+            m_buffered = 0;
+        }
+
+        if( m_buffered == 0 && bytes > stripe_size )
+        {
+            // keep at least one byte for the buffer
+            const size_t stripes = (bytes - 1) / stripe_size;
+            _consume(p, stripes);
+            p     += stripes * stripe_size;
+            bytes -= stripes * stripe_size;
+        }
+
+        memcpy(m_buffer + m_buffered, p, bytes);
+        m_buffered += bytes;
+    }
+
+    /**
+     * @brief digest
+     * @return
+     *
+     * Returns the hash of all the bytes added so far. More data can
+     * be added afterwards.
+     */
+    uint64_t digest() const
+    {
+        uint64_t acc[8];
+        memcpy(acc, m_acc, sizeof(acc));
+
+        if( m_buffered )
+        {
+            // the last (partial) stripe is zero padded and uses
+            // a different part of the secret
+            uint8_t last[stripe_size] = {};
+            memcpy(last, m_buffer, m_buffered);
+            _accumulate(acc, last, _secret() + stripes_per_block);
+        }
+
+        uint64_t h = m_length * prime64_1 + m_seed;
+        for(size_t i = 0; i < 8; i++)
+        {
+            h ^= _avalanche( acc[i] ^ _secret()[i + 1] );
+            h  = _rotate_left(h, 27) * prime64_1 + prime64_3;
+        }
+        return _avalanche(h);
+    }
+
+    static uint64_t _rotate_left(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t _avalanche(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= prime64_2;
+        h ^= h >> 29;
+        h *= prime64_3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    /**
+     * @brief _secret
+     * @return
+     *
+     * 24 pseudo random 64-bit keys. Stripe i of a block is combined
+     * with keys [i, i+8).
+     */
+    static uint64_t const * _secret()
+    {
+        struct keys
+        {
+            uint64_t k[stripes_per_block + 8];
+            keys()
+            {
+                // splitmix64
+                uint64_t x = prime64_3;
+                for(auto & v : k)
+                {
+                    uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+                    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                    v = z ^ (z >> 31);
+                }
+            }
+        };
+        static const keys K;
+        return K.k;
+    }
+
+    static uint64_t _read64(uint8_t const * p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // acc[i] += data[i^1] + lo32(data[i]^key[i]) * hi32(data[i]^key[i])
+    static void _accumulate(uint64_t * acc, uint8_t const * p, uint64_t const * key)
+    {
+#if defined(GUL_HASH_AVX2)
+        for(size_t i = 0; i < 8; i += 4)
+        {
+            auto * A = reinterpret_cast<__m256i*>(acc + i);
+            __m256i d  = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(p + 8*i) );
+            __m256i k  = _mm256_loadu_si256( reinterpret_cast<__m256i const*>(key + i) );
+            __m256i dk = _mm256_xor_si256(d, k);
+            __m256i m  = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+            __m256i s  = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1,0,3,2));
+            _mm256_storeu_si256(A, _mm256_add_epi64( _mm256_loadu_si256(A), _mm256_add_epi64(m, s)) );
+        }
+#elif defined(GUL_HASH_SSE2)
+        for(size_t i = 0; i < 8; i += 2)
+        {
+            auto * A = reinterpret_cast<__m128i*>(acc + i);
+            __m128i d  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(p + 8*i) );
+            __m128i k  = _mm_loadu_si128( reinterpret_cast<__m128i const*>(key + i) );
+            __m128i dk = _mm_xor_si128(d, k);
+            __m128i m  = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+            __m128i s  = _mm_shuffle_epi32(d, _MM_SHUFFLE(1,0,3,2));
+            _mm_storeu_si128(A, _mm_add_epi64( _mm_loadu_si128(A), _mm_add_epi64(m, s)) );
+        }
+#else
+        for(size_t i = 0; i < 8; i++)
+        {
+            const uint64_t d  = _read64(p + 8*i);
+            const uint64_t dk = d ^ key[i];
+            acc[i ^ 1] += d;
+            acc[i]     += (dk & 0xFFFFFFFFu) * (dk >> 32);
+        }
+#endif
+    }
+
+    // acc = (acc ^ (acc >> 47) ^ key) * prime32_1
+    static void _scramble(uint64_t * acc, uint64_t const * key)
+    {
+#if defined(GUL_HASH_SSE2)
+        const __m128i P = _mm_set1_epi32( static_cast<int>(prime32_1) );
+        for(size_t i = 0; i < 8; i += 2)
+        {
+            auto * A = reinterpret_cast<__m128i*>(acc + i);
+            __m128i a = _mm_loadu_si128(A);
+            a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+            a = _mm_xor_si128(a, _mm_loadu_si128( reinterpret_cast<__m128i const*>(key + i) ));
+            __m128i lo = _mm_mul_epu32(a, P);
+            __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), P);
+            _mm_storeu_si128(A, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)) );
+        }
+#else
+        for(size_t i = 0; i < 8; i++)
+        {
+            uint64_t a = acc[i];
+            a ^= a >> 47;
+            a ^= key[i];
+            acc[i] = a * prime32_1;
+        }
+#endif
+    }
+
+    void _consume(uint8_t const * p, size_t stripes)
+    {
+        auto * secret = _secret();
+        for(size_t s = 0; s < stripes; s++)
+        {
+            _accumulate(m_acc, p + s*stripe_size, secret + m_stripe);
+            if( ++m_stripe == stripes_per_block )
+            {
+                _scramble(m_acc, secret + 8);
+                m_stripe = 0;
+            }
+        }
+    }
+
+private:
+    uint64_t m_acc[8];
+    uint8_t  m_buffer[stripe_size];
+    uint64_t m_seed     = 0;
+    size_t   m_buffered = 0;
+    size_t   m_stripe   = 0;
+    uint64_t m_length   = 0;
+};
+
+/**
+ * @brief hash64
+ * @param data
+ * @param bytes
+ * @param seed
+ * @return
+ *
+ * Returns the 64-bit hash of a buffer. See hash64_stream
+ */
+inline uint64_t hash64(void const * data, size_t bytes, uint64_t seed = 0)
+{
+    hash64_stream H(seed);
+    H.update(data, bytes);
+    return H.digest();
+}
+
+}
+
+#endif
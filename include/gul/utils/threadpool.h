@@ -10,6 +10,8 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
 
 #ifndef GUL_NAMESPACE
     #define GUL_NAMESPACE gul
@@ -66,10 +68,29 @@ class thread_pool
 
         /**
          * @brief executeTask
+         * @return
          *
-         * Executes a single task on the queue
+         * Executes a single task on the queue. Returns false if there
+         * were no tasks to execute.
          */
-        void executeTask();
+        bool executeTask();
+
+        /**
+         * @brief parallel_for
+         * @param begin
+         * @param end
+         * @param f
+         * @param grain
+         *
+         * Splits the range [begin, end) into chunks of at least grain
+         * elements and calls f(chunkBegin, chunkEnd) for each chunk on the
+         * workers. The calling thread helps execute the tasks while it
+         * waits, so this also works if the pool has no workers.
+         *
+         * Returns once all the chunks have been processed.
+         */
+        template<typename F>
+        void parallel_for(std::size_t begin, std::size_t end, F && f, std::size_t grain=1);
 
         ~thread_pool();
 
@@ -112,23 +133,77 @@ inline void thread_pool::create_workers(std::size_t num)
         m_cv.notify_all();
 }
 
-inline void thread_pool::executeTask()
+inline bool thread_pool::executeTask()
 {
     std::function<void()> task;
     {
         std::unique_lock<std::mutex> lock(this->m_mutex);
         if( this->m_tasks.empty() )
-            return;
+            return false;
         task = std::move(this->m_tasks.front());
         this->m_tasks.pop();
     }
     task();
+    return true;
+}
+
+template<typename F>
+void thread_pool::parallel_for(std::size_t begin, std::size_t end, F && f, std::size_t grain)
+{
+    if( end <= begin )
+        return;
+
+    grain = grain == 0 ? 1 : grain;
+
+    // workers can be added or removed from other threads, take one
+    // snapshot of the count under the lock
+    std::size_t workerCount;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        workerCount = m_worker_count;
+    }
+
+    // a few chunks per thread so that uneven chunks balance out
+    const std::size_t total     = end - begin;
+    const std::size_t maxChunks = (workerCount + 1) * 4;
+    const std::size_t chunkSize = std::max( grain, (total + maxChunks - 1) / maxChunks );
+
+    if( workerCount == 0 || chunkSize >= total )
+    {
+        f(begin, end);
+        return;
+    }
+
+    std::vector< std::future<void> > results;
+    for(std::size_t i = begin; i < end; i += chunkSize)
+    {
+        const std::size_t last = std::min(end, i + chunkSize);
+        results.push_back( push( [&f](std::size_t a, std::size_t b){ f(a,b); }, i, last) );
+    }
+
+    for(auto & r : results)
+    {
+        while( r.wait_for( std::chrono::seconds(0) ) != std::future_status::ready )
+        {
+            if( !executeTask() )
+            {
+                r.wait();
+            }
+        }
+    }
+    for(auto & r : results)
+    {
+        r.get();
+    }
 }
 
 inline void thread_pool::add_thread()
 {
-    ++m_thread_count;
-    ++m_worker_count;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_thread_count;
+        ++m_worker_count;
+    }
 
     workers.emplace_back(
         [this]
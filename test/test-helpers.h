@@ -0,0 +1,62 @@
+#ifndef GUL_TEST_HELPERS_H
+#define GUL_TEST_HELPERS_H
+
+// Helpers shared by the image unit tests
+
+#include <gul/Image.h>
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+// Fills the bytes of the image with random values, in the order they
+// are stored
+inline void fillRandom(gul::Image & I, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    auto * p = static_cast<uint8_t*>(I.data());
+    for(size_t i = 0; i < I.size(); i++)
+    {
+        p[i] = static_cast<uint8_t>(gen());
+    }
+}
+
+// Fills the image with random values in the range [lo, hi]
+inline void fillRandom(gul::Image & I, uint32_t seed, int lo, int hi)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> dist(lo, hi);
+    auto * p = static_cast<uint8_t*>(I.data());
+    for(size_t i = 0; i < I.size(); i++)
+    {
+        p[i] = static_cast<uint8_t>( dist(gen) );
+    }
+}
+
+// Returns an image filled with fillRandom(I, seed)
+inline gul::Image makeNoise(uint32_t w, uint32_t h, uint32_t ch, uint32_t seed)
+{
+    gul::Image I(w, h, ch);
+    fillRandom(I, seed);
+    return I;
+}
+
+// Fills the channel with random values in the range [0, 1)
+inline void fillRandom(gul::channel1f & C, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for(auto & v : C.data)
+        v = dist(gen);
+}
+
+// true if the images have the same size and the same bytes
+inline bool samePixels(gul::Image const & A, gul::Image const & B)
+{
+    return A.getWidth()    == B.getWidth()  &&
+           A.getHeight()   == B.getHeight() &&
+           A.getChannels() == B.getChannels() &&
+           std::memcmp(A.data(), B.data(), A.size()) == 0;
+}
+
+#endif
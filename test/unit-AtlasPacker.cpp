@@ -0,0 +1,269 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/AtlasPacker.h>
+
+#include <cstring>
+#include <random>
+
+// fills a sprite with a pattern unique to its index so that every
+// pixel can be traced back to the sprite
+static gul::Image makeSprite(uint32_t index, uint32_t w, uint32_t h, uint32_t ch = 4)
+{
+    gul::Image I(w, h, ch);
+    for(uint32_t y = 0; y < h; y++)
+        for(uint32_t x = 0; x < w; x++)
+            for(uint32_t c = 0; c < ch; c++)
+                I(x,y,c) = static_cast<uint8_t>( (index * 7 + x * 3 + y * 5 + c * 11) | 1u );
+    return I;
+}
+
+static std::vector<gul::Image> makeSprites(uint32_t count, uint32_t minSize, uint32_t maxSize, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<uint32_t> dist(minSize, maxSize);
+    std::vector<gul::Image> S;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t w = dist(gen);
+        const uint32_t h = dist(gen);
+        S.push_back( makeSprite(i, w, h) );
+    }
+    return S;
+}
+
+static bool overlap(gul::AtlasRect const & a, gul::AtlasRect const & b, uint32_t margin)
+{
+    return a.page == b.page &&
+           a.x < b.x + b.width  + margin && b.x < a.x + a.width  + margin &&
+           a.y < b.y + b.height + margin && b.y < a.y + a.height + margin;
+}
+
+SCENARIO("Skyline packing")
+{
+    GIVEN("A packer")
+    {
+        gul::SkylinePacker P(64, 32);
+        uint32_t x = 0, y = 0;
+
+        THEN("Rectangles are placed bottom-left without overlapping")
+        {
+            REQUIRE( P.insert(32, 16, x, y) );
+            REQUIRE( x == 0 );
+            REQUIRE( y == 0 );
+            REQUIRE( P.insert(32, 8, x, y) );
+            REQUIRE( x == 32 );
+            REQUIRE( y == 0 );
+            REQUIRE( P.insert(32, 8, x, y) );
+            REQUIRE( x == 32 );
+            REQUIRE( y == 8 );
+            REQUIRE( P.insert(64, 16, x, y) );
+            REQUIRE( x == 0 );
+            REQUIRE( y == 16 );
+            REQUIRE( P.occupancy() == 1.0 );
+            REQUIRE_FALSE( P.insert(1, 1, x, y) );
+        }
+
+        THEN("Rectangles which are too large are rejected")
+        {
+            REQUIRE_FALSE( P.insert(65, 1, x, y) );
+            REQUIRE_FALSE( P.insert(1, 33, x, y) );
+            REQUIRE_FALSE( P.insert(0, 1, x, y) );
+        }
+    }
+}
+
+SCENARIO("Building atlases")
+{
+    GIVEN("A few hundred sprites")
+    {
+        auto S = makeSprites(300, 1, 40, 1);
+
+        gul::AtlasSettings settings;
+        settings.pageWidth  = 512;
+        settings.pageHeight = 512;
+        settings.padding    = 2;
+        settings.gutter     = 1;
+
+        auto A = gul::buildAtlas(S, settings);
+
+        THEN("Every sprite is copied to its rectangle")
+        {
+            REQUIRE( A.rects.size() == S.size() );
+            for(size_t i = 0; i < S.size(); i++)
+            {
+                auto & R = A.rects[i];
+                auto & P = A.pages.at(R.page);
+                REQUIRE( R.width  == S[i].getWidth() );
+                REQUIRE( R.height == S[i].getHeight() );
+                REQUIRE( R.x >= 1 );
+                REQUIRE( R.y >= 1 );
+                REQUIRE( R.x + R.width  + 1 <= P.getWidth() );
+                REQUIRE( R.y + R.height + 1 <= P.getHeight() );
+                REQUIRE( R.u0 == float(R.x) / float(P.getWidth()) );
+                REQUIRE( R.v1 == float(R.y + R.height) / float(P.getHeight()) );
+                for(uint32_t y = 0; y < R.height; y++)
+                {
+                    REQUIRE( std::memcmp( &P(R.x, R.y + y, 0), &S[i](0, y, 0), R.width * 4) == 0 );
+                }
+            }
+        }
+
+        THEN("The gutters repeat the edges and the padding stays empty")
+        {
+            for(size_t i = 0; i < S.size(); i++)
+            {
+                auto & R = A.rects[i];
+                auto & P = A.pages.at(R.page);
+                for(uint32_t c = 0; c < 4; c++)
+                {
+                    REQUIRE( P(R.x - 1, R.y - 1, c) == S[i](0, 0, c) );
+                    REQUIRE( P(R.x + R.width, R.y + R.height - 1, c) == S[i](R.width - 1, R.height - 1, c) );
+                    REQUIRE( P(R.x, R.y + R.height, c) == S[i](0, R.height - 1, c) );
+                }
+                for(size_t j = i + 1; j < S.size(); j++)
+                {
+                    // the cells, gutters included, are at least padding apart
+                    REQUIRE_FALSE( overlap(A.rects[i], A.rects[j], 2*1 + 2) );
+                }
+            }
+        }
+
+        THEN("The thread pool gives the same pages")
+        {
+            gul::thread_pool pool(3);
+            auto B = gul::buildAtlas(pool, S, settings);
+            REQUIRE( B.pages.size() == A.pages.size() );
+            for(size_t p = 0; p < A.pages.size(); p++)
+                REQUIRE( B.pages[p].hash() == A.pages[p].hash() );
+        }
+    }
+
+    GIVEN("More sprites than fit in one page")
+    {
+        auto S = makeSprites(200, 20, 30, 2);
+        gul::AtlasSettings settings;
+        settings.pageWidth  = 128;
+        settings.pageHeight = 128;
+        settings.padding    = 0;
+
+        THEN("Several pages are used")
+        {
+            auto A = gul::buildAtlas(S, settings);
+            REQUIRE( A.pages.size() > 5 );
+            for(size_t i = 0; i < S.size(); i++)
+                for(size_t j = i + 1; j < S.size(); j++)
+                    REQUIRE_FALSE( overlap(A.rects[i], A.rects[j], 0) );
+        }
+
+        THEN("The page limit is respected")
+        {
+            settings.maxPages = 2;
+            REQUIRE_THROWS_AS( gul::buildAtlas(S, settings), std::runtime_error );
+        }
+
+        THEN("Sprites larger than a page are rejected")
+        {
+            S.push_back( makeSprite(0, 129, 4) );
+            REQUIRE_THROWS_AS( gul::buildAtlas(S, settings), std::runtime_error );
+        }
+    }
+
+    GIVEN("Settings for a mipmapped atlas")
+    {
+        auto S = makeSprites(100, 3, 50, 3);
+        gul::AtlasSettings settings;
+        settings.mipLevels = 4;
+        settings.gutter    = 8;
+        settings.padding   = 0;
+        auto L = gul::packAtlas(S.size(), [&](size_t i, uint32_t & w, uint32_t & h)
+        {
+            w = S[i].getWidth();
+            h = S[i].getHeight();
+        }, settings);
+
+        THEN("The cells are aligned to the coarsest level")
+        {
+            for(auto & R : L.rects)
+            {
+                REQUIRE( (R.x - 8) % 8 == 0 );
+                REQUIRE( (R.y - 8) % 8 == 0 );
+            }
+            REQUIRE( L.pages.size() == 1 );
+            REQUIRE( L.pages[0].width  % 8 == 0 );
+            REQUIRE( L.pages[0].height % 8 == 0 );
+        }
+    }
+
+    GIVEN("Sprites with a different number of channels")
+    {
+        std::vector<gul::Image> S;
+        S.push_back( makeSprite(1, 4, 4, 1) );
+        S.push_back( makeSprite(2, 4, 4, 3) );
+        S.push_back( gul::Image(0, 0, 4) );
+        auto A = gul::buildAtlas(S);
+
+        THEN("They are converted to the atlas channels")
+        {
+            auto & R0 = A.rects[0];
+            auto & R1 = A.rects[1];
+            auto & P  = A.pages[0];
+            REQUIRE( P(R0.x + 1, R0.y + 2, 0) == S[0](1,2,0) );
+            REQUIRE( P(R0.x + 1, R0.y + 2, 2) == S[0](1,2,0) );
+            REQUIRE( P(R0.x + 1, R0.y + 2, 3) == 255 );
+            REQUIRE( P(R1.x + 3, R1.y, 1) == S[1](3,0,1) );
+            REQUIRE( P(R1.x + 3, R1.y, 3) == 255 );
+            REQUIRE( A.rects[2].width == 0 );
+        }
+
+        THEN("Planar sprites give the same pages")
+        {
+            auto Q = S;
+            for(auto & I : Q)
+                I.setPlanar(true);
+            auto B = gul::buildAtlas(Q);
+            REQUIRE( B.pages.size() == A.pages.size() );
+            REQUIRE( B.pages[0].hash() == A.pages[0].hash() );
+            REQUIRE( Q[1].isPlanar() );
+        }
+    }
+}
+
+TEST_CASE("Atlas packer benchmarks", "[.benchmark]")
+{
+    std::mt19937 gen(4);
+    std::uniform_int_distribution<uint32_t> dist(4, 40);
+    std::vector<uint32_t> W(50000), H(50000);
+    for(size_t i = 0; i < W.size(); i++)
+    {
+        W[i] = dist(gen);
+        H[i] = dist(gen);
+    }
+    gul::AtlasSettings settings;
+    settings.pageWidth  = 4096;
+    settings.pageHeight = 4096;
+    settings.gutter     = 1;
+
+    BENCHMARK("pack 50k sprites")
+    {
+        return gul::packAtlas(W.size(), [&](size_t i, uint32_t & w, uint32_t & h)
+        {
+            w = W[i];
+            h = H[i];
+        }, settings);
+    };
+
+    std::vector<gul::Image> S;
+    for(size_t i = 0; i < 50000; i++)
+        S.emplace_back(W[i], H[i], 4);
+    gul::thread_pool pool(4);
+
+    BENCHMARK("build 50k sprite atlas")
+    {
+        return gul::buildAtlas(S, settings);
+    };
+    BENCHMARK("build 50k sprite atlas 4 threads")
+    {
+        return gul::buildAtlas(pool, S, settings);
+    };
+}
@@ -0,0 +1,356 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/BlockCompression.h>
+#include "test-helpers.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// smooth gradients with some low frequency variation, similar to a photo
+static void fillSmooth(gul::Image & I)
+{
+    auto * p = static_cast<uint8_t*>(I.data());
+    const uint32_t C = I.getChannels();
+    for(uint32_t y = 0; y < I.getHeight(); y++)
+    {
+        for(uint32_t x = 0; x < I.getWidth(); x++)
+        {
+            for(uint32_t c = 0; c < C; c++)
+            {
+                const double v = 127.5 + 127.5 * std::sin(0.05 * double(x) * double(c+1) + 0.07 * double(y) + double(c));
+                p[(size_t(y) * I.getWidth() + x) * C + c] = static_cast<uint8_t>(v);
+            }
+        }
+    }
+}
+
+// PSNR over the first `channels` channels of both images
+static double psnr(gul::Image const & A, gul::Image const & B, uint32_t channels)
+{
+    double err = 0.0;
+    for(uint32_t y = 0; y < A.getHeight(); y++)
+    {
+        for(uint32_t x = 0; x < A.getWidth(); x++)
+        {
+            for(uint32_t c = 0; c < channels; c++)
+            {
+                const double d = double(A(x,y,c)) - double(B(x,y,c));
+                err += d*d;
+            }
+        }
+    }
+    err /= double(A.getWidth()) * double(A.getHeight()) * double(channels);
+    return err == 0.0 ? 100.0 : 10.0 * std::log10(255.0 * 255.0 / err);
+}
+
+SCENARIO("Block compression round trips")
+{
+    gul::Image I(64, 48, 4);
+    fillSmooth(I);
+
+    WHEN("We compress a smooth image with each format")
+    {
+        THEN("BC1 reproduces the colour")
+        {
+            // pixels with alpha < 128 would be transparent black
+            I.a = uint8_t(255);
+            auto C = gul::compressBC(I, gul::BCFormat::BC1);
+            REQUIRE( C.data.size() == 16*12*8 );
+            auto D = gul::decompressBC(C);
+            REQUIRE( D.getChannels() == 4 );
+            REQUIRE( psnr(I, D, 3) > 33.0 );
+        }
+        THEN("BC3 reproduces colour and alpha")
+        {
+            auto C = gul::compressBC(I, gul::BCFormat::BC3);
+            REQUIRE( C.data.size() == 16*12*16 );
+            auto D = gul::decompressBC(C);
+            REQUIRE( psnr(I, D, 3) > 33.0 );
+            for(uint32_t y = 0; y < 48; y++)
+                for(uint32_t x = 0; x < 64; x++)
+                    REQUIRE( std::abs(int(D(x,y,3)) - int(I(x,y,3))) <= 10 );
+        }
+        THEN("BC4 and BC5 reproduce the first channels")
+        {
+            auto D4 = gul::decompressBC( gul::compressBC(I, gul::BCFormat::BC4) );
+            auto D5 = gul::decompressBC( gul::compressBC(I, gul::BCFormat::BC5) );
+            REQUIRE( D4.getChannels() == 1 );
+            REQUIRE( D5.getChannels() == 2 );
+            REQUIRE( psnr(I, D4, 1) > 40.0 );
+            for(uint32_t y = 0; y < 48; y++)
+                for(uint32_t x = 0; x < 64; x++)
+                {
+                    REQUIRE( D4(x,y,0) == D5(x,y,0) );
+                    REQUIRE( std::abs(int(D5(x,y,1)) - int(I(x,y,1))) <= 10 );
+                }
+        }
+        THEN("BC7 is better than BC3 and improves with quality")
+        {
+            auto D3 = gul::decompressBC( gul::compressBC(I, gul::BCFormat::BC3) );
+            double last = 0.0;
+            for(uint32_t q = 0; q <= 2; q++)
+            {
+                auto D = gul::decompressBC( gul::compressBC(I, gul::BCFormat::BC7, {q}) );
+                const double p = psnr(I, D, 4);
+                REQUIRE( p > 38.0 );
+                REQUIRE( p >= last );
+                last = p;
+            }
+            REQUIRE( last > psnr(I, D3, 4) );
+        }
+    }
+
+    WHEN("We compress random noise")
+    {
+        fillRandom(I, 3);
+        I.a = uint8_t(255);
+        THEN("Every format decodes without error and BC7 stays ahead")
+        {
+            const double p1 = psnr(I, gul::decompressBC( gul::compressBC(I, gul::BCFormat::BC1) ), 3);
+            const double p7 = psnr(I, gul::decompressBC( gul::compressBC(I, gul::BCFormat::BC7, {2}) ), 3);
+            REQUIRE( p1 > 10.0 );
+            REQUIRE( p7 > p1 );
+        }
+    }
+
+    WHEN("The image size is not a multiple of 4 and has fewer channels")
+    {
+        gul::Image G(13, 7, 1);
+        fillSmooth(G);
+        auto C = gul::compressBC(G, gul::BCFormat::BC1);
+        REQUIRE( C.blocksX() == 4 );
+        REQUIRE( C.blocksY() == 2 );
+        auto D = gul::decompressBC(C);
+        REQUIRE( D.getWidth()  == 13 );
+        REQUIRE( D.getHeight() == 7 );
+        THEN("The grey value is expanded to RGB")
+        {
+            for(uint32_t y = 0; y < 7; y++)
+                for(uint32_t x = 0; x < 13; x++)
+                {
+                    REQUIRE( std::abs(int(D(x,y,0)) - int(G(x,y,0))) <= 12 );
+                    REQUIRE( std::abs(int(D(x,y,1)) - int(G(x,y,0))) <= 12 );
+                    REQUIRE( D(x,y,3) == 255 );
+                }
+        }
+    }
+
+    WHEN("A BC1 block has transparent pixels")
+    {
+        gul::Image A(4, 4, 4);
+        fillSmooth(A);
+        for(uint32_t x = 0; x < 4; x++)
+        {
+            A(x,0,3) = 0;
+            for(uint32_t y = 1; y < 4; y++) A(x,y,3) = 255;
+        }
+        auto D = gul::decompressBC( gul::compressBC(A, gul::BCFormat::BC1) );
+        THEN("They decode as transparent black")
+        {
+            for(uint32_t x = 0; x < 4; x++)
+            {
+                REQUIRE( D(x,0,3) == 0 );
+                for(uint32_t y = 1; y < 4; y++) REQUIRE( D(x,y,3) == 255 );
+            }
+        }
+    }
+
+    WHEN("Solid blocks are compressed")
+    {
+        gul::Image S(8, 8, 4);
+        S.r = uint8_t(200);
+        S.g = uint8_t(17);
+        S.b = uint8_t(99);
+        S.a = uint8_t(128);
+        THEN("BC4, BC5 and BC7 are lossless")
+        {
+            auto D7 = gul::decompressBC( gul::compressBC(S, gul::BCFormat::BC7) );
+            auto D4 = gul::decompressBC( gul::compressBC(S, gul::BCFormat::BC4) );
+            REQUIRE( std::memcmp(D7.data(), S.data(), S.size()) == 0 );
+            REQUIRE( D4(3,3,0) == 200 );
+        }
+    }
+
+    WHEN("We compress on a thread pool")
+    {
+        gul::thread_pool pool(3);
+        gul::Image N(50, 38, 4);
+        fillRandom(N, 9);
+        for(auto f : {gul::BCFormat::BC1, gul::BCFormat::BC3, gul::BCFormat::BC4, gul::BCFormat::BC5, gul::BCFormat::BC7})
+        {
+            auto A = gul::compressBC(N, f, {2});
+            auto B = gul::compressBC(pool, N, f, {2});
+            THEN("The output is identical to the single threaded version")
+            {
+                REQUIRE( A.data == B.data );
+                auto DA = gul::decompressBC(A);
+                auto DB = gul::decompressBC(pool, B);
+                REQUIRE( std::memcmp(DA.data(), DB.data(), DA.size()) == 0 );
+            }
+        }
+    }
+
+    WHEN("We compress a planar image")
+    {
+        for(uint32_t ch = 1; ch <= 4; ch++)
+        {
+            gul::Image N(23, 18, ch);
+            fillRandom(N, 20 + ch);
+            auto P = N;
+            P.setPlanar(true);
+            THEN("The blocks are the same as for the interleaved image")
+            {
+                for(auto f : {gul::BCFormat::BC1, gul::BCFormat::BC4, gul::BCFormat::BC7})
+                    REQUIRE( gul::compressBC(P, f, {1}).data == gul::compressBC(N, f, {1}).data );
+            }
+        }
+    }
+
+    WHEN("We compress a mip chain")
+    {
+        gul::ImageMM MM;
+        MM.level[0] = I;
+        MM.generateMipMaps();
+        auto L = gul::compressBC(MM, gul::BCFormat::BC7, {0});
+        REQUIRE( L.size() == MM.getLevelCount() );
+        for(uint32_t i = 0; i < L.size(); i++)
+        {
+            REQUIRE( L[i].width  == MM.level[i].getWidth() );
+            REQUIRE( L[i].height == MM.level[i].getHeight() );
+        }
+    }
+}
+
+TEST_CASE("BC7 decodes the two subset modes")
+{
+    // build random blocks with the two subset modes (which all have p-bits)
+    // and check that they decode to the colours we packed
+    std::mt19937 gen(5);
+    for(uint32_t mode : {1u, 3u, 7u})
+    {
+        for(uint32_t p = 0; p < 64; p++)
+        {
+            auto const & M = gul::detail::bc7_mode(mode);
+            gul::detail::bc7_endpoints E[2];
+            const uint16_t mask = gul::detail::bc7_partition2(p);
+            for(int s = 0; s < 2; s++)
+            {
+                for(int e = 0; e < 2; e++)
+                {
+                    for(int c = 0; c < 4; c++)
+                        E[s].code[e][c] = static_cast<int>( gen() % (1u << M.colorBits) );
+                    E[s].pbit[e] = M.sharedPBits ? E[s].pbit[0] : static_cast<int>(gen() & 1u);
+                }
+                if( M.sharedPBits ) E[s].pbit[1] = E[s].pbit[0];
+            }
+            for(int i = 0; i < 16; i++)
+            {
+                const int s = (mask >> i) & 1;
+                E[s].idx[i] = static_cast<uint8_t>( gen() % (1u << M.indexBits) );
+            }
+            gul::detail::bc7_fix_anchor(E[0], static_cast<uint16_t>(~mask), 0, M.indexBits);
+            gul::detail::bc7_fix_anchor(E[1], mask, gul::detail::bc7_anchor2(p), M.indexBits);
+
+            uint8_t block[16];
+            gul::detail::bc7_pack(mode, p, 0, 0, E, block);
+            uint8_t px[16][4];
+            gul::detail::bc7_decode(block, px);
+
+            const int bits = M.colorBits + ((M.endpointPBits || M.sharedPBits) ? 1 : 0);
+            for(int i = 0; i < 16; i++)
+            {
+                const int s = (mask >> i) & 1;
+                const int w = gul::detail::bc7_weights(M.indexBits)[E[s].idx[i]];
+                for(int c = 0; c < 3; c++)
+                {
+                    const int e0 = gul::detail::bc7_expand( (E[s].code[0][c] << 1) | E[s].pbit[0], bits);
+                    const int e1 = gul::detail::bc7_expand( (E[s].code[1][c] << 1) | E[s].pbit[1], bits);
+                    REQUIRE( int(px[i][c]) == gul::detail::bc7_interpolate(e0, e1, w) );
+                }
+                if( !M.alphaBits )
+                    REQUIRE( px[i][3] == 255 );
+            }
+        }
+    }
+}
+
+TEST_CASE("BC7 decodes the three subset modes")
+{
+    // the anchor pixels of each subset belong to that subset
+    for(uint32_t p = 0; p < 64; p++)
+    {
+        REQUIRE( gul::detail::bc7_subset(3, p, 0) == 0 );
+        REQUIRE( gul::detail::bc7_subset(3, p, gul::detail::bc7_anchor3(p, 1)) == 1 );
+        REQUIRE( gul::detail::bc7_subset(3, p, gul::detail::bc7_anchor3(p, 2)) == 2 );
+    }
+
+    // mode 0 and mode 2 blocks and their pixels, as decoded by an
+    // independent BC7 decoder
+    struct Vector
+    {
+        uint8_t block[16];
+        uint8_t px[64];
+    };
+    const Vector vectors[] =
+    {
+        { {0x73, 0xDD, 0x8F, 0xDB, 0xEC, 0xC7, 0x77, 0x73, 0x82, 0xDA, 0x96, 0x30, 0x2F, 0xCD, 0x83, 0x79},
+          {197, 101, 174, 255, 215, 104, 167, 255, 181,  99, 181, 255, 231, 106, 160, 255,
+           167, 136,  33, 255, 115,  49,  16, 255, 204, 197,  45, 255, 204, 197,  45, 255,
+           187, 168,  40, 255, 167, 136,  33, 255, 115,  49,  16, 255, 239, 255,  57, 255,
+           215, 210, 160, 255, 208, 232,  95, 255, 222, 189, 222, 255, 208, 232,  95, 255} },
+        { {0xA1, 0x9D, 0xCB, 0x2F, 0x18, 0x72, 0x4D, 0x24, 0x17, 0x89, 0xCF, 0xE3, 0xB1, 0xA2, 0x0A, 0x98},
+          {216,  42,  33, 255, 229, 172,  33, 255, 157,  70, 170, 255, 206,   8, 156, 255,
+           231, 198,  33, 255, 216,  42,  33, 255, 106, 135, 184, 255, 173,  50, 165, 255,
+           216,  42,  33, 255, 206, 166, 121, 255, 156, 130,  93, 255, 173,  50, 165, 255,
+           239, 189, 140, 255, 239, 189, 140, 255, 190, 154, 112, 255, 206, 166, 121, 255} },
+        { {0xFC, 0x65, 0xF6, 0x73, 0xA7, 0xBD, 0x9D, 0xA6, 0x28, 0x9F, 0x03, 0xD4, 0x87, 0x10, 0x0F, 0x09},
+          {148, 222, 206, 255, 247, 115,  57, 255, 186, 182,  19, 255, 247, 115,  57, 255,
+           222, 165,  82, 255, 187, 222, 106, 255, 247, 115,  57, 255, 186, 182,  19, 255,
+           173, 133, 139, 255,  74,  66, 255, 255, 148, 222, 206, 255, 247, 115,  57, 255,
+           173, 133, 139, 255, 123,  98, 198, 255, 222, 165,  82, 255, 148, 222, 206, 255} },
+        { {0x34, 0xE1, 0x3D, 0x99, 0x07, 0xC7, 0x76, 0x53, 0x70, 0x97, 0xD7, 0x32, 0x84, 0x3B, 0xA3, 0x4B},
+          {132, 115, 222, 255,  57, 222, 123, 255,  81, 116, 156, 255, 189,  99,  41, 255,
+            81, 116, 156, 255, 189,  99,  41, 255,  57, 222, 123, 255,   8, 132, 132, 255,
+            57, 222, 123, 255, 231,  82, 206, 255, 170, 104, 100, 255, 157, 145, 112, 255,
+           189,  99,  41, 255, 157, 145, 112, 255, 231,  82, 206, 255, 151, 110, 163, 255} }
+    };
+    for(auto & V : vectors)
+    {
+        uint8_t px[16][4];
+        gul::detail::bc7_decode(V.block, px);
+        REQUIRE( std::memcmp(px, V.px, 64) == 0 );
+    }
+
+    // the reserved mode still decodes to transparent black
+    uint8_t reserved[16] = {};
+    uint8_t px[16][4];
+    gul::detail::bc7_decode(reserved, px);
+    for(int i = 0; i < 16; i++)
+        REQUIRE( (px[i][0] | px[i][1] | px[i][2] | px[i][3]) == 0 );
+}
+
+TEST_CASE("Block compression benchmarks", "[.benchmark]")
+{
+    gul::Image I(512, 512, 4);
+    fillSmooth(I);
+    gul::thread_pool pool(4);
+
+    BENCHMARK("BC1 512x512")
+    {
+        return gul::compressBC(I, gul::BCFormat::BC1);
+    };
+    BENCHMARK("BC3 512x512")
+    {
+        return gul::compressBC(I, gul::BCFormat::BC3);
+    };
+    BENCHMARK("BC7 q1 512x512")
+    {
+        return gul::compressBC(I, gul::BCFormat::BC7);
+    };
+    BENCHMARK("BC7 q1 512x512 4 threads")
+    {
+        return gul::compressBC(pool, I, gul::BCFormat::BC7);
+    };
+}
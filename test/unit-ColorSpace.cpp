@@ -0,0 +1,402 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/ColorSpace.h>
+#include "test-helpers.h"
+
+#include <cmath>
+#include <random>
+
+// the textbook conversion in doubles
+static void refYCbCr(double R, double G, double B, gul::YCbCrFormat f, double & Y, double & Cb, double & Cr)
+{
+    const double Kr = f.matrix == gul::YCbCrMatrix::BT601 ? 0.299 : 0.2126;
+    const double Kb = f.matrix == gul::YCbCrMatrix::BT601 ? 0.114 : 0.0722;
+    const double y  = Kr*R + (1.0-Kr-Kb)*G + Kb*B;
+    const double pb = (B - y) / (2.0*(1.0-Kb));
+    const double pr = (R - y) / (2.0*(1.0-Kr));
+    if( f.fullRange )
+    {
+        Y = y; Cb = 128.0 + pb; Cr = 128.0 + pr;
+    }
+    else
+    {
+        Y = 16.0 + y*219.0/255.0; Cb = 128.0 + pb*224.0/255.0; Cr = 128.0 + pr*224.0/255.0;
+    }
+}
+
+static void refHSV(double r, double g, double b, double & H, double & S, double & V)
+{
+    const double mx = std::max({r,g,b}), mn = std::min({r,g,b}), d = mx - mn;
+    V = mx;
+    S = mx == 0 ? 0 : 255.0 * d / mx;
+    double h = 0;
+    if( d > 0 )
+    {
+        if( mx == r )      h = (g - b) / d;
+        else if( mx == g ) h = 2.0 + (b - r) / d;
+        else               h = 4.0 + (r - g) / d;
+    }
+    H = std::fmod(h * 256.0 / 6.0 + 256.0, 256.0);
+}
+
+static int hueDistance(int a, int b)
+{
+    const int d = std::abs(a - b);
+    return std::min(d, 256 - d);
+}
+
+static int maxDifference(gul::Image const & a, gul::Image const & b, uint32_t channels = 3)
+{
+    int d = 0;
+    for(uint32_t y = 0; y < a.getHeight(); y++)
+        for(uint32_t x = 0; x < a.getWidth(); x++)
+            for(uint32_t c = 0; c < channels; c++)
+                d = std::max(d, std::abs( int(a(x,y,c)) - int(b(x,y,c)) ));
+    return d;
+}
+
+TEST_CASE("The color matrix kernel matches the scalar version")
+{
+    std::mt19937 gen(5);
+    const auto M = gul::detail::ycbcr_to_rgb_matrix({});
+    for(size_t n : {size_t(1), size_t(15), size_t(16), size_t(47), size_t(100)})
+    {
+        std::vector<uint8_t> a(n), b(n), c(n), out(n);
+        for(size_t i = 0; i < n; i++)
+        {
+            a[i] = uint8_t(gen()); b[i] = uint8_t(gen()); c[i] = uint8_t(gen());
+        }
+        for(int k = 0; k < 3; k++)
+        {
+            gul::detail::color_matrix_row(a.data(), b.data(), c.data(), M.m[k], M.k[k], out.data(), n);
+            for(size_t i = 0; i < n; i++)
+                REQUIRE( out[i] == gul::detail::color_matrix_scalar(a[i], b[i], c[i], M.m[k], M.k[k]) );
+        }
+    }
+}
+
+SCENARIO("RGB <-> YCbCr")
+{
+    gul::thread_pool pool(3);
+    const gul::YCbCrFormat formats[4] = { {gul::YCbCrMatrix::BT601, false}, {gul::YCbCrMatrix::BT601, true},
+                                          {gul::YCbCrMatrix::BT709, false}, {gul::YCbCrMatrix::BT709, true} };
+
+    GIVEN("Random RGB and RGBA images")
+    {
+        for(uint32_t ch = 3; ch <= 4; ch++)
+        for(auto f : formats)
+        {
+            auto I = makeNoise(301, 37, ch, ch);
+
+            THEN("4:4:4 agrees with the exact conversion and round trips")
+            {
+                auto Y = gul::rgbToYCbCr(I, f);
+                REQUIRE( Y.isPlanar() );
+                REQUIRE( Y.getChannels() == 3 );
+                for(uint32_t y = 0; y < I.getHeight(); y++)
+                    for(uint32_t x = 0; x < I.getWidth(); x++)
+                    {
+                        double ry, rb, rr;
+                        refYCbCr(I(x,y,0), I(x,y,1), I(x,y,2), f, ry, rb, rr);
+                        REQUIRE( std::abs(Y(x,y,0) - ry) <= 1.0 );
+                        REQUIRE( std::abs(Y(x,y,1) - rb) <= 1.0 );
+                        REQUIRE( std::abs(Y(x,y,2) - rr) <= 1.0 );
+                    }
+
+                auto R = gul::yCbCrToRGB(Y, ch, f);
+                REQUIRE( R.getChannels() == ch );
+                REQUIRE( maxDifference(R, I) <= (f.fullRange ? 2 : 3) );
+                if( ch == 4 )
+                    REQUIRE( R(5,5,3) == 255 );
+
+                // interleaved input and the pool give the same result
+                auto Yi = Y;
+                Yi.setPlanar(false);
+                REQUIRE( maxDifference(gul::yCbCrToRGB(pool, Yi, ch, f), R, ch) == 0 );
+                REQUIRE( maxDifference(gul::rgbToYCbCr(pool, I, f), Y) == 0 );
+            }
+
+            THEN("4:2:0 and NV12 have the same luma and averaged chroma")
+            {
+                auto F = gul::rgbToYCbCr(I, f);
+                auto P = gul::rgbToYCbCr420(I, f);
+                auto N = gul::rgbToNV12(pool, I, f);
+                REQUIRE( P.cb.getWidth() == 151 );
+                REQUIRE( P.cb.getHeight() == 19 );
+                REQUIRE( N.uv.getChannels() == 2 );
+                for(uint32_t y = 0; y < I.getHeight(); y++)
+                    for(uint32_t x = 0; x < I.getWidth(); x++)
+                    {
+                        REQUIRE( P.y(x,y,0) == F(x,y,0) );
+                        REQUIRE( N.y(x,y,0) == F(x,y,0) );
+                    }
+                for(uint32_t y = 0; y < P.cb.getHeight(); y++)
+                    for(uint32_t x = 0; x < P.cb.getWidth(); x++)
+                    {
+                        REQUIRE( N.uv(x,y,0) == P.cb(x,y,0) );
+                        REQUIRE( N.uv(x,y,1) == P.cr(x,y,0) );
+                        double avg[3] = {0,0,0};
+                        for(uint32_t k = 0; k < 4; k++)
+                        {
+                            const uint32_t px = std::min(2*x + (k & 1), I.getWidth() - 1);
+                            const uint32_t py = std::min(2*y + (k >> 1), I.getHeight() - 1);
+                            for(uint32_t c = 0; c < 3; c++)
+                                avg[c] += I(px,py,c) / 4.0;
+                        }
+                        double ry, rb, rr;
+                        refYCbCr(avg[0], avg[1], avg[2], f, ry, rb, rr);
+                        REQUIRE( std::abs(P.cb(x,y,0) - rb) <= 1.5 );
+                        REQUIRE( std::abs(P.cr(x,y,0) - rr) <= 1.5 );
+                    }
+
+                auto A = gul::yCbCr420ToRGB(P, ch, f);
+                auto B = gul::nv12ToRGB(pool, N, ch, f);
+                REQUIRE( maxDifference(A, B, ch) == 0 );
+
+                // the chroma of each block is used for all four pixels
+                gul::Image C(I.getWidth(), I.getHeight(), 3);
+                C.r = P.y.r;
+                for(uint32_t y = 0; y < I.getHeight(); y++)
+                    for(uint32_t x = 0; x < I.getWidth(); x++)
+                    {
+                        C(x,y,1) = P.cb(x/2,y/2,0);
+                        C(x,y,2) = P.cr(x/2,y/2,0);
+                    }
+                REQUIRE( maxDifference(A, gul::yCbCrToRGB(C, ch, f)) == 0 );
+            }
+        }
+    }
+
+    GIVEN("Black, white and grey")
+    {
+        gul::Image I(3, 1, 3);
+        I(0,0,0) = I(0,0,1) = I(0,0,2) = 0;
+        I(1,0,0) = I(1,0,1) = I(1,0,2) = 255;
+        I(2,0,0) = I(2,0,1) = I(2,0,2) = 100;
+
+        THEN("They map to the ends of the range with no colour")
+        {
+            auto L = gul::rgbToYCbCr(I);
+            REQUIRE( L(0,0,0) == 16 );
+            REQUIRE( L(1,0,0) == 235 );
+            auto F = gul::rgbToYCbCr(I, {gul::YCbCrMatrix::BT709, true});
+            REQUIRE( F(0,0,0) == 0 );
+            REQUIRE( F(1,0,0) == 255 );
+            REQUIRE( F(2,0,0) == 100 );
+            for(uint32_t x = 0; x < 3; x++)
+            {
+                REQUIRE( L(x,0,1) == 128 );
+                REQUIRE( L(x,0,2) == 128 );
+                REQUIRE( F(x,0,1) == 128 );
+                REQUIRE( F(x,0,2) == 128 );
+            }
+            REQUIRE( maxDifference(gul::yCbCrToRGB(F, 3, {gul::YCbCrMatrix::BT709, true}), I) == 0 );
+        }
+    }
+
+    GIVEN("An NV12 frame in a single buffer with padded rows")
+    {
+        const uint32_t w = 70, h = 41, pitch = 80;
+        const uint32_t cw = (w+1)/2, chh = (h+1)/2;
+        std::vector<uint8_t> buf( size_t(pitch) * (h + chh), 0 );
+        auto I = makeNoise(w, h, 3, 77);
+        auto N = gul::rgbToNV12(I);
+        for(uint32_t y = 0; y < h; y++)
+            memcpy(buf.data() + y*pitch, static_cast<uint8_t*>(N.y.data()) + y*w, w);
+        for(uint32_t y = 0; y < chh; y++)
+            memcpy(buf.data() + (h + y)*pitch, static_cast<uint8_t*>(N.uv.data()) + y*cw*2, cw*2);
+
+        THEN("Views of the buffer convert the same as the images")
+        {
+            gul::ConstImageView Y(buf.data(), w, h, 1, pitch);
+            gul::ConstImageView UV(buf.data() + size_t(pitch)*h, cw, chh, 2, pitch);
+            REQUIRE( maxDifference(gul::nv12ToRGB(Y, UV, 3), gul::nv12ToRGB(N, 3)) == 0 );
+        }
+    }
+
+    GIVEN("Images of the wrong shape")
+    {
+        gul::Image G(8, 8, 1), Y(8, 8, 1), C(3, 4, 1);
+        THEN("The conversions throw")
+        {
+            REQUIRE_THROWS_AS( gul::rgbToYCbCr(G), std::logic_error );
+            REQUIRE_THROWS_AS( gul::yCbCrToRGB(G), std::logic_error );
+            REQUIRE_THROWS_AS( gul::yCbCr420ToRGB(Y, C, C), std::logic_error );
+            REQUIRE_THROWS_AS( gul::yCbCrToRGB(gul::Image(8, 8, 3), 2), std::logic_error );
+        }
+    }
+}
+
+SCENARIO("RGB <-> HSV")
+{
+    GIVEN("The primary colours")
+    {
+        gul::Image I(4, 1, 3);
+        I.r = uint8_t(0); I.g = uint8_t(0); I.b = uint8_t(0);
+        I(0,0,0) = 255;
+        I(1,0,1) = 255;
+        I(2,0,2) = 255;
+
+        THEN("Red, green and blue are a third of the hue circle apart")
+        {
+            auto H = gul::rgbToHSV(I);
+            REQUIRE( H(0,0,0) == 0 );
+            REQUIRE( H(1,0,0) == 85 );
+            REQUIRE( H(2,0,0) == 171 );
+            REQUIRE( H(3,0,1) == 0 );
+            REQUIRE( H(3,0,2) == 0 );
+            for(uint32_t x = 0; x < 3; x++)
+            {
+                REQUIRE( H(x,0,1) == 255 );
+                REQUIRE( H(x,0,2) == 255 );
+            }
+            // blue is at 170.67, so it does not quite round trip
+            REQUIRE( maxDifference(gul::hsvToRGB(H), I) <= 2 );
+            REQUIRE( gul::hsvToRGB(H)(0,0,0) == 255 );
+            REQUIRE( gul::hsvToRGB(H)(1,0,1) == 255 );
+        }
+    }
+
+    GIVEN("Random RGB and RGBA images")
+    {
+        gul::thread_pool pool(3);
+        for(uint32_t ch = 3; ch <= 4; ch++)
+        {
+            auto I = makeNoise(263, 29, ch, 10 + ch);
+
+            THEN("The HSV values agree with the exact conversion and round trip")
+            {
+                auto H = gul::rgbToHSV(I);
+                REQUIRE( H.getChannels() == ch );
+                for(uint32_t y = 0; y < I.getHeight(); y++)
+                    for(uint32_t x = 0; x < I.getWidth(); x++)
+                    {
+                        double rh, rs, rv;
+                        refHSV(I(x,y,0), I(x,y,1), I(x,y,2), rh, rs, rv);
+                        REQUIRE( hueDistance(H(x,y,0), int(std::lround(rh)) & 255) <= 1 );
+                        REQUIRE( std::abs(H(x,y,1) - rs) <= 1.0 );
+                        REQUIRE( H(x,y,2) == rv );
+                        if( ch == 4 )
+                            REQUIRE( H(x,y,3) == I(x,y,3) );
+                    }
+                auto R = gul::hsvToRGB(H);
+                REQUIRE( maxDifference(R, I, ch) <= 4 );
+                REQUIRE( maxDifference(gul::rgbToHSV(pool, I), H, ch) == 0 );
+                REQUIRE( maxDifference(gul::hsvToRGB(pool, H), R, ch) == 0 );
+            }
+
+            THEN("The SIMD kernels match the scalar conversions")
+            {
+                auto H = gul::rgbToHSV(I);
+                auto R = gul::hsvToRGB(H);
+                for(uint32_t y = 0; y < I.getHeight(); y++)
+                    for(uint32_t x = 0; x < I.getWidth(); x++)
+                    {
+                        uint8_t h, s, v, r, g, b;
+                        gul::detail::rgb_to_hsv_scalar(I(x,y,0), I(x,y,1), I(x,y,2), h, s, v);
+                        REQUIRE( hueDistance(H(x,y,0), h) <= 1 );
+                        REQUIRE( std::abs(H(x,y,1) - s) <= 1 );
+                        REQUIRE( H(x,y,2) == v );
+                        gul::detail::hsv_to_rgb_scalar(H(x,y,0), H(x,y,1), H(x,y,2), r, g, b);
+                        REQUIRE( std::abs(R(x,y,0) - r) <= 1 );
+                        REQUIRE( std::abs(R(x,y,1) - g) <= 1 );
+                        REQUIRE( std::abs(R(x,y,2) - b) <= 1 );
+                    }
+            }
+        }
+    }
+}
+
+SCENARIO("sRGB <-> linear")
+{
+    GIVEN("Random images of every channel count")
+    {
+        gul::thread_pool pool(3);
+        for(uint32_t ch = 1; ch <= 4; ch++)
+        {
+            auto I = makeNoise(133, 17, ch, 20 + ch);
+            const uint32_t alpha = ch == 4 ? 3 : ch == 2 ? 1 : ch;
+
+            THEN("The colour channels are decoded and alpha is normalized")
+            {
+                auto L = gul::srgbToLinear(I);
+                REQUIRE( L.getChannels() == ch );
+                for(uint32_t y = 0; y < I.getHeight(); y++)
+                    for(uint32_t x = 0; x < I.getWidth(); x++)
+                        for(uint32_t c = 0; c < ch; c++)
+                        {
+                            const double v = I(x,y,c) / 255.0;
+                            const double e = c == alpha ? v : (v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+                            REQUIRE( L.data()[ (size_t(y)*I.getWidth() + x)*ch + c ] == Approx(e).margin(1e-6) );
+                        }
+            }
+
+            THEN("Encoding the linear values gives back the same image")
+            {
+                auto L = gul::srgbToLinear(pool, I);
+                REQUIRE( maxDifference(gul::linearToSRGB(L), I, ch) == 0 );
+                REQUIRE( maxDifference(gul::linearToSRGB(pool, L), I, ch) == 0 );
+            }
+        }
+    }
+}
+
+TEST_CASE("Color space benchmarks", "[.benchmark]")
+{
+    auto I = makeNoise(3840, 2160, 4, 1);
+    auto N = gul::rgbToNV12(I);
+    auto Y = gul::rgbToYCbCr(I);
+    gul::thread_pool pool(4);
+
+    BENCHMARK("4k NV12 -> RGBA, per pixel")
+    {
+        gul::Image O(3840, 2160, 4);
+        const double Kr = 0.2126, Kb = 0.0722, Kg = 1.0 - Kr - Kb;
+        for(uint32_t y = 0; y < 2160; y++)
+            for(uint32_t x = 0; x < 3840; x++)
+            {
+                const double l  = (N.y.r(x,y) - 16.0) * 255.0 / 219.0;
+                const double pb = (N.uv.r(x/2,y/2) - 128.0) * 255.0 / 224.0;
+                const double pr = (N.uv.g(x/2,y/2) - 128.0) * 255.0 / 224.0;
+                O.r(x,y) = uint8_t( std::min(255.0, std::max(0.0, l + 2*(1-Kr)*pr)) );
+                O.g(x,y) = uint8_t( std::min(255.0, std::max(0.0, l - 2*Kb*(1-Kb)/Kg*pb - 2*Kr*(1-Kr)/Kg*pr)) );
+                O.b(x,y) = uint8_t( std::min(255.0, std::max(0.0, l + 2*(1-Kb)*pb)) );
+                O.a(x,y) = 255;
+            }
+        return O(1,1,0);
+    };
+    BENCHMARK("4k NV12 -> RGBA")
+    {
+        return gul::nv12ToRGB(N)(1,1,0);
+    };
+    BENCHMARK("4k NV12 -> RGBA, 4 threads")
+    {
+        return gul::nv12ToRGB(pool, N)(1,1,0);
+    };
+    BENCHMARK("4k RGBA -> NV12, 4 threads")
+    {
+        return gul::rgbToNV12(pool, I).y(1,1,0);
+    };
+    BENCHMARK("4k YCbCr 4:4:4 -> RGBA, 4 threads")
+    {
+        return gul::yCbCrToRGB(pool, Y)(1,1,0);
+    };
+    BENCHMARK("4k RGBA -> HSV, 4 threads")
+    {
+        return gul::rgbToHSV(pool, I)(1,1,0);
+    };
+    BENCHMARK("4k HSV -> RGBA, 4 threads")
+    {
+        return gul::hsvToRGB(pool, I)(1,1,0);
+    };
+    BENCHMARK("4k sRGB -> linear, 4 threads")
+    {
+        return gul::srgbToLinear(pool, I).data()[0];
+    };
+    auto L = gul::srgbToLinear(I);
+    BENCHMARK("4k linear -> sRGB, 4 threads")
+    {
+        return gul::linearToSRGB(pool, L)(1,1,0);
+    };
+}
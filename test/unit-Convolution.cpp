@@ -0,0 +1,255 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/Convolution.h>
+#include "test-helpers.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// direct 2D evaluation of a separable convolution
+static gul::channel1f reference(gul::channel1f const & C, gul::Kernel1D const & kx, gul::Kernel1D const & ky, gul::EdgeMode edge)
+{
+    const uint32_t w = C.getWidth(), h = C.getHeight();
+    gul::channel1f out(w, h);
+    for(uint32_t y = 0; y < h; y++)
+    {
+        for(uint32_t x = 0; x < w; x++)
+        {
+            double sum = 0.0;
+            for(uint32_t j = 0; j < ky.size(); j++)
+            {
+                const uint32_t sy = gul::detail::edge_index( int64_t(y) + j - ky.center, h, edge);
+                for(uint32_t i = 0; i < kx.size(); i++)
+                {
+                    const uint32_t sx = gul::detail::edge_index( int64_t(x) + i - kx.center, w, edge);
+                    sum += double(kx.weights[i]) * double(ky.weights[j]) * double(C(sx, sy));
+                }
+            }
+            out(x,y) = static_cast<float>(sum);
+        }
+    }
+    return out;
+}
+
+static float maxDifference(gul::channel1f const & A, gul::channel1f const & B)
+{
+    float d = 0.0f;
+    for(size_t i = 0; i < A.data.size(); i++)
+        d = std::max(d, std::abs(A.data[i] - B.data[i]));
+    return d;
+}
+
+SCENARIO("Edge modes")
+{
+    using gul::detail::edge_index;
+    REQUIRE( edge_index(-2, 4, gul::EdgeMode::Clamp)  == 0 );
+    REQUIRE( edge_index( 5, 4, gul::EdgeMode::Clamp)  == 3 );
+    REQUIRE( edge_index(-1, 4, gul::EdgeMode::Wrap)   == 3 );
+    REQUIRE( edge_index( 9, 4, gul::EdgeMode::Wrap)   == 1 );
+    REQUIRE( edge_index(-1, 4, gul::EdgeMode::Mirror) == 1 );
+    REQUIRE( edge_index(-3, 4, gul::EdgeMode::Mirror) == 3 );
+    REQUIRE( edge_index( 4, 4, gul::EdgeMode::Mirror) == 2 );
+    REQUIRE( edge_index( 9, 4, gul::EdgeMode::Mirror) == 3 );
+    REQUIRE( edge_index( 7, 1, gul::EdgeMode::Mirror) == 0 );
+}
+
+SCENARIO("Separable convolution")
+{
+    gul::channel1f C(37, 23);
+    fillRandom(C, 1);
+
+    for(auto edge : {gul::EdgeMode::Clamp, gul::EdgeMode::Wrap, gul::EdgeMode::Mirror})
+    {
+        WHEN("We convolve with asymmetric kernels")
+        {
+            gul::Kernel1D kx;
+            kx.weights = {0.1f, -0.25f, 0.5f, 0.3f, 0.2f, 0.15f};
+            kx.center  = 1;
+            auto ky = gul::Kernel1D::gaussian(2.5f);
+
+            auto out = gul::convolve(C, kx, ky, edge);
+            THEN("The result matches a direct 2D evaluation")
+            {
+                REQUIRE( maxDifference(out, reference(C, kx, ky, edge)) < 1e-5f );
+            }
+        }
+
+        WHEN("We box blur with radii up to larger than the image")
+        {
+            for(uint32_t r : {0u, 1u, 4u, 30u})
+            {
+                auto out = gul::boxBlur(C, r, edge);
+                auto K   = gul::Kernel1D::box(r);
+                REQUIRE( maxDifference(out, reference(C, K, K, edge)) < 1e-5f );
+            }
+        }
+    }
+
+    WHEN("We use an identity kernel")
+    {
+        auto out = gul::convolve(C, gul::Kernel1D(), gul::Kernel1D());
+        REQUIRE( out.data == C.data );
+    }
+
+    WHEN("We approximate a large gaussian with box filters")
+    {
+        gul::channel1f S(128, 96);
+        for(uint32_t y = 0; y < 96; y++)
+            for(uint32_t x = 0; x < 128; x++)
+                S(x,y) = (x / 16 + y / 16) % 2 ? 1.0f : 0.0f;
+
+        auto exact  = gul::gaussianBlur(S, 8.0f, gul::EdgeMode::Wrap, gul::BlurMethod::Exact);
+        auto approx = gul::gaussianBlur(S, 8.0f, gul::EdgeMode::Wrap, gul::BlurMethod::Box);
+        THEN("The difference is small")
+        {
+            REQUIRE( maxDifference(exact, approx) < 0.03f );
+        }
+    }
+
+    WHEN("We filter on a thread pool")
+    {
+        gul::thread_pool pool(3);
+        gul::channel1f L(301, 257);
+        fillRandom(L, 2);
+        auto K = gul::Kernel1D::gaussian(1.5f);
+        THEN("The results are identical to the serial version")
+        {
+            REQUIRE( gul::convolve(pool, L, K, K).data == gul::convolve(L, K, K).data );
+            REQUIRE( gul::boxBlur(pool, L, 9).data == gul::boxBlur(L, 9).data );
+            REQUIRE( gul::gaussianBlur(pool, L, 10.0f).data == gul::gaussianBlur(L, 10.0f).data );
+        }
+    }
+}
+
+SCENARIO("Invalid kernels")
+{
+    gul::channel1f C(8, 8);
+    gul::Image     I(8, 8, 3);
+    gul::Kernel1D  good;
+
+    GIVEN("A kernel without weights")
+    {
+        gul::Kernel1D K;
+        K.weights.clear();
+        THEN("Convolving throws")
+        {
+            REQUIRE_THROWS_AS( K.validate(), std::invalid_argument );
+            REQUIRE_THROWS_AS( gul::convolve(C, K, good), std::invalid_argument );
+            REQUIRE_THROWS_AS( gul::convolve(I, good, K), std::invalid_argument );
+        }
+    }
+    GIVEN("A kernel whose center is past the last weight")
+    {
+        gul::Kernel1D K;
+        K.weights = {0.25f, 0.5f, 0.25f};
+        K.center  = 3;
+        THEN("Convolving throws")
+        {
+            REQUIRE_THROWS_AS( gul::convolve(C, good, K), std::invalid_argument );
+            REQUIRE_THROWS_AS( gul::convolve(I, K, good), std::invalid_argument );
+            K.center = 2;
+            REQUIRE_NOTHROW( gul::convolve(I, K, good) );
+        }
+    }
+}
+
+SCENARIO("Filtering images")
+{
+    GIVEN("A constant image")
+    {
+        gul::Image I(33, 17, 3);
+        I.r = uint8_t(10);
+        I.g = uint8_t(128);
+        I.b = uint8_t(250);
+
+        THEN("Blurring and sharpening does not change it")
+        {
+            for(auto & J : {gul::gaussianBlur(I, 2.0f), gul::gaussianBlur(I, 20.0f), gul::boxBlur(I, 5), gul::unsharpMask(I, 1.0f, 1.5f)})
+            {
+                REQUIRE( std::memcmp(J.data(), I.data(), I.size()) == 0 );
+            }
+        }
+    }
+
+    GIVEN("A random image")
+    {
+        gul::Image I(64, 40, 4);
+        fillRandom(I, 3);
+
+        THEN("Each channel is filtered like a channel1f")
+        {
+            auto K = gul::Kernel1D::gaussian(1.0f);
+            auto out = gul::convolve(I, K, K, gul::EdgeMode::Mirror);
+            for(uint32_t c = 0; c < 4; c++)
+            {
+                gul::channel1f C(64, 40);
+                for(uint32_t y = 0; y < 40; y++)
+                    for(uint32_t x = 0; x < 64; x++)
+                        C(x,y) = float(I(x,y,c)) / 255.0f;
+                auto R = gul::convolve(C, K, K, gul::EdgeMode::Mirror);
+                for(uint32_t y = 0; y < 40; y++)
+                    for(uint32_t x = 0; x < 64; x++)
+                        REQUIRE( std::abs( float(out(x,y,c)) - R(x,y)*255.0f ) <= 0.51f );
+            }
+        }
+
+        THEN("The pooled version is identical")
+        {
+            gul::thread_pool pool(2);
+            auto A = gul::gaussianBlur(I, 3.0f);
+            auto B = gul::gaussianBlur(pool, I, 3.0f);
+            REQUIRE( std::memcmp(A.data(), B.data(), A.size()) == 0 );
+        }
+
+        THEN("A planar image gives the same pixels in the planar layout")
+        {
+            auto P = I;
+            P.setPlanar(true);
+            auto K = gul::Kernel1D::gaussian(1.5f);
+            for(auto pair : { std::make_pair(gul::boxBlur(P, 5), gul::boxBlur(I, 5)),
+                              std::make_pair(gul::convolve(P, K, K), gul::convolve(I, K, K)),
+                              std::make_pair(gul::unsharpMask(P, 1.0f, 1.5f), gul::unsharpMask(I, 1.0f, 1.5f)) })
+            {
+                REQUIRE( pair.first.isPlanar() );
+                pair.first.setPlanar(false);
+                REQUIRE( std::memcmp(pair.first.data(), pair.second.data(), I.size()) == 0 );
+            }
+        }
+
+        THEN("Blurring reduces the variance")
+        {
+            auto B = gul::boxBlur(I, 2);
+            double vi = 0.0, vb = 0.0;
+            for(size_t i = 0; i < I.size(); i++)
+            {
+                vi += std::pow(double(static_cast<uint8_t const*>(I.data())[i]) - 127.5, 2.0);
+                vb += std::pow(double(static_cast<uint8_t const*>(B.data())[i]) - 127.5, 2.0);
+            }
+            REQUIRE( vb < vi / 10.0 );
+        }
+    }
+}
+
+TEST_CASE("Convolution benchmarks", "[.benchmark]")
+{
+    gul::Image I(1024, 1024, 4);
+    fillRandom(I, 1);
+    gul::channel1f C(2048, 2048);
+    fillRandom(C, 2);
+    auto K = gul::Kernel1D::gaussian(2.0f);
+
+    BENCHMARK("channel1f 2048x2048 gaussian sigma=2")
+    {
+        return gul::convolve(C, K, K);
+    };
+    BENCHMARK("channel1f 2048x2048 gaussian sigma=20 (box)")
+    {
+        return gul::gaussianBlur(C, 20.0f);
+    };
+    BENCHMARK("Image 1024x1024x4 gaussian sigma=2")
+    {
+        return gul::gaussianBlur(I, 2.0f);
+    };
+}
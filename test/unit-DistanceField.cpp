@@ -0,0 +1,154 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/DistanceField.h>
+
+#include <cmath>
+#include <random>
+
+// distance from every pixel to the closest pixel on the other side of the
+// edge, minus the half pixel to the edge itself
+static gul::channel1f bruteForce(gul::Image const & M, uint8_t threshold)
+{
+    const uint32_t w = M.getWidth(), h = M.getHeight();
+    gul::channel1f D(w, h);
+    for(uint32_t y = 0; y < h; y++)
+    {
+        for(uint32_t x = 0; x < w; x++)
+        {
+            const bool in = M(x,y,0) >= threshold;
+            double best = std::numeric_limits<double>::infinity();
+            for(uint32_t j = 0; j < h; j++)
+                for(uint32_t i = 0; i < w; i++)
+                    if( (M(i,j,0) >= threshold) != in )
+                        best = std::min(best, std::hypot(double(i) - double(x), double(j) - double(y)));
+            const float d = static_cast<float>(best - 0.5);
+            D(x,y) = in ? -d : d;
+        }
+    }
+    return D;
+}
+
+static void fillDisc(gul::Image & M, float cx, float cy, float r)
+{
+    for(uint32_t y = 0; y < M.getHeight(); y++)
+        for(uint32_t x = 0; x < M.getWidth(); x++)
+            if( std::hypot(float(x) - cx, float(y) - cy) <= r )
+                M(x,y,0) = 255;
+}
+
+SCENARIO("Signed distance fields")
+{
+    GIVEN("Random masks")
+    {
+        std::mt19937 gen(1);
+        for(uint32_t t = 0; t < 8; t++)
+        {
+            gul::Image M(23 + t, 17 + 2*t, 1);
+            M.r = uint8_t(0);
+            for(uint32_t b = 0; b < 6; b++)
+            {
+                fillDisc(M, float(gen() % M.getWidth()), float(gen() % M.getHeight()), float(gen() % 6));
+            }
+            for(uint32_t n = 0; n < 10; n++)
+                M(static_cast<uint32_t>(gen() % M.getWidth()), static_cast<uint32_t>(gen() % M.getHeight()), 0) = 200;
+
+            THEN("The distances are the exact Euclidean distances")
+            {
+                auto D = gul::signedDistanceField(M.r);
+                auto R = bruteForce(M, 128);
+                for(size_t i = 0; i < D.data.size(); i++)
+                {
+                    REQUIRE( D.data[i] == Approx(R.data[i]).margin(1e-4) );
+                }
+            }
+
+            THEN("The pooled version is identical")
+            {
+                gul::thread_pool pool(3);
+                REQUIRE( gul::signedDistanceField(pool, M.r).data == gul::signedDistanceField(M.r).data );
+            }
+
+            THEN("A mask in the alpha channel of a planar image gives the same field")
+            {
+                gul::Image A(M.getWidth(), M.getHeight(), 4);
+                A.r = uint8_t(255);
+                A.a = M.r;
+                A.setPlanar(true);
+                REQUIRE( gul::signedDistanceField(A.a).data == gul::signedDistanceField(M.r).data );
+                REQUIRE( gul::signedDistanceImage(A, {128, 2, 3.0f}).hash() == gul::signedDistanceImage(M, {128, 2, 3.0f}).hash() );
+            }
+        }
+    }
+
+    GIVEN("A mask with no edge")
+    {
+        gul::Image M(8, 8, 1);
+        M.r = uint8_t(0);
+        THEN("The distances are infinite")
+        {
+            auto D = gul::signedDistanceField(M.r);
+            REQUIRE( std::isinf(D(3,3)) );
+            REQUIRE( D(3,3) > 0.0f );
+            M.r = uint8_t(255);
+            REQUIRE( gul::signedDistanceField(M.r)(0,0) < 0.0f );
+        }
+    }
+
+    GIVEN("A large disc")
+    {
+        gul::Image M(256, 256, 1);
+        M.r = uint8_t(0);
+        fillDisc(M, 127.5f, 127.5f, 80.0f);
+
+        THEN("The distance grows linearly from the edge")
+        {
+            auto D = gul::signedDistanceField(M.r);
+            REQUIRE( D(127, 127) == Approx(std::hypot(0.5f, 0.5f) - 80.0f).margin(1.0f) );
+            REQUIRE( D(0, 127)   == Approx(47.0f).margin(1.0f) );
+            REQUIRE( D(0, 0)     == Approx(std::hypot(127.5f, 127.5f) - 80.0f).margin(1.0f) );
+        }
+
+        THEN("The downsampled image encodes the distance around 128")
+        {
+            auto I = gul::signedDistanceImage(M, {128, 8, 4.0f});
+            REQUIRE( I.getWidth() == 32 );
+            REQUIRE( I.getChannels() == 1 );
+            REQUIRE( I(16, 16, 0) == 255 );
+            REQUIRE( I(0, 0, 0) == 0 );
+            // the edge is 10 output pixels from the centre
+            REQUIRE( std::abs(int(I(16, 6, 0)) - 128) < 20 );
+            REQUIRE( I(16, 8, 0) > I(16, 6, 0) );
+            REQUIRE( I(16, 4, 0) < I(16, 6, 0) );
+
+            gul::thread_pool pool(2);
+            auto J = gul::signedDistanceImage(pool, M, {128, 8, 4.0f});
+            REQUIRE( J.hash() == I.hash() );
+
+            REQUIRE_THROWS_AS( gul::signedDistanceImage(M, {128, 0, 4.0f}), std::logic_error );
+        }
+    }
+}
+
+TEST_CASE("Distance field benchmarks", "[.benchmark]")
+{
+    gul::Image M(8192, 8192, 1);
+    M.r = uint8_t(0);
+    std::mt19937 gen(2);
+    for(uint32_t b = 0; b < 200; b++)
+        fillDisc(M, float(gen() % 8192), float(gen() % 8192), float(gen() % 300));
+    gul::thread_pool pool(4);
+
+    BENCHMARK("8192x8192 mask")
+    {
+        return gul::signedDistanceField(M.r);
+    };
+    BENCHMARK("8192x8192 mask 4 threads")
+    {
+        return gul::signedDistanceField(pool, M.r);
+    };
+    BENCHMARK("8192x8192 mask -> 1024x1024 image")
+    {
+        return gul::signedDistanceImage(pool, M, {128, 8, 4.0f});
+    };
+}
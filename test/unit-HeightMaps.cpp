@@ -0,0 +1,274 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/HeightMaps.h>
+
+#include <cmath>
+#include <random>
+
+// a smooth random terrain, the sum of a few sine waves which tile
+static gul::Image makeTerrain(uint32_t w, uint32_t h, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    const float pi = 3.14159265f;
+    float fx[4], fy[4], ph[4];
+    for(int i = 0; i < 4; i++)
+    {
+        fx[i] = float(1 + gen() % 4);
+        fy[i] = float(1 + gen() % 4);
+        ph[i] = float(gen() % 100) * 0.0628f;
+    }
+    gul::Image I(w, h, 1);
+    for(uint32_t y = 0; y < h; y++)
+    {
+        for(uint32_t x = 0; x < w; x++)
+        {
+            float v = 0.0f;
+            for(int i = 0; i < 4; i++)
+                v += std::sin(2.0f * pi * (fx[i] * float(x) / float(w) + fy[i] * float(y) / float(h)) + ph[i]);
+            I(x,y,0) = gul::detail::float_to_unorm8(0.5f + v * 0.12f);
+        }
+    }
+    return I;
+}
+
+SCENARIO("Normal maps")
+{
+    GIVEN("A flat height map")
+    {
+        gul::Image H(13, 7, 1);
+        H.r = uint8_t(90);
+
+        THEN("The normals point straight up")
+        {
+            auto N = gul::normalMap(H.r);
+            REQUIRE( N.getChannels() == 3 );
+            for(uint32_t y = 0; y < 7; y++)
+                for(uint32_t x = 0; x < 13; x++)
+                {
+                    REQUIRE( N(x,y,0) == 128 );
+                    REQUIRE( N(x,y,1) == 128 );
+                    REQUIRE( N(x,y,2) == 255 );
+                }
+        }
+    }
+
+    GIVEN("A ramp going up to the right and down the image")
+    {
+        gul::Image H(16, 16, 4);
+        for(uint32_t y = 0; y < 16; y++)
+            for(uint32_t x = 0; x < 16; x++)
+                H(x,y,3) = static_cast<uint8_t>(x * 8 + y * 4);
+
+        THEN("The normals lean against the slope")
+        {
+            gul::normalMap(H.a, H);
+            REQUIRE( H(8,8,0) < 128 );
+            REQUIRE( H(8,8,1) > 128 );
+            REQUIRE( H(8,8,2) < 255 );
+            // the alpha channel holding the heights is untouched
+            REQUIRE( H(8,8,3) == 8*8 + 8*4 );
+
+            // the slope is (8,4)/255 per pixel, scaled by heightScale
+            const float gx = 8.0f * 8.0f / 255.0f, gy = 8.0f * 4.0f / 255.0f;
+            const float l  = std::sqrt(gx*gx + gy*gy + 1.0f);
+            REQUIRE( std::abs( int(H(8,8,0)) - int(gul::detail::float_to_unorm8(-gx / l * 0.5f + 0.5f)) ) <= 1 );
+            REQUIRE( std::abs( int(H(8,8,1)) - int(gul::detail::float_to_unorm8( gy / l * 0.5f + 0.5f)) ) <= 1 );
+
+            gul::NormalMapSettings dx;
+            dx.greenUp = false;
+            dx.filter  = gul::GradientFilter::Scharr;
+            auto N = gul::normalMap(H.a, dx);
+            REQUIRE( N(8,8,1) < 128 );
+            REQUIRE( std::abs( int(N(8,8,0)) - int(H(8,8,0)) ) <= 1 );
+        }
+
+        THEN("The edge mode decides the slope at the border")
+        {
+            gul::NormalMapSettings S;
+            auto C = gul::normalMap(H.a, S);
+            S.edge = gul::EdgeMode::Wrap;
+            auto W = gul::normalMap(H.a, S);
+            // wrapping sees the drop from the right edge back to the left
+            REQUIRE( W(8,8,0) == C(8,8,0) );
+            REQUIRE( C(15,8,0) < 128 );
+            REQUIRE( W(15,8,0) > 128 );
+        }
+
+        THEN("The output must match the height map")
+        {
+            gul::Image O(16, 16, 2);
+            REQUIRE_THROWS_AS( gul::normalMap(H.a, O), std::logic_error );
+            gul::Image P(8, 16, 3);
+            REQUIRE_THROWS_AS( gul::normalMap(H.a, P), std::logic_error );
+        }
+    }
+
+    GIVEN("A terrain")
+    {
+        auto T = makeTerrain(67, 45, 1);
+
+        THEN("The SIMD rows match the scalar rows and the pool gives the same result")
+        {
+            gul::thread_pool pool(3);
+            gul::NormalMapSettings S{12.0f, gul::GradientFilter::Scharr, gul::EdgeMode::Mirror, true};
+            auto A = gul::normalMap(T.r, S);
+            REQUIRE( gul::normalMap(pool, T.r, S).hash() == A.hash() );
+
+            auto P = gul::detail::make_height_plane(T.r, 1, gul::EdgeMode::Mirror, nullptr);
+            for(uint32_t y = 0; y < 45; y++)
+            {
+                std::vector<float> nx(67), ny(67), nz(67);
+                gul::detail::normal_row(P.row(int64_t(y)-1), P.row(y), P.row(y+1), 67, 3.0f, 10.0f, 12.0f/32.0f, 1.0f, nx.data(), ny.data(), nz.data());
+                for(uint32_t x = 0; x < 67; x++)
+                {
+                    std::vector<float> sx(1), sy(1), sz(1);
+                    gul::detail::normal_row(P.row(int64_t(y)-1) + x, P.row(y) + x, P.row(y+1) + x, 1, 3.0f, 10.0f, 12.0f/32.0f, 1.0f, sx.data(), sy.data(), sz.data());
+                    REQUIRE( nx[x] == sx[0] );
+                    REQUIRE( ny[x] == sy[0] );
+                    REQUIRE( nz[x] == sz[0] );
+                    REQUIRE( nx[x]*nx[x] + ny[x]*ny[x] + nz[x]*nz[x] == Approx(1.0f) );
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Height maps stored in planar images")
+{
+    GIVEN("A terrain in the alpha channel of an interleaved and a planar image")
+    {
+        auto T = makeTerrain(41, 29, 3);
+        gul::Image I(41, 29, 4);
+        I.a = T.r;
+        auto P = I;
+        P.setPlanar(true);
+
+        THEN("The maps are the same in both layouts")
+        {
+            gul::NormalMapSettings S{8.0f, gul::GradientFilter::Sobel, gul::EdgeMode::Wrap, true};
+            gul::normalMap(I.a, I, S);
+            gul::normalMap(P.a, P, S);
+            gul::cavityMap(I.a, I.g);
+            gul::cavityMap(P.a, P.g);
+            gul::ambientOcclusionMap(I.a, I.b);
+            gul::ambientOcclusionMap(P.a, P.b);
+            REQUIRE( P.isPlanar() );
+            P.setPlanar(false);
+            REQUIRE( P.hash() == I.hash() );
+            REQUIRE( gul::normalMap(T.r, S)(7, 9, 0) == I(7, 9, 0) );
+        }
+    }
+}
+
+SCENARIO("Cavity and ambient occlusion maps")
+{
+    GIVEN("A height map with a pit and a bump")
+    {
+        gul::Image H(64, 32, 2);
+        H.r = uint8_t(128);
+        for(uint32_t y = 12; y < 20; y++)
+        {
+            for(uint32_t x = 12; x < 20; x++)
+            {
+                H(x, y, 0)      = 20;
+                H(x + 32, y, 0) = 240;
+            }
+        }
+
+        THEN("The cavity is dark in the pit and bright on the bump")
+        {
+            auto C = gul::cavityMap(H.r);
+            REQUIRE( C(5, 5, 0) == 128 );
+            REQUIRE( C(12, 12, 0) < 100 );
+            REQUIRE( C(44, 12, 0) > 156 );
+
+            gul::cavityMap(H.r, H.a);
+            REQUIRE( H(12, 12, 1) == C(12, 12, 0) );
+        }
+
+        THEN("The pit is occluded and the flat ground and the bump are not")
+        {
+            auto A = gul::ambientOcclusionMap(H.r);
+            REQUIRE( A(2, 2, 0) == 255 );
+            REQUIRE( A(44, 16, 0) == 255 );
+            REQUIRE( A(16, 16, 0) < 128 );
+            // next to the bump, half the directions see it
+            REQUIRE( A(43, 9, 0) < 255 );
+            REQUIRE( A(43, 9, 0) > A(16, 16, 0) );
+        }
+
+        THEN("The output channel must have the same size")
+        {
+            gul::Image O(3, 3, 1);
+            REQUIRE_THROWS_AS( gul::ambientOcclusionMap(H.r, O.r), std::logic_error );
+            REQUIRE_THROWS_AS( gul::cavityMap(H.r, O.r), std::logic_error );
+        }
+    }
+
+    GIVEN("A terrain")
+    {
+        auto T = makeTerrain(71, 40, 2);
+        gul::thread_pool pool(3);
+
+        THEN("The pool gives the same result")
+        {
+            gul::AOSettings S;
+            S.edge   = gul::EdgeMode::Wrap;
+            S.radius = 20;
+            REQUIRE( gul::ambientOcclusionMap(pool, T.r, S).hash() == gul::ambientOcclusionMap(T.r, S).hash() );
+            gul::CavitySettings C;
+            C.edge = gul::EdgeMode::Wrap;
+            REQUIRE( gul::cavityMap(pool, T.r, C).hash() == gul::cavityMap(T.r, C).hash() );
+        }
+
+        THEN("The SIMD rows match the scalar rows")
+        {
+            auto P = gul::detail::make_height_plane(T.r, 4, gul::EdgeMode::Clamp, nullptr);
+            std::vector<float> t(71, 0.0f), o(71, 0.0f);
+            gul::detail::horizon_row(P.row(5), P.row(9) - 4, 3.5f, 71, t.data());
+            gul::detail::occlusion_row(t.data(), 71, o.data());
+            for(uint32_t x = 0; x < 71; x++)
+            {
+                float ts = 0.0f, os = 0.0f;
+                gul::detail::horizon_row(P.row(5) + x, P.row(9) - 4 + x, 3.5f, 1, &ts);
+                gul::detail::occlusion_row(&ts, 1, &os);
+                REQUIRE( t[x] == ts );
+                REQUIRE( o[x] == os );
+            }
+        }
+    }
+}
+
+TEST_CASE("Height map benchmarks", "[.benchmark]")
+{
+    auto T = makeTerrain(2048, 2048, 3);
+    gul::Image N(2048, 2048, 4);
+    gul::thread_pool pool(4);
+
+    BENCHMARK("normal map 2048x2048")
+    {
+        gul::normalMap(T.r, N);
+        return N.getWidth();
+    };
+    BENCHMARK("normal map 2048x2048 4 threads")
+    {
+        gul::normalMap(pool, T.r, N);
+        return N.getWidth();
+    };
+    BENCHMARK("cavity map 2048x2048")
+    {
+        gul::cavityMap(T.r, N.a);
+        return N.getWidth();
+    };
+    BENCHMARK("ambient occlusion 2048x2048 radius 16")
+    {
+        gul::ambientOcclusionMap(T.r, N.a);
+        return N.getWidth();
+    };
+    BENCHMARK("ambient occlusion 2048x2048 radius 16 4 threads")
+    {
+        gul::ambientOcclusionMap(pool, T.r, N.a);
+        return N.getWidth();
+    };
+}
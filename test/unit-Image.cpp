@@ -1,3 +1,4 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 
 #if defined(__clang__)
@@ -11,8 +12,13 @@
 
 #define private public
 #include <gul/Image.h>
+#include "test-helpers.h"
 #undef private
 #include <iostream>
+#include <random>
+#include <cstring>
+#include <thread>
+#include <atomic>
 
 using namespace gul;
 
@@ -538,6 +544,10 @@ TEST_CASE("Multiplying a number by a channel")
         I.a = I.r*2.0f;
         auto x = I.r*2.0f;
 
+        REQUIRE( x.getWidth() == 10 );
+        REQUIRE( x.getHeight() == 10 );
+        REQUIRE( x.eval(0,0) == Approx(20.0f/255.0f) );
+
         THEN("All the values in that channel are decreased by that value")
         {
             for(uint32_t v=0;v<10;v++)
@@ -612,6 +622,107 @@ TEST_CASE("Basic Math on two channels")
 }
 
 
+TEST_CASE("Channel expressions are evaluated in a single pass")
+{
+    gul::Image I;
+
+    I.resize(10,10);
+
+    I.r = 0;
+    I.g = 100;
+    I.b = 255;
+    I.a = 51;
+
+    WHEN("We combine several channels")
+    {
+        I.r = 0.5f*I.g + I.b * I.a;
+
+        THEN("The result is the same as evaluating each pixel")
+        {
+            auto expected = static_cast<uint8_t>( 255.0f * ( (100.0f/255.0f)*0.5f + (255.0f*51.0f)/(255.0f*255.0f) ) );
+            for(uint32_t v=0;v<10;v++)
+            {
+                for(uint32_t u=0;u<10;u++)
+                {
+                    REQUIRE( I.r(u,v) == expected );
+                }
+            }
+        }
+    }
+    WHEN("The destination is also used in the expression")
+    {
+        I.a = I.a * 2.0f - I.a;
+
+        THEN("Each pixel only reads its own value")
+        {
+            for(uint32_t v=0;v<10;v++)
+            {
+                for(uint32_t u=0;u<10;u++)
+                {
+                    REQUIRE( I.a(u,v) == 51 );
+                }
+            }
+        }
+    }
+    WHEN("We mix two expressions")
+    {
+        I.r = mix( I.g * 1.0f, I.b * 1.0f, 0.5f);
+
+        THEN("The result is halfway between them")
+        {
+            for(uint32_t v=0;v<10;v++)
+            {
+                for(uint32_t u=0;u<10;u++)
+                {
+                    REQUIRE( I.r(u,v) == 177 );
+                }
+            }
+        }
+    }
+    WHEN("We use channel1f in an expression")
+    {
+        I.r = gul::Image::X(10,10) + gul::Image::Y(10,10) * 0.0f;
+
+        THEN("The channel1f is used directly")
+        {
+            for(uint32_t v=0;v<10;v++)
+            {
+                for(uint32_t u=0;u<10;u++)
+                {
+                    REQUIRE( I.r(u,v) == static_cast<uint8_t>( 255.0f * static_cast<float>(u) / 10.0f ) );
+                }
+            }
+        }
+    }
+    WHEN("The channels are of different sizes")
+    {
+        gul::Image J(5,5);
+
+        REQUIRE_THROWS( I.r = J.r * 0.5f );
+    }
+}
+
+TEST_CASE("Channel expressions on 3-channel images")
+{
+    gul::Image I(10,10,3);
+
+    I.r = 10;
+    I.g = 20;
+    I.b = 30;
+
+    I.b = I.r * 2.0f + 0.0f;
+
+    for(uint32_t v=0;v<10;v++)
+    {
+        for(uint32_t u=0;u<10;u++)
+        {
+            REQUIRE( I.r(u,v) == 10 );
+            REQUIRE( I.g(u,v) == 20 );
+            REQUIRE( I.b(u,v) == 20 );
+        }
+    }
+}
+
 TEST_CASE("Static functions")
 {
     auto x = gul::Image::X(255,255);
@@ -631,6 +742,50 @@ TEST_CASE("Static functions")
 }
 
 
+TEST_CASE("Expressions built from temporary channels can be stored")
+{
+    gul::Image I(31,17,4);
+    I.r = uint8_t(51);
+
+    auto e = gul::Image::X(31,17) * 2.0f;
+    auto f = gul::Image::Y(31,17) + gul::Image::X(31,17);
+    auto g = I.r - gul::Image::Y(31,17);
+    auto h = mix(gul::Image::X(31,17), I.r, gul::Image::Y(31,17));
+    auto k = 0.5f - (gul::Image::X(31,17) * gul::Image::Y(31,17));
+
+    // the temporaries are destroyed by now
+    gul::channel1f E(e), F(f), G(g), H(h), K(k);
+    auto x = gul::Image::X(31,17);
+    auto y = gul::Image::Y(31,17);
+
+    for(uint32_t v = 0; v < 17; v++)
+    {
+        for(uint32_t u = 0; u < 31; u++)
+        {
+            const float r = 0.2f;
+            REQUIRE( E(u,v) == Approx( x(u,v) * 2.0f ) );
+            REQUIRE( F(u,v) == Approx( y(u,v) + x(u,v) ) );
+            REQUIRE( G(u,v) == Approx( r - y(u,v) ) );
+            REQUIRE( H(u,v) == Approx( (1.0f - y(u,v)) * x(u,v) + y(u,v) * r ) );
+            REQUIRE( K(u,v) == Approx( 0.5f - x(u,v) * y(u,v) ) );
+        }
+    }
+}
+
+TEST_CASE("Static functions on a thread pool")
+{
+    for(size_t workers : {0u, 1u, 4u})
+    {
+        gul::thread_pool pool(workers);
+
+        auto x = gul::Image::X(pool, 255,131);
+        auto y = gul::Image::Y(pool, 255,131);
+
+        REQUIRE( x.data == gul::Image::X(255,131).data );
+        REQUIRE( y.data == gul::Image::Y(255,131).data );
+    }
+}
+
 TEST_CASE("Mix functions")
 {
     gul::Image I;
@@ -668,6 +823,145 @@ TEST_CASE("Mix functions")
 }
 
 
+// The SIMD kernels perform the same float operations as the scalar code,
+// the only allowed difference is if the compiler contracts the scalar
+// code into FMAs.
+static bool closeTo(uint8_t a, uint8_t b)
+{
+    return std::abs( int(a) - int(b) ) <= 1;
+}
+
+TEST_CASE("SIMD mix of Images agrees with the scalar mix")
+{
+    // odd sizes so that the scalar tail is also used
+    gul::Image A(37,19), B(37,19), T(37,19);
+    fillRandom(A, 1);
+    fillRandom(B, 2);
+    fillRandom(T, 3);
+
+    WHEN("We mix with a constant")
+    {
+        for(float t : {0.0f, 0.25f, 0.5f, 0.7f, 1.0f})
+        {
+            auto D = gul::mix(A,B,t);
+            for(uint32_t j=0;j<A.getHeight();j++)
+            for(uint32_t i=0;i<A.getWidth();i++)
+            for(uint32_t c=0;c<4;c++)
+            {
+                REQUIRE( closeTo( D(i,j,c), gul::mix( A(i,j,c), B(i,j,c), t) ) );
+            }
+        }
+    }
+    WHEN("We mix with an image")
+    {
+        auto D = gul::mix(A,B,T);
+        for(uint32_t j=0;j<A.getHeight();j++)
+        for(uint32_t i=0;i<A.getWidth();i++)
+        for(uint32_t c=0;c<4;c++)
+        {
+            float t = static_cast<float>(T(i,j,c)) / 255.0f;
+            REQUIRE( closeTo( D(i,j,c), gul::mix( A(i,j,c), B(i,j,c), t) ) );
+        }
+    }
+    WHEN("We mix 3-channel images")
+    {
+        gul::Image A3(37,19,3), B3(37,19,3);
+        fillRandom(A3, 4);
+        fillRandom(B3, 5);
+        auto D = gul::mix(A3,B3,0.3f);
+        REQUIRE( D.getChannels() == 3 );
+        for(uint32_t j=0;j<A3.getHeight();j++)
+        for(uint32_t i=0;i<A3.getWidth();i++)
+        for(uint32_t c=0;c<3;c++)
+        {
+            REQUIRE( closeTo( D(i,j,c), gul::mix( A3(i,j,c), B3(i,j,c), 0.3f) ) );
+        }
+    }
+    WHEN("We call the byte kernels directly")
+    {
+        auto * a = static_cast<uint8_t const*>(A.data());
+        auto * b = static_cast<uint8_t const*>(B.data());
+        auto * t = static_cast<uint8_t const*>(T.data());
+        std::vector<uint8_t> s(A.size()), v(A.size());
+
+        gul::detail::mix_bytes_scalar(a,b,0.4f,s.data(),s.size());
+        gul::detail::mix_bytes(a,b,0.4f,v.data(),v.size());
+        REQUIRE( s == v );
+
+        gul::detail::mix_bytes_scalar(a,b,t,s.data(),s.size());
+        gul::detail::mix_bytes(a,b,t,v.data(),v.size());
+        REQUIRE( s == v );
+    }
+}
+
+TEST_CASE("SIMD channel operators agree with the scalar operators")
+{
+    gul::Image I(37,19);
+    fillRandom(I, 7);
+
+    auto const ref = I;
+    const float sc = 1.0f / 255.0f;
+
+    WHEN("We add two channels")
+    {
+        I.a = I.r + I.g;
+        for(uint32_t j=0;j<I.getHeight();j++)
+        for(uint32_t i=0;i<I.getWidth();i++)
+        {
+            float r = ref.r(i,j), g = ref.g(i,j);
+            REQUIRE( closeTo( I.a(i,j), gul::detail::clamp_u8( 255.0f * ((r + g) * sc) ) ) );
+            REQUIRE( I.r(i,j) == ref.r(i,j) );
+            REQUIRE( I.g(i,j) == ref.g(i,j) );
+            REQUIRE( I.b(i,j) == ref.b(i,j) );
+        }
+    }
+    WHEN("We multiply two channels")
+    {
+        I.b = I.r * I.a;
+        for(uint32_t j=0;j<I.getHeight();j++)
+        for(uint32_t i=0;i<I.getWidth();i++)
+        {
+            float r = ref.r(i,j), a = ref.a(i,j);
+            REQUIRE( closeTo( I.b(i,j), static_cast<uint8_t>( 255.0f * ((r * a) * (sc*sc)) ) ) );
+            REQUIRE( I.a(i,j) == ref.a(i,j) );
+        }
+    }
+    WHEN("We mix two channels with a constant")
+    {
+        I.r = mix(I.g, I.b, 0.3f);
+        for(uint32_t j=0;j<I.getHeight();j++)
+        for(uint32_t i=0;i<I.getWidth();i++)
+        {
+            float g = ref.g(i,j), b = ref.b(i,j);
+            REQUIRE( closeTo( I.r(i,j), static_cast<uint8_t>( 255.0f * (((1.0f-0.3f)*g + 0.3f*b) * sc) ) ) );
+        }
+    }
+    WHEN("We mix two channels with a third channel")
+    {
+        I.g = mix(I.r, I.b, I.g);
+        for(uint32_t j=0;j<I.getHeight();j++)
+        for(uint32_t i=0;i<I.getWidth();i++)
+        {
+            float r = ref.r(i,j), b = ref.b(i,j), t = static_cast<float>(ref.g(i,j)) * sc;
+            REQUIRE( closeTo( I.g(i,j), static_cast<uint8_t>( 255.0f * (((1.0f-t)*r + t*b) * sc) ) ) );
+        }
+    }
+    WHEN("The channels belong to a 3-channel image")
+    {
+        gul::Image J(37,19,3);
+        fillRandom(J, 8);
+        auto const refJ = J;
+
+        J.b = J.r + J.g;
+        for(uint32_t j=0;j<J.getHeight();j++)
+        for(uint32_t i=0;i<J.getWidth();i++)
+        {
+            float r = refJ.r(i,j), g = refJ.g(i,j);
+            REQUIRE( J.b(i,j) == gul::detail::clamp_u8( 255.0f * ((r + g) * sc) ) );
+        }
+    }
+}
+
 TEST_CASE("apply functions")
 {
     gul::Image I;
@@ -707,6 +1001,36 @@ TEST_CASE("apply functions")
 }
 
 
+TEST_CASE("apply functions on a thread pool")
+{
+    auto f = [](float u, float v)
+    {
+        return std::fmod( u*7.0f + v*v*3.0f, 1.0f);
+    };
+
+    gul::Image I(257,131);
+    gul::Image J(257,131);
+
+    I.r.apply(f);
+
+    for(size_t workers : {0u, 1u, 4u})
+    {
+        gul::thread_pool pool(workers);
+
+        J.r = 0;
+        J.r.apply(pool, f);
+
+        // the output is identical to the single threaded version
+        for(uint32_t v=0;v<I.getHeight();v++)
+        {
+            for(uint32_t u=0;u<I.getWidth();u++)
+            {
+                REQUIRE( I.r(u,v) == J.r(u,v) );
+            }
+        }
+    }
+}
+
 SCENARIO("Test 3-channel")
 {
     gul::Image I(8,8,3);
@@ -788,3 +1112,1618 @@ SCENARIO("gul::ImageArray")
 
     REQUIRE( MM.getLevelCount() == 4);
 }
+
+SCENARIO("nextMipMap agrees with sample() for even sized images")
+{
+    for(uint32_t ch : {1u,2u,3u,4u})
+    {
+        gul::Image I(38,22,ch);
+        fillRandom(I, 11+ch);
+
+        auto M = I.nextMipMap();
+
+        REQUIRE( M.getWidth() == 19 );
+        REQUIRE( M.getHeight() == 11 );
+        REQUIRE( M.getChannels() == ch );
+        for(uint32_t j=0;j<M.getHeight();j++)
+        for(uint32_t i=0;i<M.getWidth();i++)
+        for(uint32_t c=0;c<ch;c++)
+        {
+            REQUIRE( M(i,j,c) == I.sample(2*i,2*j,c) );
+        }
+    }
+}
+
+SCENARIO("nextMipMap on odd sized images")
+{
+    GIVEN("A constant image")
+    {
+        gul::Image I(37,19);
+        I.r = 200;
+        I.g = 1;
+        I.b = 0;
+        I.a = 255;
+
+        auto M = I.nextMipMap();
+        REQUIRE( M.getWidth() == 18 );
+        REQUIRE( M.getHeight() == 9 );
+
+        THEN("The mipmap is the same constant")
+        {
+            for(uint32_t j=0;j<M.getHeight();j++)
+            for(uint32_t i=0;i<M.getWidth();i++)
+            {
+                REQUIRE( M.r(i,j) == 200 );
+                REQUIRE( M.g(i,j) == 1 );
+                REQUIRE( M.b(i,j) == 0 );
+                REQUIRE( M.a(i,j) == 255 );
+            }
+        }
+    }
+    GIVEN("A 3x3 image")
+    {
+        gul::Image I(3,3,1);
+        uint32_t total=0;
+        for(uint32_t j=0;j<3;j++)
+        for(uint32_t i=0;i<3;i++)
+        {
+            I(i,j,0) = static_cast<uint8_t>(10*(j*3+i));
+            total += I(i,j,0);
+        }
+
+        THEN("Every pixel contributes to the 1x1 mipmap")
+        {
+            auto M = I.nextMipMap();
+            REQUIRE( M.getWidth() == 1 );
+            REQUIRE( M.getHeight() == 1 );
+            REQUIRE( M(0,0,0) == total/9 );
+        }
+    }
+}
+
+SCENARIO("Generating mipmaps")
+{
+    GIVEN("An ImageMM")
+    {
+        gul::ImageMM MM;
+        MM.resize(64,32);
+        fillRandom(MM.level[0], 21);
+
+        MM.generateMipMaps();
+        REQUIRE( MM.getLevelCount() == 5 );
+
+        THEN("Each level is the nextMipMap of the previous")
+        {
+            for(uint32_t i=1;i<MM.getLevelCount();i++)
+            {
+                auto M = MM.level[i-1].nextMipMap();
+                REQUIRE( MM.level[i].getWidth() == M.getWidth() );
+                REQUIRE( MM.level[i].getHeight() == M.getHeight() );
+                REQUIRE( MM.level[i].hash() == M.hash() );
+            }
+        }
+        THEN("The thread pool version produces the same levels")
+        {
+            gul::thread_pool pool(3);
+            gul::ImageMM MM2;
+            MM2.resize(64,32);
+            MM2.level[0] = MM.level[0];
+            MM2.generateMipMaps(pool);
+
+            REQUIRE( MM2.getLevelCount() == MM.getLevelCount() );
+            for(uint32_t i=0;i<MM.getLevelCount();i++)
+            {
+                REQUIRE( samePixels(MM2.level[i], MM.level[i]) );
+            }
+        }
+    }
+    GIVEN("An ImageArray")
+    {
+        gul::ImageArray A;
+        A.resize(32,32,6);
+        for(uint32_t l=0;l<A.getLayerCount();l++)
+        {
+            fillRandom(A.layer[l].level[0], 30+l);
+        }
+
+        auto B = A;
+
+        A.generateMipMaps();
+
+        gul::thread_pool pool(3);
+        B.generateMipMaps(pool);
+
+        THEN("All layers have their mipmaps generated")
+        {
+            REQUIRE( A.getLevelCount() == 5 );
+            for(uint32_t l=0;l<A.getLayerCount();l++)
+            {
+                for(uint32_t i=1;i<A.getLevelCount();i++)
+                {
+                    REQUIRE( samePixels(A.layer[l].level[i], A.layer[l].level[i-1].nextMipMap()) );
+                    REQUIRE( samePixels(B.layer[l].level[i], A.layer[l].level[i]) );
+                }
+            }
+        }
+    }
+    GIVEN("An image with a dimension of 1")
+    {
+        gul::ImageMM MM;
+        MM.resize(16,1);
+        MM.generateMipMaps();
+        REQUIRE( MM.getLevelCount() == 1 );
+    }
+}
+
+SCENARIO("Mipmap filter modes")
+{
+    GIVEN("A checkerboard of black and white sRGB pixels")
+    {
+        gul::ImageMM MM;
+        MM.resize(16,16);
+        auto & I = MM.level[0];
+        for(uint32_t j=0;j<16;j++)
+        for(uint32_t i=0;i<16;i++)
+        {
+            uint8_t v = ((i+j)%2) ? 255 : 0;
+            I(i,j,0) = I(i,j,1) = I(i,j,2) = v;
+            I(i,j,3) = 255;
+        }
+
+        WHEN("We filter the raw sRGB values")
+        {
+            MM.generateMipMaps();
+            THEN("The mipmap is too dark")
+            {
+                REQUIRE( MM.level[1](0,0,0) == 127 );
+            }
+        }
+        WHEN("We filter in linear light")
+        {
+            gul::MipMapSettings S;
+            S.sRGB = true;
+            MM.generateMipMaps(S);
+            THEN("The mipmap has the same brightness")
+            {
+                // linear 0.5 == 188 in sRGB
+                for(uint32_t l=1;l<MM.getLevelCount();l++)
+                {
+                    REQUIRE( MM.level[l](0,0,0) == 188 );
+                    REQUIRE( MM.level[l](0,0,3) == 255 );
+                }
+            }
+        }
+    }
+
+    GIVEN("A constant image with odd dimensions")
+    {
+        for(auto f : {gul::ImageFilter::Box, gul::ImageFilter::Kaiser, gul::ImageFilter::Lanczos3,
+                      gul::ImageFilter::Bilinear, gul::ImageFilter::Bicubic, gul::ImageFilter::Mitchell})
+        {
+            gul::ImageMM MM;
+            MM.resize(37,21);
+            MM.level[0].r = 10;
+            MM.level[0].g = 100;
+            MM.level[0].b = 200;
+            MM.level[0].a = 255;
+
+            gul::MipMapSettings S;
+            S.filter = f;
+            S.sRGB   = true;
+            MM.generateMipMaps(S);
+
+            REQUIRE( MM.getLevelCount() == 4 );
+            for(uint32_t l=1;l<MM.getLevelCount();l++)
+            {
+                auto & L = MM.level[l];
+                REQUIRE( L.getWidth()  == MM.level[l-1].getWidth()/2 );
+                REQUIRE( L.getHeight() == MM.level[l-1].getHeight()/2 );
+                for(uint32_t j=0;j<L.getHeight();j++)
+                for(uint32_t i=0;i<L.getWidth();i++)
+                {
+                    REQUIRE( L.r(i,j) == 10 );
+                    REQUIRE( L.g(i,j) == 100 );
+                    REQUIRE( L.b(i,j) == 200 );
+                    REQUIRE( L.a(i,j) == 255 );
+                }
+            }
+        }
+    }
+
+    GIVEN("A random image")
+    {
+        gul::ImageArray A;
+        A.resize(64,48,3);
+        for(uint32_t l=0;l<A.getLayerCount();l++)
+        {
+            fillRandom(A.layer[l].level[0], 50+l);
+        }
+        auto B = A;
+
+        gul::MipMapSettings S;
+        S.filter = gul::ImageFilter::Lanczos3;
+        S.sRGB   = true;
+
+        A.generateMipMaps(S);
+
+        gul::thread_pool pool(3);
+        B.layer[0].generateMipMaps(pool, S);
+        B.generateMipMaps(pool, S);
+
+        THEN("The thread pool version gives the same result")
+        {
+            for(uint32_t l=0;l<A.getLayerCount();l++)
+            {
+                for(uint32_t i=0;i<A.getLevelCount();i++)
+                {
+                    REQUIRE( samePixels(A.layer[l].level[i], B.layer[l].level[i]) );
+                }
+            }
+        }
+    }
+
+    GIVEN("An alpha tested image")
+    {
+        gul::ImageMM MM;
+        MM.resize(128,128);
+        fillRandom(MM.level[0], 60);
+        auto & I = MM.level[0];
+        for(uint32_t j=0;j<128;j++)
+        for(uint32_t i=0;i<128;i++)
+        {
+            // roughly 30% of the pixels pass the alpha test
+            I(i,j,3) = I(i,j,3) < 77 ? 255 : 0;
+        }
+        auto const base = gul::detail::alpha_coverage(I, 0.5f);
+        REQUIRE( base == Approx(0.3f).margin(0.02f) );
+
+        WHEN("We do not preserve the coverage")
+        {
+            MM.generateMipMaps();
+            THEN("The coverage drops")
+            {
+                REQUIRE( gul::detail::alpha_coverage(MM.level[1], 0.5f) < 0.15f );
+            }
+        }
+        WHEN("We preserve the coverage")
+        {
+            gul::MipMapSettings S;
+            S.alphaCoverage = 0.5f;
+            MM.generateMipMaps(S);
+            THEN("Each level has the same coverage")
+            {
+                for(uint32_t l=1;l<MM.getLevelCount()-1;l++)
+                {
+                    REQUIRE( gul::detail::alpha_coverage(MM.level[l], 0.5f) == Approx(base).margin(0.05f) );
+                }
+            }
+        }
+    }
+
+    GIVEN("A planar base level and an interleaved copy")
+    {
+        for(auto f : {gul::ImageFilter::Box, gul::ImageFilter::Kaiser, gul::ImageFilter::Lanczos3})
+        for(bool sRGB : {false, true})
+        {
+            gul::ImageMM MM;
+            MM.resize(64,48);
+            fillRandom(MM.level[0], 70);
+            for(uint32_t j=0;j<48;j++)
+            for(uint32_t i=0;i<64;i++)
+            {
+                MM.level[0](i,j,3) = MM.level[0](i,j,3) < 77 ? 255 : 0;
+            }
+
+            // P allocates planar levels, Q already has interleaved levels
+            // which have to be converted
+            gul::ImageMM P = MM;
+            P.level[0].setPlanar(true);
+            gul::ImageMM Q = MM;
+            Q.allocateMipMaps();
+            Q.level[0].setPlanar(true);
+
+            gul::MipMapSettings S;
+            S.filter        = f;
+            S.sRGB          = sRGB;
+            S.alphaCoverage = 0.5f;
+            MM.generateMipMaps(S);
+            P.generateMipMaps(S);
+            Q.generateMipMaps(S);
+
+            REQUIRE( P.getLevelCount() == MM.getLevelCount() );
+            REQUIRE( Q.getLevelCount() == MM.getLevelCount() );
+            for(uint32_t l=1;l<MM.getLevelCount();l++)
+            {
+                REQUIRE( P.level[l].isPlanar() );
+                REQUIRE( Q.level[l].isPlanar() );
+                REQUIRE( gul::detail::alpha_coverage(P.level[l], 0.5f) == gul::detail::alpha_coverage(MM.level[l], 0.5f) );
+                auto p = P.level[l];
+                auto q = Q.level[l];
+                p.setPlanar(false);
+                q.setPlanar(false);
+                REQUIRE( samePixels(p, MM.level[l]) );
+                REQUIRE( samePixels(q, MM.level[l]) );
+            }
+        }
+    }
+}
+
+SCENARIO("Contiguous storage for ImageArray and ImageMM")
+{
+    GIVEN("An array allocated in a single buffer")
+    {
+        gul::ImageArray A;
+        A.allocateContiguous(64,32,3,0,4,64);
+
+        REQUIRE( A.getLayerCount() == 3 );
+        REQUIRE( A.getLevelCount() == 5 );
+        REQUIRE( A.isContiguous() );
+
+        auto * base = static_cast<uint8_t*>( A.contiguousData() );
+        REQUIRE( base != nullptr );
+        REQUIRE( reinterpret_cast<uintptr_t>(base) % 64 == 0 );
+
+        THEN("Each image is a view into the buffer, ordered by level then layer")
+        {
+            size_t expected = 0;
+            for(uint32_t i=0;i<A.getLevelCount();i++)
+            {
+                for(uint32_t l=0;l<A.getLayerCount();l++)
+                {
+                    auto & I = A.layer[l].level[i];
+                    REQUIRE( I.getWidth()  == 64u >> i );
+                    REQUIRE( I.getHeight() == 32u >> i );
+                    REQUIRE( A.getOffset(l,i) % 64 == 0 );
+                    REQUIRE( A.getOffset(l,i) >= expected );
+                    REQUIRE( static_cast<uint8_t*>(I.data()) == base + A.getOffset(l,i) );
+                    expected = A.getOffset(l,i) + I.size();
+                }
+            }
+            REQUIRE( A.contiguousByteSize() == expected );
+
+            auto offsets = A.getLevelOffsets();
+            REQUIRE( offsets.size() == A.getLevelCount() );
+            for(uint32_t i=0;i<A.getLevelCount();i++)
+            {
+                REQUIRE( offsets[i] == A.getOffset(0,i) );
+            }
+        }
+
+        WHEN("We generate the mipmaps")
+        {
+            for(uint32_t l=0;l<A.getLayerCount();l++)
+                fillRandom(A.layer[l].level[0], 70+l);
+            A.generateMipMaps();
+
+            THEN("The levels are written in place")
+            {
+                REQUIRE( A.isContiguous() );
+                REQUIRE( samePixels(A.layer[2].level[1], A.layer[2].level[0].nextMipMap()) );
+            }
+            THEN("A copy is contiguous and independent")
+            {
+                gul::ImageArray B = A;
+                REQUIRE( B.isContiguous() );
+                REQUIRE( B.contiguousData() != A.contiguousData() );
+                REQUIRE( B.getLevelOffsets() == A.getLevelOffsets() );
+                REQUIRE( std::memcmp(B.contiguousData(), A.contiguousData(), A.contiguousByteSize()) == 0 );
+
+                B.layer[1].level[0](0,0,0) ^= 0xFF;
+                REQUIRE( B.layer[1].level[0](0,0,0) != A.layer[1].level[0](0,0,0) );
+            }
+        }
+
+        WHEN("An image is resized")
+        {
+            A.layer[1].level[2].resize(3,3);
+            THEN("It is detached from the buffer")
+            {
+                REQUIRE( !A.isContiguous() );
+                REQUIRE( A.contiguousData() == nullptr );
+                REQUIRE( A.getLevelOffsets().empty() );
+            }
+        }
+    }
+
+    GIVEN("An ImageMM with separately allocated levels")
+    {
+        gul::ImageMM MM;
+        MM.resize(32,32);
+        fillRandom(MM.level[0], 80);
+        MM.generateMipMaps();
+        gul::ImageMM ref = MM;
+        REQUIRE( !MM.isContiguous() );
+
+        WHEN("We make it contiguous")
+        {
+            MM.makeContiguous(16);
+            THEN("The pixels are preserved")
+            {
+                REQUIRE( MM.isContiguous() );
+                auto offsets = MM.getLevelOffsets();
+                REQUIRE( offsets.size() == MM.getLevelCount() );
+                for(uint32_t i=0;i<MM.getLevelCount();i++)
+                {
+                    REQUIRE( offsets[i] % 16 == 0 );
+                    REQUIRE( static_cast<uint8_t*>(MM.level[i].data()) == static_cast<uint8_t*>(MM.contiguousData()) + offsets[i] );
+                    REQUIRE( samePixels(MM.level[i], ref.level[i]) );
+                }
+            }
+            THEN("A level moved out of it keeps the buffer alive")
+            {
+                gul::Image L = std::move(MM.level[1]);
+                MM = gul::ImageMM();
+                REQUIRE( samePixels(L, ref.level[1]) );
+            }
+        }
+    }
+
+    GIVEN("Code written against the old public m_data vector")
+    {
+        gul::Image I(4, 3, 4);
+        REQUIRE( I.m_data.size() == I.size() );
+        REQUIRE( I.m_data.data() == I.data() );
+        std::fill( I.m_data.begin(), I.m_data.end(), uint8_t(7) );
+        I.m_data[5] = 9;
+        REQUIRE( I(1,0,1) == 9 );
+        REQUIRE( I(2,2,3) == 7 );
+
+        THEN("It follows the image through copies, moves and views")
+        {
+            gul::Image C = I;
+            gul::Image M = std::move(I);
+            REQUIRE( C.m_data.data() == C.data() );
+            REQUIRE( M.m_data.data() == M.data() );
+            REQUIRE( M.m_data[5] == 9 );
+
+            gul::ImageArray A;
+            A.allocateContiguous(4, 3, 2, 1, 4);
+            auto const & L = A.layer[1].level[0];
+            REQUIRE( L.m_data.data() == L.data() );
+            REQUIRE( !L.m_data.empty() );
+        }
+    }
+}
+
+// channel() hands out a writable ColorChannel, so only mutable views have it
+template<typename V, typename = void>
+struct has_channel : std::false_type {};
+template<typename V>
+struct has_channel<V, decltype(void(std::declval<V const &>().channel(0u)))> : std::true_type {};
+static_assert(  has_channel<gul::ImageView>::value,      "ImageView::channel() must exist" );
+static_assert( !has_channel<gul::ConstImageView>::value, "ConstImageView must not hand out writable channels" );
+
+SCENARIO("Image views")
+{
+    GIVEN("An image and a view of a sub-rectangle")
+    {
+        gul::Image I(64,48,4);
+        fillRandom(I, 90);
+
+        auto V = I.view(8,4,20,16);
+
+        REQUIRE( V.getWidth()    == 20 );
+        REQUIRE( V.getHeight()   == 16 );
+        REQUIRE( V.getChannels() == 4 );
+        REQUIRE( V.getRowPitch() == 64*4 );
+        REQUIRE( !V.isPacked() );
+
+        THEN("The view refers to the pixels of the image")
+        {
+            for(uint32_t j=0;j<V.getHeight();j++)
+            for(uint32_t i=0;i<V.getWidth();i++)
+            for(uint32_t c=0;c<4;c++)
+            {
+                REQUIRE( &V(i,j,c) == &I(i+8,j+4,c) );
+            }
+            auto S = V.subView(2,3,4,4);
+            REQUIRE( &S(0,0,0) == &I(10,7,0) );
+        }
+
+        THEN("A copy of the view is the same as cropping the image")
+        {
+            gul::Image C(V);
+            REQUIRE( C.getWidth()  == 20 );
+            REQUIRE( C.getHeight() == 16 );
+            for(uint32_t j=0;j<C.getHeight();j++)
+            for(uint32_t i=0;i<C.getWidth();i++)
+            for(uint32_t c=0;c<4;c++)
+            {
+                REQUIRE( C(i,j,c) == I(i+8,j+4,c) );
+            }
+
+            REQUIRE( V.hash() == C.view().hash() );
+            REQUIRE( C.view().hash() == C.hash() );
+            REQUIRE( V.nextMipMap().hash() == C.nextMipMap().hash() );
+        }
+
+        THEN("Views can be mixed")
+        {
+            gul::Image J(64,48,4);
+            fillRandom(J, 91);
+            gul::Image T(64,48,4);
+            fillRandom(T, 92);
+
+            auto D = gul::mix(V, J.view(8,4,20,16), 0.3f);
+            auto E = gul::mix(gul::Image(V), gul::Image(J.view(8,4,20,16)), 0.3f);
+            REQUIRE( samePixels(D, E) );
+
+            auto D2 = gul::mix(V, J.view(8,4,20,16), T.view(8,4,20,16));
+            auto E2 = gul::mix(gul::Image(V), gul::Image(J.view(8,4,20,16)), gul::Image(T.view(8,4,20,16)));
+            REQUIRE( samePixels(D2, E2) );
+
+            // write the result back into the image
+            gul::mix(V, J.view(8,4,20,16), 0.3f, V);
+            REQUIRE( samePixels(gul::Image(I.view(8,4,20,16)), E) );
+            REQUIRE_THROWS( gul::mix(V, J.view(0,0,4,4), 0.3f, V) );
+        }
+
+        THEN("The mipmap can be written into another view")
+        {
+            gul::Image M(32,32,4);
+            V.nextMipMap( M.view(5,5,10,8) );
+            auto ref = gul::Image(V).nextMipMap();
+            REQUIRE( samePixels(gul::Image(M.view(5,5,10,8)), ref) );
+            REQUIRE_THROWS( V.nextMipMap( M.view(0,0,9,8) ) );
+        }
+
+        THEN("The channels of a view can be used in expressions")
+        {
+            gul::Image ref(V);
+            ref.r = gul::mix(ref.g, ref.b, 0.25f);
+            ref.a = ref.r + ref.g;
+
+            V.channel(0) = gul::mix(V.channel(1), V.channel(2), 0.25f);
+            V.channel(3) = V.channel(0) + V.channel(1);
+
+            REQUIRE( samePixels(gul::Image(V), ref) );
+
+            // the pixels outside the view are unchanged
+            gul::Image J(64,48,4);
+            fillRandom(J, 90);
+            REQUIRE( I(7,4,0) == J(7,4,0) );
+            REQUIRE( I(28,4,0) == J(28,4,0) );
+            REQUIRE( I(8,20,3) == J(8,20,3) );
+        }
+    }
+
+    GIVEN("A view of external memory")
+    {
+        std::vector<uint8_t> mem(10*6, 0);
+        gul::ImageView V(mem.data(), 3, 4, 2, 10);
+        V.channel(1) = uint8_t(7);
+
+        gul::ConstImageView C = V;
+        REQUIRE( C(2,3,1) == 7 );
+        REQUIRE( mem[3*10 + 2*2 + 1] == 7 );
+        REQUIRE( mem[3*10 + 3*2 + 1] == 0 );
+    }
+}
+
+TEST_CASE("Channel copy and fill kernels match the scalar versions")
+{
+    std::mt19937 gen(100);
+    std::uniform_int_distribution<int> D(0,255);
+
+    for(uint32_t dstStride : {1u,2u,3u,4u})
+    for(uint32_t srcStride : {1u,2u,3u,4u})
+    for(size_t n : {size_t(1), size_t(15), size_t(16), size_t(37), size_t(100)})
+    {
+        std::vector<uint8_t> src(n*srcStride), A(n*dstStride), B;
+        for(auto & x : src) x = static_cast<uint8_t>(D(gen));
+        for(auto & x : A)   x = static_cast<uint8_t>(D(gen));
+
+        uint32_t srcOffset = srcStride - 1;
+        uint32_t dstOffset = dstStride / 2;
+
+        B = A;
+        gul::detail::channel_copy       (A.data(), dstOffset, dstStride, src.data(), srcOffset, srcStride, n);
+        gul::detail::channel_copy_scalar(B.data(), dstOffset, dstStride, src.data(), srcOffset, srcStride, n);
+        REQUIRE( A == B );
+
+        gul::detail::channel_fill(A.data(), dstOffset, dstStride, 77, n);
+        for(size_t i=0;i<n;i++)
+        {
+            B[i*dstStride + dstOffset] = 77;
+        }
+        REQUIRE( A == B );
+    }
+}
+
+SCENARIO("Copying channels between images")
+{
+    GIVEN("An RGBA image and a single channel image")
+    {
+        gul::Image I(37,21,4);
+        gul::Image G(37,21,1);
+        fillRandom(I, 110);
+        fillRandom(G, 111);
+        gul::Image ref = I;
+
+        WHEN("We copy a channel into the other channels")
+        {
+            I.b = I.r;
+            I.a = G.r;
+            G.r = I.g;
+            THEN("Only the destination channel changes")
+            {
+                for(uint32_t j=0;j<21;j++)
+                for(uint32_t i=0;i<37;i++)
+                {
+                    REQUIRE( I(i,j,0) == ref(i,j,0) );
+                    REQUIRE( I(i,j,1) == ref(i,j,1) );
+                    REQUIRE( I(i,j,2) == ref(i,j,0) );
+                    REQUIRE( G(i,j,0) == ref(i,j,1) );
+                }
+            }
+        }
+        WHEN("We copy between views")
+        {
+            gul::Image J(50,30,4);
+            auto V = J.view(3,5,20,10);
+            V.channel(1) = I.view(1,1,20,10).channel(3);
+            V.channel(2) = uint8_t(9);
+            THEN("Only the pixels in the view change")
+            {
+                for(uint32_t j=0;j<30;j++)
+                for(uint32_t i=0;i<50;i++)
+                {
+                    bool inside = i >= 3 && i < 23 && j >= 5 && j < 15;
+                    REQUIRE( J(i,j,1) == (inside ? I(i-2,j-4,3) : 0) );
+                    REQUIRE( J(i,j,2) == (inside ? 9 : 0) );
+                    REQUIRE( J(i,j,0) == 0 );
+                }
+            }
+        }
+        WHEN("We copy assign an image")
+        {
+            gul::Image C(2,2,1);
+            C = I;
+            THEN("The images are the same")
+            {
+                REQUIRE( samePixels(C, I) );
+            }
+        }
+    }
+}
+
+SCENARIO("Planar images")
+{
+    GIVEN("Random images of every channel count")
+    {
+        for(uint32_t ch = 1; ch <= 4; ch++)
+        {
+            gul::Image I(37, 23, ch);
+            fillRandom(I, 30 + ch);
+            auto P = I;
+            P.setPlanar(true);
+
+            THEN("The pixels and channels are the same, stored one plane after the other")
+            {
+                REQUIRE( P.isPlanar() );
+                REQUIRE( P.size() == I.size() );
+                auto const * d = static_cast<uint8_t const*>(P.data());
+                for(uint32_t j = 0; j < I.getHeight(); j++)
+                for(uint32_t i = 0; i < I.getWidth(); i++)
+                {
+                    for(uint32_t c = 0; c < ch; c++)
+                    {
+                        REQUIRE( P(i,j,c) == I(i,j,c) );
+                        REQUIRE( d[ (size_t(c)*I.getHeight() + j)*I.getWidth() + i ] == I(i,j,c) );
+                    }
+                    REQUIRE( P.r(i,j) == I.r(i,j) );
+                    REQUIRE( P.g(i,j) == I.g(i,j) );
+                    REQUIRE( P.b(i,j) == I.b(i,j) );
+                    REQUIRE( P.a(i,j) == I.a(i,j) );
+                }
+                P.setPlanar(false);
+                REQUIRE( samePixels(P, I) );
+            }
+
+            THEN("Copies keep the layout and assigning converts into views")
+            {
+                auto Q = P;
+                REQUIRE( Q.isPlanar() );
+                REQUIRE( samePixels(Q, P) );
+
+                gul::ImageArray A;
+                A.allocateContiguous(I.getWidth(), I.getHeight(), 2, 1, ch);
+                auto & L = A.layer[1].level[0];
+                auto * p = L.data();
+                L = P;
+                REQUIRE( L.data() == p );
+                REQUIRE( !L.isPlanar() );
+                REQUIRE( samePixels(L, I) );
+                REQUIRE_THROWS_AS( A.layer[0].level[0].setPlanar(true), std::logic_error );
+            }
+
+            THEN("Mip maps and resizing give the same pixels as the interleaved image")
+            {
+                auto M = P.nextMipMap();
+                REQUIRE( M.isPlanar() );
+                M.setPlanar(false);
+                REQUIRE( samePixels(M, I.nextMipMap()) );
+
+                auto R = P.resized(20, 30, gul::ImageFilter::Lanczos3);
+                REQUIRE( R.isPlanar() );
+                R.setPlanar(false);
+                REQUIRE( samePixels(R, I.resized(20, 30, gul::ImageFilter::Lanczos3)) );
+            }
+
+            THEN("A ConstImageView reads an interleaved copy and an ImageView throws")
+            {
+                REQUIRE_THROWS_AS( gul::ImageView(P), std::logic_error );
+
+                gul::ConstImageView S;
+                {
+                    gul::ConstImageView V(P);
+                    REQUIRE( V.data() != P.data() );
+                    REQUIRE( V(1,2,0) == I(1,2,0) );
+                    REQUIRE( V.hash() == I.hash() );
+                    S = V.subView(1, 1, 4, 4);
+                }
+                // the sub view keeps the copy alive
+                REQUIRE( S(0,0,ch-1) == I(1,1,ch-1) );
+
+                auto L = gul::detail::interleaved_copy(P);
+                REQUIRE( P.isPlanar() );
+                REQUIRE( !L.isPlanar() );
+                REQUIRE( samePixels(L, I) );
+                gul::ConstImageView V(L);
+                REQUIRE( V(1,2,0) == I(1,2,0) );
+            }
+
+            THEN("Mixing planar images gives a planar image")
+            {
+                gul::Image J(37, 23, ch);
+                fillRandom(J, 40 + ch);
+                auto Jp = J;
+                Jp.setPlanar(true);
+                auto X = gul::mix(P, Jp, 0.25f);
+                REQUIRE( X.isPlanar() );
+                X.setPlanar(false);
+                REQUIRE( samePixels(X, gul::mix(I, J, 0.25f)) );
+            }
+        }
+    }
+
+    GIVEN("A planar image")
+    {
+        gul::Image P(8, 8, 3);
+        P.setPlanar(true);
+        THEN("Resizing it past the 32 bit channel offsets throws before allocating")
+        {
+            REQUIRE_THROWS_AS( P.resize(40000, 40000, 3), std::length_error );
+            REQUIRE( P.getWidth() == 8 );
+            REQUIRE( P.isPlanar() );
+            P.resize(16, 4, 3);
+            REQUIRE( &P.b(0,0) == static_cast<uint8_t const*>(P.data()) + 2*64 );
+        }
+        THEN("Copying interleaved bytes into it makes it interleaved")
+        {
+            const uint8_t px[16] = {1,2,3,4, 5,6,7,8, 9,10,11,12, 13,14,15,16};
+            P.copyFromBuffer(px, 16, 2, 2, 4);
+            REQUIRE( !P.isPlanar() );
+            REQUIRE( P.r(1,0) == 5 );
+            REQUIRE( P.a(1,1) == 16 );
+        }
+    }
+
+    GIVEN("An RGBA image and its planar copy")
+    {
+        gul::Image I(53, 17);
+        fillRandom(I, 9, 0, 127);
+        auto P = I;
+        P.setPlanar(true);
+
+        THEN("The channel operators run on the planes and agree with the interleaved kernels")
+        {
+            I.a = I.r + I.g;
+            P.a = P.r + P.g;
+            I.b = I.r * I.a;
+            P.b = P.r * P.a;
+            I.g = mix(I.r, I.b, 0.3f);
+            P.g = mix(P.r, P.b, 0.3f);
+            I.r = mix(I.g, I.b, I.a);
+            P.r = mix(P.g, P.b, P.a);
+            P.setPlanar(false);
+            REQUIRE( samePixels(P, I) );
+        }
+
+        THEN("Channels can be copied between layouts")
+        {
+            gul::Image J(53, 17);
+            J.g = P.b;
+            J.r = uint8_t(3);
+            for(uint32_t j = 0; j < I.getHeight(); j++)
+            for(uint32_t i = 0; i < I.getWidth(); i++)
+            {
+                REQUIRE( J(i,j,1) == I(i,j,2) );
+                REQUIRE( J(i,j,0) == 3 );
+            }
+        }
+    }
+}
+
+TEST_CASE("Interleave and deinterleave kernels match the scalar versions")
+{
+    for(uint32_t C = 1; C <= 4; C++)
+    {
+        for(size_t n : {size_t(1), size_t(15), size_t(16), size_t(67)})
+        {
+            std::vector<uint8_t> src(n*C), planes(n*C), back(n*C);
+            for(size_t i = 0; i < src.size(); i++)
+                src[i] = static_cast<uint8_t>(i * 7 + C);
+            gul::detail::deinterleave(src.data(), n, C, planes.data());
+            for(size_t i = 0; i < n; i++)
+                for(uint32_t c = 0; c < C; c++)
+                    REQUIRE( planes[c*n + i] == src[i*C + c] );
+            gul::detail::interleave(planes.data(), n, C, back.data());
+            REQUIRE( back == src );
+        }
+    }
+}
+
+TEST_CASE("Fixed point operators round exactly")
+{
+    for(uint32_t a = 0; a < 256; a++)
+    for(uint32_t b = 0; b < 256; b++)
+    {
+        auto A = uint8_t(a), B = uint8_t(b);
+        REQUIRE( gul::detail::fixed_op_sum::apply(A, B, 0) == std::min(255u, a + b) );
+        REQUIRE( gul::detail::fixed_op_product::apply(A, B, 0) == uint32_t(std::lround(a * b / 255.0)) );
+        for(uint32_t t : {0u, 1u, 77u, 128u, 254u, 255u})
+        {
+            REQUIRE( gul::detail::fixed_op_mix::apply(A, B, uint8_t(t)) == uint32_t(std::lround( (a * (255.0 - t) + b * double(t)) / 255.0 )) );
+        }
+    }
+    for(uint32_t v = 0; v <= 255u*255u; v++)
+        REQUIRE( gul::detail::div255_round(v) == uint32_t(std::lround(v / 255.0)) );
+}
+
+SCENARIO("Fixed point channel expressions")
+{
+    // reference results using the scalar operators one pixel at a time
+    auto fixedRef = [](gul::ColorChannel const & a, gul::ColorChannel const & b, uint32_t i, uint32_t j, int op, uint8_t t)
+    {
+        switch(op)
+        {
+            case 0:  return gul::detail::fixed_op_sum::apply(a(i,j), b(i,j), 0);
+            case 1:  return gul::detail::fixed_op_product::apply(a(i,j), b(i,j), 0);
+            default: return gul::detail::fixed_op_mix::apply(a(i,j), b(i,j), t);
+        }
+    };
+
+    GIVEN("RGBA, planar, 3-channel and 2-channel images")
+    {
+        for(uint32_t layout = 0; layout < 4; layout++)
+        {
+            gul::Image I(71, 19, layout >= 2 ? 5 - layout : 4);
+            fillRandom(I, 60 + layout);
+            if( layout == 1 )
+                I.setPlanar(true);
+            gul::Image G(71, 19, 1);
+            fillRandom(G, 70 + layout);
+
+            auto J = I;
+            auto check = [&](gul::ColorChannel const & out, gul::ColorChannel const & a, gul::ColorChannel const & b, int op, gul::ColorChannel const * t, uint8_t tc)
+            {
+                for(uint32_t j = 0; j < out.getHeight(); j++)
+                for(uint32_t i = 0; i < out.getWidth(); i++)
+                    REQUIRE( out(i,j) == fixedRef(a, b, i, j, op, t ? (*t)(i,j) : tc) );
+            };
+
+            THEN("The results match the scalar operators")
+            {
+                I.g = gul::fixedPoint(J.r + J.g);
+                check(I.g, J.r, J.g, 0, nullptr, 0);
+                I.g = gul::fixedPoint(J.r * J.g);
+                check(I.g, J.r, J.g, 1, nullptr, 0);
+                I.g = gul::fixedPoint(mix(J.r, J.g, 0.3f));
+                check(I.g, J.r, J.g, 2, nullptr, uint8_t(77));
+                I.g = gul::fixedPoint(mix(J.r, G.r, J.g));
+                check(I.g, J.r, G.r, 2, &J.g, 0);
+                G.r = gul::fixedPoint(J.g + J.r);
+                check(G.r, J.g, J.r, 0, nullptr, 0);
+            }
+
+            THEN("The output can be one of the inputs")
+            {
+                I.r = gul::fixedPoint(I.r * I.g);
+                check(I.r, J.r, J.g, 1, nullptr, 0);
+            }
+
+            THEN("They stay within one step of the float path")
+            {
+                auto K = I;
+                I.g = gul::fixedPoint(mix(J.r, G.r, J.g));
+                K.g = mix(J.r, G.r, J.g);
+                for(uint32_t j = 0; j < I.getHeight(); j++)
+                for(uint32_t i = 0; i < I.getWidth(); i++)
+                    REQUIRE( std::abs(int(I.g(i,j)) - int(K.g(i,j))) <= 1 );
+            }
+
+            THEN("They can be used inside other expressions")
+            {
+                gul::channel1f F(71, 19);
+                F = gul::fixedPoint(J.r * J.g);
+                for(uint32_t j = 0; j < J.getHeight(); j++)
+                for(uint32_t i = 0; i < J.getWidth(); i++)
+                    REQUIRE( F(i,j) * 255.0f == Approx( fixedRef(J.r, J.g, i, j, 1, 0) ) );
+            }
+        }
+    }
+}
+
+TEST_CASE("Image copy and channel benchmarks", "[.benchmark]")
+{
+    gul::Image I(1024,1024,4);
+    gul::Image J(1024,1024,4);
+    gul::Image G(1024,1024,1);
+    fillRandom(I, 120);
+
+    // the per-pixel loops used before the bulk kernels
+    auto copyChannel = [](gul::ColorChannel & d, gul::ColorChannel const & s)
+    {
+        for(uint32_t j=0;j<s.getHeight();j++)
+        for(uint32_t i=0;i<s.getWidth();i++)
+            d(i,j) = s(i,j);
+    };
+
+    BENCHMARK("Image copy, per pixel")
+    {
+        for(uint32_t j=0;j<I.getHeight();j++)
+        for(uint32_t i=0;i<I.getWidth();i++)
+        for(uint32_t c=0;c<4;c++)
+            J(i,j,c) = I(i,j,c);
+        return J(1,1,1);
+    };
+    BENCHMARK("Image copy, operator=")
+    {
+        J = I;
+        return J(1,1,1);
+    };
+
+    BENCHMARK("Channel RGBA->RGBA, per pixel")
+    {
+        copyChannel(J.b, I.r);
+        return J(1,1,2);
+    };
+    BENCHMARK("Channel RGBA->RGBA, operator=")
+    {
+        J.b = I.r;
+        return J(1,1,2);
+    };
+
+    BENCHMARK("Channel extract RGBA->R, per pixel")
+    {
+        copyChannel(G.r, I.g);
+        return G(1,1,0);
+    };
+    BENCHMARK("Channel extract RGBA->R, operator=")
+    {
+        G.r = I.g;
+        return G(1,1,0);
+    };
+
+    BENCHMARK("Channel insert R->RGBA, per pixel")
+    {
+        copyChannel(J.a, G.r);
+        return J(1,1,3);
+    };
+    BENCHMARK("Channel insert R->RGBA, operator=")
+    {
+        J.a = G.r;
+        return J(1,1,3);
+    };
+
+    BENCHMARK("Channel fill, per pixel")
+    {
+        for(uint32_t j=0;j<J.getHeight();j++)
+        for(uint32_t i=0;i<J.getWidth();i++)
+            J.a(i,j) = 255;
+        return J(1,1,3);
+    };
+    BENCHMARK("Channel fill, operator=")
+    {
+        J.a = uint8_t(255);
+        return J(1,1,3);
+    };
+
+    gul::Image P = I;
+    P.setPlanar(true);
+    BENCHMARK("Channel mix, interleaved")
+    {
+        J.r = mix(I.g, I.b, I.a);
+        return J(1,1,0);
+    };
+    BENCHMARK("Channel mix, planar")
+    {
+        P.r = mix(P.g, P.b, P.a);
+        return P(1,1,0);
+    };
+    BENCHMARK("Channel mix, interleaved, fixed point")
+    {
+        J.r = gul::fixedPoint(mix(I.g, I.b, I.a));
+        return J(1,1,0);
+    };
+    BENCHMARK("Channel mix, planar, fixed point")
+    {
+        P.r = gul::fixedPoint(mix(P.g, P.b, P.a));
+        return P(1,1,0);
+    };
+    BENCHMARK("Channel multiply, planar")
+    {
+        P.r = P.g * P.b;
+        return P(1,1,0);
+    };
+    BENCHMARK("Channel multiply, planar, fixed point")
+    {
+        P.r = gul::fixedPoint(P.g * P.b);
+        return P(1,1,0);
+    };
+    BENCHMARK("Deinterleave RGBA")
+    {
+        P.setPlanar(false);
+        P.setPlanar(true);
+        return P(1,1,0);
+    };
+}
+
+TEST_CASE("hash64 streaming gives the same result as one shot")
+{
+    std::vector<uint8_t> buf(5000);
+    std::mt19937 gen(130);
+    for(auto & x : buf) x = static_cast<uint8_t>(gen());
+
+    for(size_t len : {size_t(0), size_t(1), size_t(63), size_t(64), size_t(65), size_t(1024), size_t(1025), size_t(5000)})
+    {
+        auto ref = gul::hash64(buf.data(), len);
+        for(size_t chunk : {size_t(1), size_t(7), size_t(64), size_t(100), size_t(1024)})
+        {
+            gul::hash64_stream H;
+            for(size_t i = 0; i < len; i += chunk)
+            {
+                H.update(buf.data() + i, std::min(chunk, len - i));
+            }
+            REQUIRE( H.digest() == ref );
+        }
+    }
+}
+
+TEST_CASE("hash64 depends on every byte, the length and the seed")
+{
+    std::vector<uint8_t> buf(3000, 0);
+    auto ref = gul::hash64(buf.data(), buf.size());
+
+    REQUIRE( gul::hash64(buf.data(), buf.size(), 1) != ref );
+    REQUIRE( gul::hash64(buf.data(), buf.size()-1)  != ref );
+
+    std::vector<uint64_t> hashes;
+    for(size_t i = 0; i < buf.size(); i += 37)
+    {
+        buf[i] = 1;
+        hashes.push_back( gul::hash64(buf.data(), buf.size()) );
+        buf[i] = 0;
+    }
+    hashes.push_back(ref);
+    std::sort(hashes.begin(), hashes.end());
+    REQUIRE( std::unique(hashes.begin(), hashes.end()) == hashes.end() );
+}
+
+TEST_CASE("buffer_pool size classes")
+{
+    using P = gul::buffer_pool;
+    REQUIRE( P::size_class(1) == 0 );
+    REQUIRE( P::size_class(256) == 0 );
+    REQUIRE( P::class_size(1) == 320 );
+    REQUIRE( P::class_size(4) == 512 );
+    REQUIRE( P::class_size(5) == 640 );
+    for(size_t n = 1; n < 100000; n += 7)
+    {
+        auto c = P::size_class(n);
+        REQUIRE( P::class_size(c) >= n );
+        REQUIRE( (c == 0 || P::class_size(c-1) < n) );
+        REQUIRE( P::class_size(c) * 4 <= n * 5 + 4 * 256 );
+    }
+    REQUIRE( P::size_class( P::class_size(P::max_size_class) ) == P::max_size_class );
+    REQUIRE( P::size_class( P::class_size(P::max_size_class) + 1 ) == P::max_size_class + 1 );
+}
+
+// channel1f keeps a plain vector, only its scratch memory is pooled
+static_assert( std::is_same<decltype(gul::channel1f::data), std::vector<float> >::value, "channel1f::data must stay a std::vector<float>" );
+
+// the pool is opt-in, enables it for a test and restores the default
+struct pool_enabled
+{
+    pool_enabled()
+    {
+        gul::buffer_pool::global().set_enabled(true);
+    }
+    ~pool_enabled()
+    {
+        gul::buffer_pool::global().set_enabled(false);
+    }
+};
+
+SCENARIO("Images and channels reuse pooled buffers")
+{
+    auto & pool = gul::buffer_pool::global();
+    REQUIRE( !pool.enabled() );
+    REQUIRE( pool.capacity() == size_t(32) << 20 );
+    pool_enabled enabled;
+
+    GIVEN("An image which is destroyed")
+    {
+        void * p = nullptr;
+        {
+            gul::Image I(300, 200);
+            fillRandom(I, 3);
+            p = I.data();
+        }
+        pool.reset_stats();
+
+        THEN("The next image of the same size gets the same, zeroed, block")
+        {
+            gul::Image J(200, 300);
+            REQUIRE( J.data() == p );
+            REQUIRE( pool.stats().local_hits == 1 );
+            REQUIRE( pool.stats().misses == 0 );
+            auto const * d = static_cast<uint8_t const*>(J.data());
+            REQUIRE( std::all_of(d, d + J.size(), [](uint8_t x){ return x == 0; }) );
+        }
+
+        THEN("Copies, copy-on-write detaching and channel1f scratch memory hit the pool")
+        {
+            gul::Image J(300, 200);
+            fillRandom(J, 4);
+            gul::Image K(J); // first miss
+            for(int i = 0; i < 10; i++)
+            {
+                gul::Image L(J);
+                gul::channel1f F(300, 200);
+                F = J.r * J.g;
+            }
+            // L and the scratch of F each iteration, all but the first hit
+            auto s = pool.stats();
+            REQUIRE( s.misses <= 3 );
+            REQUIRE( s.hits() >= 19 );
+            REQUIRE( s.hit_rate() > 0.8 );
+        }
+    }
+
+    GIVEN("Threads which allocate and exit")
+    {
+        pool.release_cached();
+        pool.reset_stats();
+        std::vector<std::thread> T;
+        for(int k = 0; k < 4; k++)
+        {
+            T.emplace_back([]()
+            {
+                for(int i = 0; i < 20; i++)
+                {
+                    gul::Image I(128, 128);
+                    I.r = uint8_t(i);
+                }
+            });
+        }
+        for(auto & t : T)
+            t.join();
+
+        THEN("Each thread reuses its own block and gives it to the shared list on exit")
+        {
+            auto s = pool.stats();
+            REQUIRE( s.misses <= 4 );
+            REQUIRE( s.local_hits >= 4*19 );
+            REQUIRE( s.shared_bytes >= gul::buffer_pool::class_size( gul::buffer_pool::size_class(128*128*4) ) );
+
+            gul::Image I(128, 128);
+            REQUIRE( pool.stats().shared_hits == s.shared_hits + 1 );
+        }
+    }
+
+    GIVEN("A pool without room or which is disabled")
+    {
+        pool.release_cached();
+        pool.reset_stats();
+
+        THEN("Blocks are freed when there is no room for them")
+        {
+            const auto cap = pool.capacity();
+            const auto tcap = pool.thread_capacity();
+            pool.set_capacity(0);
+            pool.set_thread_capacity(0);
+            {
+                gul::Image I(64, 64);
+            }
+            REQUIRE( pool.stats().discards == 1 );
+            REQUIRE( pool.stats().shared_bytes == 0 );
+            pool.set_capacity(cap);
+            pool.set_thread_capacity(tcap);
+        }
+
+        THEN("Disabling the pool sends every allocation to the heap")
+        {
+            pool.set_enabled(false);
+            for(int i = 0; i < 3; i++)
+            {
+                gul::Image I(64, 64);
+            }
+            REQUIRE( pool.stats().hits() == 0 );
+            REQUIRE( pool.stats().misses == 3 );
+            pool.set_enabled(true);
+        }
+    }
+}
+
+SCENARIO("Hashing images")
+{
+    GIVEN("Images with different channel counts")
+    {
+        for(uint32_t ch : {1u,2u,3u,4u})
+        {
+            gul::Image I(33,17,ch);
+            fillRandom(I, 140+ch);
+            gul::Image J = I;
+
+            REQUIRE( I.hash() == J.hash() );
+            REQUIRE( std::hash<gul::Image>()(I) == static_cast<size_t>(I.hash()) );
+
+            // the last byte of the image is part of the hash
+            J(32,16,ch-1) ^= 1;
+            REQUIRE( I.hash() != J.hash() );
+
+            // so is the shape
+            gul::Image K(17,33,ch);
+            memcpy(K.data(), I.data(), I.size());
+            REQUIRE( I.hash() != K.hash() );
+
+            THEN("The image can be hashed as it is loaded")
+            {
+                auto H = gul::Image::hashStream(I.getWidth(), I.getHeight(), I.getChannels());
+                auto * p = static_cast<uint8_t const*>(I.data());
+                for(size_t i = 0; i < I.size(); i += 100)
+                {
+                    H.update(p + i, std::min<size_t>(100, I.size() - i));
+                }
+                REQUIRE( H.digest() == I.hash() );
+            }
+        }
+    }
+}
+
+SCENARIO("Copy-on-write images")
+{
+    GIVEN("An image which is not in copy-on-write mode")
+    {
+        gul::Image A(16,16,4);
+        fillRandom(A, 150);
+        gul::Image B = A;
+        THEN("Copies do not share memory")
+        {
+            REQUIRE( !A.isCopyOnWrite() );
+            REQUIRE( static_cast<gul::Image const&>(A).data() != static_cast<gul::Image const&>(B).data() );
+        }
+    }
+
+    GIVEN("An image in copy-on-write mode")
+    {
+        gul::Image A(16,16,4);
+        fillRandom(A, 151);
+        A.setCopyOnWrite(true);
+
+        gul::Image const ref(A.view());
+
+        gul::Image B = A;
+        gul::Image C(4,4,1);
+        C = A;
+
+        auto constData = [](gul::Image const & I)
+        {
+            return I.data();
+        };
+
+        THEN("Copies share the pixels")
+        {
+            REQUIRE( B.isCopyOnWrite() );
+            REQUIRE( A.isShared() );
+            REQUIRE( B.isShared() );
+            REQUIRE( constData(A) == constData(B) );
+            REQUIRE( constData(A) == constData(C) );
+            REQUIRE( samePixels(B, ref) );
+            REQUIRE( B.hash() == ref.hash() );
+        }
+
+        WHEN("A copy is modified through operator()")
+        {
+            B(0,0,0) ^= 0xFF;
+            THEN("Only the copy changes")
+            {
+                REQUIRE( constData(A) != constData(B) );
+                REQUIRE( samePixels(A, ref) );
+                REQUIRE( B(0,0,0) == (ref(0,0,0) ^ 0xFF) );
+                REQUIRE( B(1,0,0) == ref(1,0,0) );
+            }
+        }
+
+        WHEN("A copy is modified through a channel")
+        {
+            gul::ColorChannel & red = B.r;
+            gul::ColorChannel green = B.g;
+
+            B.a = B.r + B.b;
+            THEN("The channels point to the new buffer")
+            {
+                REQUIRE( constData(A) != constData(B) );
+                REQUIRE( samePixels(A, ref) );
+                REQUIRE( &red(3,2) == &B(3,2,0) );
+
+                green = uint8_t(7);
+                REQUIRE( B(3,2,1) == 7 );
+                REQUIRE( A(3,2,1) == ref(3,2,1) );
+            }
+        }
+
+        WHEN("A copy of a channel is read after its image was modified")
+        {
+            gul::ColorChannel green = B.g;
+            B.g = uint8_t(7);
+
+            gul::Image X(16,16,4);
+            X.r = green;
+            X.g = green + B.r;
+            X.b = B.g + B.r;
+            THEN("It reads the new buffer")
+            {
+                REQUIRE( green(3,2) == 7 );
+                REQUIRE( green.eval(3,2) == Approx(7.0f / 255.0f) );
+                REQUIRE( X(3,2,0) == 7 );
+                for(uint32_t j = 0; j < 16; j++)
+                for(uint32_t i = 0; i < 16; i++)
+                    REQUIRE( X(i,j,1) == X(i,j,2) );
+                REQUIRE( A(3,2,1) == ref(3,2,1) );
+            }
+        }
+
+        WHEN("The image is moved while a copy of its channel exists")
+        {
+            gul::ColorChannel green = B.g;
+            gul::Image D( std::move(B) );
+            green = uint8_t(9);
+            THEN("The copy refers to the image it was moved into")
+            {
+                REQUIRE( D(3,2,1) == 9 );
+                REQUIRE( green(3,2) == 9 );
+                REQUIRE( samePixels(A, ref) );
+                REQUIRE( samePixels(C, ref) );
+            }
+        }
+
+        WHEN("A copy of a channel outlives its image")
+        {
+            std::vector<gul::ColorChannel> channels;
+            {
+                gul::Image D = A;
+                channels.push_back(D.b);
+                REQUIRE( channels.front().valid() );
+            }
+            THEN("It no longer refers to any pixels")
+            {
+                REQUIRE( !channels.front().valid() );
+                REQUIRE( samePixels(A, ref) );
+            }
+        }
+
+        WHEN("The original is modified through a view")
+        {
+            A.view(2,2,4,4).channel(1) = uint8_t(3);
+            THEN("The copies are unchanged")
+            {
+                REQUIRE( samePixels(B, ref) );
+                REQUIRE( samePixels(C, ref) );
+                REQUIRE( A(2,2,1) == 3 );
+                REQUIRE( !A.isShared() );
+                REQUIRE( B.isShared() );
+            }
+        }
+
+        WHEN("All the copies are modified")
+        {
+            A.r = uint8_t(1);
+            B.g.apply([](float x, float y){ return x*y; });
+            C.b = gul::mix(C.r, C.g, 0.5f);
+            THEN("Each image has its own buffer")
+            {
+                REQUIRE( constData(A) != constData(B) );
+                REQUIRE( constData(B) != constData(C) );
+                REQUIRE( !A.isShared() );
+                REQUIRE( !B.isShared() );
+                REQUIRE( !C.isShared() );
+            }
+        }
+
+        WHEN("The mode is disabled on a copy")
+        {
+            B.setCopyOnWrite(false);
+            THEN("It gets its own pixels")
+            {
+                REQUIRE( constData(A) != constData(B) );
+                REQUIRE( samePixels(B, ref) );
+                REQUIRE( !B.isCopyOnWrite() );
+                REQUIRE( constData(A) == constData(C) );
+            }
+        }
+    }
+}
+
+SCENARIO("Resizing images")
+{
+    const auto filters = {gul::ImageFilter::Box, gul::ImageFilter::Kaiser, gul::ImageFilter::Lanczos3,
+                          gul::ImageFilter::Bilinear, gul::ImageFilter::Bicubic, gul::ImageFilter::Mitchell};
+
+    GIVEN("A constant image")
+    {
+        gul::Image I(37, 21, 4);
+        I.r = uint8_t(10);
+        I.g = uint8_t(100);
+        I.b = uint8_t(200);
+        I.a = uint8_t(255);
+
+        THEN("It stays constant when enlarged or shrunk with any filter")
+        {
+            for(auto f : filters)
+            {
+                for(auto size : {std::make_pair(100u, 7u), std::make_pair(5u, 64u), std::make_pair(1u, 1u)})
+                {
+                    auto R = I.resized(size.first, size.second, f);
+                    REQUIRE( R.getWidth()  == size.first );
+                    REQUIRE( R.getHeight() == size.second );
+                    for(uint32_t j = 0; j < R.getHeight(); j++)
+                    for(uint32_t i = 0; i < R.getWidth(); i++)
+                    {
+                        REQUIRE( R(i,j,0) == 10 );
+                        REQUIRE( R(i,j,1) == 100 );
+                        REQUIRE( R(i,j,2) == 200 );
+                        REQUIRE( R(i,j,3) == 255 );
+                    }
+                }
+            }
+        }
+    }
+
+    GIVEN("A random image")
+    {
+        gul::Image I(48, 40, 3);
+        fillRandom(I, 21);
+
+        THEN("Interpolating filters reproduce it at the same size")
+        {
+            for(auto f : {gul::ImageFilter::Box, gul::ImageFilter::Bilinear, gul::ImageFilter::Bicubic, gul::ImageFilter::Lanczos3})
+            {
+                REQUIRE( samePixels(I.resized(48, 40, f), I) );
+            }
+        }
+
+        THEN("Shrinking by an integer factor with Box averages the blocks")
+        {
+            auto R = I.resized(12, 10, gul::ImageFilter::Box);
+            for(uint32_t j = 0; j < 10; j++)
+            for(uint32_t i = 0; i < 12; i++)
+            for(uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t sum = 0;
+                for(uint32_t y = 0; y < 4; y++)
+                    for(uint32_t x = 0; x < 4; x++)
+                        sum += I(4*i+x, 4*j+y, c);
+                REQUIRE( std::abs( int(R(i,j,c)) - int((sum + 8) / 16) ) <= 1 );
+            }
+        }
+
+        THEN("The thread pool gives the same result")
+        {
+            gul::thread_pool pool(3);
+            for(auto f : filters)
+            {
+                REQUIRE( samePixels(I.resized(pool, 97, 13, f), I.resized(97, 13, f)) );
+            }
+        }
+    }
+
+    GIVEN("A horizontal ramp")
+    {
+        gul::Image I(16, 2, 1);
+        for(uint32_t i = 0; i < 16; i++)
+            I(i,0,0) = I(i,1,0) = static_cast<uint8_t>(i*16);
+
+        THEN("Bilinear enlarging interpolates between the pixels")
+        {
+            auto R = I.resized(32, 2, gul::ImageFilter::Bilinear);
+            // output pixel 2k+1 is 3/4 of the way from source pixel k to k+1
+            for(uint32_t k = 1; k < 15; k++)
+            {
+                REQUIRE( R(2*k+1, 0, 0) == k*16 + 4 );
+                REQUIRE( R(2*k,   0, 0) == k*16 - 4 );
+            }
+        }
+    }
+
+    GIVEN("An image array")
+    {
+        gul::ImageArray A;
+        A.resize(30, 20, 3, 0);
+        for(uint32_t l = 0; l < 3; l++)
+            fillRandom(A.layer[l].level[0], 30 + l);
+
+        auto R = A.resized(11, 17, gul::ImageFilter::Lanczos3);
+        THEN("Every layer is resized like a single image")
+        {
+            REQUIRE( R.getLayerCount() == 3 );
+            REQUIRE( R.getLevelCount() == 1 );
+            for(uint32_t l = 0; l < 3; l++)
+            {
+                REQUIRE( samePixels(R.layer[l].level[0], A.layer[l].level[0].resized(11, 17, gul::ImageFilter::Lanczos3)) );
+            }
+        }
+    }
+}
+
+TEST_CASE("buffer_pool benchmarks", "[.benchmark]")
+{
+    gul::thread_pool T(4);
+    gul::Image J(1920, 1080);
+
+    // compositor style frames on 4 threads, each with a few full size temporaries
+    auto frames = [&]()
+    {
+        std::atomic<uint32_t> sum{0};
+        T.parallel_for(0, 16, [&](size_t i0, size_t i1)
+        {
+            for(size_t i = i0; i < i1; i++)
+            {
+                gul::Image A(1920, 1080);
+                gul::Image B(J);
+                gul::channel1f F(1920, 1080);
+                sum += A(1,1,0) + B(1,1,0) + uint32_t(F(1,1));
+            }
+        }, 1);
+        return sum.load();
+    };
+
+    BENCHMARK("16 frames of 1080p temporaries, heap")
+    {
+        return frames();
+    };
+    BENCHMARK("16 frames of 1080p temporaries, pooled")
+    {
+        pool_enabled enabled;
+        return frames();
+    };
+}
+
+TEST_CASE("Resize benchmarks", "[.benchmark]")
+{
+    gul::Image I(1024, 768, 4);
+    fillRandom(I, 1);
+    gul::ImageArray A;
+    A.resize(512, 512, 16, 1);
+    for(auto & L : A.layer)
+        fillRandom(L.level[0], 2);
+
+    BENCHMARK("1024x768 -> 256x192 Mitchell")
+    {
+        return I.resized(256, 192);
+    };
+    BENCHMARK("1024x768 -> 256x192 Lanczos3")
+    {
+        return I.resized(256, 192, gul::ImageFilter::Lanczos3);
+    };
+    BENCHMARK("1024x768 -> 2048x1536 Bicubic")
+    {
+        return I.resized(2048, 1536, gul::ImageFilter::Bicubic);
+    };
+    BENCHMARK("16 layers 512x512 -> 128x128 thumbnails")
+    {
+        return A.resized(128, 128);
+    };
+}
@@ -0,0 +1,248 @@
+#include <catch2/catch.hpp>
+
+#include <gul/image/ImageContainer.h>
+#include "test-helpers.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+static std::vector<char> readFile(std::string const & path)
+{
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(0, std::ios::end);
+    std::vector<char> bytes( static_cast<size_t>(in.tellg()) );
+    in.seekg(0, std::ios::beg);
+    in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return bytes;
+}
+
+SCENARIO("Writing and mapping a raw image container")
+{
+    const std::string path = "unit-ImageContainer.gimg";
+
+    GIVEN("An image array with mipmaps")
+    {
+        gul::ImageArray A;
+        A.resize(64,32,3,0);
+        for(uint32_t l = 0; l < A.getLayerCount(); l++)
+        {
+            fillRandom(A.layer[l].level[0], 10+l);
+        }
+        A.generateMipMaps();
+
+        gul::writeImageContainer(path, A);
+
+        WHEN("We map the file")
+        {
+            gul::MappedImageContainer F(path);
+            auto const & H = F.getHeader();
+
+            REQUIRE( H.width    == 64 );
+            REQUIRE( H.height   == 32 );
+            REQUIRE( H.channels == 4 );
+            REQUIRE( H.layers   == 3 );
+            REQUIRE( H.levels   == A.getLevelCount() );
+            REQUIRE( F.byteSize() == H.fileSize );
+
+            gul::ImageArray B = F.getArray();
+
+            THEN("The images are views into the file")
+            {
+                REQUIRE( B.isContiguous() );
+                auto * base = static_cast<uint8_t const*>( static_cast<gul::ImageArray const&>(B).contiguousData() );
+                for(uint32_t i = 0; i < H.levels; i++)
+                {
+                    for(uint32_t l = 0; l < H.layers; l++)
+                    {
+                        auto & I = static_cast<gul::ImageArray const&>(B).layer[l].level[i];
+                        REQUIRE( samePixels(I, A.layer[l].level[i]) );
+                        REQUIRE( static_cast<uint8_t const*>(I.data()) == base + F.getEntry(l,i).offset );
+                        REQUIRE( B.getOffset(l,i) % 4096 == 0 );
+                        F.prefetch(l,i);
+                    }
+                }
+            }
+
+            THEN("The views keep the mapping alive")
+            {
+                gul::ImageMM MM;
+                {
+                    gul::MappedImageContainer G(path);
+                    MM = G.getLayer(2);
+                }
+                for(uint32_t i = 0; i < MM.getLevelCount(); i++)
+                {
+                    REQUIRE( samePixels(MM.level[i], A.layer[2].level[i]) );
+                }
+            }
+
+            THEN("Writing to the images does not change the file")
+            {
+                B.layer[1].level[0].r = uint8_t(0);
+                B.layer[1].level[0](0,0,1) = 0;
+
+                gul::MappedImageContainer G(path);
+                REQUIRE( samePixels(G.getLayer(1).level[0], A.layer[1].level[0]) );
+            }
+        }
+
+        WHEN("The file is truncated")
+        {
+            {
+                auto bytes = readFile(path);
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                out.write(bytes.data(), static_cast<std::streamsize>(bytes.size() / 2));
+            }
+            THEN("Mapping it throws")
+            {
+                REQUIRE_THROWS( gul::MappedImageContainer(path) );
+            }
+        }
+
+        std::remove(path.c_str());
+    }
+
+    GIVEN("A single channel mip chain and a small alignment")
+    {
+        gul::ImageMM MM;
+        MM.level[0].resize(17,9,1);
+        fillRandom(MM.level[0], 20);
+        MM.generateMipMaps();
+
+        gul::writeImageContainer(path, MM, 16);
+
+        gul::MappedImageContainer F(path);
+        auto B = F.getLayer(0);
+
+        REQUIRE( B.getLevelCount() == MM.getLevelCount() );
+        for(uint32_t i = 0; i < MM.getLevelCount(); i++)
+        {
+            REQUIRE( samePixels(B.level[i], MM.level[i]) );
+            REQUIRE( F.getEntry(0,i).offset % 16 == 0 );
+        }
+
+        std::remove(path.c_str());
+    }
+
+    GIVEN("A mip chain with planar levels")
+    {
+        gul::ImageMM MM;
+        MM.level[0].resize(20,12,3);
+        fillRandom(MM.level[0], 30);
+        MM.generateMipMaps();
+        auto I = MM;
+        for(auto & L : MM.level)
+            L.setPlanar(true);
+
+        gul::writeImageContainer(path, MM);
+
+        THEN("The file stores the interleaved pixels")
+        {
+            gul::MappedImageContainer F(path);
+            auto B = F.getLayer(0);
+            REQUIRE( B.getLevelCount() == I.getLevelCount() );
+            for(uint32_t i = 0; i < I.getLevelCount(); i++)
+            {
+                REQUIRE( !B.level[i].isPlanar() );
+                REQUIRE( samePixels(B.level[i], I.level[i]) );
+            }
+        }
+        std::remove(path.c_str());
+    }
+
+    GIVEN("A container whose header or table has been corrupted")
+    {
+        gul::ImageMM MM;
+        MM.level[0].resize(8,8,4);
+        fillRandom(MM.level[0], 30);
+        MM.generateMipMaps();
+        gul::writeImageContainer(path, MM, 16);
+
+        auto bytes = readFile(path);
+        gul::ImageContainerHeader H;
+        std::memcpy(&H, bytes.data(), sizeof(H));
+        gul::ImageContainerEntry E;
+        std::memcpy(&E, bytes.data() + H.tableOffset, sizeof(E));
+
+        // writes a copy of the file with a modified header or first entry
+        auto writeCorrupt = [&](gul::ImageContainerHeader const & h, gul::ImageContainerEntry const & e)
+        {
+            auto b = bytes;
+            std::memcpy(b.data(), &h, sizeof(h));
+            std::memcpy(b.data() + H.tableOffset, &e, sizeof(e));
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(b.data(), static_cast<std::streamsize>(b.size()));
+        };
+
+        THEN("The unmodified file can be opened")
+        {
+            writeCorrupt(H, E);
+            REQUIRE_NOTHROW( gul::MappedImageContainer(path) );
+        }
+        THEN("An offset which wraps around past the end of the file is rejected")
+        {
+            auto e = E;
+            e.offset = ~uint64_t(0) - 8;
+            writeCorrupt(H, e);
+            REQUIRE_THROWS( gul::MappedImageContainer(path) );
+        }
+        THEN("A size which overflows width*height*channels is rejected")
+        {
+            auto e = E;
+            e.width  = 0x80000000u;
+            e.height = 0x80000000u;
+            e.size   = 0; // 2^31 * 2^31 * 4 wraps to 0
+            writeCorrupt(H, e);
+            REQUIRE_THROWS( gul::MappedImageContainer(path) );
+        }
+        THEN("A table which overflows the file is rejected")
+        {
+            auto h = H;
+            h.layers = 0xFFFFFFFFu;
+            h.levels = 0xFFFFFFFFu;
+            writeCorrupt(h, E);
+            REQUIRE_THROWS( gul::MappedImageContainer(path) );
+        }
+        THEN("A container without layers or levels is rejected")
+        {
+            auto h = H;
+            h.layers = 0;
+            writeCorrupt(h, E);
+            REQUIRE_THROWS( gul::MappedImageContainer(path) );
+
+            h = H;
+            h.levels = 0;
+            writeCorrupt(h, E);
+            REQUIRE_THROWS( gul::MappedImageContainer(path) );
+        }
+        THEN("A file written with the other byte order is rejected")
+        {
+            auto h = H;
+            h.magic = 0x4755'4C49u;
+            writeCorrupt(h, E);
+            REQUIRE_THROWS_WITH( gul::MappedImageContainer(path), Catch::Contains("byte order") );
+        }
+
+        std::remove(path.c_str());
+    }
+
+    GIVEN("An image array without layers")
+    {
+        gul::ImageArray A;
+        A.layer.clear();
+        REQUIRE_THROWS( gul::writeImageContainer(path, A) );
+    }
+
+    GIVEN("A file which is not a container")
+    {
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out << "this is not an image container, just some text which is long enough for a header";
+        }
+        REQUIRE_THROWS( gul::MappedImageContainer(path) );
+        REQUIRE_THROWS( gul::MappedImageContainer("does-not-exist.gimg") );
+        std::remove(path.c_str());
+    }
+}
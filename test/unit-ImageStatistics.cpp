@@ -0,0 +1,258 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/ImageStatistics.h>
+#include <gul/image/ColorSpace.h>
+#include "test-helpers.h"
+
+#include <cmath>
+#include <random>
+
+// the textbook definitions, one pixel at a time
+static double bruteMSE(gul::Image const & a, gul::Image const & b, uint32_t c)
+{
+    double s = 0.0;
+    for(uint32_t y = 0; y < a.getHeight(); y++)
+        for(uint32_t x = 0; x < a.getWidth(); x++)
+        {
+            const double d = double(a(x,y,c)) - double(b(x,y,c));
+            s += d * d;
+        }
+    return s / (double(a.getWidth()) * a.getHeight());
+}
+
+static double bruteSSIM(gul::Image const & a, gul::Image const & b, uint32_t c, uint32_t W)
+{
+    const double C1 = 6.5025, C2 = 58.5225;
+    double total = 0.0;
+    uint32_t tiles = 0;
+    for(uint32_t y0 = 0; y0 < a.getHeight(); y0 += W)
+        for(uint32_t x0 = 0; x0 < a.getWidth(); x0 += W)
+        {
+            double mx = 0, my = 0, N = 0;
+            for(uint32_t y = y0; y < std::min(a.getHeight(), y0 + W); y++)
+                for(uint32_t x = x0; x < std::min(a.getWidth(), x0 + W); x++)
+                {
+                    mx += a(x,y,c); my += b(x,y,c); N += 1;
+                }
+            mx /= N; my /= N;
+            double vx = 0, vy = 0, cxy = 0;
+            for(uint32_t y = y0; y < std::min(a.getHeight(), y0 + W); y++)
+                for(uint32_t x = x0; x < std::min(a.getWidth(), x0 + W); x++)
+                {
+                    vx  += (a(x,y,c) - mx) * (a(x,y,c) - mx);
+                    vy  += (b(x,y,c) - my) * (b(x,y,c) - my);
+                    cxy += (a(x,y,c) - mx) * (b(x,y,c) - my);
+                }
+            vx /= N; vy /= N; cxy /= N;
+            total += ((2*mx*my + C1) * (2*cxy + C2)) / ((mx*mx + my*my + C1) * (vx + vy + C2));
+            tiles++;
+        }
+    return total / tiles;
+}
+
+SCENARIO("Image statistics")
+{
+    GIVEN("An image with known values")
+    {
+        gul::Image I(10, 5, 3);
+        I.r = uint8_t(7);
+        I.g = uint8_t(0);
+        I.b = uint8_t(0);
+        for(uint32_t x = 0; x < 10; x++)
+            I(x, 2, 1) = 200;
+        I(3, 4, 2) = 255;
+
+        THEN("Each channel has its own histogram, min, max, mean and deviation")
+        {
+            auto S = gul::imageStatistics(I);
+            REQUIRE( S.size() == 3 );
+            REQUIRE( S[0].min == 7 );
+            REQUIRE( S[0].max == 7 );
+            REQUIRE( S[0].mean == Approx(7.0) );
+            REQUIRE( S[0].stddev == Approx(0.0).margin(1e-9) );
+            REQUIRE( S[0].histogram[7] == 50 );
+
+            REQUIRE( S[1].min == 0 );
+            REQUIRE( S[1].max == 200 );
+            REQUIRE( S[1].histogram[0] == 40 );
+            REQUIRE( S[1].histogram[200] == 10 );
+            REQUIRE( S[1].mean == Approx(40.0) );
+            REQUIRE( S[1].stddev == Approx(80.0) );
+
+            REQUIRE( S[2].max == 255 );
+            REQUIRE( S[2].histogram[255] == 1 );
+        }
+    }
+
+    GIVEN("Random images of every channel count")
+    {
+        gul::thread_pool pool(3);
+        for(uint32_t ch = 1; ch <= 4; ch++)
+        {
+            auto I = makeNoise(37, 131, ch, ch);
+
+            THEN("The histograms match a per pixel count and the pool gives the same result")
+            {
+                auto S = gul::imageStatistics(I);
+                auto P = gul::imageStatistics(pool, I);
+                REQUIRE( S.size() == ch );
+                for(uint32_t c = 0; c < ch; c++)
+                {
+                    std::array<uint64_t,256> h = {};
+                    for(uint32_t y = 0; y < I.getHeight(); y++)
+                        for(uint32_t x = 0; x < I.getWidth(); x++)
+                            h[ I(x,y,c) ]++;
+                    REQUIRE( S[c].histogram == h );
+                    REQUIRE( P[c].histogram == h );
+                    REQUIRE( P[c].mean == S[c].mean );
+                }
+            }
+
+            THEN("A view only counts its own pixels")
+            {
+                auto V = I.view(3, 5, 20, 30);
+                auto S = gul::imageStatistics(V);
+                uint64_t total = 0;
+                for(auto k : S[0].histogram)
+                    total += k;
+                REQUIRE( total == 600 );
+            }
+        }
+    }
+}
+
+SCENARIO("Image comparison")
+{
+    GIVEN("Two random images")
+    {
+        gul::thread_pool pool(3);
+        for(uint32_t ch = 1; ch <= 4; ch++)
+        {
+            auto A = makeNoise(45, 29, ch, 10 + ch);
+            auto B = A;
+            std::mt19937 gen(ch);
+            auto * p = static_cast<uint8_t*>(B.data());
+            for(size_t i = 0; i < B.size(); i++)
+                p[i] = static_cast<uint8_t>( std::min(255, std::max(0, int(p[i]) + int(gen() % 21) - 10)) );
+
+            THEN("The MSE and SSIM match the definitions")
+            {
+                auto D = gul::compareImages(A, B);
+                REQUIRE( D.channels == ch );
+                for(uint32_t c = 0; c < ch; c++)
+                {
+                    REQUIRE( D.mse[c] == Approx(bruteMSE(A, B, c)) );
+                    REQUIRE( D.psnr[c] == Approx(10.0 * std::log10(255.0 * 255.0 / D.mse[c])) );
+                    REQUIRE( D.ssim[c] == Approx(bruteSSIM(A, B, c, 8)).epsilon(1e-9) );
+                    REQUIRE( D.ssim[c] < 1.0 );
+                }
+                REQUIRE( gul::meanSquaredError(A, B) == Approx(D.meanMSE()) );
+                REQUIRE( gul::psnr(A, B) == Approx(D.meanPSNR()) );
+                REQUIRE( gul::ssim(A, B) == Approx(D.meanSSIM()) );
+                REQUIRE( gul::compareImages(A, B, 5).ssim[0] == Approx(bruteSSIM(A, B, 0, 5)).epsilon(1e-9) );
+            }
+
+            THEN("The pool gives the same result")
+            {
+                auto D = gul::compareImages(A, B);
+                auto P = gul::compareImages(pool, A, B);
+                REQUIRE( P.mse == D.mse );
+                REQUIRE( P.ssim == D.ssim );
+            }
+
+            THEN("Identical images have an infinite PSNR and an SSIM of 1")
+            {
+                auto D = gul::compareImages(A, A);
+                REQUIRE( D.meanMSE() == 0.0 );
+                REQUIRE( std::isinf(D.meanPSNR()) );
+                REQUIRE( D.meanSSIM() == Approx(1.0) );
+            }
+
+            THEN("The difference image holds the absolute differences")
+            {
+                auto D = gul::differenceImage(A, B);
+                auto S = gul::differenceImage(pool, A, B, 4.0f);
+                for(uint32_t y = 0; y < A.getHeight(); y++)
+                    for(uint32_t x = 0; x < A.getWidth(); x++)
+                        for(uint32_t c = 0; c < ch; c++)
+                        {
+                            const int d = std::abs( int(A(x,y,c)) - int(B(x,y,c)) );
+                            REQUIRE( D(x,y,c) == d );
+                            REQUIRE( S(x,y,c) == std::min(255, 4*d) );
+                        }
+            }
+        }
+    }
+
+    GIVEN("Images of different sizes")
+    {
+        gul::Image A(8, 8, 4), B(8, 8, 3), C(4, 8, 4);
+        THEN("Comparing them throws")
+        {
+            REQUIRE_THROWS_AS( gul::compareImages(A, B), std::logic_error );
+            REQUIRE_THROWS_AS( gul::meanSquaredError(A, C), std::logic_error );
+            REQUIRE_THROWS_AS( gul::differenceImage(A, C), std::logic_error );
+        }
+    }
+
+    GIVEN("A planar image")
+    {
+        auto A = makeNoise(16, 8, 3, 1);
+        auto P = A;
+        P.setPlanar(true);
+        THEN("The functions taking views read its pixels, not its planes")
+        {
+            auto S = gul::imageStatistics(P);
+            auto R = gul::imageStatistics(A);
+            REQUIRE( S.size() == 3 );
+            for(uint32_t c = 0; c < 3; c++)
+            {
+                REQUIRE( S[c].histogram == R[c].histogram );
+                REQUIRE( S[c].mean == R[c].mean );
+            }
+            REQUIRE( gul::meanSquaredError(A, P) == 0.0 );
+            REQUIRE( std::isinf( gul::psnr(P, A) ) );
+            REQUIRE( gul::compareImages(P, A).ssim[2] == Approx(1.0) );
+            REQUIRE( gul::differenceImage(P, A).hash() == gul::differenceImage(A, A).hash() );
+        }
+        THEN("The planar output of rgbToYCbCr can be measured")
+        {
+            auto Y  = gul::rgbToYCbCr(A);
+            auto Yi = Y;
+            Yi.setPlanar(false);
+            REQUIRE( Y.isPlanar() );
+            auto S = gul::imageStatistics(Y);
+            auto R = gul::imageStatistics(Yi);
+            for(uint32_t c = 0; c < 3; c++)
+            {
+                REQUIRE( S[c].histogram == R[c].histogram );
+            }
+            REQUIRE( gul::meanSquaredError(Y, Yi) == 0.0 );
+        }
+    }
+}
+
+TEST_CASE("Image statistics benchmarks", "[.benchmark]")
+{
+    auto A = makeNoise(2048, 2048, 4, 1);
+    auto B = makeNoise(2048, 2048, 4, 2);
+    gul::thread_pool pool(4);
+
+    BENCHMARK("statistics 2048x2048 rgba")
+    {
+        return gul::imageStatistics(A).size();
+    };
+    BENCHMARK("compare 2048x2048 rgba")
+    {
+        return gul::compareImages(A, B).meanSSIM();
+    };
+    BENCHMARK("compare 2048x2048 rgba 4 threads")
+    {
+        return gul::compareImages(pool, A, B).meanSSIM();
+    };
+    BENCHMARK("difference 2048x2048 rgba")
+    {
+        return gul::differenceImage(A, B).getWidth();
+    };
+}
@@ -0,0 +1,242 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/QoiCodec.h>
+#include "test-helpers.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// gradients, flat areas and a bit of noise so that every op is used
+static void fillMixed(gul::Image & I, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    auto * p = static_cast<uint8_t*>(I.data());
+    const uint32_t C = I.getChannels();
+    for(uint32_t y = 0; y < I.getHeight(); y++)
+    {
+        for(uint32_t x = 0; x < I.getWidth(); x++)
+        {
+            for(uint32_t c = 0; c < C; c++)
+            {
+                uint32_t v;
+                if( y < I.getHeight() / 4 )      v = 40;
+                else if( y < I.getHeight() / 2 ) v = (x*3 + y + c*50) & 0xFF;
+                else if( x < I.getWidth() / 2 )  v = (x*7 + (gen() & 7u) + c*20) & 0xFF;
+                else                             v = gen() & 0xFF;
+                if( c == 3 && (x / 5) % 3 == 0 )
+                    v = 255;
+                p[(size_t(y) * I.getWidth() + x) * C + c] = static_cast<uint8_t>(v);
+            }
+        }
+    }
+}
+
+SCENARIO("Lossless QOI style encoding")
+{
+    for(uint32_t channels = 1; channels <= 4; channels++)
+    {
+        GIVEN("An image with " + std::to_string(channels) + " channels")
+        {
+            gul::Image I(97, 131, channels);
+            fillMixed(I, channels);
+
+            THEN("Encoding and decoding gives the same pixels")
+            {
+                auto E = gul::encodeQOI(I);
+                REQUIRE( E.size() <= gul::qoiMaxEncodedSize(97, 131, channels) );
+                REQUIRE( samePixels(gul::decodeQOI(E), I) );
+
+                auto H = gul::readQOIHeader(E.data(), E.size());
+                REQUIRE( H.width == 97 );
+                REQUIRE( H.height == 131 );
+                REQUIRE( H.channels == channels );
+                REQUIRE( H.chunkCount() == 3 );
+            }
+
+            THEN("The pooled encoder and decoder give identical results")
+            {
+                gul::thread_pool pool(3);
+                for(uint32_t chunkRows : {0u, 1u, 16u, 64u, 200u})
+                {
+                    auto A = gul::encodeQOI(I, chunkRows);
+                    auto B = gul::encodeQOI(pool, I, chunkRows);
+                    REQUIRE( A == B );
+                    REQUIRE( samePixels(gul::decodeQOI(pool, B), I) );
+                }
+            }
+
+            THEN("A planar image encodes to the same stream")
+            {
+                gul::thread_pool pool(3);
+                auto P = I;
+                P.setPlanar(true);
+                auto A = gul::encodeQOI(I, 16);
+                REQUIRE( gul::encodeQOI(P, 16) == A );
+                REQUIRE( gul::encodeQOI(pool, P, 16) == A );
+                REQUIRE( samePixels(gul::decodeQOI(A), I) );
+            }
+
+            THEN("The streaming encoder gives the same result for any row split")
+            {
+                auto A = gul::encodeQOI(I, 16);
+                std::vector<uint8_t> buffer( gul::qoiMaxEncodedSize(97, 131, channels, 16) );
+                gul::QoiEncoder S(97, 131, channels, buffer.data(), buffer.size(), 16);
+                auto * src = static_cast<uint8_t const*>(I.data());
+                uint32_t row = 0;
+                for(uint32_t n : {1u, 20u, 3u, 50u, 57u})
+                {
+                    S.addRows(src + size_t(row) * 97 * channels, n);
+                    row += n;
+                }
+                buffer.resize( S.finish() );
+                REQUIRE( buffer == A );
+            }
+        }
+    }
+
+    GIVEN("Special images")
+    {
+        THEN("Random noise survives and stays within the bound")
+        {
+            gul::Image N(64, 64, 4);
+            fillRandom(N, 1);
+            auto E = gul::encodeQOI(N);
+            REQUIRE( E.size() <= gul::qoiMaxEncodedSize(64, 64, 4) );
+            REQUIRE( samePixels(gul::decodeQOI(E), N) );
+        }
+        THEN("Long runs are split")
+        {
+            gul::Image F(1000, 3, 3);
+            F.r = uint8_t(7);
+            auto E = gul::encodeQOI(F, 0);
+            REQUIRE( E.size() < 100 );
+            REQUIRE( samePixels(gul::decodeQOI(E), F) );
+        }
+        THEN("Empty images can be encoded")
+        {
+            gul::Image Z(0, 0, 4);
+            auto E = gul::encodeQOI(Z);
+            auto D = gul::decodeQOI(E);
+            REQUIRE( D.getWidth() == 0 );
+            REQUIRE( D.getChannels() == 4 );
+        }
+    }
+
+    GIVEN("Invalid input")
+    {
+        gul::Image I(40, 40, 3);
+        fillMixed(I, 7);
+        auto E = gul::encodeQOI(I, 8);
+
+        THEN("A small output buffer throws")
+        {
+            std::vector<uint8_t> small(100);
+            REQUIRE_THROWS_AS( gul::encodeQOI(I, small.data(), small.size()), std::runtime_error );
+        }
+        THEN("Truncated or corrupt streams throw")
+        {
+            REQUIRE_THROWS_AS( gul::decodeQOI(E.data(), 10), std::runtime_error );
+
+            auto T = E;
+            T[0] = 'X';
+            REQUIRE_THROWS_AS( gul::decodeQOI(T), std::runtime_error );
+
+            // point the last chunk past the end of the data
+            T = E;
+            std::memset(T.data() + T.size() - 8, 0xFF, 8);
+            REQUIRE_THROWS_AS( gul::decodeQOI(T), std::runtime_error );
+
+            // cut the encoded pixels of every chunk short
+            T = E;
+            const size_t chunks = 5;
+            for(size_t c = 0; c < chunks; c++)
+            {
+                uint64_t end;
+                std::memcpy(&end, T.data() + T.size() - 8*(chunks - c), 8);
+                end -= 3;
+                std::memcpy(T.data() + T.size() - 8*(chunks - c), &end, 8);
+            }
+            REQUIRE_THROWS_AS( gul::decodeQOI(T), std::runtime_error );
+        }
+        THEN("Adding too many rows throws")
+        {
+            std::vector<uint8_t> buffer( gul::qoiMaxEncodedSize(40, 40, 3) );
+            gul::QoiEncoder S(40, 40, 3, buffer.data(), buffer.size());
+            REQUIRE_THROWS_AS( S.finish(), std::logic_error );
+            S.addRows(I.data(), 40);
+            REQUIRE_THROWS_AS( S.addRows(I.data(), 1), std::logic_error );
+        }
+        THEN("A chunk larger than the image is a single chunk")
+        {
+            gul::thread_pool pool(2);
+            auto A = gul::encodeQOI(I, 0xFFFFFFFFu);
+            REQUIRE( A == gul::encodeQOI(I, 0) );
+            REQUIRE( A == gul::encodeQOI(pool, I, 0xFFFFFFFFu) );
+            REQUIRE( samePixels(gul::decodeQOI(A), I) );
+        }
+    }
+
+    GIVEN("A hand written stream with a single chunk")
+    {
+        // one RGB op and a run of 1, the chunk ends at byte 27
+        gul::QoiHeader H;
+        H.width     = 1;
+        H.height    = 2;
+        H.channels  = 1;
+        H.chunkRows = 0xFFFFFFFFu;
+
+        std::vector<uint8_t> S(sizeof(H));
+        std::memcpy(S.data(), &H, sizeof(H));
+        for(uint8_t b : {uint8_t(0xFE), uint8_t(9), uint8_t(0xC0), uint8_t(27), uint8_t(0), uint8_t(0), uint8_t(0), uint8_t(0), uint8_t(0), uint8_t(0), uint8_t(0)})
+            S.push_back(b);
+
+        THEN("A large chunkRows does not wrap the chunk count")
+        {
+            REQUIRE( gul::readQOIHeader(S.data(), S.size()).chunkCount() == 1 );
+            auto D = gul::decodeQOI(S);
+            REQUIRE( D.r(0,0) == 9 );
+            REQUIRE( D.r(0,1) == 9 );
+        }
+        THEN("A header larger than the stream can encode throws before allocating")
+        {
+            H.width    = 0xFFFF;
+            H.height   = 0xFFFF;
+            H.channels = 4;
+            std::memcpy(S.data(), &H, sizeof(H));
+            REQUIRE_THROWS_AS( gul::readQOIHeader(S.data(), S.size()), std::runtime_error );
+            REQUIRE_THROWS_AS( gul::decodeQOI(S), std::runtime_error );
+
+            // 3 op bytes can hold at most 186 pixels
+            H.width  = 186;
+            H.height = 1;
+            std::memcpy(S.data(), &H, sizeof(H));
+            REQUIRE_NOTHROW( gul::readQOIHeader(S.data(), S.size()) );
+            H.width  = 187;
+            std::memcpy(S.data(), &H, sizeof(H));
+            REQUIRE_THROWS_AS( gul::readQOIHeader(S.data(), S.size()), std::runtime_error );
+        }
+    }
+}
+
+TEST_CASE("QOI codec benchmarks", "[.benchmark]")
+{
+    gul::Image I(2048, 2048, 4);
+    fillMixed(I, 3);
+    gul::thread_pool pool(4);
+    auto E = gul::encodeQOI(I);
+
+    BENCHMARK("encode 2048x2048 RGBA")
+    {
+        return gul::encodeQOI(I);
+    };
+    BENCHMARK("decode 2048x2048 RGBA")
+    {
+        return gul::decodeQOI(E);
+    };
+    BENCHMARK("decode 2048x2048 RGBA 4 threads")
+    {
+        return gul::decodeQOI(pool, E);
+    };
+}
@@ -0,0 +1,129 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/TiledImage.h>
+#include "test-helpers.h"
+
+#include <random>
+
+SCENARIO("Tiled and Morton ordered images")
+{
+    const gul::PixelLayout layouts[] = { gul::PixelLayout::Tiled, gul::PixelLayout::Morton };
+
+    GIVEN("Images of every channel count and awkward sizes")
+    {
+        gul::thread_pool pool(3);
+        for(auto layout : layouts)
+        {
+            for(uint32_t ch = 1; ch <= 4; ch++)
+            {
+                auto I = makeNoise(45 + ch, 38 - ch, ch, ch);
+
+                THEN("The accessors and the round trip give back the pixels")
+                {
+                    auto T = gul::TiledImage::fromImage(I, layout, 8);
+                    REQUIRE( T.getTilesX() == (I.getWidth() + 7) / 8 );
+                    for(uint32_t y = 0; y < I.getHeight(); y++)
+                        for(uint32_t x = 0; x < I.getWidth(); x++)
+                            for(uint32_t c = 0; c < ch; c++)
+                                REQUIRE( T(x,y,c) == I(x,y,c) );
+                    REQUIRE( T.toImage().hash() == I.hash() );
+                    REQUIRE( gul::TiledImage::fromImage(pool, I, layout, 8).toImage(pool).hash() == I.hash() );
+                }
+
+                THEN("The mip maps match Image::nextMipMap")
+                {
+                    auto T = gul::TiledImage::fromImage(I, layout, 8);
+                    auto M = T.nextMipMap();
+                    REQUIRE( M.getWidth() == I.getWidth() / 2 );
+                    REQUIRE( M.toImage().hash() == I.nextMipMap().hash() );
+                    REQUIRE( T.nextMipMap(pool).toImage().hash() == I.nextMipMap().hash() );
+
+                    // and with both dimensions even
+                    auto E = makeNoise(66, 36, ch, 7);
+                    auto TE = gul::TiledImage::fromImage(E, layout, 16);
+                    REQUIRE( TE.nextMipMap().toImage().hash() == E.nextMipMap().hash() );
+                    REQUIRE( TE.nextMipMap().nextMipMap().toImage().hash() == E.nextMipMap().nextMipMap().hash() );
+                }
+
+                THEN("Transposing and rotating move the pixels")
+                {
+                    auto T = gul::TiledImage::fromImage(I, layout, 8);
+                    auto X = T.transposed();
+                    auto R = T.rotated90(pool);
+                    const uint32_t w = I.getWidth(), h = I.getHeight();
+                    REQUIRE( X.getWidth() == h );
+                    REQUIRE( R.getHeight() == w );
+                    for(uint32_t y = 0; y < h; y++)
+                        for(uint32_t x = 0; x < w; x++)
+                            for(uint32_t c = 0; c < ch; c++)
+                            {
+                                REQUIRE( X(y,x,c) == I(x,y,c) );
+                                REQUIRE( R(h-1-y,x,c) == I(x,y,c) );
+                            }
+                }
+            }
+        }
+    }
+
+    GIVEN("A tiled image")
+    {
+        auto I = makeNoise(50, 20, 4, 3);
+        auto T = gul::TiledImage::fromImage(I, gul::PixelLayout::Tiled, 16);
+
+        THEN("Each tile is a view of the pixels, clipped to the image")
+        {
+            auto V = T.tile(3, 1);
+            REQUIRE( V.getWidth() == 2 );
+            REQUIRE( V.getHeight() == 4 );
+            REQUIRE( V(1, 2, 3) == I(49, 18, 3) );
+
+            T.tile(1, 0)(0, 0, 0) = 17;
+            REQUIRE( T(16, 0, 0) == 17 );
+        }
+
+        THEN("The tile size must be a power of two")
+        {
+            REQUIRE_THROWS_AS( gul::TiledImage(8, 8, 4, gul::PixelLayout::Tiled, 12), std::invalid_argument );
+            REQUIRE_THROWS_AS( gul::TiledImage(8, 8, 4, gul::PixelLayout::Morton, 1), std::invalid_argument );
+        }
+
+        THEN("Copying into a view of another size throws")
+        {
+            gul::Image O(10, 10, 4);
+            REQUIRE_THROWS_AS( T.copyTo(O), std::logic_error );
+        }
+    }
+}
+
+TEST_CASE("Tiled image benchmarks", "[.benchmark]")
+{
+    auto I = makeNoise(4096, 4096, 4, 1);
+    auto T = gul::TiledImage::fromImage(I, gul::PixelLayout::Tiled);
+    auto M = gul::TiledImage::fromImage(I, gul::PixelLayout::Morton);
+
+    BENCHMARK("linear to tiled 4096x4096")
+    {
+        return gul::TiledImage::fromImage(I).getTilesX();
+    };
+    BENCHMARK("linear to morton 4096x4096")
+    {
+        return gul::TiledImage::fromImage(I, gul::PixelLayout::Morton).getTilesX();
+    };
+    BENCHMARK("Image::nextMipMap 4096x4096")
+    {
+        return I.nextMipMap().getWidth();
+    };
+    BENCHMARK("tiled nextMipMap 4096x4096")
+    {
+        return T.nextMipMap().getWidth();
+    };
+    BENCHMARK("morton nextMipMap 4096x4096")
+    {
+        return M.nextMipMap().getWidth();
+    };
+    BENCHMARK("tiled transpose 4096x4096")
+    {
+        return T.transposed().getWidth();
+    };
+}
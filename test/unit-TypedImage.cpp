@@ -0,0 +1,287 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <gul/image/TypedImage.h>
+#include "test-helpers.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+
+static float bitsToFloat(uint32_t x)
+{
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+SCENARIO("Half precision floats")
+{
+    THEN("Known values convert exactly")
+    {
+        REQUIRE( gul::half(1.0f).bits      == 0x3C00 );
+        REQUIRE( gul::half(-2.0f).bits     == 0xC000 );
+        REQUIRE( gul::half(0.1f).bits      == 0x2E66 );
+        REQUIRE( gul::half(65504.0f).bits  == 0x7BFF );
+        REQUIRE( gul::half(65519.0f).bits  == 0x7BFF );
+        REQUIRE( gul::half(65520.0f).bits  == 0x7C00 );
+        REQUIRE( gul::half(1e10f).bits     == 0x7C00 );
+        REQUIRE( gul::half(-std::numeric_limits<float>::infinity()).bits == 0xFC00 );
+        REQUIRE( gul::half(5.9604645e-8f).bits == 0x0001 );
+        REQUIRE( gul::half(1e-8f).bits     == 0x0000 );
+        REQUIRE( gul::half(-0.0f).bits     == 0x8000 );
+        REQUIRE( std::isnan( float(gul::half(std::nanf(""))) ) );
+    }
+
+    THEN("Every half converts to float and back")
+    {
+        for(uint32_t b = 0; b < 0x10000; b++)
+        {
+            const auto h = gul::half::fromBits( static_cast<uint16_t>(b) );
+            const float f = float(h);
+            if( std::isnan(f) )
+            {
+                REQUIRE( ((b >> 10) & 0x1F) == 0x1F );
+                continue;
+            }
+            REQUIRE( gul::half(f) == h );
+        }
+    }
+
+    THEN("Rounding is to nearest even")
+    {
+        // 1 + 2^-11 is half way between 1 and the next half
+        REQUIRE( gul::half(1.0f + std::ldexp(1.0f, -11)).bits == 0x3C00 );
+        REQUIRE( gul::half(1.0f + 3.0f * std::ldexp(1.0f, -11)).bits == 0x3C02 );
+        REQUIRE( gul::half(std::ldexp(1.0f, -25)).bits == 0x0000 );
+        REQUIRE( gul::half(3.0f * std::ldexp(1.0f, -25)).bits == 0x0002 );
+    }
+
+    THEN("The row conversions match the scalar conversion")
+    {
+        std::mt19937 gen(3);
+        std::vector<float>      f(4099);
+        std::vector<gul::half>  h(f.size());
+        std::vector<float>      back(f.size());
+        for(uint32_t round = 0; round < 64; round++)
+        {
+            for(auto & v : f)
+            {
+                do { v = bitsToFloat(static_cast<uint32_t>(gen())); } while( std::isnan(v) );
+            }
+            gul::detail::store_components(f.data(), h.data(), f.size());
+            gul::detail::load_components(h.data(), back.data(), h.size());
+            for(size_t i = 0; i < f.size(); i++)
+            {
+                REQUIRE( h[i].bits == gul::detail::float_to_half(f[i]) );
+                const float e = gul::detail::half_to_float(h[i].bits);
+                REQUIRE( std::memcmp(&back[i], &e, sizeof(float)) == 0 );
+            }
+        }
+    }
+}
+
+SCENARIO("Typed images")
+{
+    GIVEN("An 8-bit image")
+    {
+        gul::Image I(37, 19, 4);
+        fillRandom(I, 1);
+
+        THEN("It survives a round trip through every component type")
+        {
+            gul::Image8u  A(I);
+            gul::Image16u B = A.convert<uint16_t>();
+            gul::Image16f C = B.convert<gul::half>();
+            gul::Image32f D = C.convert<float>();
+
+            REQUIRE( A.hash() == I.hash() );
+            REQUIRE( B(3,4,2) == uint16_t(I(3,4,2) * 257) );
+            REQUIRE( D(5,6,1) == Approx(I(5,6,1) / 255.0f).margin(1e-3) );
+
+            auto E = D.convert<uint16_t>().convert<uint8_t>().toImage();
+            REQUIRE( E.hash() == I.hash() );
+            REQUIRE( C.toImage().hash() == I.hash() );
+        }
+
+        THEN("A planar image converts to the same interleaved pixels")
+        {
+            auto P = I;
+            P.setPlanar(true);
+            gul::Image16u A(P);
+            REQUIRE( A.hash() == gul::Image16u(I).hash() );
+            REQUIRE( A.toImage().hash() == I.hash() );
+        }
+
+        THEN("Integer types are clamped, float types are not")
+        {
+            gul::Image32f F(4, 4, 1);
+            F.r = 2.5f;
+            F(1,0,0) = -1.0f;
+            auto U = F.convert<uint16_t>();
+            auto H = F.convert<gul::half>();
+            REQUIRE( U(0,0,0) == 65535 );
+            REQUIRE( U(1,0,0) == 0 );
+            REQUIRE( float(H(0,0,0)) == 2.5f );
+            REQUIRE( float(H(1,0,0)) == -1.0f );
+        }
+
+        THEN("The pooled conversion gives the same result")
+        {
+            gul::thread_pool pool(3);
+            gul::Image32f F(gul::Image8u(I).convert<float>());
+            REQUIRE( F.convert<gul::half>(pool).hash() == F.convert<gul::half>().hash() );
+            REQUIRE( F.convert<uint8_t>(pool).hash() == I.hash() );
+        }
+    }
+
+    GIVEN("A float image")
+    {
+        gul::Image32f F(16, 8, 3);
+        F.r = 1.0f;
+        F.g = 8.0f;
+        F.b = 0.25f;
+
+        THEN("The channels are mapped like Image")
+        {
+            REQUIRE( &F.a(0,0) == &F.b(0,0) );
+            REQUIRE( &F[1](2,3) == &F(2,3,1) );
+            gul::Image32f G(2, 2, 1);
+            REQUIRE( &G.a(1,1) == &G.r(1,1) );
+        }
+
+        THEN("Channel expressions work with HDR values")
+        {
+            gul::Image I(16, 8, 1);
+            I.r = uint8_t(51);
+            F.r = F.g * 0.5f + F.b + I.r;
+            REQUIRE( F(3,3,0) == Approx(4.25f + 0.2f) );
+
+            gul::Image16f H(16, 8, 4);
+            H.a = gul::half(1.0f);
+            H.r = F.g;
+            H.g = mix(F.g, F.b, 0.5f);
+            REQUIRE( float(H(7,2,0)) == 8.0f );
+            REQUIRE( float(H(7,2,1)) == 4.125f );
+            REQUIRE( float(H(7,2,3)) == 1.0f );
+
+            gul::Image32f S(3, 3, 1);
+            REQUIRE_THROWS_AS( S.r = F.g, std::logic_error );
+        }
+
+        THEN("Images can be mixed")
+        {
+            gul::Image32f G(16, 8, 3);
+            G.r = 3.0f;
+            auto M = gul::mix(F, G, 0.25f);
+            REQUIRE( M(1,1,0) == 1.5f );
+            REQUIRE( M(1,1,1) == 6.0f );
+
+            gul::Image32f T(16, 8, 3);
+            T.g = 1.0f;
+            auto N = gul::mix(F, G, T);
+            REQUIRE( N(1,1,0) == 1.0f );
+            REQUIRE( N(1,1,1) == 0.0f );
+
+            REQUIRE_THROWS_AS( gul::mix(F, gul::Image32f(4,4,3), 0.5f), std::logic_error );
+        }
+
+        THEN("The hash depends on the component type")
+        {
+            gul::Image32f Z(4, 4, 1);
+            gul::Image16f Y(4, 4, 1);
+            Z.r = 0.0f;
+            REQUIRE( Z.hash() != Y.hash() );
+            REQUIRE( Z.hash() == Z.convert<float>().hash() );
+        }
+    }
+
+    GIVEN("A mipmap chain")
+    {
+        gul::Image I(33, 20, 2);
+        fillRandom(I, 5);
+        gul::ImageMM_t<float> M( gul::Image8u(I).convert<float>() );
+        M.generateMipMaps();
+
+        THEN("The levels match Image mipmaps")
+        {
+            gul::ImageMM R;
+            R.level[0] = I;
+            R.generateMipMaps();
+            REQUIRE( M.getLevelCount() == R.getLevelCount() );
+            for(uint32_t l = 1; l < M.getLevelCount(); l++)
+            {
+                auto & A = M.level[l];
+                auto & B = R.level[l];
+                REQUIRE( A.getWidth()  == B.getWidth() );
+                REQUIRE( A.getHeight() == B.getHeight() );
+                if( l == 1 )
+                {
+                    // Image truncates, so stay within one step of it
+                    for(uint32_t j = 0; j < A.getHeight(); j++)
+                        for(uint32_t i = 0; i < A.getWidth(); i++)
+                            for(uint32_t c = 0; c < 2; c++)
+                            {
+                                const float d = A(i,j,c) * 255.0f - float(B(i,j,c));
+                                REQUIRE( d >= -1e-3f );
+                                REQUIRE( d < 1.0f );
+                            }
+                }
+            }
+        }
+
+        THEN("A constant image stays constant")
+        {
+            gul::ImageMM_t<gul::half> H(29, 30, 4);
+            H.level[0].r = gul::half(100.0f);
+            H.generateMipMaps();
+            auto & L = H.level.back();
+            REQUIRE( float(L(0,0,0)) == 100.0f );
+        }
+
+        THEN("The pooled version is identical")
+        {
+            gul::thread_pool pool(2);
+            gul::ImageMM_t<uint16_t> A( gul::Image8u(I).convert<uint16_t>() );
+            auto B = A;
+            A.generateMipMaps();
+            B.generateMipMaps(pool);
+            for(uint32_t l = 0; l < A.getLevelCount(); l++)
+                REQUIRE( A.level[l].hash() == B.level[l].hash() );
+        }
+    }
+}
+
+TEST_CASE("Typed image benchmarks", "[.benchmark]")
+{
+    gul::Image32f F(1024, 1024, 4);
+    std::mt19937 gen(1);
+    for(size_t i = 0; i < F.size(); i++)
+        F.data()[i] = float(gen() % 4096) / 1024.0f;
+    auto H = F.convert<gul::half>();
+    auto U = F.convert<uint8_t>();
+
+    BENCHMARK("float -> half 1024x1024x4")
+    {
+        return F.convert<gul::half>();
+    };
+    BENCHMARK("half -> float 1024x1024x4")
+    {
+        return H.convert<float>();
+    };
+    BENCHMARK("float -> uint8 1024x1024x4")
+    {
+        return F.convert<uint8_t>();
+    };
+    BENCHMARK("uint8 -> float 1024x1024x4")
+    {
+        return U.convert<float>();
+    };
+    BENCHMARK("half mipmap chain 1024x1024x4")
+    {
+        gul::ImageMM_t<gul::half> M(H);
+        M.generateMipMaps();
+        return M.getLevelCount();
+    };
+}